@@ -9,15 +9,86 @@
 
 #include <bitstream_buffer.h>
 #include <native_pixmap_handle.h>
+#include <thread_scheduling.h>
 #include <v4l2_device.h>
+#include <v4l2_device_selector.h>
 #include <v4l2_slice_video_decode_accelerator.h>
+#include <v4l2_video_decode_accelerator.h>
 #include <video_pixel_format.h>
 #include <videodev2_custom.h>
 
+#include <cutils/properties.h>
 #include <utils/Log.h>
 
+#include <string.h>
+#include <sstream>
+#include <string>
+
 namespace android {
 
+namespace {
+
+// System property to override the accelerator selection at runtime. "stateful" or "slice" forces
+// the corresponding VDA implementation, any other value (or unset) selects automatically.
+const char kVDATypeProperty[] = "debug.v4l2_codec2.vda";
+
+// System properties setting the scheduling of the VDA threads, read at each initialize(), in the
+// format of media::ParseThreadSchedulingConfig(), e.g. "rtprio=2,cpus=0xf0".
+const char kDecoderThreadSchedulingProperty[] = "debug.v4l2_codec2.sched.decoder";
+const char kDevicePollThreadSchedulingProperty[] = "debug.v4l2_codec2.sched.device_poll";
+
+// System property enabling the ioctl counters of the device of each session, which are dumped to
+// the log when the session is destroyed.
+const char kIoctlStatsProperty[] = "debug.v4l2_codec2.ioctl_stats";
+
+enum class VDAType {
+    STATEFUL,  // V4L2VideoDecodeAccelerator, the device parses the bitstream.
+    SLICE,     // V4L2SliceVideoDecodeAccelerator, the bitstream is parsed in userspace.
+};
+
+bool containsProfile(const media::VideoDecodeAccelerator::SupportedProfiles& profiles,
+                     media::VideoCodecProfile profile) {
+    for (const auto& supported : profiles) {
+        if (supported.profile == profile) return true;
+    }
+    return false;
+}
+
+// Returns the preferred accelerator type for |profile|. The stateful decoder is preferred whenever
+// a device exposes the stream format (V4L2_PIX_FMT_H264/VP8/VP9) for |profile|, as it saves the
+// per-frame userspace parsing of the slice decoder. Only the slice decoder can drop the non-key
+// frames before they reach the device though, so it is preferred for |keyframesOnly| decoding.
+VDAType selectVDAType(media::VideoCodecProfile profile, bool keyframesOnly) {
+    char value[PROPERTY_VALUE_MAX];
+    property_get(kVDATypeProperty, value, "auto");
+    if (!strcmp(value, "stateful")) return VDAType::STATEFUL;
+    if (!strcmp(value, "slice")) return VDAType::SLICE;
+
+    if (keyframesOnly &&
+        containsProfile(media::V4L2SliceVideoDecodeAccelerator::GetSupportedProfiles(), profile)) {
+        return VDAType::SLICE;
+    }
+    if (containsProfile(media::V4L2VideoDecodeAccelerator::GetSupportedProfiles(), profile)) {
+        return VDAType::STATEFUL;
+    }
+    return VDAType::SLICE;
+}
+
+std::unique_ptr<media::VideoDecodeAccelerator> createVDA(
+        VDAType type, const scoped_refptr<media::V4L2Device>& device) {
+    switch (type) {
+    case VDAType::STATEFUL:
+        return std::unique_ptr<media::VideoDecodeAccelerator>(
+                new media::V4L2VideoDecodeAccelerator(device));
+    case VDAType::SLICE:
+        return std::unique_ptr<media::VideoDecodeAccelerator>(
+                new media::V4L2SliceVideoDecodeAccelerator(device));
+    }
+    return nullptr;
+}
+
+}  // namespace
+
 C2VDAAdaptor::C2VDAAdaptor() : mNumOutputBuffers(0u) {}
 
 C2VDAAdaptor::~C2VDAAdaptor() {
@@ -27,8 +98,11 @@ C2VDAAdaptor::~C2VDAAdaptor() {
 }
 
 VideoDecodeAcceleratorAdaptor::Result C2VDAAdaptor::initialize(
-        media::VideoCodecProfile profile, bool secureMode,
-        VideoDecodeAcceleratorAdaptor::Client* client) {
+        media::VideoCodecProfile profile, bool secureMode, bool keyframesOnly, bool errorResilient,
+        const media::Size& expectedSize, uint32_t frameRate,
+        const scoped_refptr<media::MemoryUsageTracker>& memoryUsage,
+        VideoDecodeAcceleratorAdaptor::Client* client,
+        VideoDecodeAcceleratorAdaptor::AppliedConfig* appliedConfig) {
     // TODO: use secureMode here, or ignore?
     if (mVDA) {
         ALOGE("Re-initialize() is not allowed");
@@ -38,19 +112,62 @@ VideoDecodeAcceleratorAdaptor::Result C2VDAAdaptor::initialize(
     media::VideoDecodeAccelerator::Config config;
     config.profile = profile;
     config.output_mode = media::VideoDecodeAccelerator::Config::OutputMode::IMPORT;
-
-    // TODO(johnylin): may need to implement factory to create VDA if there are multiple VDA
-    // implementations in the future.
+    config.initial_expected_coded_size = expectedSize;
+    config.frame_rate = static_cast<int>(frameRate);
+    config.decoder_thread_scheduling =
+            media::GetThreadSchedulingConfigFromProperty(kDecoderThreadSchedulingProperty);
+    config.device_poll_thread_scheduling =
+            media::GetThreadSchedulingConfigFromProperty(kDevicePollThreadSchedulingProperty);
+    config.memory_usage_tracker = memoryUsage;
+
+    VDAType type = selectVDAType(profile, keyframesOnly);
+    // The stateful decoder cannot drop frames, decode all of them instead of failing.
+    if (keyframesOnly && type == VDAType::STATEFUL) {
+        ALOGW("Keyframe-only decoding is not supported by the stateful VDA, decoding all frames");
+    }
+    config.keyframes_only = keyframesOnly && type == VDAType::SLICE;
+    // Likewise, the stateful decoder reports every bitstream error.
+    if (errorResilient && type == VDAType::STATEFUL) {
+        ALOGW("Error resilient decoding is not supported by the stateful VDA");
+    }
+    config.error_resilient = errorResilient && type == VDAType::SLICE;
+    const bool ioctlStats = property_get_bool(kIoctlStatsProperty, false);
     scoped_refptr<media::V4L2Device> device = new media::V4L2Device();
-    std::unique_ptr<media::VideoDecodeAccelerator> vda(
-            new media::V4L2SliceVideoDecodeAccelerator(device));
+    if (ioctlStats) device->EnableIoctlStats();
+    std::unique_ptr<media::VideoDecodeAccelerator> vda = createVDA(type, device);
     if (!vda->Initialize(config, this)) {
-        ALOGE("Failed to initialize VDA");
-        return PLATFORM_FAILURE;
+        if (device->IsOutOfCapacity()) {
+            ALOGE("Not enough decoder capacity left for %dx%d at %u fps", expectedSize.width(),
+                  expectedSize.height(), frameRate);
+            return INSUFFICIENT_RESOURCES;
+        }
+        if (type != VDAType::STATEFUL) {
+            ALOGE("Failed to initialize VDA");
+            return PLATFORM_FAILURE;
+        }
+        // The stateful device may be forced by the property, or refuse this stream even though it
+        // lists the profile; the slice decoder is still able to decode it.
+        ALOGW("Failed to initialize stateful VDA, falling back to slice VDA");
+        type = VDAType::SLICE;
+        config.keyframes_only = keyframesOnly;
+        config.error_resilient = errorResilient;
+        device = new media::V4L2Device();
+        if (ioctlStats) device->EnableIoctlStats();
+        vda = createVDA(type, device);
+        if (!vda->Initialize(config, this)) {
+            ALOGE("Failed to initialize VDA");
+            return device->IsOutOfCapacity() ? INSUFFICIENT_RESOURCES : PLATFORM_FAILURE;
+        }
     }
+    ALOGV("Initialized %s VDA", type == VDAType::STATEFUL ? "stateful" : "slice");
 
     mVDA = std::move(vda);
+    mDevice = std::move(device);
     mClient = client;
+    appliedConfig->keyframesOnly = config.keyframes_only;
+    // The slice decoder starts at a keyframe, an IDR picture or a recovery point only, the device
+    // of the stateful decoder handles the frames before them.
+    appliedConfig->dropsFramesBeforeRandomAccessPoint = type == VDAType::SLICE;
 
     return SUCCESS;
 }
@@ -85,8 +202,12 @@ void C2VDAAdaptor::importBufferForPicture(int32_t pictureBufferId, HalPixelForma
         case HalPixelFormat::NV12:
             pixelFormat = media::PIXEL_FORMAT_NV12;
             break;
+        case HalPixelFormat::I420:
+            pixelFormat = media::PIXEL_FORMAT_I420;
+            break;
         default:
-            LOG_ALWAYS_FATAL("Unsupported format: 0x%x", format);
+            ALOGE("Unsupported format: 0x%x", format);
+            mClient->notifyError(INVALID_ARGUMENT);
             return;
     }
 
@@ -105,6 +226,11 @@ void C2VDAAdaptor::reusePictureBuffer(int32_t pictureBufferId) {
     mVDA->ReusePictureBuffer(pictureBufferId);
 }
 
+void C2VDAAdaptor::setSkipNonReferenceFrames(bool skip) {
+    CHECK(mVDA);
+    mVDA->SetSkipNonReferenceFrames(skip);
+}
+
 void C2VDAAdaptor::flush() {
     CHECK(mVDA);
     mVDA->Flush();
@@ -117,10 +243,28 @@ void C2VDAAdaptor::reset() {
 
 void C2VDAAdaptor::destroy() {
     mVDA.reset(nullptr);
+    if (mDevice) {
+        // One line per request code, as the log truncates long messages.
+        std::istringstream dump(media::V4L2IoctlStats::SnapshotToString(getIoctlStats()));
+        std::string line;
+        while (std::getline(dump, line)) {
+            ALOGI("ioctl stats: %s", line.c_str());
+        }
+        mDevice = nullptr;
+        // The sessions of the other components remaining on each node.
+        for (const auto& load : media::V4L2DeviceSelector::GetInstance()->GetNodeLoads()) {
+            ALOGI("node load: %s", media::V4L2DeviceSelector::NodeLoadToString(load).c_str());
+        }
+    }
     mNumOutputBuffers = 0u;
     mPictureSize = media::Size();
 }
 
+std::vector<media::V4L2IoctlStats::RequestStats> C2VDAAdaptor::getIoctlStats() const {
+    if (!mDevice) return std::vector<media::V4L2IoctlStats::RequestStats>();
+    return mDevice->GetIoctlStatsSnapshot();
+}
+
 //static
 media::VideoDecodeAccelerator::SupportedProfiles C2VDAAdaptor::GetSupportedProfiles(
         uint32_t inputFormatFourcc) {
@@ -135,6 +279,15 @@ media::VideoDecodeAccelerator::SupportedProfiles C2VDAAdaptor::GetSupportedProfi
             supportedProfiles.push_back(profile);
         }
     }
+    // initialize() may pick the stateful decoder, so the profiles it supports for the codec of
+    // |inputFormatFourcc| are supported as well.
+    for (const auto& profile : media::V4L2VideoDecodeAccelerator::GetSupportedProfiles()) {
+        if (containsProfile(supportedProfiles, profile.profile)) continue;
+        if (inputFormatFourcc ==
+            media::V4L2Device::VideoCodecProfileToV4L2PixFmt(profile.profile, isSliceBased)) {
+            supportedProfiles.push_back(profile);
+        }
+    }
     return supportedProfiles;
 }
 
@@ -162,6 +315,14 @@ void C2VDAAdaptor::NotifyEndOfBitstreamBuffer(int32_t bitstream_buffer_id) {
     mClient->notifyEndOfBitstreamBuffer(bitstream_buffer_id);
 }
 
+void C2VDAAdaptor::NotifyBitstreamBufferSkipped(int32_t bitstream_buffer_id) {
+    mClient->notifyFrameSkipped(bitstream_buffer_id);
+}
+
+void C2VDAAdaptor::NotifyBitstreamBufferError(int32_t bitstream_buffer_id) {
+    mClient->notifyFrameError(bitstream_buffer_id);
+}
+
 void C2VDAAdaptor::NotifyFlushDone() {
     mClient->notifyFlushDone();
 }
@@ -171,10 +171,27 @@ media::VideoDecodeAccelerator::SupportedProfiles C2VDAAdaptorProxy::GetSupported
 }
 
 VideoDecodeAcceleratorAdaptor::Result C2VDAAdaptorProxy::initialize(
-        media::VideoCodecProfile profile, bool secureMode,
-        VideoDecodeAcceleratorAdaptor::Client* client) {
-    ALOGV("initialize(profile=%d, secureMode=%d)", static_cast<int>(profile),
-          static_cast<int>(secureMode));
+        media::VideoCodecProfile profile, bool secureMode, bool keyframesOnly, bool errorResilient,
+        const media::Size& expectedSize, uint32_t frameRate,
+        const scoped_refptr<media::MemoryUsageTracker>& memoryUsage,
+        VideoDecodeAcceleratorAdaptor::Client* client,
+        VideoDecodeAcceleratorAdaptor::AppliedConfig* appliedConfig) {
+    ALOGV("initialize(profile=%d, secureMode=%d, keyframesOnly=%d, errorResilient=%d, size=%s, "
+          "frameRate=%u)",
+          static_cast<int>(profile), static_cast<int>(secureMode),
+          static_cast<int>(keyframesOnly), static_cast<int>(errorResilient),
+          expectedSize.ToString().c_str(), frameRate);
+    // The mojo interface has no way to request them, all frames are decoded and any bitstream
+    // error is fatal.
+    if (keyframesOnly) {
+        ALOGW("Keyframe-only decoding is not supported, decoding all frames");
+    }
+    if (errorResilient) {
+        ALOGW("Error resilient decoding is not supported");
+    }
+    // The memory of the remote decoder is not visible from this process, only the component
+    // accounts its own buffers in |memoryUsage|.
+    (void)memoryUsage;
     DCHECK(client);
     DCHECK(!mClient);
     mClient = client;
@@ -193,6 +210,8 @@ VideoDecodeAcceleratorAdaptor::Result C2VDAAdaptorProxy::initialize(
         ALOGE("Connection lost");
         return VideoDecodeAcceleratorAdaptor::PLATFORM_FAILURE;
     }
+    appliedConfig->keyframesOnly = false;
+    appliedConfig->dropsFramesBeforeRandomAccessPoint = false;
     return static_cast<VideoDecodeAcceleratorAdaptor::Result>(future->get());
 }
 
@@ -287,6 +306,12 @@ void C2VDAAdaptorProxy::reusePictureBufferOnMojoThread(int32_t pictureBufferId)
     mVDAPtr->ReusePictureBuffer(pictureBufferId);
 }
 
+void C2VDAAdaptorProxy::setSkipNonReferenceFrames(bool skip) {
+    // The mojo VideoDecodeAccelerator interface has no way to pass this hint; every frame keeps
+    // being decoded.
+    ALOGV("setSkipNonReferenceFrames(%d) is not supported", skip);
+}
+
 void C2VDAAdaptorProxy::flush() {
     ALOGV("flush");
     mMojoTaskRunner->PostTask(
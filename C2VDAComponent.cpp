@@ -27,6 +27,9 @@
 
 #include <base/bind.h>
 #include <base/bind_helpers.h>
+#include <h264_parser.h>
+#include <thread_scheduling.h>
+#include <trace_events.h>
 
 #include <media/stagefright/MediaDefs.h>
 #include <utils/Log.h>
@@ -62,8 +65,67 @@ const C2String kVP8SecureDecoderName = "c2.vda.vp8.decoder.secure";
 const C2String kVP9SecureDecoderName = "c2.vda.vp9.decoder.secure";
 
 const uint32_t kDpbOutputBufferExtraCount = 3;  // Use the same number as ACodec.
+// In keyframe-only mode the decoded frames are outputted right away, so one extra buffer is enough.
+const uint32_t kKeyframesOnlyOutputBufferExtraCount = 1;
+// The automatic frame skipping starts when the client holds more than 1/kFrameSkipStartDivisor of
+// the output buffers, and stops once it holds 1/kFrameSkipStopDivisor of them or less.
+const size_t kFrameSkipStartDivisor = 2;
+const size_t kFrameSkipStopDivisor = 4;
 const int kDequeueRetryDelayUs = 10000;  // Wait time of dequeue buffer retry in microseconds.
 const int32_t kAllocateBufferMaxRetries = 10;  // Max retry time for fetchGraphicBlock timeout.
+
+// System properties setting the scheduling of the component and dequeue threads, read at each
+// start(), in the format of media::ParseThreadSchedulingConfig(), e.g. "nice=-10,cpus=0xf0".
+const char kComponentThreadSchedulingProperty[] = "debug.v4l2_codec2.sched.component";
+const char kDequeueThreadSchedulingProperty[] = "debug.v4l2_codec2.sched.dequeue";
+
+// Returns true if the decoder can start decoding at the bitstream |data| of |profile|, i.e. it
+// holds a VP8/VP9 keyframe, an H.264 IDR picture or a picture following a recovery point SEI
+// message, or no picture at all (e.g. H.264 parameter sets only). |size| must be positive.
+bool isRandomAccessPoint(media::VideoCodecProfile profile, const uint8_t* data, size_t size) {
+    if (profile >= media::H264PROFILE_MIN && profile <= media::H264PROFILE_MAX) {
+        media::H264Parser parser;
+        parser.SetStream(data, size);
+        media::H264NALU nalu;
+        bool afterRecoveryPoint = false;
+        while (parser.AdvanceToNextNALU(&nalu) == media::H264Parser::kOk) {
+            switch (nalu.nal_unit_type) {
+            case media::H264NALU::kIDRSlice:
+                return true;
+            case media::H264NALU::kNonIDRSlice:
+                return afterRecoveryPoint;
+            case media::H264NALU::kSEIMessage: {
+                media::H264SEIMessage sei;
+                if (parser.ParseSEI(&sei) == media::H264Parser::kOk &&
+                    sei.type == media::H264SEIMessage::kSEIRecoveryPoint) {
+                    afterRecoveryPoint = true;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+    if (profile >= media::VP8PROFILE_MIN && profile <= media::VP8PROFILE_MAX) {
+        // The first bit of the frame tag is 0 for keyframes (RFC 6386, 9.1).
+        return (data[0] & 0x01) == 0;
+    }
+    if (profile >= media::VP9PROFILE_MIN && profile <= media::VP9PROFILE_MAX) {
+        // The uncompressed header starts with frame_marker(2), profile_low_bit(1),
+        // profile_high_bit(1), reserved_zero(1) for profile 3 only, show_existing_frame(1) and
+        // frame_type(1), which is 0 for keyframes (VP9 bitstream specification, 6.2). Keyframes
+        // come first in superframes.
+        int bit = 2;
+        const int vp9Profile = ((data[0] >> 5) & 0x01) | ((data[0] >> 3) & 0x02);
+        bit += 2;
+        if (vp9Profile == 3) bit++;
+        const bool showExistingFrame = (data[0] >> (7 - bit++)) & 0x01;
+        return !showExistingFrame && ((data[0] >> (7 - bit)) & 0x01) == 0;
+    }
+    return true;
+}
 }  // namespace
 
 C2VDAComponent::IntfImpl::IntfImpl(C2String name, const std::shared_ptr<C2ReflectorHelper>& helper)
@@ -177,6 +239,50 @@ C2VDAComponent::IntfImpl::IntfImpl(C2String name, const std::shared_ptr<C2Reflec
                                  C2F(mOutputBlockPoolIds, m.values).inRange(0, 1)})
                     .withSetter(Setter<C2PortBlockPoolsTuning::output>::NonStrictValuesWithNoDeps)
                     .build());
+
+    addParameter(DefineParam(mFrameSkipMode, C2_PARAMKEY_VDA_FRAME_SKIP_MODE)
+                         .withDefault(new C2VDAFrameSkipModeTuning(FRAME_SKIP_NONE))
+                         .withFields({C2F(mFrameSkipMode, value)
+                                              .inRange(FRAME_SKIP_NONE, FRAME_SKIP_NON_REFERENCE)})
+                         .withSetter(Setter<C2VDAFrameSkipModeTuning>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mKeyframesOnly, C2_PARAMKEY_VDA_KEYFRAMES_ONLY)
+                         .withDefault(new C2VDAKeyframesOnlyTuning(0u))
+                         .withFields({C2F(mKeyframesOnly, value).inRange(0u, 1u)})
+                         .withSetter(Setter<C2VDAKeyframesOnlyTuning>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(
+            DefineParam(mPresentationDeadline, C2_PARAMKEY_VDA_PRESENTATION_DEADLINE)
+                    .withDefault(new C2VDAPresentationDeadlineTuning(0u))
+                    .withFields({C2F(mPresentationDeadline, value).any()})
+                    .withSetter(Setter<C2VDAPresentationDeadlineTuning>::NonStrictValueWithNoDeps)
+                    .build());
+
+    addParameter(DefineParam(mErrorResilient, C2_PARAMKEY_VDA_ERROR_RESILIENT)
+                         .withDefault(new C2VDAErrorResilientTuning(0u))
+                         .withFields({C2F(mErrorResilient, value).inRange(0u, 1u)})
+                         .withSetter(Setter<C2VDAErrorResilientTuning>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mFrameRate, C2_PARAMKEY_VDA_FRAME_RATE)
+                         .withDefault(new C2VDAFrameRateTuning(0u))
+                         .withFields({C2F(mFrameRate, value).inRange(0u, 240u)})
+                         .withSetter(Setter<C2VDAFrameRateTuning>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mMemoryUsage, C2_PARAMKEY_VDA_MEMORY_USAGE)
+                         .withDefault(new C2VDAMemoryUsageInfo(0u))
+                         .withFields({C2F(mMemoryUsage, value).any()})
+                         .withSetter(Setter<C2VDAMemoryUsageInfo>::NonStrictValueWithNoDeps)
+                         .build());
+
+    addParameter(DefineParam(mPeakMemoryUsage, C2_PARAMKEY_VDA_PEAK_MEMORY_USAGE)
+                         .withDefault(new C2VDAPeakMemoryUsageInfo(0u))
+                         .withFields({C2F(mPeakMemoryUsage, value).any()})
+                         .withSetter(Setter<C2VDAPeakMemoryUsageInfo>::NonStrictValueWithNoDeps)
+                         .build());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -208,7 +314,22 @@ C2VDAComponent::C2VDAComponent(C2String name, c2_node_id_t id,
         mVDAInitResult(VideoDecodeAcceleratorAdaptor::Result::ILLEGAL_STATE),
         mComponentState(ComponentState::UNINITIALIZED),
         mPendingOutputEOS(false),
+        mVDAProfile(media::VIDEO_CODEC_PROFILE_UNKNOWN),
+        mKeyframesOnly(false),
+        mVDADropsFramesBeforeRAP(false),
+        mSeekingRandomAccessPoint(false),
+        mNumWorksDroppedBeforeRAP(0u),
+        mSkippingNonReferenceFrames(false),
+        mOutputStarved(false),
+        mNumSkippedFrames(0u),
+        mNumLateSkippedFrames(0u),
+        mNumLateDecodedFrames(0u),
+        mNumCorruptedWorks(0u),
+        mReportedMemoryUsage(0u),
+        mReportedPeakMemoryUsage(0u),
         mCodecProfile(media::VIDEO_CODEC_PROFILE_UNKNOWN),
+        mErrorResilientConfig(false),
+        mFrameRateConfig(0u),
         mState(State::UNLOADED),
         mWeakThisFactory(this) {
     // TODO(johnylin): the client may need to know if init is failed.
@@ -246,7 +367,9 @@ void C2VDAComponent::onDestroy() {
     stopDequeueThread();
 }
 
-void C2VDAComponent::onStart(media::VideoCodecProfile profile, ::base::WaitableEvent* done) {
+void C2VDAComponent::onStart(media::VideoCodecProfile profile, bool keyframesOnly,
+                             bool errorResilient, media::Size expectedSize, uint32_t frameRate,
+                             ::base::WaitableEvent* done) {
     DCHECK(mTaskRunner->BelongsToCurrentThread());
     ALOGV("onStart");
     CHECK_EQ(mComponentState, ComponentState::UNINITIALIZED);
@@ -257,9 +380,26 @@ void C2VDAComponent::onStart(media::VideoCodecProfile profile, ::base::WaitableE
     mVDAAdaptor.reset(new C2VDAAdaptor());
 #endif
 
-    mVDAInitResult = mVDAAdaptor->initialize(profile, mSecureMode, this);
+    VideoDecodeAcceleratorAdaptor::AppliedConfig appliedConfig;
+    mVDAInitResult = mVDAAdaptor->initialize(profile, mSecureMode, keyframesOnly, errorResilient,
+                                             expectedSize, frameRate, mMemoryUsage, this,
+                                             &appliedConfig);
+    // Reset the parameters to the usage of this session.
+    updateMemoryUsageParams();
     if (mVDAInitResult == VideoDecodeAcceleratorAdaptor::Result::SUCCESS) {
         mComponentState = ComponentState::STARTED;
+        mVDAProfile = profile;
+        mKeyframesOnly = appliedConfig.keyframesOnly;
+        mVDADropsFramesBeforeRAP = appliedConfig.dropsFramesBeforeRandomAccessPoint;
+        startSeekingRandomAccessPoint();
+        mSkippingNonReferenceFrames = false;
+        mOutputStarved = false;
+        mNumSkippedFrames = 0u;
+        mNumLateSkippedFrames = 0u;
+        mNumLateDecodedFrames = 0u;
+        mNumCorruptedWorks = 0u;
+        mLateBitstreamIds.clear();
+        updateFrameSkipping();
     }
 
     done->Signal();
@@ -299,11 +439,20 @@ void C2VDAComponent::onDequeueWork() {
         return;
     }
 
+    // Pick up any change of the frame skip mode before sending the next input buffer, and skip it
+    // if it is a non-reference frame that is late already. VDA takes the decision along with the
+    // buffer, so this is also the lateness its skipped frame is accounted with.
+    bool late = isWorkLate(mQueue.front().mWork.get());
+    updateFrameSkipping(late);
+
     // Dequeue a work from mQueue.
     std::unique_ptr<C2Work> work(std::move(mQueue.front().mWork));
     auto drainMode = mQueue.front().mDrainMode;
     mQueue.pop();
+    media::ScopedTraceEvent traceEvent("onDequeueWork",
+                                       frameIndexToBitstreamId(work->input.ordinal.frameIndex));
 
+    bool dropped = false;
     CHECK_LE(work->input.buffers.size(), 1u);
     if (work->input.buffers.empty()) {
         // Client may queue a work with no input buffer for either it's EOS or empty CSD, otherwise
@@ -316,16 +465,29 @@ void C2VDAComponent::onDequeueWork() {
         // If input.buffers is not empty, the buffer should have meaningful content inside.
         C2ConstLinearBlock linearBlock = work->input.buffers.front()->data().linearBlocks().front();
         CHECK_GT(linearBlock.size(), 0u);
-        // Send input buffer to VDA for decode.
-        // Use frameIndex as bitstreamId.
-        int32_t bitstreamId = frameIndexToBitstreamId(work->input.ordinal.frameIndex);
-        sendInputBufferToAccelerator(linearBlock, bitstreamId);
+        if (drainMode == NO_DRAIN && !(work->input.flags & C2FrameData::FLAG_CODEC_CONFIG) &&
+            !isWorkAtRandomAccessPoint(linearBlock)) {
+            // VDA would drop the frame anyway, return the work right away.
+            work->input.buffers.front().reset();
+            dropped = true;
+        } else {
+            // Send input buffer to VDA for decode.
+            // Use frameIndex as bitstreamId.
+            int32_t bitstreamId = frameIndexToBitstreamId(work->input.ordinal.frameIndex);
+            if (late) {
+                mLateBitstreamIds.insert(bitstreamId);
+            }
+            sendInputBufferToAccelerator(linearBlock, bitstreamId);
+        }
     }
 
     CHECK_EQ(work->worklets.size(), 1u);
-    work->worklets.front()->output.flags = static_cast<C2FrameData::flags_t>(0);
+    work->worklets.front()->output.flags =
+            dropped ? C2FrameData::FLAG_DROP_FRAME : static_cast<C2FrameData::flags_t>(0);
     work->worklets.front()->output.buffers.clear();
     work->worklets.front()->output.ordinal = work->input.ordinal;
+    // This may be changed by onFrameError() until the work is reported.
+    work->result = C2_OK;
 
     if (drainMode != NO_DRAIN) {
         mVDAAdaptor->flush();
@@ -335,6 +497,9 @@ void C2VDAComponent::onDequeueWork() {
 
     // Put work to mPendingWorks.
     mPendingWorks.emplace_back(std::move(work));
+    if (dropped) {
+        reportFinishedWorkIfAny();
+    }
 
     if (!mQueue.empty()) {
         mTaskRunner->PostTask(FROM_HERE, ::base::Bind(&C2VDAComponent::onDequeueWork,
@@ -355,10 +520,54 @@ void C2VDAComponent::onInputBufferDone(int32_t bitstreamId) {
 
     // When the work is done, the input buffer shall be reset by component.
     work->input.buffers.front().reset();
+    mLateBitstreamIds.erase(bitstreamId);
 
     reportFinishedWorkIfAny();
 }
 
+void C2VDAComponent::onFrameSkipped(int32_t bitstreamId) {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    ALOGV("onFrameSkipped: bitstream id=%d", bitstreamId);
+    EXPECT_RUNNING_OR_RETURN_ON_ERROR();
+
+    C2Work* work = getPendingWorkByBitstreamId(bitstreamId);
+    if (!work) {
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    // The work has no output buffer to wait for. It is reported as done once its input buffer is
+    // returned by onInputBufferDone().
+    auto& outputFlags = work->worklets.front()->output.flags;
+    outputFlags = static_cast<C2FrameData::flags_t>(outputFlags | C2FrameData::FLAG_DROP_FRAME);
+    if (mLateBitstreamIds.erase(bitstreamId) > 0u) {
+        mNumLateSkippedFrames++;
+    } else {
+        mNumSkippedFrames++;
+    }
+}
+
+void C2VDAComponent::onFrameError(int32_t bitstreamId) {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    ALOGV("onFrameError: bitstream id=%d", bitstreamId);
+    EXPECT_RUNNING_OR_RETURN_ON_ERROR();
+
+    C2Work* work = getPendingWorkByBitstreamId(bitstreamId);
+    if (!work) {
+        reportError(C2_CORRUPTED);
+        return;
+    }
+
+    // VDA recovered from the error and will not output this frame. The work is reported as done,
+    // with the error result, once its input buffer is returned by onInputBufferDone().
+    ALOGW("Bitstream error in work with bitstream id=%d, resuming at the next keyframe",
+          bitstreamId);
+    work->result = C2_CORRUPTED;
+    auto& outputFlags = work->worklets.front()->output.flags;
+    outputFlags = static_cast<C2FrameData::flags_t>(outputFlags | C2FrameData::FLAG_DROP_FRAME);
+    mNumCorruptedWorks++;
+}
+
 void C2VDAComponent::onOutputBufferReturned(std::shared_ptr<C2GraphicBlock> block,
                                             uint32_t poolId) {
     DCHECK(mTaskRunner->BelongsToCurrentThread());
@@ -385,6 +594,7 @@ void C2VDAComponent::onOutputBufferReturned(std::shared_ptr<C2GraphicBlock> bloc
     CHECK_EQ(info->mState, GraphicBlockInfo::State::OWNED_BY_CLIENT);
     info->mGraphicBlock = std::move(block);
     info->mState = GraphicBlockInfo::State::OWNED_BY_COMPONENT;
+    updateFrameSkipping();
 
     if (mPendingOutputFormat) {
         tryChangeOutputFormat();
@@ -409,9 +619,23 @@ void C2VDAComponent::onOutputBufferDone(int32_t pictureBufferId, int32_t bitstre
         return;
     }
     CHECK_EQ(info->mState, GraphicBlockInfo::State::OWNED_BY_ACCELERATOR);
+
+    if (isWorkLate(work)) {
+        // The client would drop the frame, give the buffer back to VDA right away instead.
+        ALOGV("Dropping late output, timestamp=%llu", work->input.ordinal.timestamp.peekull());
+        auto& outputFlags = work->worklets.front()->output.flags;
+        outputFlags = static_cast<C2FrameData::flags_t>(outputFlags | C2FrameData::FLAG_DROP_FRAME);
+        mNumLateDecodedFrames++;
+        info->mState = GraphicBlockInfo::State::OWNED_BY_COMPONENT;
+        sendOutputBufferToAccelerator(info);
+        reportFinishedWorkIfAny();
+        return;
+    }
+
     // Output buffer will be passed to client soon along with mListener->onWorkDone_nb().
     info->mState = GraphicBlockInfo::State::OWNED_BY_CLIENT;
     mBuffersInClient++;
+    updateFrameSkipping();
 
     // Attach output buffer to the work corresponded to bitstreamId.
     C2ConstGraphicBlock constBlock = info->mGraphicBlock->share(
@@ -498,6 +722,16 @@ void C2VDAComponent::onFlush() {
     mComponentState = ComponentState::FLUSHING;
 }
 
+void C2VDAComponent::startSeekingRandomAccessPoint() {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    // Some decoders wait for a random access point after being started or reset, and drop the
+    // frames before it without reporting them. Find it before queueing inputs to VDA instead, so
+    // that the works before it are returned right away rather than when draining. The other
+    // decoders decode these frames, they are queued to VDA.
+    mSeekingRandomAccessPoint = mVDADropsFramesBeforeRAP;
+    mNumWorksDroppedBeforeRAP = 0u;
+}
+
 void C2VDAComponent::onStop(::base::WaitableEvent* done) {
     DCHECK(mTaskRunner->BelongsToCurrentThread());
     ALOGV("onStop");
@@ -537,6 +771,7 @@ void C2VDAComponent::onFlushDone() {
     ALOGV("onFlushDone");
     reportAbandonedWorks();
     mComponentState = ComponentState::STARTED;
+    startSeekingRandomAccessPoint();
 
     // Work dequeueing was stopped while component flushing. Restart it.
     mTaskRunner->PostTask(FROM_HERE,
@@ -551,12 +786,23 @@ void C2VDAComponent::onStopDone() {
     // do something for them?
     reportAbandonedWorks();
     mPendingOutputFormat.reset();
+    if (mNumSkippedFrames > 0u || mNumLateSkippedFrames > 0u || mNumLateDecodedFrames > 0u) {
+        ALOGI("Dropped frames: %" PRIu64 " skipped, %" PRIu64 " late and skipped, %" PRIu64
+              " late after decoding",
+              mNumSkippedFrames, mNumLateSkippedFrames, mNumLateDecodedFrames);
+    }
+    if (mNumCorruptedWorks > 0u) {
+        ALOGI("Recovered from %" PRIu64 " bitstream errors", mNumCorruptedWorks);
+    }
     if (mVDAAdaptor.get()) {
         mVDAAdaptor->destroy();
         mVDAAdaptor.reset(nullptr);
     }
 
     mGraphicBlocks.clear();
+    updateGraphicBlocksMemoryUsage();
+    updateMemoryUsageParams();
+    ALOGI("Memory usage: %s", mMemoryUsage->ToString().c_str());
 
     stopDequeueThread();
 
@@ -592,6 +838,27 @@ void C2VDAComponent::sendInputBufferToAccelerator(const C2ConstLinearBlock& inpu
     mVDAAdaptor->decode(bitstreamId, dupFd, input.offset(), input.size());
 }
 
+bool C2VDAComponent::isWorkAtRandomAccessPoint(const C2ConstLinearBlock& input) {
+    // Protected input buffers cannot be parsed, the decoder drops what it cannot decode then.
+    if (!mSeekingRandomAccessPoint || mSecureMode) {
+        return true;
+    }
+
+    C2ReadView view = input.map().get();
+    if (view.error() != C2_OK) {
+        ALOGE("Failed to map input buffer: %d", view.error());
+        return true;
+    }
+    if (!isRandomAccessPoint(mVDAProfile, view.data(), view.capacity())) {
+        mNumWorksDroppedBeforeRAP++;
+        return false;
+    }
+
+    ALOGV("Found random access point after dropping %zu works", mNumWorksDroppedBeforeRAP);
+    mSeekingRandomAccessPoint = false;
+    return true;
+}
+
 C2Work* C2VDAComponent::getPendingWorkByBitstreamId(int32_t bitstreamId) {
     auto workIter = std::find_if(mPendingWorks.begin(), mPendingWorks.end(),
                                  [bitstreamId](const std::unique_ptr<C2Work>& w) {
@@ -690,7 +957,9 @@ c2_status_t C2VDAComponent::allocateBuffersFromBlockAllocator(const media::Size&
 
     stopDequeueThread();
 
-    size_t bufferCount = mOutputFormat.mMinNumBuffers + kDpbOutputBufferExtraCount;
+    const uint32_t extraCount =
+            mKeyframesOnly ? kKeyframesOnlyOutputBufferExtraCount : kDpbOutputBufferExtraCount;
+    size_t bufferCount = mOutputFormat.mMinNumBuffers + extraCount;
 
     // Allocate the output buffers.
     mVDAAdaptor->assignPictureBuffers(bufferCount);
@@ -707,6 +976,7 @@ c2_status_t C2VDAComponent::allocateBuffersFromBlockAllocator(const media::Size&
     }
 
     mGraphicBlocks.clear();
+    updateGraphicBlocksMemoryUsage();
 
     bool useBufferQueue = blockPool->getAllocatorId() == C2PlatformAllocatorStore::BUFFERQUEUE;
     if (useBufferQueue) {
@@ -760,6 +1030,7 @@ c2_status_t C2VDAComponent::allocateBuffersFromBlockAllocator(const media::Size&
                 retries_left--;
             } else if (err != C2_OK) {
                 mGraphicBlocks.clear();
+                updateGraphicBlocksMemoryUsage();
                 ALOGE("failed to allocate buffer: %d", err);
                 reportError(err);
                 return err;
@@ -774,6 +1045,7 @@ c2_status_t C2VDAComponent::allocateBuffersFromBlockAllocator(const media::Size&
         }
         if (err != C2_OK) {
             mGraphicBlocks.clear();
+            updateGraphicBlocksMemoryUsage();
             ALOGE("failed to getPoolIdFromGraphicBlock: %d", err);
             reportError(err);
             return err;
@@ -785,6 +1057,7 @@ c2_status_t C2VDAComponent::allocateBuffersFromBlockAllocator(const media::Size&
         }
     }
     mOutputFormat.mMinNumBuffers = bufferCount;
+    updateGraphicBlocksMemoryUsage();
 
     if (!startDequeueThread(size, pixelFormat, std::move(blockPool))) {
         reportError(C2_CORRUPTED);
@@ -932,6 +1205,8 @@ c2_status_t C2VDAComponent::queue_nb(std::list<std::unique_ptr<C2Work>>* const i
         return C2_BAD_STATE;
     }
     while (!items->empty()) {
+        media::TraceAsyncBegin(media::kWorkTraceName,
+                               frameIndexToBitstreamId(items->front()->input.ordinal.frameIndex));
         mTaskRunner->PostTask(FROM_HERE,
                               ::base::Bind(&C2VDAComponent::onQueueWork, ::base::Unretained(this),
                                            ::base::Passed(&items->front())));
@@ -982,15 +1257,40 @@ c2_status_t C2VDAComponent::start() {
 
     mCodecProfile = mIntfImpl->getCodecProfile();
     ALOGI("get parameter: mCodecProfile = %d", static_cast<int>(mCodecProfile));
+    const bool keyframesOnly = mIntfImpl->getKeyframesOnly();
+    ALOGI("get parameter: keyframesOnly = %d", keyframesOnly);
+    mErrorResilientConfig = mIntfImpl->getErrorResilient();
+    ALOGI("get parameter: mErrorResilientConfig = %d", mErrorResilientConfig);
+    mExpectedSizeConfig = mIntfImpl->getSize();
+    mFrameRateConfig = mIntfImpl->getFrameRate();
+    ALOGI("get parameter: mExpectedSizeConfig = %s, mFrameRateConfig = %u",
+          mExpectedSizeConfig.ToString().c_str(), mFrameRateConfig);
+    mComponentThreadScheduling =
+            media::GetThreadSchedulingConfigFromProperty(kComponentThreadSchedulingProperty);
+    mDequeueThreadScheduling =
+            media::GetThreadSchedulingConfigFromProperty(kDequeueThreadSchedulingProperty);
+    ALOGI("thread scheduling: component = %s, dequeue = %s",
+          mComponentThreadScheduling.AsHumanReadableString().c_str(),
+          mDequeueThreadScheduling.AsHumanReadableString().c_str());
+    // The component thread is idle until onStart() is posted, the accounting starts over here.
+    mMemoryUsage = new media::MemoryUsageTracker();
 
     ::base::WaitableEvent done(::base::WaitableEvent::ResetPolicy::AUTOMATIC,
                                ::base::WaitableEvent::InitialState::NOT_SIGNALED);
+    // The component thread outlives the session, the scheduling of the previous session is kept
+    // unless this one sets another.
+    media::PostApplyThreadSchedulingConfig(mTaskRunner, mComponentThreadScheduling);
     mTaskRunner->PostTask(FROM_HERE,
                           ::base::Bind(&C2VDAComponent::onStart, ::base::Unretained(this),
-                                       mCodecProfile, &done));
+                                       mCodecProfile, keyframesOnly, mErrorResilientConfig,
+                                       mExpectedSizeConfig, mFrameRateConfig, &done));
     done.Wait();
     if (mVDAInitResult != VideoDecodeAcceleratorAdaptor::Result::SUCCESS) {
         ALOGE("Failed to start component due to VDA error: %d", static_cast<int>(mVDAInitResult));
+        // The decoder is at capacity, the client may try again once other sessions are released.
+        if (mVDAInitResult == VideoDecodeAcceleratorAdaptor::Result::INSUFFICIENT_RESOURCES) {
+            return C2_NO_MEMORY;
+        }
         return C2_CORRUPTED;
     }
     mState.store(State::RUNNING);
@@ -1069,6 +1369,16 @@ void C2VDAComponent::notifyEndOfBitstreamBuffer(int32_t bitstreamId) {
                                                   ::base::Unretained(this), bitstreamId));
 }
 
+void C2VDAComponent::notifyFrameSkipped(int32_t bitstreamId) {
+    mTaskRunner->PostTask(FROM_HERE, ::base::Bind(&C2VDAComponent::onFrameSkipped,
+                                                  ::base::Unretained(this), bitstreamId));
+}
+
+void C2VDAComponent::notifyFrameError(int32_t bitstreamId) {
+    mTaskRunner->PostTask(FROM_HERE, ::base::Bind(&C2VDAComponent::onFrameError,
+                                                  ::base::Unretained(this), bitstreamId));
+}
+
 void C2VDAComponent::notifyFlushDone() {
     mTaskRunner->PostTask(FROM_HERE,
                           ::base::Bind(&C2VDAComponent::onDrainDone, ::base::Unretained(this)));
@@ -1112,7 +1422,6 @@ void C2VDAComponent::reportFinishedWorkIfAny() {
     auto iter = mPendingWorks.begin();
     while (iter != mPendingWorks.end()) {
         if (isWorkDone(iter->get())) {
-            iter->get()->result = C2_OK;
             iter->get()->workletsProcessed = static_cast<uint32_t>(iter->get()->worklets.size());
             finishedWorks.emplace_back(std::move(*iter));
             iter = mPendingWorks.erase(iter);
@@ -1122,7 +1431,7 @@ void C2VDAComponent::reportFinishedWorkIfAny() {
     }
 
     if (!finishedWorks.empty()) {
-        mListener->onWorkDone_nb(shared_from_this(), std::move(finishedWorks));
+        reportWorksDone(std::move(finishedWorks));
     }
 }
 
@@ -1141,11 +1450,60 @@ bool C2VDAComponent::isWorkDone(const C2Work* work) const {
         return false;
     }
     if (!(work->input.flags & C2FrameData::FLAG_CODEC_CONFIG) &&
+        !(work->worklets.front()->output.flags & C2FrameData::FLAG_DROP_FRAME) &&
         work->worklets.front()->output.buffers.empty()) {
         // Output buffer is not returned from VDA yet.
         return false;
     }
-    return true;  // Output buffer is returned, or it has no related output buffer (CSD work).
+    // Output buffer is returned, or it has no related output buffer (CSD work or skipped frame).
+    return true;
+}
+
+void C2VDAComponent::updateFrameSkipping(bool nextInputLate) {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    if (!mVDAAdaptor) {
+        return;
+    }
+
+    // VDA applies the decision to the input buffers sent after it, so it can be made per buffer.
+    bool skip = nextInputLate;
+    switch (mIntfImpl->getFrameSkipMode()) {
+    case FRAME_SKIP_AUTO:
+        mOutputStarved = isOutputStarved();
+        skip = skip || mOutputStarved;
+        break;
+    case FRAME_SKIP_NON_REFERENCE:
+        skip = true;
+        break;
+    default:
+        break;
+    }
+    if (skip == mSkippingNonReferenceFrames) {
+        return;
+    }
+
+    ALOGV("%s skipping non-reference frames", skip ? "Start" : "Stop");
+    mSkippingNonReferenceFrames = skip;
+    mVDAAdaptor->setSkipNonReferenceFrames(skip);
+}
+
+bool C2VDAComponent::isOutputStarved() const {
+    if (mGraphicBlocks.empty()) {
+        return false;
+    }
+    size_t buffersInClient = std::count_if(mGraphicBlocks.begin(), mGraphicBlocks.end(),
+                                           [](const GraphicBlockInfo& info) {
+                                               return info.mState ==
+                                                      GraphicBlockInfo::State::OWNED_BY_CLIENT;
+                                           });
+    // Use a lower threshold to stop skipping than to start, so that skipping is not toggled on
+    // every returned buffer.
+    size_t divisor = mOutputStarved ? kFrameSkipStopDivisor : kFrameSkipStartDivisor;
+    return buffersInClient * divisor > mGraphicBlocks.size();
+}
+
+bool C2VDAComponent::isWorkLate(const C2Work* work) const {
+    return work->input.ordinal.timestamp.peeku() < mIntfImpl->getPresentationDeadline();
 }
 
 void C2VDAComponent::reportEOSWork() {
@@ -1171,12 +1529,13 @@ void C2VDAComponent::reportEOSWork() {
 
     std::list<std::unique_ptr<C2Work>> finishedWorks;
     finishedWorks.emplace_back(std::move(eosWork));
-    mListener->onWorkDone_nb(shared_from_this(), std::move(finishedWorks));
+    reportWorksDone(std::move(finishedWorks));
 }
 
 void C2VDAComponent::reportAbandonedWorks() {
     DCHECK(mTaskRunner->BelongsToCurrentThread());
     std::list<std::unique_ptr<C2Work>> abandonedWorks;
+    mLateBitstreamIds.clear();
 
     while (!mPendingWorks.empty()) {
         std::unique_ptr<C2Work> work(std::move(mPendingWorks.front()));
@@ -1206,14 +1565,63 @@ void C2VDAComponent::reportAbandonedWorks() {
     mPendingOutputEOS = false;
 
     if (!abandonedWorks.empty()) {
-        mListener->onWorkDone_nb(shared_from_this(), std::move(abandonedWorks));
+        reportWorksDone(std::move(abandonedWorks));
     }
 }
 
+void C2VDAComponent::reportWorksDone(std::list<std::unique_ptr<C2Work>> works) {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    // The works of the batch are told apart by the end of their async slice.
+    media::ScopedTraceEvent traceEvent("onWorkDone");
+    for (const auto& work : works) {
+        media::TraceAsyncEnd(media::kWorkTraceName,
+                             frameIndexToBitstreamId(work->input.ordinal.frameIndex));
+    }
+    mListener->onWorkDone_nb(shared_from_this(), std::move(works));
+    updateMemoryUsageParams();
+}
+
 void C2VDAComponent::reportError(c2_status_t error) {
     mListener->onError_nb(shared_from_this(), static_cast<uint32_t>(error));
 }
 
+void C2VDAComponent::updateGraphicBlocksMemoryUsage() {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    uint64_t bytes = 0;
+    for (const auto& info : mGraphicBlocks) {
+        // The allocations of the block pool are opaque, estimate them from the 4:2:0 formats the
+        // blocks are fetched with.
+        const C2GraphicBlock& block = *info.mGraphicBlock;
+        bytes += static_cast<uint64_t>(block.width()) * block.height() * 3 / 2;
+    }
+    mMemoryUsage->Set(media::MemoryUsageTracker::kGraphicBlocks, bytes, mGraphicBlocks.size());
+}
+
+void C2VDAComponent::updateMemoryUsageParams() {
+    DCHECK(mTaskRunner->BelongsToCurrentThread());
+    const uint64_t bytes = mMemoryUsage->GetTotalBytes();
+    const uint64_t peakBytes = mMemoryUsage->GetPeakTotalBytes();
+    if (bytes == mReportedMemoryUsage && peakBytes == mReportedPeakMemoryUsage) {
+        return;
+    }
+
+    C2VDAMemoryUsageInfo usage(bytes);
+    C2VDAPeakMemoryUsageInfo peakUsage(peakBytes);
+    std::vector<std::unique_ptr<C2SettingResult>> failures;
+    if (mIntfImpl->config({&usage, &peakUsage}, C2_MAY_BLOCK, &failures) != C2_OK) {
+        ALOGW("Failed to update the memory usage parameters");
+        return;
+    }
+    mReportedMemoryUsage = bytes;
+    mReportedPeakMemoryUsage = peakBytes;
+}
+
+std::string C2VDAComponent::dumpMemoryUsage() {
+    // mMemoryUsage is only replaced by start().
+    std::lock_guard<std::mutex> lock(mStartStopLock);
+    return mMemoryUsage ? mMemoryUsage->ToString() : std::string();
+}
+
 bool C2VDAComponent::startDequeueThread(const media::Size& size, uint32_t pixelFormat,
                                         std::shared_ptr<C2BlockPool> blockPool) {
     CHECK(!mDequeueThread.IsRunning());
@@ -1221,6 +1629,7 @@ bool C2VDAComponent::startDequeueThread(const media::Size& size, uint32_t pixelF
         ALOGE("failed to start dequeue thread!!");
         return false;
     }
+    media::PostApplyThreadSchedulingConfig(mDequeueThread.task_runner(), mDequeueThreadScheduling);
     mDequeueLoopStop.store(false);
     mBuffersInClient.store(0u);
     mDequeueThread.task_runner()->PostTask(
@@ -7,9 +7,17 @@
 
 #include <VideoDecodeAcceleratorAdaptor.h>
 
+#include <v4l2_ioctl_stats.h>
 #include <video_decode_accelerator.h>
 
 #include <base/macros.h>
+#include <base/memory/ref_counted.h>
+
+#include <vector>
+
+namespace media {
+class V4L2Device;
+}  // namespace media
 
 namespace android {
 
@@ -22,13 +30,17 @@ public:
     ~C2VDAAdaptor() override;
 
     // Implementation of the VideoDecodeAcceleratorAdaptor interface.
-    Result initialize(media::VideoCodecProfile profile, bool secureMode,
-                      VideoDecodeAcceleratorAdaptor::Client* client) override;
+    Result initialize(media::VideoCodecProfile profile, bool secureMode, bool keyframesOnly,
+                      bool errorResilient, const media::Size& expectedSize, uint32_t frameRate,
+                      const scoped_refptr<media::MemoryUsageTracker>& memoryUsage,
+                      VideoDecodeAcceleratorAdaptor::Client* client,
+                      AppliedConfig* appliedConfig) override;
     void decode(int32_t bitstreamId, int handleFd, off_t offset, uint32_t bytesUsed) override;
     void assignPictureBuffers(uint32_t numOutputBuffers) override;
     void importBufferForPicture(int32_t pictureBufferId, HalPixelFormat format, int handleFd,
                                 const std::vector<VideoFramePlane>& planes) override;
     void reusePictureBuffer(int32_t pictureBufferId) override;
+    void setSkipNonReferenceFrames(bool skip) override;
     void flush() override;
     void reset() override;
     void destroy() override;
@@ -36,6 +48,11 @@ public:
     static media::VideoDecodeAccelerator::SupportedProfiles GetSupportedProfiles(
             uint32_t inputFormatFourcc);
 
+    // Returns the ioctl counters of the device of the session, for dumps and benchmarks. They are
+    // only recorded if enabled by kIoctlStatsProperty when the session was initialized, the
+    // returned vector is empty otherwise.
+    std::vector<media::V4L2IoctlStats::RequestStats> getIoctlStats() const;
+
     // Implementation of the media::VideoDecodeAccelerator::Client interface.
     void ProvidePictureBuffers(uint32_t requested_num_of_buffers,
                                media::VideoPixelFormat output_format,
@@ -43,12 +60,16 @@ public:
     void DismissPictureBuffer(int32_t picture_buffer_id) override;
     void PictureReady(const media::Picture& picture) override;
     void NotifyEndOfBitstreamBuffer(int32_t bitstream_buffer_id) override;
+    void NotifyBitstreamBufferSkipped(int32_t bitstream_buffer_id) override;
+    void NotifyBitstreamBufferError(int32_t bitstream_buffer_id) override;
     void NotifyFlushDone() override;
     void NotifyResetDone() override;
     void NotifyError(media::VideoDecodeAccelerator::Error error) override;
 
 private:
     std::unique_ptr<media::VideoDecodeAccelerator> mVDA;
+    // The device used by |mVDA|.
+    scoped_refptr<media::V4L2Device> mDevice;
     VideoDecodeAcceleratorAdaptor::Client* mClient;
 
     // The number of allocated output buffers. This is obtained from assignPictureBuffers call from
@@ -36,13 +36,17 @@ public:
     bool establishChannel();
 
     // Implementation of the VideoDecodeAcceleratorAdaptor interface.
-    Result initialize(media::VideoCodecProfile profile, bool secureMode,
-                      VideoDecodeAcceleratorAdaptor::Client* client) override;
+    Result initialize(media::VideoCodecProfile profile, bool secureMode, bool keyframesOnly,
+                      bool errorResilient, const media::Size& expectedSize, uint32_t frameRate,
+                      const scoped_refptr<media::MemoryUsageTracker>& memoryUsage,
+                      VideoDecodeAcceleratorAdaptor::Client* client,
+                      AppliedConfig* appliedConfig) override;
     void decode(int32_t bitstreamId, int handleFd, off_t offset, uint32_t size) override;
     void assignPictureBuffers(uint32_t numOutputBuffers) override;
     void importBufferForPicture(int32_t pictureBufferId, HalPixelFormat format, int handleFd,
                                 const std::vector<VideoFramePlane>& planes) override;
     void reusePictureBuffer(int32_t pictureBufferId) override;
+    void setSkipNonReferenceFrames(bool skip) override;
     void flush() override;
     void reset() override;
     void destroy() override;
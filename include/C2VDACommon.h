@@ -14,6 +14,7 @@ enum class HalPixelFormat : uint32_t {
     YCbCr_420_888 = 0x23,
     YV12 = 0x32315659,
     NV12 = 0x3231564e,
+    I420 = 0x30323449,
 };
 } // namespace android
 #endif  // ANDROID_C2_VDA_COMMON_H
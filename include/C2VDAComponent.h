@@ -7,8 +7,10 @@
 
 #include <VideoDecodeAcceleratorAdaptor.h>
 
+#include <memory_usage_tracker.h>
 #include <rect.h>
 #include <size.h>
+#include <thread_scheduling.h>
 #include <video_codecs.h>
 #include <video_decode_accelerator.h>
 
@@ -31,10 +33,78 @@
 #include <map>
 #include <mutex>
 #include <queue>
+#include <set>
 #include <unordered_map>
 
 namespace android {
 
+// Vendor parameter indices of the VDA components.
+enum C2VDAParamIndexKind : C2Param::type_index_t {
+    kParamIndexVDAFrameSkipMode = C2Param::TYPE_INDEX_VENDOR_START,
+    kParamIndexVDAKeyframesOnly,
+    kParamIndexVDAPresentationDeadline,
+    kParamIndexVDAErrorResilient,
+    kParamIndexVDAFrameRate,
+    kParamIndexVDAMemoryUsage,
+    kParamIndexVDAPeakMemoryUsage,
+};
+
+// Modes of skipping the frames that no other frame refers to, so that decoding keeps up with a
+// client that falls behind. Skipped frames are not submitted to the device, and their works are
+// returned with no output buffer and C2FrameData::FLAG_DROP_FRAME set in the output flags.
+enum C2VDAFrameSkipMode : uint32_t {
+    // Decode every frame. This is the default.
+    FRAME_SKIP_NONE = 0,
+    // Skip non-reference frames while the client holds most of the output buffers.
+    FRAME_SKIP_AUTO = 1,
+    // Always skip non-reference frames.
+    FRAME_SKIP_NON_REFERENCE = 2,
+};
+
+typedef C2GlobalParam<C2Tuning, C2Uint32Value, kParamIndexVDAFrameSkipMode>
+        C2VDAFrameSkipModeTuning;
+constexpr char C2_PARAMKEY_VDA_FRAME_SKIP_MODE[] = "vendor.vda.frame-skip-mode";
+
+// Whether only the keyframes are decoded (non-zero value), e.g. to extract thumbnails or to scrub
+// through a video. The works of the other frames are returned as the skipped ones above, and fewer
+// output buffers are allocated. Read when the component is started.
+typedef C2GlobalParam<C2Tuning, C2Uint32Value, kParamIndexVDAKeyframesOnly>
+        C2VDAKeyframesOnlyTuning;
+constexpr char C2_PARAMKEY_VDA_KEYFRAMES_ONLY[] = "vendor.vda.keyframes-only";
+
+// Timestamp of the frame the client presents now, in the unit of the work ordinals, updated by the
+// client as its media clock advances. Frames with an earlier timestamp are late: the non-reference
+// ones are not decoded, and the others are decoded but not outputted. The works of late frames are
+// returned with no output buffer and C2FrameData::FLAG_DROP_FRAME set. 0 (the default) disables
+// late frame dropping.
+typedef C2GlobalParam<C2Tuning, C2Uint64Value, kParamIndexVDAPresentationDeadline>
+        C2VDAPresentationDeadlineTuning;
+constexpr char C2_PARAMKEY_VDA_PRESENTATION_DEADLINE[] = "vendor.vda.presentation-deadline";
+
+// Whether bitstream errors are recovered from (non-zero value), e.g. for lossy network streams.
+// The work of a frame which cannot be decoded is returned with C2_CORRUPTED result, no output
+// buffer and C2FrameData::FLAG_DROP_FRAME set, and decoding resumes at the next keyframe instead
+// of moving the component to the error state. Read when the component is started.
+typedef C2GlobalParam<C2Tuning, C2Uint32Value, kParamIndexVDAErrorResilient>
+        C2VDAErrorResilientTuning;
+constexpr char C2_PARAMKEY_VDA_ERROR_RESILIENT[] = "vendor.vda.error-resilient";
+
+// Frame rate of the stream in frames per second, 0 (the default) if unknown. Along with the picture
+// size, it is the expected decoder load of the component, which fails to start with C2_NO_MEMORY
+// if the decoder has not enough capacity left for it. Read when the component is started.
+typedef C2GlobalParam<C2Tuning, C2Uint32Value, kParamIndexVDAFrameRate> C2VDAFrameRateTuning;
+constexpr char C2_PARAMKEY_VDA_FRAME_RATE[] = "vendor.vda.frame-rate";
+
+// Memory held by the current or last session of the component, in bytes, and its high-water mark:
+// the output graphic blocks, plus the input buffers, mapped bitstream buffers and parser state of
+// the decoder when it runs in the process of the component. Updated as works are done, and reset
+// when the component is started. Configuring them has no effect.
+typedef C2GlobalParam<C2Info, C2Uint64Value, kParamIndexVDAMemoryUsage> C2VDAMemoryUsageInfo;
+constexpr char C2_PARAMKEY_VDA_MEMORY_USAGE[] = "vendor.vda.memory-usage";
+typedef C2GlobalParam<C2Info, C2Uint64Value, kParamIndexVDAPeakMemoryUsage>
+        C2VDAPeakMemoryUsageInfo;
+constexpr char C2_PARAMKEY_VDA_PEAK_MEMORY_USAGE[] = "vendor.vda.peak-memory-usage";
+
 class C2VDAComponent : public C2Component,
                        public VideoDecodeAcceleratorAdaptor::Client,
                        public std::enable_shared_from_this<C2VDAComponent> {
@@ -47,6 +117,14 @@ public:
         c2_status_t status() const { return mInitStatus; }
         media::VideoCodecProfile getCodecProfile() const { return mCodecProfile; }
         C2BlockPool::local_id_t getBlockPoolId() const { return mOutputBlockPoolIds->m.values[0]; }
+        uint32_t getFrameSkipMode() const { return mFrameSkipMode->value; }
+        bool getKeyframesOnly() const { return mKeyframesOnly->value != 0; }
+        uint64_t getPresentationDeadline() const { return mPresentationDeadline->value; }
+        bool getErrorResilient() const { return mErrorResilient->value != 0; }
+        media::Size getSize() const { return media::Size(mSize->width, mSize->height); }
+        uint32_t getFrameRate() const { return mFrameRate->value; }
+        uint64_t getMemoryUsage() const { return mMemoryUsage->value; }
+        uint64_t getPeakMemoryUsage() const { return mPeakMemoryUsage->value; }
 
     private:
         // The input format kind; should be C2FormatCompressed.
@@ -67,6 +145,19 @@ public:
         std::shared_ptr<C2PortSurfaceAllocatorTuning::output> mOutputSurfaceAllocatorId;
         // Compnent uses this ID to fetch corresponding output block pool from platform.
         std::shared_ptr<C2PortBlockPoolsTuning::output> mOutputBlockPoolIds;
+        // The mode of skipping non-reference frames, one of C2VDAFrameSkipMode.
+        std::shared_ptr<C2VDAFrameSkipModeTuning> mFrameSkipMode;
+        // Whether only the keyframes are decoded.
+        std::shared_ptr<C2VDAKeyframesOnlyTuning> mKeyframesOnly;
+        // The timestamp before which frames are late.
+        std::shared_ptr<C2VDAPresentationDeadlineTuning> mPresentationDeadline;
+        // Whether bitstream errors are recovered from.
+        std::shared_ptr<C2VDAErrorResilientTuning> mErrorResilient;
+        // The expected frame rate of the stream.
+        std::shared_ptr<C2VDAFrameRateTuning> mFrameRate;
+        // The memory held by the session, and its high-water mark.
+        std::shared_ptr<C2VDAMemoryUsageInfo> mMemoryUsage;
+        std::shared_ptr<C2VDAPeakMemoryUsageInfo> mPeakMemoryUsage;
 
         c2_status_t mInitStatus;
         media::VideoCodecProfile mCodecProfile;
@@ -97,10 +188,16 @@ public:
     virtual void pictureReady(int32_t pictureBufferId, int32_t bitstreamId,
                               const media::Rect& cropRect) override;
     virtual void notifyEndOfBitstreamBuffer(int32_t bitstreamId) override;
+    virtual void notifyFrameSkipped(int32_t bitstreamId) override;
+    virtual void notifyFrameError(int32_t bitstreamId) override;
     virtual void notifyFlushDone() override;
     virtual void notifyResetDone() override;
     virtual void notifyError(VideoDecodeAcceleratorAdaptor::Result error) override;
 
+    // Return the memory held by the current or last session by category, with the high-water
+    // marks, for dumps. Empty if the component was never started.
+    std::string dumpMemoryUsage();
+
 private:
     // The state machine enumeration on parent thread.
     enum class State : int32_t {
@@ -183,10 +280,13 @@ private:
 
     // These tasks should be run on the component thread |mThread|.
     void onDestroy();
-    void onStart(media::VideoCodecProfile profile, ::base::WaitableEvent* done);
+    void onStart(media::VideoCodecProfile profile, bool keyframesOnly, bool errorResilient,
+                 media::Size expectedSize, uint32_t frameRate, ::base::WaitableEvent* done);
     void onQueueWork(std::unique_ptr<C2Work> work);
     void onDequeueWork();
     void onInputBufferDone(int32_t bitstreamId);
+    void onFrameSkipped(int32_t bitstreamId);
+    void onFrameError(int32_t bitstreamId);
     void onOutputBufferDone(int32_t pictureBufferId, int32_t bitstreamId);
     void onDrain(uint32_t drainMode);
     void onDrainDone();
@@ -209,6 +309,11 @@ private:
     GraphicBlockInfo* getGraphicBlockById(int32_t blockId);
     // Helper function to get the specified GraphicBlockInfo object by its pool id.
     GraphicBlockInfo* getGraphicBlockByPoolId(uint32_t poolId);
+    // Start dropping the incoming works until one is at a random access point.
+    void startSeekingRandomAccessPoint();
+    // Return true if the work with |input| buffer is to be decoded, false if it precedes the random
+    // access point looked for after starting or flushing.
+    bool isWorkAtRandomAccessPoint(const C2ConstLinearBlock& input);
     // Helper function to get the specified work in mPendingWorks by bitstream id.
     C2Work* getPendingWorkByBitstreamId(int32_t bitstreamId);
     // Try to apply the output format change.
@@ -226,11 +331,28 @@ private:
     void reportEOSWork();
     // Abandon all works in mPendingWorks and mAbandonedWorks.
     void reportAbandonedWorks();
+    // Make onWorkDone call to listener for |works|, which must not be empty.
+    void reportWorksDone(std::list<std::unique_ptr<C2Work>> works);
     // Make onError call to listener for reporting errors.
     void reportError(c2_status_t error);
+    // Account the graphic blocks of mGraphicBlocks in mMemoryUsage.
+    void updateGraphicBlocksMemoryUsage();
+    // Update the memory usage parameters of the component interface from mMemoryUsage, if it
+    // changed since they were last updated.
+    void updateMemoryUsageParams();
     // Helper function to determine if the work is finished.
     bool isWorkDone(const C2Work* work) const;
 
+    // Apply the configured frame skip mode, asking VDA to start or stop skipping non-reference
+    // frames if the decision changes. Non-reference frames are skipped as well if |nextInputLate|,
+    // i.e. the input buffer sent next to VDA is late already.
+    void updateFrameSkipping(bool nextInputLate = false);
+    // Return true if the client holds so many output buffers that decoding should catch up by
+    // skipping non-reference frames.
+    bool isOutputStarved() const;
+    // Return true if the frame of |work| is behind the presentation deadline set by the client.
+    bool isWorkLate(const C2Work* work) const;
+
     // Start dequeue thread, return true on success.
     bool startDequeueThread(const media::Size& size, uint32_t pixelFormat,
                             std::shared_ptr<C2BlockPool> blockPool);
@@ -296,11 +418,54 @@ private:
 
     // The indicator of whether component is in secure mode.
     bool mSecureMode;
+    // The codec profile VDA is initialized with.
+    media::VideoCodecProfile mVDAProfile;
+    // Whether VDA decodes the keyframes only, as it applied the keyframe-only tuning. This sets the
+    // number of output buffers.
+    bool mKeyframesOnly;
+    // Whether VDA drops the frames before the first random access point after starting or
+    // flushing, as it reported at initialization.
+    bool mVDADropsFramesBeforeRAP;
+    // Whether the works are dropped until the first one at a random access point, after starting
+    // or flushing, and the number of works dropped so far.
+    bool mSeekingRandomAccessPoint;
+    size_t mNumWorksDroppedBeforeRAP;
+    // Whether VDA is asked to skip non-reference frames, and whether it is because the client holds
+    // too many output buffers.
+    bool mSkippingNonReferenceFrames;
+    bool mOutputStarved;
+    // The number of frames dropped since the component was started, by reason: skipped by VDA as
+    // configured (frame skip mode or keyframe-only decoding), skipped by VDA because they were
+    // late, and decoded but late.
+    uint64_t mNumSkippedFrames;
+    uint64_t mNumLateSkippedFrames;
+    uint64_t mNumLateDecodedFrames;
+    // The bitstream IDs of the input buffers pending in VDA that were already late when they were
+    // sent, which VDA was asked to skip if they are non-reference frames.
+    std::set<int32_t> mLateBitstreamIds;
+    // The number of works returned with C2_CORRUPTED result since the component was started, each
+    // of them is a bitstream error VDA recovered from.
+    uint64_t mNumCorruptedWorks;
+    // The total and peak bytes of mMemoryUsage last set to the component interface.
+    uint64_t mReportedMemoryUsage;
+    uint64_t mReportedPeakMemoryUsage;
 
     // The following members should be utilized on parent thread.
 
     // The input codec profile which is configured in component interface.
     media::VideoCodecProfile mCodecProfile;
+    // Whether bitstream errors are to be recovered from, configured in component interface.
+    bool mErrorResilientConfig;
+    // The expected picture size and frame rate, configured in component interface.
+    media::Size mExpectedSizeConfig;
+    uint32_t mFrameRateConfig;
+    // The scheduling of the component and dequeue threads, set by system properties. The latter
+    // is read on component thread once start() posted onStart().
+    media::ThreadSchedulingConfig mComponentThreadScheduling;
+    media::ThreadSchedulingConfig mDequeueThreadScheduling;
+    // The memory accounting of the current or last session, created by start(). It is shared with
+    // VDA, which accounts its own buffers.
+    scoped_refptr<media::MemoryUsageTracker> mMemoryUsage;
     // The state machine on parent thread which should be atomic.
     std::atomic<State> mState;
     // The mutex lock to synchronize start/stop/reset/release calls.
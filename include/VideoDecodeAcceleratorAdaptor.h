@@ -7,6 +7,7 @@
 
 #include <C2VDACommon.h>
 
+#include <memory_usage_tracker.h>
 #include <rect.h>
 #include <size.h>
 #include <video_codecs.h>
@@ -38,6 +39,15 @@ public:
         INSUFFICIENT_RESOURCES = 5,
     };
 
+    // The decoding options of initialize() that the decoder actually applies.
+    struct AppliedConfig {
+        // Whether the non-key frames are dropped, as requested by |keyframesOnly|.
+        bool keyframesOnly = false;
+        // Whether the frames before the first random access point after initialize() or
+        // reset() are dropped without being reported, as the decoder cannot decode them.
+        bool dropsFramesBeforeRandomAccessPoint = false;
+    };
+
     // The adaptor client interface. This interface should be implemented in the component side.
     class Client {
     public:
@@ -58,6 +68,16 @@ public:
         // specified ID.
         virtual void notifyEndOfBitstreamBuffer(int32_t bitstreamId) = 0;
 
+        // Callback to notify that the frame in the bitstream buffer with specified ID was skipped
+        // and no picture will be delivered for it. This comes before notifyEndOfBitstreamBuffer()
+        // for the same bitstream buffer.
+        virtual void notifyFrameSkipped(int32_t bitstreamId) = 0;
+
+        // Callback to notify that the bitstream buffer with specified ID could not be decoded and
+        // the decoder recovered from it, in error resilient mode. No picture will be delivered for
+        // it. This comes before notifyEndOfBitstreamBuffer() for the same bitstream buffer.
+        virtual void notifyFrameError(int32_t bitstreamId) = 0;
+
         // Flush completion callback.
         virtual void notifyFlushDone() = 0;
 
@@ -70,9 +90,20 @@ public:
     };
 
     // Initializes the video decoder with specific profile. This call is synchronous and returns
-    // SUCCESS iff initialization is successful.
-    virtual Result initialize(media::VideoCodecProfile profile, bool secureMode,
-                              Client* client) = 0;
+    // SUCCESS iff initialization is successful. If |keyframesOnly| is true, the decoder may drop
+    // all non-key frames, and report them by Client::notifyFrameSkipped(). If |errorResilient| is
+    // true, the decoder may resume at the next keyframe after a bitstream error instead of
+    // reporting it by Client::notifyError(), and report the bad buffer by
+    // Client::notifyFrameError(). |expectedSize| and |frameRate| (0 if unknown) are the expected
+    // load of the session; INSUFFICIENT_RESOURCES is returned if the decoder has not enough
+    // capacity left for it. The memory the decoder holds for the session is accounted in
+    // |memoryUsage| if not null, as far as the implementation can see it. On success, the options
+    // the decoder applies are set to |appliedConfig|, as it may ignore some of them.
+    virtual Result initialize(media::VideoCodecProfile profile, bool secureMode, bool keyframesOnly,
+                              bool errorResilient, const media::Size& expectedSize,
+                              uint32_t frameRate,
+                              const scoped_refptr<media::MemoryUsageTracker>& memoryUsage,
+                              Client* client, AppliedConfig* appliedConfig) = 0;
 
     // Decodes given buffer handle with bitstream ID.
     virtual void decode(int32_t bitstreamId, int handleFd, off_t offset, uint32_t bytesUsed) = 0;
@@ -88,6 +119,10 @@ public:
     // Sends picture buffer to be reused by the decoder by its piture ID.
     virtual void reusePictureBuffer(int32_t pictureBufferId) = 0;
 
+    // Sets whether the decoder should skip the frames no other frame refers to. Skipped frames are
+    // reported by notifyFrameSkipped(). This is a hint and may be ignored by the decoder.
+    virtual void setSkipNonReferenceFrames(bool skip) = 0;
+
     // Flushes the decoder.
     virtual void flush() = 0;
 
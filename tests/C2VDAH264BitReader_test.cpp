@@ -0,0 +1,89 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "C2VDAH264BitReader_test"
+
+#include <h264_bit_reader.h>
+
+#include <gtest/gtest.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace android {
+
+namespace {
+
+// Remove the emulation prevention bytes of |nalu| one byte at a time, as the spec describes it.
+std::vector<uint8_t> unescape(const std::vector<uint8_t>& nalu, size_t* numEmulationPrevention) {
+    std::vector<uint8_t> rbsp;
+    *numEmulationPrevention = 0;
+    size_t zeros = 0;
+    for (uint8_t byte : nalu) {
+        if (zeros >= 2 && byte == 0x03) {
+            (*numEmulationPrevention)++;
+            zeros = 0;
+            continue;
+        }
+        rbsp.push_back(byte);
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+    return rbsp;
+}
+
+// Read |nalu| byte by byte with media::H264BitReader and check it matches unescape().
+void expectReadsUnescaped(const std::vector<uint8_t>& nalu) {
+    size_t numEmulationPrevention;
+    const std::vector<uint8_t> expected = unescape(nalu, &numEmulationPrevention);
+
+    media::H264BitReader reader;
+    ASSERT_TRUE(reader.Initialize(nalu.data(), nalu.size()));
+    std::vector<uint8_t> read;
+    int byte;
+    while (reader.NumBitsLeft() >= 8 && reader.ReadBits(8, &byte)) {
+        read.push_back(static_cast<uint8_t>(byte));
+    }
+    EXPECT_EQ(expected, read);
+    EXPECT_EQ(numEmulationPrevention, reader.NumEmulationPreventionBytesRead());
+}
+
+}  // namespace
+
+TEST(C2VDAH264BitReaderTest, ReadsStreamWithoutEmulationPrevention) {
+    std::vector<uint8_t> nalu;
+    for (int i = 0; i < 64; ++i) {
+        nalu.push_back(static_cast<uint8_t>(0x10 + i));
+    }
+    expectReadsUnescaped(nalu);
+}
+
+TEST(C2VDAH264BitReaderTest, SkipsEmulationPreventionBytes) {
+    // The 0x000003 sequences fall at every offset of the 8-byte refills, so that windows start
+    // with the 0x03 byte, and with 0x02 or 0x03 bytes followed by small bytes, which are the
+    // words below 0x0101010101010101 once the 0x03 bytes are cleared.
+    for (size_t offset = 0; offset < 16; ++offset) {
+        std::vector<uint8_t> nalu(offset, 0x55);
+        for (int i = 0; i < 4; ++i) {
+            nalu.insert(nalu.end(), {0x00, 0x00, 0x03, 0x01, 0x02, 0x00, 0x01, 0x03});
+            nalu.insert(nalu.end(), {0x02, 0x01, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x03});
+        }
+        nalu.insert(nalu.end(), {0x03, 0x02, 0x01, 0x00, 0x01, 0x02, 0x03, 0x80});
+        SCOPED_TRACE(offset);
+        expectReadsUnescaped(nalu);
+    }
+}
+
+TEST(C2VDAH264BitReaderTest, KeepsThreeBytesNotEmulationPrevention) {
+    // 0x03 bytes not after two zero bytes, and a 0x03 right after an emulation prevention byte,
+    // are data.
+    const std::vector<uint8_t> nalu = {0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+                                       0x00, 0x03, 0x00, 0x00, 0x03, 0x03, 0x00, 0x00,
+                                       0x03, 0x00, 0x03, 0x01, 0x02, 0x03, 0x04, 0x80};
+    expectReadsUnescaped(nalu);
+}
+
+}  // namespace android
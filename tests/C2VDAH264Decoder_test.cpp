@@ -0,0 +1,273 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "C2VDAH264Decoder_test"
+
+#include <h264_decoder.h>
+
+#include <gtest/gtest.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+namespace {
+
+// Number of heap allocations made by the test binary and the libraries it loads, while
+// |gCountAllocations| is set.
+std::atomic<bool> gCountAllocations(false);
+std::atomic<size_t> gNumAllocations(0);
+
+void* allocate(size_t size) {
+    if (gCountAllocations) gNumAllocations++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+namespace android {
+
+namespace {
+
+// Width and height of the stream in macroblocks. Each macroblock row is a slice.
+const int kWidthInMbs = 2;
+const int kHeightInMbs = 4;
+// Frames decoded before allocations are counted, by then the decoder storage and the pictures
+// of the DPB have reached their steady-state sizes.
+const int kNumWarmUpFrames = 32;
+const int kNumCountedFrames = 64;
+
+// Writes the Exp-Golomb coded syntax elements of H.264 headers, with emulation prevention.
+class NaluWriter {
+public:
+    explicit NaluWriter(std::vector<uint8_t>* stream) : mStream(stream) {}
+
+    void putBits(uint32_t value, int numBits) {
+        for (int i = numBits - 1; i >= 0; --i) {
+            mByte = (mByte << 1) | ((value >> i) & 1);
+            if (++mNumBits == 8) putByte();
+        }
+    }
+    void putUE(uint32_t value) {
+        int numBits = 0;
+        while ((value + 1) >> (numBits + 1)) numBits++;
+        putBits(0, numBits);
+        putBits(value + 1, numBits + 1);
+    }
+    void putSE(int32_t value) { putUE(value > 0 ? 2 * value - 1 : -2 * value); }
+
+    void startNalu(int nalRefIdc, int nalUnitType) {
+        mStream->insert(mStream->end(), {0x00, 0x00, 0x00, 0x01});
+        mNumZeros = 0;
+        putBits(0, 1);
+        putBits(nalRefIdc, 2);
+        putBits(nalUnitType, 5);
+    }
+    // Write the RBSP trailing bits, preceded by |numDataBytes| bytes standing for slice data.
+    void finishNalu(int numDataBytes = 0) {
+        putBits(1, 1);
+        while (mNumBits != 0) putBits(0, 1);
+        for (int i = 0; i < numDataBytes; ++i) putBits(0xa5, 8);
+    }
+
+private:
+    void putByte() {
+        if (mNumZeros == 2 && mByte <= 0x03) {
+            mStream->push_back(0x03);
+            mNumZeros = 0;
+        }
+        mStream->push_back(mByte);
+        mNumZeros = mByte == 0 ? mNumZeros + 1 : 0;
+        mByte = 0;
+        mNumBits = 0;
+    }
+
+    std::vector<uint8_t>* const mStream;
+    uint8_t mByte = 0;
+    int mNumBits = 0;
+    int mNumZeros = 0;
+};
+
+// Return a Main profile IDR frame with its parameter sets, followed by |numFrames| - 1 P frames.
+// Each frame is returned as its own buffer, as the VDA passes them to the decoder.
+std::vector<std::vector<uint8_t>> createStream(int numFrames) {
+    std::vector<std::vector<uint8_t>> frames(numFrames);
+    for (int frame = 0; frame < numFrames; ++frame) {
+        NaluWriter writer(&frames[frame]);
+        const bool idr = frame == 0;
+        if (idr) {
+            writer.startNalu(3, 7);  // SPS.
+            writer.putBits(77, 8);   // profile_idc
+            writer.putBits(0, 8);    // constraint_set_flags, reserved_zero_2bits
+            writer.putBits(30, 8);   // level_idc
+            writer.putUE(0);         // seq_parameter_set_id
+            writer.putUE(0);         // log2_max_frame_num_minus4
+            writer.putUE(0);         // pic_order_cnt_type
+            writer.putUE(0);         // log2_max_pic_order_cnt_lsb_minus4
+            writer.putUE(1);         // max_num_ref_frames
+            writer.putBits(0, 1);    // gaps_in_frame_num_value_allowed_flag
+            writer.putUE(kWidthInMbs - 1);
+            writer.putUE(kHeightInMbs - 1);
+            writer.putBits(1, 1);  // frame_mbs_only_flag
+            writer.putBits(1, 1);  // direct_8x8_inference_flag
+            writer.putBits(0, 1);  // frame_cropping_flag
+            writer.putBits(0, 1);  // vui_parameters_present_flag
+            writer.finishNalu();
+
+            writer.startNalu(3, 8);  // PPS.
+            writer.putUE(0);         // pic_parameter_set_id
+            writer.putUE(0);         // seq_parameter_set_id
+            writer.putBits(0, 1);    // entropy_coding_mode_flag
+            writer.putBits(0, 1);    // bottom_field_pic_order_in_frame_present_flag
+            writer.putUE(0);         // num_slice_groups_minus1
+            writer.putUE(0);         // num_ref_idx_l0_default_active_minus1
+            writer.putUE(0);         // num_ref_idx_l1_default_active_minus1
+            writer.putBits(0, 1);    // weighted_pred_flag
+            writer.putBits(0, 2);    // weighted_bipred_idc
+            writer.putSE(0);         // pic_init_qp_minus26
+            writer.putSE(0);         // pic_init_qs_minus26
+            writer.putSE(0);         // chroma_qp_index_offset
+            writer.putBits(1, 1);    // deblocking_filter_control_present_flag
+            writer.putBits(0, 1);    // constrained_intra_pred_flag
+            writer.putBits(0, 1);    // redundant_pic_cnt_present_flag
+            writer.finishNalu();
+        }
+
+        for (int row = 0; row < kHeightInMbs; ++row) {
+            writer.startNalu(2, idr ? 5 : 1);
+            writer.putUE(row * kWidthInMbs);      // first_mb_in_slice
+            writer.putUE(idr ? 7 : 5);            // slice_type, I or P
+            writer.putUE(0);                      // pic_parameter_set_id
+            writer.putBits(frame % 16, 4);        // frame_num
+            if (idr) writer.putUE(0);             // idr_pic_id
+            writer.putBits((frame * 2) % 16, 4);  // pic_order_cnt_lsb
+            if (!idr) {
+                writer.putBits(0, 1);  // num_ref_idx_active_override_flag
+                writer.putBits(0, 1);  // ref_pic_list_modification_flag_l0
+            }
+            if (idr) {
+                writer.putBits(0, 1);  // no_output_of_prior_pics_flag
+                writer.putBits(0, 1);  // long_term_reference_flag
+            } else {
+                writer.putBits(0, 1);  // adaptive_ref_pic_marking_mode_flag
+            }
+            writer.putSE(0);  // slice_qp_delta
+            writer.putUE(1);  // disable_deblocking_filter_idc
+            writer.finishNalu(16);
+        }
+    }
+    return frames;
+}
+
+// Accelerator handing out pictures from a pool, as the V4L2 one does, and counting what it is
+// given.
+class FakeH264Accelerator : public media::H264Decoder::H264Accelerator {
+public:
+    FakeH264Accelerator() {}
+    ~FakeH264Accelerator() override {}
+
+    scoped_refptr<media::H264Picture> CreateH264Picture() override {
+        for (const auto& pic : mPicturePool) {
+            if (pic->HasOneRef()) {
+                pic->ResetForReuse();
+                return pic;
+            }
+        }
+        mPicturePool.push_back(new media::H264Picture());
+        return mPicturePool.back();
+    }
+    bool SubmitFrameMetadata(const media::H264SPS* sps, const media::H264PPS* pps,
+                             const media::H264DPB& dpb,
+                             const media::H264Picture::Vector& refPicListP0,
+                             const media::H264Picture::Vector& refPicListB0,
+                             const media::H264Picture::Vector& refPicListB1,
+                             const scoped_refptr<media::H264Picture>& pic) override {
+        return true;
+    }
+    bool SubmitSlice(const media::H264PPS* pps, const media::H264SliceHeader* sliceHdr,
+                     const media::H264Picture::Vector& refPicList0,
+                     const media::H264Picture::Vector& refPicList1,
+                     const scoped_refptr<media::H264Picture>& pic, const uint8_t* data,
+                     size_t size) override {
+        mNumSlices++;
+        return true;
+    }
+    bool SubmitDecode(const scoped_refptr<media::H264Picture>& pic) override {
+        mNumDecodes++;
+        return true;
+    }
+    bool OutputPicture(const scoped_refptr<media::H264Picture>& pic) override {
+        mNumOutputs++;
+        return true;
+    }
+    void Reset() override {}
+
+    size_t mNumSlices = 0;
+    size_t mNumDecodes = 0;
+    size_t mNumOutputs = 0;
+
+private:
+    std::vector<scoped_refptr<media::H264Picture>> mPicturePool;
+};
+
+// Decode |frame| as one input buffer, as the VDA does.
+void decodeFrame(media::H264Decoder* decoder, const std::vector<uint8_t>& frame) {
+    decoder->SetStream(frame.data(), frame.size());
+    media::H264Decoder::DecodeResult result;
+    while ((result = decoder->Decode()) == media::H264Decoder::kAllocateNewSurfaces) {
+    }
+    ASSERT_EQ(media::H264Decoder::kRanOutOfStreamData, result);
+}
+
+}  // namespace
+
+TEST(C2VDAH264DecoderTest, DecodesWithoutAllocatingPerFrame) {
+    const std::vector<std::vector<uint8_t>> frames =
+            createStream(kNumWarmUpFrames + kNumCountedFrames);
+    FakeH264Accelerator accelerator;
+    media::H264Decoder decoder(&accelerator);
+
+    for (int i = 0; i < kNumWarmUpFrames; ++i) {
+        ASSERT_NO_FATAL_FAILURE(decodeFrame(&decoder, frames[i]));
+    }
+
+    gNumAllocations = 0;
+    gCountAllocations = true;
+    for (int i = kNumWarmUpFrames; i < kNumWarmUpFrames + kNumCountedFrames; ++i) {
+        decodeFrame(&decoder, frames[i]);
+    }
+    gCountAllocations = false;
+    EXPECT_EQ(0u, gNumAllocations.load());
+
+    ASSERT_TRUE(decoder.Flush());
+    const size_t numFrames = kNumWarmUpFrames + kNumCountedFrames;
+    EXPECT_EQ(numFrames * kHeightInMbs, accelerator.mNumSlices);
+    EXPECT_EQ(numFrames, accelerator.mNumDecodes);
+    EXPECT_EQ(numFrames, accelerator.mNumOutputs);
+}
+
+}  // namespace android
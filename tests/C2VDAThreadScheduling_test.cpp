@@ -0,0 +1,139 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "C2VDAThreadScheduling_test"
+
+#include <thread_scheduling.h>
+
+#include <base/bind.h>
+#include <base/synchronization/waitable_event.h>
+#include <base/threading/thread.h>
+
+#include <gtest/gtest.h>
+#include <utils/Log.h>
+
+#include <stdint.h>
+
+namespace android {
+
+class C2VDAThreadSchedulingTest : public ::testing::Test {
+protected:
+    C2VDAThreadSchedulingTest() : mThread("C2VDAThreadSchedulingTestThread") {}
+    ~C2VDAThreadSchedulingTest() override {}
+
+    void SetUp() override { ASSERT_TRUE(mThread.Start()); }
+    void TearDown() override { mThread.Stop(); }
+
+    // Applies |config| to |mThread| the way the pipeline threads are set up, and returns the
+    // resulting scheduling of |mThread|.
+    media::ThreadSchedulingConfig applyOnThread(const media::ThreadSchedulingConfig& config) {
+        media::PostApplyThreadSchedulingConfig(mThread.task_runner(), config);
+        media::ThreadSchedulingConfig current;
+        ::base::WaitableEvent done(::base::WaitableEvent::ResetPolicy::AUTOMATIC,
+                                   ::base::WaitableEvent::InitialState::NOT_SIGNALED);
+        mThread.task_runner()->PostTask(
+                FROM_HERE, ::base::Bind(&C2VDAThreadSchedulingTest::getOnThread, &current, &done));
+        done.Wait();
+        return current;
+    }
+
+    static void applyAndGetOnThread(const media::ThreadSchedulingConfig& config, bool* applied,
+                                    media::ThreadSchedulingConfig* current,
+                                    ::base::WaitableEvent* done) {
+        *applied = media::ApplyThreadSchedulingConfig(config);
+        *current = media::GetCurrentThreadSchedulingConfig();
+        done->Signal();
+    }
+
+    static void getOnThread(media::ThreadSchedulingConfig* current, ::base::WaitableEvent* done) {
+        *current = media::GetCurrentThreadSchedulingConfig();
+        done->Signal();
+    }
+
+    ::base::Thread mThread;
+};
+
+TEST_F(C2VDAThreadSchedulingTest, ParseConfig) {
+    media::ThreadSchedulingConfig config;
+    ASSERT_TRUE(media::ParseThreadSchedulingConfig("", &config));
+    EXPECT_TRUE(config.IsDefault());
+
+    ASSERT_TRUE(media::ParseThreadSchedulingConfig("nice=-10,cpus=0xf0", &config));
+    EXPECT_TRUE(config.has_nice_value);
+    EXPECT_EQ(-10, config.nice_value);
+    EXPECT_EQ(0, config.realtime_priority);
+    EXPECT_EQ(0xf0u, config.cpu_affinity_mask);
+
+    ASSERT_TRUE(media::ParseThreadSchedulingConfig("rtprio=2", &config));
+    EXPECT_FALSE(config.has_nice_value);
+    EXPECT_EQ(2, config.realtime_priority);
+    EXPECT_EQ(0u, config.cpu_affinity_mask);
+}
+
+TEST_F(C2VDAThreadSchedulingTest, ParseMalformedConfig) {
+    media::ThreadSchedulingConfig config;
+    ASSERT_TRUE(media::ParseThreadSchedulingConfig("nice=5", &config));
+
+    const char* malformed[] = {"nice", "nice=", "nice=5x", "nice=20", "rtprio=100", "cpus=-1",
+                               "prio=1", "nice=5,,cpus=1"};
+    for (const char* str : malformed) {
+        EXPECT_FALSE(media::ParseThreadSchedulingConfig(str, &config)) << str;
+        // |config| is left unchanged.
+        EXPECT_EQ(5, config.nice_value) << str;
+    }
+}
+
+TEST_F(C2VDAThreadSchedulingTest, DefaultConfigKeepsScheduling) {
+    const media::ThreadSchedulingConfig before = applyOnThread(media::ThreadSchedulingConfig());
+    const media::ThreadSchedulingConfig after = applyOnThread(media::ThreadSchedulingConfig());
+    EXPECT_EQ(before.nice_value, after.nice_value);
+    EXPECT_EQ(before.realtime_priority, after.realtime_priority);
+    EXPECT_EQ(before.cpu_affinity_mask, after.cpu_affinity_mask);
+}
+
+TEST_F(C2VDAThreadSchedulingTest, ApplyNiceValueAndAffinity) {
+    const media::ThreadSchedulingConfig initial = applyOnThread(media::ThreadSchedulingConfig());
+    ASSERT_NE(0u, initial.cpu_affinity_mask);
+
+    // Lowering the priority and restricting to a CPU allowed already need no privilege. Pin the
+    // thread to the lowest allowed CPU, CPU 0 may be outside of the cpuset of the process.
+    media::ThreadSchedulingConfig config;
+    config.has_nice_value = true;
+    config.nice_value = 5;
+    config.cpu_affinity_mask = initial.cpu_affinity_mask & (~initial.cpu_affinity_mask + 1);
+
+    const media::ThreadSchedulingConfig applied = applyOnThread(config);
+    EXPECT_TRUE(applied.has_nice_value);
+    EXPECT_EQ(5, applied.nice_value);
+    EXPECT_EQ(0, applied.realtime_priority);
+    EXPECT_EQ(config.cpu_affinity_mask, applied.cpu_affinity_mask);
+
+    // The scheduling of the calling thread is left alone.
+    const media::ThreadSchedulingConfig caller = media::GetCurrentThreadSchedulingConfig();
+    EXPECT_EQ(initial.cpu_affinity_mask, caller.cpu_affinity_mask);
+}
+
+TEST_F(C2VDAThreadSchedulingTest, ApplyRealtimePriority) {
+    media::ThreadSchedulingConfig config;
+    config.realtime_priority = 2;
+
+    bool applied = false;
+    media::ThreadSchedulingConfig current;
+    ::base::WaitableEvent done(::base::WaitableEvent::ResetPolicy::AUTOMATIC,
+                               ::base::WaitableEvent::InitialState::NOT_SIGNALED);
+    mThread.task_runner()->PostTask(
+            FROM_HERE, ::base::Bind(&C2VDAThreadSchedulingTest::applyAndGetOnThread, config,
+                                    &applied, &current, &done));
+    done.Wait();
+
+    // SCHED_FIFO needs CAP_SYS_NICE or a RLIMIT_RTPRIO allowance, which the test may not have.
+    if (!applied) {
+        ALOGW("SCHED_FIFO is not allowed, skipping ApplyRealtimePriority");
+        return;
+    }
+    EXPECT_EQ(2, current.realtime_priority);
+}
+
+}  // namespace android
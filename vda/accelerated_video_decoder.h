@@ -9,6 +9,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+
 #include "base/macros.h"
 #include "size.h"
 
@@ -59,6 +61,68 @@ class AcceleratedVideoDecoder {
   virtual Size GetPicSize() const = 0;
   virtual size_t GetRequiredNumOfPictures() const = 0;
 
+  // Return the maximum size in bytes of a coded frame of the stream at
+  // |frame_rate|, as bounded by its level, or 0 if the stream metadata is not
+  // parsed yet. To be used after Decode() returns kAllocateNewSurfaces.
+  virtual size_t GetMaxCodedFrameSize(int frame_rate) const = 0;
+
+  // Minimum compression ratio of the coded frames in most levels of the
+  // supported codecs.
+  enum { kDefaultMinCompressionRatio = 2 };
+
+  // Return the maximum size in bytes of a coded frame of |pic_size| at
+  // |frame_rate|, for a level with a maximum macroblock rate of
+  // |max_macroblock_rate|, 0 if unknown, and a minimum compression ratio of
+  // |min_compression_ratio|. As in section A.3.1 of the H.264 spec, a frame
+  // may take the raw 4:2:0 size, 384 bytes per macroblock, of the largest of
+  // the picture and the macroblocks the level processes in 1/172 s or in a
+  // frame interval, divided by the ratio.
+  static size_t GetMaxCodedFrameSizeFor(const Size& pic_size,
+                                        int frame_rate,
+                                        uint64_t max_macroblock_rate,
+                                        int min_compression_ratio) {
+    uint64_t num_mbs = static_cast<uint64_t>((pic_size.width() + 15) / 16) *
+                       ((pic_size.height() + 15) / 16);
+    if (max_macroblock_rate > 0) {
+      num_mbs = std::max(num_mbs, max_macroblock_rate / 172);
+      if (frame_rate > 0)
+        num_mbs = std::max(num_mbs, max_macroblock_rate / frame_rate);
+    }
+    return static_cast<size_t>(num_mbs * 384 / min_compression_ratio);
+  }
+
+  // Drop the frames that no other frame refers to, without submitting them to
+  // the accelerator, in the streams set by SetStream() while |skip| is true.
+  // A frame is dropped as a whole or not at all, as decided when its first
+  // slice or header is parsed. Dropped frames are not outputted, and do not
+  // affect the decoding of the frames that follow.
+  virtual void SetSkipNonReferenceFrames(bool skip) = 0;
+
+  // Decode the keyframes only if |keyframes_only| is true. Other frames are
+  // dropped without being submitted to the accelerator, and count as skipped
+  // frames. Since at most one keyframe is kept for reference, the
+  // decoder then needs kNumPicturesForKeyframesOnly pictures only. Must be
+  // called before the first Decode().
+  virtual void SetDecodeKeyframesOnly(bool keyframes_only) = 0;
+
+  // Recover from a kDecodeError: drop the frame being decoded, output the
+  // frames decoded already, and resume decoding at the next keyframe of the
+  // stream. The frames dropped until then count as skipped frames.
+  virtual void ResetAfterError() = 0;
+
+  // Return the number of frames dropped since the decoder was created.
+  virtual size_t GetNumSkippedFrames() const = 0;
+
+  // Return the size in bytes of the bitstream parser state, including the
+  // parameter sets it keeps.
+  virtual size_t GetParserStateSize() const = 0;
+
+ protected:
+  // Number of pictures needed in keyframe-only mode: the last keyframe, kept
+  // for reference or until it is outputted, the one being decoded, and two
+  // for the client.
+  enum { kNumPicturesForKeyframesOnly = 4 };
+
  private:
   DISALLOW_COPY_AND_ASSIGN(AcceleratedVideoDecoder);
 };
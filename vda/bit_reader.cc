@@ -7,13 +7,12 @@
 
 namespace media {
 
-BitReader::BitReader(const uint8_t* data, int size)
-    : initial_size_(size),
-      data_(data),
-      bytes_left_(size),
-      bit_reader_core_(this) {
+BitReader::BitReader() = default;
+
+BitReader::BitReader(const uint8_t* data, int size) {
   DCHECK(data != NULL);
   DCHECK_GE(size, 0);
+  Initialize(data, size);
 }
 
 BitReader::~BitReader() = default;
@@ -32,18 +31,4 @@ bool BitReader::ReadString(int num_bits, std::string* str) {
   return true;
 }
 
-int BitReader::GetBytes(int max_nbytes, const uint8_t** out) {
-  DCHECK_GE(max_nbytes, 0);
-  DCHECK(out);
-
-  int nbytes = max_nbytes;
-  if (nbytes > bytes_left_)
-    nbytes = bytes_left_;
-
-  *out = data_;
-  data_ += nbytes;
-  bytes_left_ -= nbytes;
-  return nbytes;
-}
-
 }  // namespace media
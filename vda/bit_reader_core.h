@@ -6,36 +6,84 @@
 #ifndef BIT_READER_CORE_H_
 #define BIT_READER_CORE_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "base/logging.h"
 #include "base/macros.h"
+#include "base/sys_byteorder.h"
 
 namespace media {
 
+// Byte source for BitReaderCore reading the bytes of a buffer as they are.
+class RawByteSource {
+ public:
+  RawByteSource() : data_(nullptr), bytes_left_(0) {}
+
+  void Initialize(const uint8_t* data, size_t size) {
+    data_ = data;
+    bytes_left_ = size;
+  }
+
+  // Load the next bytes of the stream into |*reg|, first byte in the most
+  // significant byte, and return the number of bits loaded. Loads a full
+  // register unless the end of the stream is reached.
+  int Fill(uint64_t* reg) {
+    if (bytes_left_ >= sizeof(*reg)) {
+      memcpy(reg, data_, sizeof(*reg));
+      *reg = base::NetToHost64(*reg);
+      data_ += sizeof(*reg);
+      bytes_left_ -= sizeof(*reg);
+      return sizeof(*reg) * 8;
+    }
+
+    const int nbytes = bytes_left_;
+    uint64_t value = 0;
+    for (int i = 0; i < nbytes; ++i)
+      value = (value << 8) | data_[i];
+    data_ += nbytes;
+    bytes_left_ = 0;
+    *reg = nbytes ? value << (sizeof(*reg) - nbytes) * 8 : 0;
+    return nbytes * 8;
+  }
+
+  // Number of bytes not loaded yet.
+  size_t bytes_left() const { return bytes_left_; }
+
+ private:
+  // Pointer to the next byte not loaded yet.
+  const uint8_t* data_;
+  size_t bytes_left_;
+
+  DISALLOW_COPY_AND_ASSIGN(RawByteSource);
+};
+
+// Reads a stream bit by bit, most significant bit of each byte first.
+// |ByteSource| turns the input buffer into the stream of bytes to read, e.g.
+// RawByteSource, or a source removing the emulation prevention bytes of a
+// NAL unit. It is a compile time parameter so that, in the common case of
+// the requested bits already being in the bit register, a read is a couple
+// of inlined shifts, and refills take whole 64-bit words from the source.
+//
+// A ByteSource must provide the interface of RawByteSource above. Fill()
+// may return fewer bits than a full register before the end of the stream,
+// but only returns 0 at the end of the stream.
+template <typename ByteSource>
 class BitReaderCore {
  public:
-  class ByteStreamProvider {
-   public:
-    ByteStreamProvider();
-    virtual ~ByteStreamProvider();
-
-    // Consume at most the following |max_n| bytes of the stream
-    // and return the number n of bytes actually consumed.
-    // Set |*array| to point to a memory buffer containing those n bytes.
-    // Note: |*array| must be valid until the next call to GetBytes
-    // but there is no guarantee it is valid after.
-    virtual int GetBytes(int max_n, const uint8_t** array) = 0;
-  };
-
-  // Lifetime of |byte_stream_provider| must be longer than BitReaderCore.
-  explicit BitReaderCore(ByteStreamProvider* byte_stream_provider);
-  ~BitReaderCore();
+  BitReaderCore() : initial_size_(0), nbits_(0), reg_(0) {}
+
+  // Start reading at |data|, |size| being size of |data| in bytes.
+  void Initialize(const uint8_t* data, size_t size) {
+    DCHECK(data);
+    source_.Initialize(data, size);
+    initial_size_ = size;
+    nbits_ = 0;
+    reg_ = 0;
+  }
 
   // Read one bit from the stream and return it as a boolean in |*out|.
-  // Remark: we do not use the template version for reading a bool
-  // since it generates some optimization warnings during compilation
-  // on Windows platforms.
   bool ReadBits(int num_bits, bool* out) {
     DCHECK_EQ(num_bits, 1);
     return ReadFlag(out);
@@ -54,7 +102,8 @@ class BitReaderCore {
   // enter a state where further ReadBits/SkipBits operations will always
   // return false unless |num_bits| is 0. The type |T| has to be a primitive
   // integer type.
-  template<typename T> bool ReadBits(int num_bits, T* out) {
+  template <typename T>
+  bool ReadBits(int num_bits, T* out) {
     DCHECK_LE(num_bits, static_cast<int>(sizeof(T) * 8));
     uint64_t temp;
     bool ret = ReadBitsInternal(num_bits, &temp);
@@ -63,60 +112,108 @@ class BitReaderCore {
   }
 
   // Read one bit from the stream and return it as a boolean in |*flag|.
-  bool ReadFlag(bool* flag);
-
-  // Retrieve some bits without actually consuming them.
-  // Bits returned in |*out| are shifted so the most significant bit contains
-  // the next bit that can be read from the stream.
-  // Return the number of bits actually written in |out|.
-  // Note: |num_bits| is just a suggestion of how many bits the caller
-  // wish to get in |*out| and must be less than 64:
-  // - The number of bits returned can be more than |num_bits|.
-  // - However, it will be strictly less than |num_bits|
-  //   if and only if there are not enough bits left in the stream.
-  int PeekBitsMsbAligned(int num_bits, uint64_t* out);
+  bool ReadFlag(bool* flag) {
+    if (nbits_ == 0 && !Refill())
+      return false;
+
+    *flag = (reg_ >> (kRegWidthInBits - 1)) != 0;
+    reg_ <<= 1;
+    nbits_--;
+    return true;
+  }
 
   // Skip |num_bits| next bits from stream. Return false if the given number of
   // bits cannot be skipped (not enough bits in the stream), true otherwise.
   // When return false, the stream will enter a state where further
   // ReadBits/ReadFlag/SkipBits operations
   // will always return false unless |num_bits| is 0.
-  bool SkipBits(int num_bits);
+  bool SkipBits(int num_bits) {
+    DCHECK_GE(num_bits, 0);
+    uint64_t dummy;
+    while (num_bits > kRegWidthInBits) {
+      if (!ReadBitsInternal(kRegWidthInBits, &dummy))
+        return false;
+      num_bits -= kRegWidthInBits;
+    }
+    return ReadBitsInternal(num_bits, &dummy);
+  }
+
+  // Returns the number of bits not read yet, counting every byte of the
+  // input buffer not loaded into the bit register yet as 8 bits.
+  int bits_available() const {
+    return nbits_ + static_cast<int>(source_.bytes_left()) * 8;
+  }
 
-  // Returns the number of bits read so far.
-  int bits_read() const;
+  // Returns the number of bits read so far, counting in the same way.
+  int bits_read() const {
+    return static_cast<int>(initial_size_) * 8 - bits_available();
+  }
 
- private:
-  // This function can skip any number of bits but is more efficient
-  // for small numbers. Return false if the given number of bits cannot be
-  // skipped (not enough bits in the stream), true otherwise.
-  bool SkipBitsSmall(int num_bits);
+ protected:
+  enum { kRegWidthInBits = sizeof(uint64_t) * 8 };
+
+  bool ReadBitsInternal(int num_bits, uint64_t* out) {
+    DCHECK_GE(num_bits, 0);
+    DCHECK_LE(num_bits, kRegWidthInBits);
+
+    if (num_bits == 0) {
+      *out = 0;
+      return true;
+    }
+    if (num_bits <= nbits_) {
+      *out = TakeBits(num_bits);
+      return true;
+    }
+    return ReadBitsSlow(num_bits, out);
+  }
 
-  // Help function used by ReadBits to avoid inlining the bit reading logic.
-  bool ReadBitsInternal(int num_bits, uint64_t* out);
+  // Read |num_bits| when they span the end of the bit register.
+  bool ReadBitsSlow(int num_bits, uint64_t* out) {
+    uint64_t value = 0;
+    while (num_bits > nbits_) {
+      if (nbits_ > 0) {
+        const int n = nbits_;
+        value = (value << n) | TakeBits(n);
+        num_bits -= n;
+      }
+      if (!Refill())
+        return false;
+    }
+
+    // Shift in two steps, as |num_bits| may be the register width.
+    *out = ((value << (num_bits - 1)) << 1) | TakeBits(num_bits);
+    return true;
+  }
 
-  // Refill bit registers to have at least |min_nbits| bits available.
-  // Return true if the mininimum bit count condition is met after the refill.
-  bool Refill(int min_nbits);
+  // Consume and return the next |num_bits| (1 to |nbits_|) bits.
+  uint64_t TakeBits(int num_bits) {
+    DCHECK_GT(num_bits, 0);
+    DCHECK_LE(num_bits, nbits_);
+    uint64_t bits = reg_ >> (kRegWidthInBits - num_bits);
+    reg_ = (reg_ << (num_bits - 1)) << 1;
+    nbits_ -= num_bits;
+    return bits;
+  }
 
-  // Refill the current bit register from the next bit register.
-  void RefillCurrentRegister();
+  // Load the empty bit register from |source_|. Return false at the end of
+  // the stream.
+  bool Refill() {
+    DCHECK_EQ(nbits_, 0);
+    nbits_ = source_.Fill(&reg_);
+    return nbits_ > 0;
+  }
 
-  ByteStreamProvider* const byte_stream_provider_;
+  ByteSource source_;
 
-  // Number of bits read so far.
-  int bits_read_;
+  // Size of the buffer passed to Initialize().
+  size_t initial_size_;
 
   // Number of bits in |reg_| that have not been consumed yet.
-  // Note: bits are consumed from MSB to LSB.
+  // Note: bits are consumed from MSB to LSB, and the bits after them are 0.
   int nbits_;
   uint64_t reg_;
 
-  // Number of bits in |reg_next_| that have not been consumed yet.
-  // Note: bits are consumed from MSB to LSB.
-  int nbits_next_;
-  uint64_t reg_next_;
-
+ private:
   DISALLOW_COPY_AND_ASSIGN(BitReaderCore);
 };
 
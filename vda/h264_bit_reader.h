@@ -10,17 +10,121 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
+#include "base/logging.h"
 #include "base/macros.h"
+#include "base/sys_byteorder.h"
+#include "bit_reader_core.h"
 
 namespace media {
 
+// Byte source for BitReaderCore skipping the emulation prevention bytes
+// (0x03 in 0x000003) of an H.264 NAL unit.
+//
+// An emulation prevention byte is only skipped when the byte following it is
+// loaded first in the bit register, i.e. once the reader needs bits from that
+// byte, so that the count of skipped bytes matches the read position.
+class H264ByteSource {
+ public:
+  H264ByteSource()
+      : data_(nullptr),
+        bytes_left_(0),
+        prev_two_bytes_(0),
+        emulation_prevention_bytes_(0) {}
+
+  void Initialize(const uint8_t* data, size_t size) {
+    data_ = data;
+    bytes_left_ = size;
+    // Initially set to 0xffff to accept all initial two-byte sequences.
+    prev_two_bytes_ = 0xffff;
+    emulation_prevention_bytes_ = 0;
+  }
+
+  int Fill(uint64_t* reg) {
+    if (bytes_left_ >= sizeof(*reg)) {
+      uint64_t bytes;
+      memcpy(&bytes, data_, sizeof(bytes));
+      bytes = base::NetToHost64(bytes);
+      // Any emulation prevention byte is a 0x03 byte, so take all the bytes
+      // at once if none of them is 0x03, i.e. no byte of |x| is zero. The
+      // high bit of each byte of |nonzero| is set if that byte of |x| is
+      // not zero; the sum cannot carry out of a byte, so this never wraps.
+      const uint64_t kLowBits = UINT64_C(0x7f7f7f7f7f7f7f7f);
+      const uint64_t x = bytes ^ UINT64_C(0x0303030303030303);
+      const uint64_t nonzero = ((x & kLowBits) + kLowBits) | x | kLowBits;
+      if (nonzero == ~UINT64_C(0)) {
+        *reg = bytes;
+        prev_two_bytes_ = bytes & 0xffff;
+        data_ += sizeof(bytes);
+        bytes_left_ -= sizeof(bytes);
+        return sizeof(bytes) * 8;
+      }
+    }
+
+    uint64_t value = 0;
+    int nbytes = 0;
+    while (nbytes < static_cast<int>(sizeof(*reg)) && bytes_left_ > 0) {
+      // Emulation prevention three-byte detection.
+      // If a sequence of 0x000003 is found, skip (ignore) the last byte (0x03).
+      if (*data_ == 0x03 && (prev_two_bytes_ & 0xffff) == 0) {
+        // Leave it to the next Fill() unless the next byte is needed now.
+        if (nbytes > 0)
+          break;
+        ++data_;
+        --bytes_left_;
+        ++emulation_prevention_bytes_;
+        // Need another full three bytes before we can detect the sequence
+        // again.
+        prev_two_bytes_ = 0xffff;
+        continue;
+      }
+
+      const int byte = *data_++;
+      --bytes_left_;
+      value = (value << 8) | byte;
+      prev_two_bytes_ = ((prev_two_bytes_ & 0xff) << 8) | byte;
+      ++nbytes;
+    }
+    *reg = nbytes ? value << (sizeof(*reg) - nbytes) * 8 : 0;
+    return nbytes * 8;
+  }
+
+  size_t bytes_left() const { return bytes_left_; }
+  const uint8_t* data() const { return data_; }
+
+  // Skip all the bytes not loaded yet.
+  void SkipToEnd() {
+    data_ += bytes_left_;
+    bytes_left_ = 0;
+  }
+
+  size_t emulation_prevention_bytes() const {
+    return emulation_prevention_bytes_;
+  }
+
+ private:
+  // Pointer to the next byte not loaded yet.
+  const uint8_t* data_;
+
+  // Bytes left in the stream, including emulation prevention bytes.
+  size_t bytes_left_;
+
+  // Used in emulation prevention three byte detection (see spec).
+  int prev_two_bytes_;
+
+  // Number of emulation preventation bytes (0x000003) we met.
+  size_t emulation_prevention_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(H264ByteSource);
+};
+
 // A class to provide bit-granularity reading of H.264 streams.
 // This is not a generic bit reader class, as it takes into account
 // H.264 stream-specific constraints, such as skipping emulation-prevention
 // bytes and stop bits. See spec for more details.
-class H264BitReader {
+class H264BitReader : private BitReaderCore<H264ByteSource> {
  public:
   H264BitReader();
   ~H264BitReader();
@@ -28,51 +132,33 @@ class H264BitReader {
   // Initialize the reader to start reading at |data|, |size| being size
   // of |data| in bytes.
   // Return false on insufficient size of stream..
-  // TODO(posciak,fischman): consider replacing Initialize() with
-  // heap-allocating and creating bit readers on demand instead.
   bool Initialize(const uint8_t* data, off_t size);
 
   // Read |num_bits| next bits from stream and return in |*out|, first bit
   // from the stream starting at |num_bits| position in |*out|.
-  // |num_bits| may be 1-32, inclusive.
+  // |num_bits| may be 1-31, inclusive.
   // Return false if the given number of bits cannot be read (not enough
   // bits in the stream), true otherwise.
-  bool ReadBits(int num_bits, int* out);
+  bool ReadBits(int num_bits, int* out) {
+    DCHECK_LE(num_bits, 31);
+    uint64_t temp = 0;
+    bool ret = ReadBitsInternal(num_bits, &temp);
+    *out = static_cast<int>(temp);
+    return ret;
+  }
 
   // Return the number of bits left in the stream.
-  off_t NumBitsLeft();
+  off_t NumBitsLeft() { return bits_available(); }
 
   // See the definition of more_rbsp_data() in spec.
   bool HasMoreRBSPData();
 
   // Return the number of emulation prevention bytes already read.
-  size_t NumEmulationPreventionBytesRead();
+  size_t NumEmulationPreventionBytesRead() {
+    return source_.emulation_prevention_bytes();
+  }
 
  private:
-  // Advance to the next byte, loading it into curr_byte_.
-  // Return false on end of stream.
-  bool UpdateCurrByte();
-
-  // Pointer to the next unread (not in curr_byte_) byte in the stream.
-  const uint8_t* data_;
-
-  // Bytes left in the stream (without the curr_byte_).
-  off_t bytes_left_;
-
-  // Contents of the current byte; first unread bit starting at position
-  // 8 - num_remaining_bits_in_curr_byte_ from MSB.
-  int curr_byte_;
-
-  // Number of bits remaining in curr_byte_
-  int num_remaining_bits_in_curr_byte_;
-
-  // Used in emulation prevention three byte detection (see spec).
-  // Initially set to 0xffff to accept all initial two-byte sequences.
-  int prev_two_bytes_;
-
-  // Number of emulation preventation bytes (0x000003) we met.
-  size_t emulation_prevention_bytes_;
-
   DISALLOW_COPY_AND_ASSIGN(H264BitReader);
 };
 
@@ -27,6 +27,12 @@ H264Decoder::H264Decoder(H264Accelerator* accelerator)
       max_pic_num_(0),
       max_long_term_frame_idx_(0),
       max_num_reorder_frames_(0),
+      max_macroblock_rate_(0),
+      min_compression_ratio_(kDefaultMinCompressionRatio),
+      skip_non_reference_frames_(false),
+      keyframes_only_(false),
+      skipping_curr_pic_(false),
+      num_skipped_frames_(0),
       accelerator_(accelerator) {
   DCHECK(accelerator_);
   Reset();
@@ -38,6 +44,9 @@ void H264Decoder::Reset() {
   curr_pic_ = nullptr;
   curr_nalu_ = nullptr;
   curr_slice_hdr_ = nullptr;
+  skipping_curr_pic_ = false;
+  recovery_frame_cnt_ = -1;
+  recovery_frame_num_ = -1;
   curr_sps_id_ = -1;
   curr_pps_id_ = -1;
 
@@ -55,6 +64,10 @@ void H264Decoder::Reset() {
   ref_pic_list_p0_.clear();
   ref_pic_list_b0_.clear();
   ref_pic_list_b1_.clear();
+  ref_pic_list0_.clear();
+  ref_pic_list1_.clear();
+  ClearAcceleratorRefPicLists();
+  not_outputted_.clear();
   dpb_.Clear();
   parser_.Reset();
   accelerator_->Reset();
@@ -65,14 +78,19 @@ void H264Decoder::Reset() {
     state_ = kAfterReset;
 }
 
+void H264Decoder::ClearAcceleratorRefPicLists() {
+  for (auto& list : accelerator_ref_pic_lists_)
+    list.clear();
+}
+
 void H264Decoder::PrepareRefPicLists(const H264SliceHeader* slice_hdr) {
   ConstructReferencePicListsP(slice_hdr);
   ConstructReferencePicListsB(slice_hdr);
 }
 
 bool H264Decoder::ModifyReferencePicLists(const H264SliceHeader* slice_hdr,
-                                          H264Picture::Vector* ref_pic_list0,
-                                          H264Picture::Vector* ref_pic_list1) {
+                                          H264DPB::SlotList* ref_pic_list0,
+                                          H264DPB::SlotList* ref_pic_list1) {
   ref_pic_list0->clear();
   ref_pic_list1->clear();
 
@@ -376,20 +394,50 @@ void H264Decoder::UpdatePicNums(int frame_num) {
   }
 }
 
+// Picture comparators, usable both on picture pointers and, wrapped in
+// SlotCompare, on DPB slots.
 struct PicNumDescCompare {
-  bool operator()(const scoped_refptr<H264Picture>& a,
-                  const scoped_refptr<H264Picture>& b) const {
+  template <typename PicPtr>
+  bool operator()(const PicPtr& a, const PicPtr& b) const {
     return a->pic_num > b->pic_num;
   }
 };
 
 struct LongTermPicNumAscCompare {
-  bool operator()(const scoped_refptr<H264Picture>& a,
-                  const scoped_refptr<H264Picture>& b) const {
+  template <typename PicPtr>
+  bool operator()(const PicPtr& a, const PicPtr& b) const {
     return a->long_term_pic_num < b->long_term_pic_num;
   }
 };
 
+struct POCAscCompare {
+  template <typename PicPtr>
+  bool operator()(const PicPtr& a, const PicPtr& b) const {
+    return a->pic_order_cnt < b->pic_order_cnt;
+  }
+};
+
+struct POCDescCompare {
+  template <typename PicPtr>
+  bool operator()(const PicPtr& a, const PicPtr& b) const {
+    return a->pic_order_cnt > b->pic_order_cnt;
+  }
+};
+
+// Compares DPB slots by comparing the pictures stored in them.
+template <typename PicCompare>
+class SlotCompare {
+ public:
+  explicit SlotCompare(const H264DPB& dpb) : dpb_(dpb) {}
+
+  bool operator()(int a, int b) const {
+    return PicCompare()(dpb_.GetPicBySlot(a), dpb_.GetPicBySlot(b));
+  }
+
+ private:
+  const H264DPB& dpb_;
+};
+
 void H264Decoder::ConstructReferencePicListsP(
     const H264SliceHeader* slice_hdr) {
   // RefPicList0 (8.2.4.2.1) [[1] [2]], where:
@@ -398,82 +446,75 @@ void H264Decoder::ConstructReferencePicListsP(
   ref_pic_list_p0_.clear();
 
   // First get the short ref pics...
-  dpb_.GetShortTermRefPicsAppending(&ref_pic_list_p0_);
+  dpb_.GetShortTermRefSlotsAppending(&ref_pic_list_p0_);
   size_t num_short_refs = ref_pic_list_p0_.size();
 
   // and sort them to get [1].
   std::sort(ref_pic_list_p0_.begin(), ref_pic_list_p0_.end(),
-            PicNumDescCompare());
+            SlotCompare<PicNumDescCompare>(dpb_));
 
   // Now get long term pics and sort them by long_term_pic_num to get [2].
-  dpb_.GetLongTermRefPicsAppending(&ref_pic_list_p0_);
+  dpb_.GetLongTermRefSlotsAppending(&ref_pic_list_p0_);
   std::sort(ref_pic_list_p0_.begin() + num_short_refs, ref_pic_list_p0_.end(),
-            LongTermPicNumAscCompare());
+            SlotCompare<LongTermPicNumAscCompare>(dpb_));
 }
 
-struct POCAscCompare {
-  bool operator()(const scoped_refptr<H264Picture>& a,
-                  const scoped_refptr<H264Picture>& b) const {
-    return a->pic_order_cnt < b->pic_order_cnt;
-  }
-};
-
-struct POCDescCompare {
-  bool operator()(const scoped_refptr<H264Picture>& a,
-                  const scoped_refptr<H264Picture>& b) const {
-    return a->pic_order_cnt > b->pic_order_cnt;
-  }
-};
-
 void H264Decoder::ConstructReferencePicListsB(
     const H264SliceHeader* slice_hdr) {
+  const int curr_poc = curr_pic_->pic_order_cnt;
+
   // RefPicList0 (8.2.4.2.3) [[1] [2] [3]], where:
   // [1] shortterm ref pics with POC < curr_pic's POC sorted by descending POC,
   // [2] shortterm ref pics with POC > curr_pic's POC by ascending POC,
   // [3] longterm ref pics by ascending long_term_pic_num.
   ref_pic_list_b0_.clear();
   ref_pic_list_b1_.clear();
-  dpb_.GetShortTermRefPicsAppending(&ref_pic_list_b0_);
+  dpb_.GetShortTermRefSlotsAppending(&ref_pic_list_b0_);
   size_t num_short_refs = ref_pic_list_b0_.size();
 
   // First sort ascending, this will put [1] in right place and finish [2].
-  std::sort(ref_pic_list_b0_.begin(), ref_pic_list_b0_.end(), POCAscCompare());
+  std::sort(ref_pic_list_b0_.begin(), ref_pic_list_b0_.end(),
+            SlotCompare<POCAscCompare>(dpb_));
 
   // Find first with POC > curr_pic's POC to get first element in [2]...
-  H264Picture::Vector::iterator iter;
-  iter = std::upper_bound(ref_pic_list_b0_.begin(), ref_pic_list_b0_.end(),
-                          curr_pic_.get(), POCAscCompare());
+  int* iter = ref_pic_list_b0_.begin();
+  while (iter != ref_pic_list_b0_.end() &&
+         dpb_.GetPicBySlot(*iter)->pic_order_cnt <= curr_poc)
+    ++iter;
 
   // and sort [1] descending, thus finishing sequence [1] [2].
-  std::sort(ref_pic_list_b0_.begin(), iter, POCDescCompare());
+  std::sort(ref_pic_list_b0_.begin(), iter, SlotCompare<POCDescCompare>(dpb_));
 
   // Now add [3] and sort by ascending long_term_pic_num.
-  dpb_.GetLongTermRefPicsAppending(&ref_pic_list_b0_);
+  dpb_.GetLongTermRefSlotsAppending(&ref_pic_list_b0_);
   std::sort(ref_pic_list_b0_.begin() + num_short_refs, ref_pic_list_b0_.end(),
-            LongTermPicNumAscCompare());
+            SlotCompare<LongTermPicNumAscCompare>(dpb_));
 
   // RefPicList1 (8.2.4.2.4) [[1] [2] [3]], where:
   // [1] shortterm ref pics with POC > curr_pic's POC sorted by ascending POC,
   // [2] shortterm ref pics with POC < curr_pic's POC by descending POC,
   // [3] longterm ref pics by ascending long_term_pic_num.
 
-  dpb_.GetShortTermRefPicsAppending(&ref_pic_list_b1_);
+  dpb_.GetShortTermRefSlotsAppending(&ref_pic_list_b1_);
   num_short_refs = ref_pic_list_b1_.size();
 
   // First sort by descending POC.
-  std::sort(ref_pic_list_b1_.begin(), ref_pic_list_b1_.end(), POCDescCompare());
+  std::sort(ref_pic_list_b1_.begin(), ref_pic_list_b1_.end(),
+            SlotCompare<POCDescCompare>(dpb_));
 
   // Find first with POC < curr_pic's POC to get first element in [2]...
-  iter = std::upper_bound(ref_pic_list_b1_.begin(), ref_pic_list_b1_.end(),
-                          curr_pic_.get(), POCDescCompare());
+  iter = ref_pic_list_b1_.begin();
+  while (iter != ref_pic_list_b1_.end() &&
+         dpb_.GetPicBySlot(*iter)->pic_order_cnt >= curr_poc)
+    ++iter;
 
   // and sort [1] ascending.
-  std::sort(ref_pic_list_b1_.begin(), iter, POCAscCompare());
+  std::sort(ref_pic_list_b1_.begin(), iter, SlotCompare<POCAscCompare>(dpb_));
 
   // Now add [3] and sort by ascending long_term_pic_num
-  dpb_.GetShortTermRefPicsAppending(&ref_pic_list_b1_);
+  dpb_.GetLongTermRefSlotsAppending(&ref_pic_list_b1_);
   std::sort(ref_pic_list_b1_.begin() + num_short_refs, ref_pic_list_b1_.end(),
-            LongTermPicNumAscCompare());
+            SlotCompare<LongTermPicNumAscCompare>(dpb_));
 
   // If lists identical, swap first two entries in RefPicList1 (spec 8.2.4.2.3)
   if (ref_pic_list_b1_.size() > 1 &&
@@ -483,7 +524,7 @@ void H264Decoder::ConstructReferencePicListsB(
 }
 
 // See 8.2.4
-int H264Decoder::PicNumF(const scoped_refptr<H264Picture>& pic) {
+int H264Decoder::PicNumF(const H264Picture* pic) {
   if (!pic)
     return -1;
 
@@ -494,8 +535,8 @@ int H264Decoder::PicNumF(const scoped_refptr<H264Picture>& pic) {
 }
 
 // See 8.2.4
-int H264Decoder::LongTermPicNumF(const scoped_refptr<H264Picture>& pic) {
-  if (pic->ref && pic->long_term)
+int H264Decoder::LongTermPicNumF(const H264Picture* pic) {
+  if (pic && pic->ref && pic->long_term)
     return pic->long_term_pic_num;
   else
     return 2 * (max_long_term_frame_idx_ + 1);
@@ -503,16 +544,16 @@ int H264Decoder::LongTermPicNumF(const scoped_refptr<H264Picture>& pic) {
 
 // Shift elements on the |v| starting from |from| to |to|, inclusive,
 // one position to the right and insert pic at |from|.
-static void ShiftRightAndInsert(H264Picture::Vector* v,
+static void ShiftRightAndInsert(H264DPB::SlotList* v,
                                 int from,
                                 int to,
-                                const scoped_refptr<H264Picture>& pic) {
+                                int slot) {
   // Security checks, do not disable in Debug mode.
   CHECK(from <= to);
   CHECK(to <= std::numeric_limits<int>::max() - 2);
   // Additional checks. Debug mode ok.
   DCHECK(v);
-  DCHECK(pic);
+  DCHECK_NE(slot, H264DPB::kNoSlot);
   DCHECK((to + 1 == static_cast<int>(v->size())) ||
          (to + 2 == static_cast<int>(v->size())));
 
@@ -521,12 +562,12 @@ static void ShiftRightAndInsert(H264Picture::Vector* v,
   for (int i = to + 1; i > from; --i)
     (*v)[i] = (*v)[i - 1];
 
-  (*v)[from] = pic;
+  (*v)[from] = slot;
 }
 
 bool H264Decoder::ModifyReferencePicList(const H264SliceHeader* slice_hdr,
                                          int list,
-                                         H264Picture::Vector* ref_pic_listx) {
+                                         H264DPB::SlotList* ref_pic_listx) {
   bool ref_pic_list_modification_flag_lX;
   int num_ref_idx_lX_active_minus1;
   const H264ModificationOfPicNum* list_mod;
@@ -563,7 +604,7 @@ bool H264Decoder::ModifyReferencePicList(const H264SliceHeader* slice_hdr,
   int pic_num_lx_no_wrap;
   int pic_num_lx;
   bool done = false;
-  scoped_refptr<H264Picture> pic;
+  int slot;
   for (int i = 0; i < H264SliceHeader::kRefListModSize && !done; ++i) {
     switch (list_mod->modification_of_pic_nums_idc) {
       case 0:
@@ -599,18 +640,22 @@ bool H264Decoder::ModifyReferencePicList(const H264SliceHeader* slice_hdr,
 
         DCHECK_LT(num_ref_idx_lX_active_minus1 + 1,
                   H264SliceHeader::kRefListModSize);
-        pic = dpb_.GetShortRefPicByPicNum(pic_num_lx);
-        if (!pic) {
+        slot = dpb_.GetShortRefSlotByPicNum(pic_num_lx);
+        if (slot == H264DPB::kNoSlot) {
+          // References from before a recovery point are missing until the
+          // recovery frame, keep the initial order for them.
+          if (recovery_frame_num_ >= 0)
+            break;
           DVLOG(1) << "Malformed stream, no pic num " << pic_num_lx;
           return false;
         }
         ShiftRightAndInsert(ref_pic_listx, ref_idx_lx,
-                            num_ref_idx_lX_active_minus1, pic);
+                            num_ref_idx_lX_active_minus1, slot);
         ref_idx_lx++;
 
         for (int src = ref_idx_lx, dst = ref_idx_lx;
              src <= num_ref_idx_lX_active_minus1 + 1; ++src) {
-          if (PicNumF((*ref_pic_listx)[src]) != pic_num_lx)
+          if (PicNumF(dpb_.GetPicBySlot((*ref_pic_listx)[src])) != pic_num_lx)
             (*ref_pic_listx)[dst++] = (*ref_pic_listx)[src];
         }
         break;
@@ -619,19 +664,22 @@ bool H264Decoder::ModifyReferencePicList(const H264SliceHeader* slice_hdr,
         // Modify long term reference picture position.
         DCHECK_LT(num_ref_idx_lX_active_minus1 + 1,
                   H264SliceHeader::kRefListModSize);
-        pic = dpb_.GetLongRefPicByLongTermPicNum(list_mod->long_term_pic_num);
-        if (!pic) {
+        slot =
+            dpb_.GetLongRefSlotByLongTermPicNum(list_mod->long_term_pic_num);
+        if (slot == H264DPB::kNoSlot) {
+          if (recovery_frame_num_ >= 0)
+            break;
           DVLOG(1) << "Malformed stream, no pic num "
                    << list_mod->long_term_pic_num;
           return false;
         }
         ShiftRightAndInsert(ref_pic_listx, ref_idx_lx,
-                            num_ref_idx_lX_active_minus1, pic);
+                            num_ref_idx_lX_active_minus1, slot);
         ref_idx_lx++;
 
         for (int src = ref_idx_lx, dst = ref_idx_lx;
              src <= num_ref_idx_lX_active_minus1 + 1; ++src) {
-          if (LongTermPicNumF((*ref_pic_listx)[src]) !=
+          if (LongTermPicNumF(dpb_.GetPicBySlot((*ref_pic_listx)[src])) !=
               static_cast<int>(list_mod->long_term_pic_num))
             (*ref_pic_listx)[dst++] = (*ref_pic_listx)[src];
         }
@@ -663,7 +711,7 @@ bool H264Decoder::ModifyReferencePicList(const H264SliceHeader* slice_hdr,
 
 void H264Decoder::OutputPic(scoped_refptr<H264Picture> pic) {
   DCHECK(!pic->outputted);
-  pic->outputted = true;
+  dpb_.MarkOutputted(pic);
 
   if (pic->nonexisting) {
     DVLOG(4) << "Skipping output, non-existing frame_num: " << pic->frame_num;
@@ -688,13 +736,13 @@ void H264Decoder::ClearDPB() {
 bool H264Decoder::OutputAllRemainingPics() {
   // Output all pictures that are waiting to be outputted.
   FinishPrevFrameIfPresent();
-  H264Picture::Vector to_output;
-  dpb_.GetNotOutputtedPicsAppending(&to_output);
+  dpb_.GetNotOutputtedPicsAppending(&not_outputted_);
   // Sort them by ascending POC to output in order.
-  std::sort(to_output.begin(), to_output.end(), POCAscCompare());
+  std::sort(not_outputted_.begin(), not_outputted_.end(), POCAscCompare());
 
-  for (auto& pic : to_output)
+  for (auto& pic : not_outputted_)
     OutputPic(pic);
+  not_outputted_.clear();
 
   return true;
 }
@@ -727,8 +775,10 @@ bool H264Decoder::StartNewFrame(const H264SliceHeader* slice_hdr) {
 
   max_frame_num_ = 1 << (sps->log2_max_frame_num_minus4 + 4);
   int frame_num = slice_hdr->frame_num;
-  if (slice_hdr->idr_pic_flag)
+  if (slice_hdr->idr_pic_flag) {
     prev_ref_frame_num_ = 0;
+    recovery_frame_num_ = -1;
+  }
 
   // 7.4.3
   if (frame_num != prev_ref_frame_num_ &&
@@ -743,12 +793,16 @@ bool H264Decoder::StartNewFrame(const H264SliceHeader* slice_hdr) {
   UpdatePicNums(frame_num);
   PrepareRefPicLists(slice_hdr);
 
-  if (!accelerator_->SubmitFrameMetadata(sps, pps, dpb_, ref_pic_list_p0_,
-                                         ref_pic_list_b0_, ref_pic_list_b1_,
-                                         curr_pic_.get()))
-    return false;
-
-  return true;
+  // Pictures are referenced from the lists only while the accelerator uses
+  // them.
+  dpb_.GetPicsBySlots(ref_pic_list_p0_, &accelerator_ref_pic_lists_[0]);
+  dpb_.GetPicsBySlots(ref_pic_list_b0_, &accelerator_ref_pic_lists_[1]);
+  dpb_.GetPicsBySlots(ref_pic_list_b1_, &accelerator_ref_pic_lists_[2]);
+  bool submitted = accelerator_->SubmitFrameMetadata(
+      sps, pps, dpb_, accelerator_ref_pic_lists_[0],
+      accelerator_ref_pic_lists_[1], accelerator_ref_pic_lists_[2], curr_pic_);
+  ClearAcceleratorRefPicLists();
+  return submitted;
 }
 
 bool H264Decoder::HandleMemoryManagementOps(scoped_refptr<H264Picture> pic) {
@@ -771,8 +825,8 @@ bool H264Decoder::HandleMemoryManagementOps(scoped_refptr<H264Picture> pic) {
             pic->pic_num - (ref_pic_marking->difference_of_pic_nums_minus1 + 1);
         to_mark = dpb_.GetShortRefPicByPicNum(pic_num_x);
         if (to_mark) {
-          to_mark->ref = false;
-        } else {
+          dpb_.MarkUnusedForRef(to_mark);
+        } else if (recovery_frame_num_ < 0) {
           DVLOG(1) << "Invalid short ref pic num to unmark";
           return false;
         }
@@ -784,8 +838,8 @@ bool H264Decoder::HandleMemoryManagementOps(scoped_refptr<H264Picture> pic) {
         to_mark = dpb_.GetLongRefPicByLongTermPicNum(
             ref_pic_marking->long_term_pic_num);
         if (to_mark) {
-          to_mark->ref = false;
-        } else {
+          dpb_.MarkUnusedForRef(to_mark);
+        } else if (recovery_frame_num_ < 0) {
           DVLOG(1) << "Invalid long term ref pic num to unmark";
           return false;
         }
@@ -797,9 +851,7 @@ bool H264Decoder::HandleMemoryManagementOps(scoped_refptr<H264Picture> pic) {
             pic->pic_num - (ref_pic_marking->difference_of_pic_nums_minus1 + 1);
         to_mark = dpb_.GetShortRefPicByPicNum(pic_num_x);
         if (to_mark) {
-          DCHECK(to_mark->ref && !to_mark->long_term);
-          to_mark->long_term = true;
-          to_mark->long_term_frame_idx = ref_pic_marking->long_term_frame_idx;
+          dpb_.MarkLongTermRef(to_mark, ref_pic_marking->long_term_frame_idx);
         } else {
           DVLOG(1) << "Invalid short term ref pic num to mark as long ref";
           return false;
@@ -810,15 +862,15 @@ bool H264Decoder::HandleMemoryManagementOps(scoped_refptr<H264Picture> pic) {
         // Unmark all reference pictures with long_term_frame_idx over new max.
         max_long_term_frame_idx_ =
             ref_pic_marking->max_long_term_frame_idx_plus1 - 1;
-        H264Picture::Vector long_terms;
-        dpb_.GetLongTermRefPicsAppending(&long_terms);
-        for (size_t i = 0; i < long_terms.size(); ++i) {
-          scoped_refptr<H264Picture>& long_term_pic = long_terms[i];
+        H264DPB::SlotList long_terms;
+        dpb_.GetLongTermRefSlotsAppending(&long_terms);
+        for (int slot : long_terms) {
+          H264Picture* long_term_pic = dpb_.GetPicBySlot(slot);
           DCHECK(long_term_pic->ref && long_term_pic->long_term);
           // Ok to cast, max_long_term_frame_idx is much smaller than 16bit.
           if (long_term_pic->long_term_frame_idx >
               static_cast<int>(max_long_term_frame_idx_))
-            long_term_pic->ref = false;
+            dpb_.MarkUnusedForRef(long_term_pic);
         }
         break;
       }
@@ -833,15 +885,15 @@ bool H264Decoder::HandleMemoryManagementOps(scoped_refptr<H264Picture> pic) {
       case 6: {
         // Replace long term reference pictures with current picture.
         // First unmark if any existing with this long_term_frame_idx...
-        H264Picture::Vector long_terms;
-        dpb_.GetLongTermRefPicsAppending(&long_terms);
-        for (size_t i = 0; i < long_terms.size(); ++i) {
-          scoped_refptr<H264Picture>& long_term_pic = long_terms[i];
+        H264DPB::SlotList long_terms;
+        dpb_.GetLongTermRefSlotsAppending(&long_terms);
+        for (int slot : long_terms) {
+          H264Picture* long_term_pic = dpb_.GetPicBySlot(slot);
           DCHECK(long_term_pic->ref && long_term_pic->long_term);
           // Ok to cast, long_term_frame_idx is much smaller than 16bit.
           if (long_term_pic->long_term_frame_idx ==
               static_cast<int>(ref_pic_marking->long_term_frame_idx))
-            long_term_pic->ref = false;
+            dpb_.MarkUnusedForRef(long_term_pic);
         }
 
         // and mark the current one instead.
@@ -912,7 +964,7 @@ bool H264Decoder::SlidingWindowPictureMarking() {
       return false;
     }
 
-    to_unmark->ref = false;
+    dpb_.MarkUnusedForRef(to_unmark);
   }
 
   return true;
@@ -930,6 +982,9 @@ bool H264Decoder::FinishPicture(scoped_refptr<H264Picture> pic) {
     prev_ref_field_ = pic->field;
     prev_ref_frame_num_ = pic->frame_num;
   }
+  // The pictures from the recovery frame on only refer to each other.
+  if (pic->frame_num == recovery_frame_num_)
+    recovery_frame_num_ = -1;
   prev_frame_num_ = pic->frame_num;
   prev_has_memmgmnt5_ = pic->mem_mgmt_5;
   prev_frame_num_offset_ = pic->frame_num_offset;
@@ -947,21 +1002,20 @@ bool H264Decoder::FinishPicture(scoped_refptr<H264Picture> pic) {
   // future reference.
 
   // Get all pictures that haven't been outputted yet.
-  H264Picture::Vector not_outputted;
-  dpb_.GetNotOutputtedPicsAppending(&not_outputted);
+  dpb_.GetNotOutputtedPicsAppending(&not_outputted_);
   // Include the one we've just decoded.
-  not_outputted.push_back(pic);
+  not_outputted_.push_back(pic);
 
   // Sort in output order.
-  std::sort(not_outputted.begin(), not_outputted.end(), POCAscCompare());
+  std::sort(not_outputted_.begin(), not_outputted_.end(), POCAscCompare());
 
   // Try to output as many pictures as we can. A picture can be output,
   // if the number of decoded and not yet outputted pictures that would remain
   // in DPB afterwards would at least be equal to max_num_reorder_frames.
   // If the outputted picture is not a reference picture, it doesn't have
   // to remain in the DPB and can be removed.
-  H264Picture::Vector::iterator output_candidate = not_outputted.begin();
-  size_t num_remaining = not_outputted.size();
+  H264Picture::Vector::iterator output_candidate = not_outputted_.begin();
+  size_t num_remaining = not_outputted_.size();
   while (num_remaining > max_num_reorder_frames_ ||
          // If the condition below is used, this is an invalid stream. We should
          // not be forced to output beyond max_num_reorder_frames in order to
@@ -986,6 +1040,7 @@ bool H264Decoder::FinishPicture(scoped_refptr<H264Picture> pic) {
     ++output_candidate;
     --num_remaining;
   }
+  not_outputted_.clear();
 
   // If we haven't managed to output the picture that we just decoded, or if
   // it's a reference picture, we have to store it in DPB.
@@ -1039,7 +1094,64 @@ static int LevelToMaxDpbMbs(int level) {
   }
 }
 
+static int LevelToMaxMBPS(int level) {
+  // See table A-1 in spec.
+  switch (level) {
+    case 10:
+      return 1485;
+    case 11:
+      return 3000;
+    case 12:
+      return 6000;
+    case 13:  //  fallthrough
+    case 20:
+      return 11880;
+    case 21:
+      return 19800;
+    case 22:
+      return 20250;
+    case 30:
+      return 40500;
+    case 31:
+      return 108000;
+    case 32:
+      return 216000;
+    case 40:  //  fallthrough
+    case 41:
+      return 245760;
+    case 42:
+      return 522240;
+    case 50:
+      return 589824;
+    case 51:
+      return 983040;
+    case 52:
+      return 2073600;
+    default:
+      return 0;
+  }
+}
+
+static int LevelToMinCR(int level) {
+  // See table A-1 in spec.
+  switch (level) {
+    case 31:  //  fallthrough
+    case 32:  //  fallthrough
+    case 40:
+      return 4;
+    default:
+      return 2;
+  }
+}
+
 bool H264Decoder::UpdateMaxNumReorderFrames(const H264SPS* sps) {
+  // IDR pictures are outputted in decoding order, so there is nothing to
+  // reorder in keyframe-only mode.
+  if (keyframes_only_) {
+    max_num_reorder_frames_ = 0;
+    return true;
+  }
+
   if (sps->vui_parameters_present_flag && sps->bitstream_restriction_flag) {
     max_num_reorder_frames_ =
         base::checked_cast<size_t>(sps->max_num_reorder_frames);
@@ -1109,6 +1221,8 @@ bool H264Decoder::ProcessSPS(int sps_id, bool* need_new_buffers) {
   int max_dpb_mbs = LevelToMaxDpbMbs(level);
   if (max_dpb_mbs == 0)
     return false;
+  max_macroblock_rate_ = LevelToMaxMBPS(level);
+  min_compression_ratio_ = LevelToMinCR(level);
 
   // MaxDpbFrames from level limits per spec.
   size_t max_dpb_frames = std::min(max_dpb_mbs / (width_mb * height_mb),
@@ -1243,7 +1357,7 @@ bool H264Decoder::IsNewPrimaryCodedPicture(
 }
 
 bool H264Decoder::PreprocessCurrentSlice() {
-  const H264SliceHeader* slice_hdr = curr_slice_hdr_.get();
+  const H264SliceHeader* slice_hdr = curr_slice_hdr_;
   DCHECK(slice_hdr);
 
   if (IsNewPrimaryCodedPicture(slice_hdr)) {
@@ -1275,10 +1389,84 @@ bool H264Decoder::PreprocessCurrentSlice() {
   return true;
 }
 
+bool H264Decoder::ShouldSkipCurrentSlice(bool* skip) {
+  const H264SliceHeader* slice_hdr = curr_slice_hdr_;
+  DCHECK(slice_hdr);
+  *skip = false;
+
+  // In keyframe-only mode, reference pictures other than IDR are dropped too.
+  const bool droppable = keyframes_only_ ? !slice_hdr->idr_pic_flag
+                                         : slice_hdr->nal_ref_idc == 0;
+  if (!droppable) {
+    skipping_curr_pic_ = false;
+    return true;
+  }
+
+  // Pictures start with their first macroblock (see PreprocessCurrentSlice()),
+  // so any other slice of a droppable picture continues the current one.
+  if (slice_hdr->first_mb_in_slice != 0) {
+    *skip = skipping_curr_pic_;
+    return true;
+  }
+
+  skipping_curr_pic_ = false;
+  if ((!keyframes_only_ && !skip_non_reference_frames_) ||
+      !IsNewPrimaryCodedPicture(slice_hdr))
+    return true;
+
+  // No decoded picture will refer to this one, so none of the decoder state
+  // depends on it. In keyframe-only mode, the next decoded picture is an IDR
+  // one, which resets the reference marking, the POC and the frame_num state.
+  // Otherwise, the reference marking and the POC state only track reference
+  // pictures, and frame_num of a non-reference picture is the one of the next
+  // reference picture. Decode the previous picture now, instead of waiting for
+  // the next one that is not skipped.
+  if (!FinishPrevFrameIfPresent())
+    return false;
+
+  DVLOG(4) << "Skipping " << (keyframes_only_ ? "non-IDR" : "non-reference")
+           << " picture, frame_num: " << slice_hdr->frame_num;
+  skipping_curr_pic_ = true;
+  num_skipped_frames_++;
+  *skip = true;
+  return true;
+}
+
+void H264Decoder::StartFromRecoveryPoint() {
+  const H264SliceHeader* slice_hdr = curr_slice_hdr_;
+  DCHECK(slice_hdr);
+  DCHECK_GE(recovery_frame_cnt_, 0);
+
+  const H264PPS* pps = parser_.GetPPS(slice_hdr->pic_parameter_set_id);
+  if (!pps)
+    return;  // StartNewFrame() fails as well.
+  const H264SPS* sps = parser_.GetSPS(pps->seq_parameter_set_id);
+  if (!sps)
+    return;
+
+  // Pictures are decoded and outputted from here on, but their content is
+  // only correct from the recovery frame on (see spec D.2.7).
+  const int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+  recovery_frame_num_ =
+      (slice_hdr->frame_num + recovery_frame_cnt_) % max_frame_num;
+  DVLOG(1) << "Resuming at recovery point, frame_num: " << slice_hdr->frame_num
+           << ", recovery frame_num: " << recovery_frame_num_;
+
+  // There is no frame_num gap before this picture, and its POC is computed
+  // from 0, as after memory_management_control_operation 5 (see 8.2.1).
+  prev_ref_frame_num_ = slice_hdr->frame_num;
+  prev_frame_num_ = 0;
+  prev_frame_num_offset_ = 0;
+  prev_has_memmgmnt5_ = true;
+  prev_ref_has_memmgmnt5_ = true;
+  prev_ref_top_field_order_cnt_ = 0;
+  prev_ref_field_ = H264Picture::FIELD_NONE;
+}
+
 bool H264Decoder::ProcessCurrentSlice() {
   DCHECK(curr_pic_);
 
-  const H264SliceHeader* slice_hdr = curr_slice_hdr_.get();
+  const H264SliceHeader* slice_hdr = curr_slice_hdr_;
   DCHECK(slice_hdr);
 
   if (slice_hdr->field_pic_flag == 0)
@@ -1286,20 +1474,21 @@ bool H264Decoder::ProcessCurrentSlice() {
   else
     max_pic_num_ = 2 * max_frame_num_;
 
-  H264Picture::Vector ref_pic_list0, ref_pic_list1;
-  if (!ModifyReferencePicLists(slice_hdr, &ref_pic_list0, &ref_pic_list1))
+  if (!ModifyReferencePicLists(slice_hdr, &ref_pic_list0_, &ref_pic_list1_))
     return false;
 
   const H264PPS* pps = parser_.GetPPS(curr_pps_id_);
   if (!pps)
     return false;
 
-  if (!accelerator_->SubmitSlice(pps, slice_hdr, ref_pic_list0, ref_pic_list1,
-                                 curr_pic_.get(), slice_hdr->nalu_data,
-                                 slice_hdr->nalu_size))
-    return false;
-
-  return true;
+  dpb_.GetPicsBySlots(ref_pic_list0_, &accelerator_ref_pic_lists_[0]);
+  dpb_.GetPicsBySlots(ref_pic_list1_, &accelerator_ref_pic_lists_[1]);
+  bool submitted = accelerator_->SubmitSlice(
+      pps, slice_hdr, accelerator_ref_pic_lists_[0],
+      accelerator_ref_pic_lists_[1], curr_pic_, slice_hdr->nalu_data,
+      slice_hdr->nalu_size);
+  ClearAcceleratorRefPicLists();
+  return submitted;
 }
 
 #define SET_ERROR_AND_RETURN()         \
@@ -1327,21 +1516,29 @@ H264Decoder::DecodeResult H264Decoder::Decode() {
     H264Parser::Result par_res;
 
     if (!curr_nalu_) {
-      curr_nalu_.reset(new H264NALU());
-      par_res = parser_.AdvanceToNextNALU(curr_nalu_.get());
+      par_res = parser_.AdvanceToNextNALU(&nalu_);
       if (par_res == H264Parser::kEOStream)
         return kRanOutOfStreamData;
       else if (par_res != H264Parser::kOk)
         SET_ERROR_AND_RETURN();
 
+      curr_nalu_ = &nalu_;
+
       DVLOG(4) << "New NALU: " << static_cast<int>(curr_nalu_->nal_unit_type);
     }
 
     switch (curr_nalu_->nal_unit_type) {
       case H264NALU::kNonIDRSlice:
-        // We can't resume from a non-IDR slice.
-        if (state_ != kDecoding)
+        // We can't resume from a non-IDR slice, unless it follows a recovery
+        // point.
+        if (state_ != kDecoding &&
+            (state_ != kAfterReset || recovery_frame_cnt_ < 0)) {
+          // The first bit of a slice is the one of first_mb_in_slice, which
+          // is set if it is 0, i.e. if the slice starts a picture.
+          if (curr_nalu_->size > 1 && (curr_nalu_->data[1] & 0x80))
+            num_skipped_frames_++;
           break;
+        }
 
         // else fallthrough
       case H264NALU::kIDRSlice: {
@@ -1353,16 +1550,29 @@ H264Decoder::DecodeResult H264Decoder::Decode() {
           break;
         }
 
-        // If after reset, we should be able to recover from an IDR.
+        // If after reset, we should be able to recover from an IDR, or from
+        // a recovery point.
+        const bool after_reset = state_ == kAfterReset;
         state_ = kDecoding;
 
         if (!curr_slice_hdr_) {
-          curr_slice_hdr_.reset(new H264SliceHeader());
-          par_res =
-              parser_.ParseSliceHeader(*curr_nalu_, curr_slice_hdr_.get());
+          par_res = parser_.ParseSliceHeader(*curr_nalu_, &slice_hdr_);
           if (par_res != H264Parser::kOk)
             SET_ERROR_AND_RETURN();
 
+          curr_slice_hdr_ = &slice_hdr_;
+          if (after_reset && !slice_hdr_.idr_pic_flag)
+            StartFromRecoveryPoint();
+          recovery_frame_cnt_ = -1;
+
+          bool skip;
+          if (!ShouldSkipCurrentSlice(&skip))
+            SET_ERROR_AND_RETURN();
+          if (skip) {
+            curr_slice_hdr_ = nullptr;
+            break;
+          }
+
           if (!PreprocessCurrentSlice())
             SET_ERROR_AND_RETURN();
         }
@@ -1374,14 +1584,14 @@ H264Decoder::DecodeResult H264Decoder::Decode() {
           if (!curr_pic_)
             return kRanOutOfSurfaces;
 
-          if (!StartNewFrame(curr_slice_hdr_.get()))
+          if (!StartNewFrame(curr_slice_hdr_))
             SET_ERROR_AND_RETURN();
         }
 
         if (!ProcessCurrentSlice())
           SET_ERROR_AND_RETURN();
 
-        curr_slice_hdr_.reset();
+        curr_slice_hdr_ = nullptr;
         break;
       }
 
@@ -1427,6 +1637,25 @@ H264Decoder::DecodeResult H264Decoder::Decode() {
         break;
       }
 
+      case H264NALU::kSEIMessage: {
+        // Only the recovery points matter, to resume after a reset. They are
+        // of no use for IDR-only decoding.
+        if (state_ != kAfterReset || keyframes_only_)
+          break;
+
+        H264SEIMessage sei_msg;
+        if (parser_.ParseSEI(&sei_msg) != H264Parser::kOk) {
+          DVLOG(1) << "Ignoring malformed SEI message";
+          break;
+        }
+        if (sei_msg.type == H264SEIMessage::kSEIRecoveryPoint) {
+          DVLOG(2) << "Found recovery point, recovery_frame_cnt: "
+                   << sei_msg.recovery_point.recovery_frame_cnt;
+          recovery_frame_cnt_ = sei_msg.recovery_point.recovery_frame_cnt;
+        }
+        break;
+      }
+
       case H264NALU::kAUD:
       case H264NALU::kEOSeq:
       case H264NALU::kEOStream:
@@ -1444,7 +1673,7 @@ H264Decoder::DecodeResult H264Decoder::Decode() {
     }
 
     DVLOG(4) << "NALU done";
-    curr_nalu_.reset();
+    curr_nalu_ = nullptr;
   }
 }
 
@@ -1453,7 +1682,47 @@ Size H264Decoder::GetPicSize() const {
 }
 
 size_t H264Decoder::GetRequiredNumOfPictures() const {
+  // Each IDR picture empties the DPB, so it never holds more than one.
+  if (keyframes_only_)
+    return kNumPicturesForKeyframesOnly;
   return dpb_.max_num_pics() + kPicsInPipeline;
 }
 
+size_t H264Decoder::GetMaxCodedFrameSize(int frame_rate) const {
+  return GetMaxCodedFrameSizeFor(pic_size_, frame_rate, max_macroblock_rate_,
+                                 min_compression_ratio_);
+}
+
+void H264Decoder::SetSkipNonReferenceFrames(bool skip) {
+  // This is set for each stream, only log the changes.
+  DVLOG_IF(2, skip != skip_non_reference_frames_)
+      << (skip ? "Start" : "Stop") << " skipping non-reference frames";
+  skip_non_reference_frames_ = skip;
+}
+
+void H264Decoder::ResetAfterError() {
+  DVLOG(1) << "Resetting after error";
+  // The current picture may be incomplete, but the pictures decoded already
+  // are outputted, so that no bitstream buffer is left without its picture.
+  curr_pic_ = nullptr;
+  OutputAllRemainingPics();
+
+  // The stream parameters are kept, unless the error came before any.
+  state_ = pic_size_.IsEmpty() ? kNeedStreamMetadata : kAfterReset;
+  Reset();
+}
+
+void H264Decoder::SetDecodeKeyframesOnly(bool keyframes_only) {
+  DVLOG(2) << "Decoding " << (keyframes_only ? "IDR" : "all") << " pictures";
+  keyframes_only_ = keyframes_only;
+}
+
+size_t H264Decoder::GetNumSkippedFrames() const {
+  return num_skipped_frames_;
+}
+
+size_t H264Decoder::GetParserStateSize() const {
+  return parser_.GetStateSize();
+}
+
 }  // namespace media
@@ -110,6 +110,12 @@ class H264Decoder : public AcceleratedVideoDecoder {
   DecodeResult Decode() override WARN_UNUSED_RESULT;
   Size GetPicSize() const override;
   size_t GetRequiredNumOfPictures() const override;
+  size_t GetMaxCodedFrameSize(int frame_rate) const override;
+  void SetSkipNonReferenceFrames(bool skip) override;
+  void SetDecodeKeyframesOnly(bool keyframes_only) override;
+  void ResetAfterError() override;
+  size_t GetNumSkippedFrames() const override;
+  size_t GetParserStateSize() const override;
 
  private:
   // We need to keep at most kDPBMaxSize pictures in DPB for
@@ -140,6 +146,13 @@ class H264Decoder : public AcceleratedVideoDecoder {
   bool PreprocessCurrentSlice();
   // Process current slice as a slice of the current picture.
   bool ProcessCurrentSlice();
+  // Set |*skip| to true if the current slice belongs to a non-reference
+  // picture that is to be dropped instead of decoded. Return false on error.
+  bool ShouldSkipCurrentSlice(bool* skip);
+  // Prepare to decode from the non-IDR picture of the current slice, which
+  // follows a recovery point SEI message, as if it followed a picture with
+  // memory_management_control_operation 5.
+  void StartFromRecoveryPoint();
 
   // Return true if we need to start a new picture.
   bool IsNewPrimaryCodedPicture(const H264SliceHeader* slice_hdr) const;
@@ -161,12 +174,15 @@ class H264Decoder : public AcceleratedVideoDecoder {
 
   bool UpdateMaxNumReorderFrames(const H264SPS* sps);
 
+  // Drop the pictures in |accelerator_ref_pic_lists_|.
+  void ClearAcceleratorRefPicLists();
+
   // Prepare reference picture lists for the current frame.
   void PrepareRefPicLists(const H264SliceHeader* slice_hdr);
   // Prepare reference picture lists for the given slice.
   bool ModifyReferencePicLists(const H264SliceHeader* slice_hdr,
-                               H264Picture::Vector* ref_pic_list0,
-                               H264Picture::Vector* ref_pic_list1);
+                               H264DPB::SlotList* ref_pic_list0,
+                               H264DPB::SlotList* ref_pic_list1);
 
   // Construct initial reference picture lists for use in decoding of
   // P and B pictures (see 8.2.4 in spec).
@@ -174,8 +190,8 @@ class H264Decoder : public AcceleratedVideoDecoder {
   void ConstructReferencePicListsB(const H264SliceHeader* slice_hdr);
 
   // Helper functions for reference list construction, per spec.
-  int PicNumF(const scoped_refptr<H264Picture>& pic);
-  int LongTermPicNumF(const scoped_refptr<H264Picture>& pic);
+  int PicNumF(const H264Picture* pic);
+  int LongTermPicNumF(const H264Picture* pic);
 
   // Perform the reference picture lists' modification (reordering), as
   // specified in spec (8.2.4).
@@ -183,7 +199,7 @@ class H264Decoder : public AcceleratedVideoDecoder {
   // |list| indicates list number and should be either 0 or 1.
   bool ModifyReferencePicList(const H264SliceHeader* slice_hdr,
                               int list,
-                              H264Picture::Vector* ref_pic_listx);
+                              H264DPB::SlotList* ref_pic_listx);
 
   // Perform reference picture memory management operations (marking/unmarking
   // of reference pictures, long term picture management, discarding, etc.).
@@ -235,10 +251,21 @@ class H264Decoder : public AcceleratedVideoDecoder {
   // Picture currently being processed/decoded.
   scoped_refptr<H264Picture> curr_pic_;
 
-  // Reference picture lists, constructed for each frame.
-  H264Picture::Vector ref_pic_list_p0_;
-  H264Picture::Vector ref_pic_list_b0_;
-  H264Picture::Vector ref_pic_list_b1_;
+  // Reference picture lists, constructed for each frame, and their per-slice
+  // modified versions. These hold DPB slots and are only valid while the DPB
+  // is not modified, i.e. until the current frame is finished.
+  H264DPB::SlotList ref_pic_list_p0_;
+  H264DPB::SlotList ref_pic_list_b0_;
+  H264DPB::SlotList ref_pic_list_b1_;
+  H264DPB::SlotList ref_pic_list0_;
+  H264DPB::SlotList ref_pic_list1_;
+
+  // The reference picture lists above turned into pictures for passing to
+  // |accelerator_|, and the list of pictures waiting for output. Kept here
+  // only to reuse their storage between frames; they are cleared after each
+  // use, so that they do not keep any pictures alive.
+  H264Picture::Vector accelerator_ref_pic_lists_[3];
+  H264Picture::Vector not_outputted_;
 
   // Global state values, needed in decoding. See spec.
   int max_frame_num_;
@@ -262,18 +289,42 @@ class H264Decoder : public AcceleratedVideoDecoder {
   int curr_sps_id_;
   int curr_pps_id_;
 
-  // Current NALU and slice header being processed.
-  std::unique_ptr<H264NALU> curr_nalu_;
-  std::unique_ptr<H264SliceHeader> curr_slice_hdr_;
+  // Current NALU and slice header being processed. When set, these point to
+  // |nalu_| and |slice_hdr_| respectively, which are reused for every NALU
+  // and slice instead of being allocated anew.
+  H264NALU* curr_nalu_;
+  H264SliceHeader* curr_slice_hdr_;
+  H264NALU nalu_;
+  H264SliceHeader slice_hdr_;
 
   // Output picture size.
   Size pic_size_;
+  // Maximum macroblock rate and minimum compression ratio of the coded
+  // pictures, from the stream level.
+  int max_macroblock_rate_;
+  int min_compression_ratio_;
   // Output visible cropping rect.
   Rect visible_rect_;
 
   // PicOrderCount of the previously outputted frame.
   int last_output_poc_;
 
+  // Recovery frame count of the recovery point SEI message parsed after
+  // Reset(), if any, -1 otherwise.
+  int recovery_frame_cnt_;
+  // frame_num of the recovery frame while decoding from a recovery point,
+  // i.e. while references from before it may be missing, -1 otherwise.
+  int recovery_frame_num_;
+
+  // Whether non-reference pictures are to be dropped, whether the slices
+  // being parsed belong to such a dropped picture, and the number of pictures
+  // dropped so far.
+  bool skip_non_reference_frames_;
+  // Only IDR pictures are decoded if true.
+  bool keyframes_only_;
+  bool skipping_curr_pic_;
+  size_t num_skipped_frames_;
+
   H264Accelerator* accelerator_;
 
   DISALLOW_COPY_AND_ASSIGN(H264Decoder);
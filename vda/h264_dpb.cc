@@ -13,36 +13,41 @@
 
 namespace media {
 
-H264Picture::H264Picture()
-    : pic_order_cnt_type(0),
-      top_field_order_cnt(0),
-      bottom_field_order_cnt(0),
-      pic_order_cnt(0),
-      pic_order_cnt_msb(0),
-      pic_order_cnt_lsb(0),
-      delta_pic_order_cnt_bottom(0),
-      delta_pic_order_cnt0(0),
-      delta_pic_order_cnt1(0),
-      pic_num(0),
-      long_term_pic_num(0),
-      frame_num(0),
-      frame_num_offset(0),
-      frame_num_wrap(0),
-      long_term_frame_idx(0),
-      type(H264SliceHeader::kPSlice),
-      nal_ref_idc(0),
-      idr(false),
-      idr_pic_id(0),
-      ref(false),
-      long_term(false),
-      outputted(false),
-      mem_mgmt_5(false),
-      nonexisting(false),
-      field(FIELD_NONE),
-      long_term_reference_flag(false),
-      adaptive_ref_pic_marking_mode_flag(false),
-      dpb_position(0) {
+H264Picture::H264Picture() {
+  ResetForReuse();
+}
+
+void H264Picture::ResetForReuse() {
+  pic_order_cnt_type = 0;
+  top_field_order_cnt = 0;
+  bottom_field_order_cnt = 0;
+  pic_order_cnt = 0;
+  pic_order_cnt_msb = 0;
+  pic_order_cnt_lsb = 0;
+  delta_pic_order_cnt_bottom = 0;
+  delta_pic_order_cnt0 = 0;
+  delta_pic_order_cnt1 = 0;
+  pic_num = 0;
+  long_term_pic_num = 0;
+  frame_num = 0;
+  frame_num_offset = 0;
+  frame_num_wrap = 0;
+  long_term_frame_idx = 0;
+  type = H264SliceHeader::kPSlice;
+  nal_ref_idc = 0;
+  idr = false;
+  idr_pic_id = 0;
+  ref = false;
+  long_term = false;
+  outputted = false;
+  mem_mgmt_5 = false;
+  nonexisting = false;
+  field = FIELD_NONE;
+  long_term_reference_flag = false;
+  adaptive_ref_pic_marking_mode_flag = false;
+  dpb_position = 0;
   memset(&ref_pic_marking, 0, sizeof(ref_pic_marking));
+  visible_rect = Rect();
 }
 
 H264Picture::~H264Picture() = default;
@@ -51,34 +56,62 @@ V4L2H264Picture* H264Picture::AsV4L2H264Picture() {
   return nullptr;
 }
 
-H264DPB::H264DPB() : max_num_pics_(0) {}
+H264DPB::H264DPB()
+    : max_num_pics_(0),
+      used_slots_(0),
+      short_term_ref_slots_(0),
+      long_term_ref_slots_(0),
+      not_outputted_slots_(0) {}
 H264DPB::~H264DPB() = default;
 
 void H264DPB::Clear() {
-  pics_.clear();
+  while (used_slots_)
+    RemoveSlot(__builtin_ctz(used_slots_));
 }
 
 void H264DPB::set_max_num_pics(size_t max_num_pics) {
   DCHECK_LE(max_num_pics, static_cast<size_t>(kDPBMaxSize));
   max_num_pics_ = max_num_pics;
-  if (pics_.size() > max_num_pics_)
-    pics_.resize(max_num_pics_);
+  while (size() > max_num_pics_)
+    RemoveSlot(31 - __builtin_clz(used_slots_));
 }
 
-void H264DPB::UpdatePicPositions() {
-  size_t i = 0;
-  for (auto& pic : pics_) {
-    pic->dpb_position = i;
-    ++i;
-  }
+bool H264DPB::Contains(const H264Picture* pic) const {
+  int slot = pic->dpb_position;
+  return slot >= 0 && slot < kDPBMaxSize && pics_[slot].get() == pic;
+}
+
+void H264DPB::UpdateSlotSets(int slot) {
+  const uint32_t bit = 1u << slot;
+  const H264Picture* pic = pics_[slot].get();
+  DCHECK(pic);
+
+  short_term_ref_slots_ &= ~bit;
+  long_term_ref_slots_ &= ~bit;
+  not_outputted_slots_ &= ~bit;
+  if (pic->ref && !pic->long_term)
+    short_term_ref_slots_ |= bit;
+  if (pic->ref && pic->long_term)
+    long_term_ref_slots_ |= bit;
+  if (!pic->outputted)
+    not_outputted_slots_ |= bit;
+}
+
+void H264DPB::RemoveSlot(int slot) {
+  const uint32_t bit = 1u << slot;
+  DCHECK(used_slots_ & bit);
+  used_slots_ &= ~bit;
+  short_term_ref_slots_ &= ~bit;
+  long_term_ref_slots_ &= ~bit;
+  not_outputted_slots_ &= ~bit;
+  pics_[slot] = nullptr;
 }
 
 void H264DPB::DeleteByPOC(int poc) {
-  for (H264Picture::Vector::iterator it = pics_.begin(); it != pics_.end();
-       ++it) {
-    if ((*it)->pic_order_cnt == poc) {
-      pics_.erase(it);
-      UpdatePicPositions();
+  for (uint32_t slots = used_slots_; slots; slots &= slots - 1) {
+    int slot = __builtin_ctz(slots);
+    if (pics_[slot]->pic_order_cnt == poc) {
+      RemoveSlot(slot);
       return;
     }
   }
@@ -86,86 +119,119 @@ void H264DPB::DeleteByPOC(int poc) {
 }
 
 void H264DPB::DeleteUnused() {
-  for (H264Picture::Vector::iterator it = pics_.begin(); it != pics_.end();) {
-    if ((*it)->outputted && !(*it)->ref)
-      it = pics_.erase(it);
-    else
-      ++it;
-  }
-  UpdatePicPositions();
+  // Outputted pictures that are neither short nor long term references.
+  uint32_t unused = used_slots_ & ~not_outputted_slots_ &
+                    ~short_term_ref_slots_ & ~long_term_ref_slots_;
+  for (; unused; unused &= unused - 1)
+    RemoveSlot(__builtin_ctz(unused));
 }
 
 void H264DPB::StorePic(const scoped_refptr<H264Picture>& pic) {
-  DCHECK_LT(pics_.size(), max_num_pics_);
+  DCHECK_LT(size(), max_num_pics_);
   DVLOG(3) << "Adding PicNum: " << pic->pic_num << " ref: " << (int)pic->ref
            << " longterm: " << (int)pic->long_term << " to DPB";
-  pic->dpb_position = pics_.size();
-  pics_.push_back(pic);
+  int slot = __builtin_ctz(~used_slots_);
+  DCHECK_LT(slot, kDPBMaxSize);
+  pic->dpb_position = slot;
+  pics_[slot] = pic;
+  used_slots_ |= 1u << slot;
+  UpdateSlotSets(slot);
 }
 
 int H264DPB::CountRefPics() {
-  int ret = 0;
-  for (size_t i = 0; i < pics_.size(); ++i) {
-    if (pics_[i]->ref)
-      ++ret;
-  }
-  return ret;
+  return __builtin_popcount(short_term_ref_slots_ | long_term_ref_slots_);
 }
 
 void H264DPB::MarkAllUnusedForRef() {
-  for (size_t i = 0; i < pics_.size(); ++i)
-    pics_[i]->ref = false;
+  for (uint32_t slots = short_term_ref_slots_ | long_term_ref_slots_; slots;
+       slots &= slots - 1) {
+    pics_[__builtin_ctz(slots)]->ref = false;
+  }
+  short_term_ref_slots_ = 0;
+  long_term_ref_slots_ = 0;
+}
+
+void H264DPB::MarkUnusedForRef(const scoped_refptr<H264Picture>& pic) {
+  pic->ref = false;
+  if (Contains(pic.get()))
+    UpdateSlotSets(pic->dpb_position);
+}
+
+void H264DPB::MarkLongTermRef(const scoped_refptr<H264Picture>& pic,
+                              int long_term_frame_idx) {
+  DCHECK(pic->ref && !pic->long_term);
+  pic->long_term = true;
+  pic->long_term_frame_idx = long_term_frame_idx;
+  if (Contains(pic.get()))
+    UpdateSlotSets(pic->dpb_position);
+}
+
+void H264DPB::MarkOutputted(const scoped_refptr<H264Picture>& pic) {
+  pic->outputted = true;
+  if (Contains(pic.get()))
+    UpdateSlotSets(pic->dpb_position);
+}
+
+void H264DPB::GetPicsBySlots(const SlotList& slots,
+                             H264Picture::Vector* pics) const {
+  pics->clear();
+  for (int slot : slots)
+    pics->push_back(GetPicBySlot(slot));
 }
 
 scoped_refptr<H264Picture> H264DPB::GetShortRefPicByPicNum(int pic_num) {
-  for (const auto& pic : pics_) {
-    if (pic->ref && !pic->long_term && pic->pic_num == pic_num)
-      return pic;
+  return GetPicBySlot(GetShortRefSlotByPicNum(pic_num));
+}
+
+scoped_refptr<H264Picture> H264DPB::GetLongRefPicByLongTermPicNum(int pic_num) {
+  return GetPicBySlot(GetLongRefSlotByLongTermPicNum(pic_num));
+}
+
+int H264DPB::GetShortRefSlotByPicNum(int pic_num) {
+  for (uint32_t slots = short_term_ref_slots_; slots; slots &= slots - 1) {
+    int slot = __builtin_ctz(slots);
+    if (pics_[slot]->pic_num == pic_num)
+      return slot;
   }
 
   DVLOG(1) << "Missing short ref pic num: " << pic_num;
-  return nullptr;
+  return kNoSlot;
 }
 
-scoped_refptr<H264Picture> H264DPB::GetLongRefPicByLongTermPicNum(int pic_num) {
-  for (const auto& pic : pics_) {
-    if (pic->ref && pic->long_term && pic->long_term_pic_num == pic_num)
-      return pic;
+int H264DPB::GetLongRefSlotByLongTermPicNum(int pic_num) {
+  for (uint32_t slots = long_term_ref_slots_; slots; slots &= slots - 1) {
+    int slot = __builtin_ctz(slots);
+    if (pics_[slot]->long_term_pic_num == pic_num)
+      return slot;
   }
 
   DVLOG(1) << "Missing long term pic num: " << pic_num;
-  return nullptr;
+  return kNoSlot;
 }
 
 scoped_refptr<H264Picture> H264DPB::GetLowestFrameNumWrapShortRefPic() {
   scoped_refptr<H264Picture> ret;
-  for (const auto& pic : pics_) {
-    if (pic->ref && !pic->long_term &&
-        (!ret || pic->frame_num_wrap < ret->frame_num_wrap))
+  for (uint32_t slots = short_term_ref_slots_; slots; slots &= slots - 1) {
+    const scoped_refptr<H264Picture>& pic = pics_[__builtin_ctz(slots)];
+    if (!ret || pic->frame_num_wrap < ret->frame_num_wrap)
       ret = pic;
   }
   return ret;
 }
 
 void H264DPB::GetNotOutputtedPicsAppending(H264Picture::Vector* out) {
-  for (const auto& pic : pics_) {
-    if (!pic->outputted)
-      out->push_back(pic);
-  }
+  for (uint32_t slots = not_outputted_slots_; slots; slots &= slots - 1)
+    out->push_back(pics_[__builtin_ctz(slots)]);
 }
 
-void H264DPB::GetShortTermRefPicsAppending(H264Picture::Vector* out) {
-  for (const auto& pic : pics_) {
-    if (pic->ref && !pic->long_term)
-      out->push_back(pic);
-  }
+void H264DPB::GetShortTermRefSlotsAppending(SlotList* out) {
+  for (uint32_t slots = short_term_ref_slots_; slots; slots &= slots - 1)
+    out->push_back(__builtin_ctz(slots));
 }
 
-void H264DPB::GetLongTermRefPicsAppending(H264Picture::Vector* out) {
-  for (const auto& pic : pics_) {
-    if (pic->ref && pic->long_term)
-      out->push_back(pic);
-  }
+void H264DPB::GetLongTermRefSlotsAppending(SlotList* out) {
+  for (uint32_t slots = long_term_ref_slots_; slots; slots &= slots - 1)
+    out->push_back(__builtin_ctz(slots));
 }
 
 }  // namespace media
@@ -10,9 +10,11 @@
 #define H264_DPB_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <vector>
 
+#include "base/logging.h"
 #include "base/macros.h"
 #include "base/memory/ref_counted.h"
 #include "h264_parser.h"
@@ -38,6 +40,11 @@ class H264Picture : public base::RefCountedThreadSafe<H264Picture> {
 
   virtual V4L2H264Picture* AsV4L2H264Picture();
 
+  // Restore all fields to their just-constructed values, so that a picture
+  // no longer referenced by the decoder can be handed out again instead of
+  // allocating a new one.
+  void ResetForReuse();
+
   // Values calculated per H.264 specification or taken from slice header.
   // See spec for more details on each (some names have been converted from
   // CamelCase in spec to Chromium-style names).
@@ -99,8 +106,87 @@ class H264Picture : public base::RefCountedThreadSafe<H264Picture> {
 // DPB - Decoded Picture Buffer.
 // Stores decoded pictures that will be used for future display
 // and/or reference.
+//
+// Pictures are kept in a fixed array of kDPBMaxSize slots. A stored picture
+// keeps its slot, which is also its |dpb_position|, until it is removed.
+// Occupied slots and the short term reference, long term reference and not
+// yet outputted subsets are tracked in bitmaps, so lookups only visit the
+// pictures that can match and removal does not move other pictures.
+// The reference and output state of stored pictures must therefore only be
+// changed using the Mark*() methods below.
 class H264DPB {
  public:
+  enum {
+    // Marks an entry of a SlotList that does not refer to any picture.
+    kNoSlot = -1,
+  };
+
+  // Fixed capacity list of DPB slots, used to build reference picture lists
+  // without allocating or touching picture reference counts.
+  class SlotList {
+   public:
+    // The modification process (8.2.4.3) temporarily makes a list one entry
+    // longer than the longest allowed reference picture list.
+    enum { kMaxSize = H264SliceHeader::kRefListSize + 1 };
+
+    SlotList() : size_(0) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    void clear() { size_ = 0; }
+    void push_back(int slot) {
+      CHECK_LT(size_, static_cast<size_t>(kMaxSize));
+      slots_[size_++] = slot;
+    }
+    // New entries are set to kNoSlot.
+    void resize(size_t size) {
+      CHECK_LE(size, static_cast<size_t>(kMaxSize));
+      for (size_t i = size_; i < size; ++i)
+        slots_[i] = kNoSlot;
+      size_ = size;
+    }
+
+    int& operator[](size_t i) {
+      DCHECK_LT(i, size_);
+      return slots_[i];
+    }
+    int operator[](size_t i) const {
+      DCHECK_LT(i, size_);
+      return slots_[i];
+    }
+
+    int* begin() { return slots_; }
+    int* end() { return slots_ + size_; }
+    const int* begin() const { return slots_; }
+    const int* end() const { return slots_ + size_; }
+
+   private:
+    int slots_[kMaxSize];
+    size_t size_;
+  };
+
+  // Iterates over the stored pictures in slot order.
+  class Iterator {
+   public:
+    Iterator(const scoped_refptr<H264Picture>* pics, uint32_t slots)
+        : pics_(pics), slots_(slots) {}
+
+    const scoped_refptr<H264Picture>& operator*() const {
+      return pics_[__builtin_ctz(slots_)];
+    }
+    Iterator& operator++() {
+      slots_ &= slots_ - 1;
+      return *this;
+    }
+    bool operator!=(const Iterator& other) const {
+      return slots_ != other.slots_;
+    }
+
+   private:
+    const scoped_refptr<H264Picture>* pics_;
+    uint32_t slots_;
+  };
+
   H264DPB();
   ~H264DPB();
 
@@ -126,41 +212,57 @@ class H264DPB {
   // Mark all pictures in DPB as unused for reference.
   void MarkAllUnusedForRef();
 
+  // Mark |pic| as unused for reference.
+  void MarkUnusedForRef(const scoped_refptr<H264Picture>& pic);
+
+  // Turn short term reference |pic| into a long term reference with
+  // |long_term_frame_idx|.
+  void MarkLongTermRef(const scoped_refptr<H264Picture>& pic,
+                       int long_term_frame_idx);
+
+  // Mark |pic| as outputted.
+  void MarkOutputted(const scoped_refptr<H264Picture>& pic);
+
+  // Return the picture in |slot|, or nullptr for an empty slot or kNoSlot.
+  H264Picture* GetPicBySlot(int slot) const {
+    return slot == kNoSlot ? nullptr : pics_[slot].get();
+  }
+
+  // Fill |pics| with the pictures in |slots|, nullptr for kNoSlot entries.
+  void GetPicsBySlots(const SlotList& slots, H264Picture::Vector* pics) const;
+
   // Return a short-term reference picture by its pic_num.
   scoped_refptr<H264Picture> GetShortRefPicByPicNum(int pic_num);
 
   // Return a long-term reference picture by its long_term_pic_num.
   scoped_refptr<H264Picture> GetLongRefPicByLongTermPicNum(int pic_num);
 
+  // Same as above, but return the slot of the picture, or kNoSlot.
+  int GetShortRefSlotByPicNum(int pic_num);
+  int GetLongRefSlotByLongTermPicNum(int pic_num);
+
   // Return the short reference picture with lowest frame_num. Used for sliding
   // window memory management.
   scoped_refptr<H264Picture> GetLowestFrameNumWrapShortRefPic();
 
   // Append all pictures that have not been outputted yet to the passed |out|
-  // vector, sorted by lowest pic_order_cnt (in output order).
+  // vector, in the order of their DPB slots. Callers sort them into output
+  // order.
   void GetNotOutputtedPicsAppending(H264Picture::Vector* out);
 
-  // Append all short term reference pictures to the passed |out| vector.
-  void GetShortTermRefPicsAppending(H264Picture::Vector* out);
+  // Append the slots of all short term reference pictures to |out|.
+  void GetShortTermRefSlotsAppending(SlotList* out);
 
-  // Append all long term reference pictures to the passed |out| vector.
-  void GetLongTermRefPicsAppending(H264Picture::Vector* out);
+  // Append the slots of all long term reference pictures to |out|.
+  void GetLongTermRefSlotsAppending(SlotList* out);
 
   // Iterators for direct access to DPB contents.
   // Will be invalidated after any of Remove* calls.
-  H264Picture::Vector::iterator begin() { return pics_.begin(); }
-  H264Picture::Vector::iterator end() { return pics_.end(); }
-  H264Picture::Vector::const_iterator begin() const { return pics_.begin(); }
-  H264Picture::Vector::const_iterator end() const { return pics_.end(); }
-  H264Picture::Vector::const_reverse_iterator rbegin() const {
-    return pics_.rbegin();
-  }
-  H264Picture::Vector::const_reverse_iterator rend() const {
-    return pics_.rend();
-  }
+  Iterator begin() const { return Iterator(pics_, used_slots_); }
+  Iterator end() const { return Iterator(pics_, 0); }
 
-  size_t size() const { return pics_.size(); }
-  bool IsFull() const { return pics_.size() == max_num_pics_; }
+  size_t size() const { return __builtin_popcount(used_slots_); }
+  bool IsFull() const { return size() == max_num_pics_; }
 
   // Per H264 spec, increase to 32 if interlaced video is supported.
   enum {
@@ -168,11 +270,24 @@ class H264DPB {
   };
 
  private:
-  void UpdatePicPositions();
+  // Return true if |pic| is stored in DPB.
+  bool Contains(const H264Picture* pic) const;
+
+  // Recompute the membership of the picture in |slot| in the reference and
+  // not outputted sets from its flags.
+  void UpdateSlotSets(int slot);
 
-  H264Picture::Vector pics_;
+  void RemoveSlot(int slot);
+
+  scoped_refptr<H264Picture> pics_[kDPBMaxSize];
   size_t max_num_pics_;
 
+  // Bitmaps of slots in |pics_|.
+  uint32_t used_slots_;
+  uint32_t short_term_ref_slots_;
+  uint32_t long_term_ref_slots_;
+  uint32_t not_outputted_slots_;
+
   DISALLOW_COPY_AND_ASSIGN(H264DPB);
 };
 
@@ -247,6 +247,11 @@ const H264PPS* H264Parser::GetPPS(int pps_id) const {
   return it->second.get();
 }
 
+size_t H264Parser::GetStateSize() const {
+  return sizeof(*this) + active_SPSes_.size() * sizeof(H264SPS) +
+         active_PPSes_.size() * sizeof(H264PPS);
+}
+
 const H264SPS* H264Parser::GetSPS(int sps_id) const {
   auto it = active_SPSes_.find(sps_id);
   if (it == active_SPSes_.end()) {
@@ -363,31 +368,48 @@ bool H264Parser::FindStartCodeInClearRanges(
     return FindStartCode(data, data_size, offset, start_code_size);
 
   DCHECK_GE(data_size, 0);
-  const uint8_t* start = data;
-  do {
-    off_t bytes_left = data_size - (start - data);
-
-    if (!FindStartCode(start, bytes_left, offset, start_code_size))
-      return false;
+  const uint8_t* const data_end = data + data_size;
+
+  // Find the first encrypted range ending after |data|.
+  size_t lo = 0;
+  size_t hi = encrypted_ranges.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (encrypted_ranges.end(mid) <= data)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-    // Construct a Ranges object that represents the region occupied
-    // by the start code and the 1 byte needed to read the NAL unit type.
-    const uint8_t* start_code = start + *offset;
-    const uint8_t* start_code_end = start_code + *start_code_size;
-    Ranges<const uint8_t*> start_code_range;
-    start_code_range.Add(start_code, start_code_end + 1);
-
-    if (encrypted_ranges.IntersectionWith(start_code_range).size() > 0) {
-      // The start code is inside an encrypted section so we need to scan
-      // for another start code.
-      *start_code_size = 0;
-      start += std::min(*offset + 1, bytes_left);
+  // A usable start code, together with the 1 byte needed to read the NAL unit
+  // type, lies entirely between two encrypted ranges, as the ranges are
+  // coalesced. So scan each clear gap once, in order, skipping the encrypted
+  // bytes altogether.
+  const uint8_t* start = data;
+  for (size_t i = lo; start < data_end; ++i) {
+    const bool last_gap = i == encrypted_ranges.size();
+    const uint8_t* gap_end = last_gap ? data_end : encrypted_ranges.start(i);
+    const uint8_t* search_end = std::min(gap_end, data_end);
+
+    if (start < search_end &&
+        FindStartCode(start, search_end - start, offset, start_code_size)) {
+      const uint8_t* start_code_end = start + *offset + *start_code_size;
+      // Later start codes in this gap would not fit either.
+      if (last_gap || start_code_end < gap_end) {
+        // Update |*offset| to include the data we skipped over.
+        *offset += start - data;
+        return true;
+      }
     }
-  } while (*start_code_size == 0);
 
-  // Update |*offset| to include the data we skipped over.
-  *offset += start - data;
-  return true;
+    if (last_gap)
+      break;
+    start = std::max(start, encrypted_ranges.end(i));
+  }
+
+  *offset = data_size;
+  *start_code_size = 0;
+  return false;
 }
 
 // static
@@ -426,6 +426,10 @@ class H264Parser {
   const H264SPS* GetSPS(int sps_id) const;
   const H264PPS* GetPPS(int pps_id) const;
 
+  // Return the size in bytes of the parser, including the SPSes and PPSes it
+  // keeps.
+  size_t GetStateSize() const;
+
   // Slice headers and SEI messages are not used across NALUs by the parser
   // and can be discarded after current NALU, so the parser does not store
   // them, nor does it manage their memory.
@@ -0,0 +1,119 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "memory_usage_tracker.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "base/logging.h"
+
+namespace media {
+
+MemoryUsageTracker::Usage::Usage()
+    : bytes(0), count(0), peak_bytes(0), peak_count(0) {}
+
+MemoryUsageTracker::MemoryUsageTracker() : peak_total_bytes_(0) {}
+
+MemoryUsageTracker::~MemoryUsageTracker() {}
+
+// static
+const char* MemoryUsageTracker::CategoryToString(Category category) {
+  switch (category) {
+    case kGraphicBlocks:
+      return "graphic blocks";
+    case kInputBuffers:
+      return "input buffers";
+    case kBitstreamBuffers:
+      return "bitstream buffers";
+    case kParserState:
+      return "parser state";
+    case kNumCategories:
+      break;
+  }
+  NOTREACHED();
+  return "unknown";
+}
+
+void MemoryUsageTracker::Add(Category category,
+                             uint64_t bytes,
+                             uint64_t count) {
+  DCHECK_LT(category, kNumCategories);
+  base::AutoLock auto_lock(lock_);
+  Usage& usage = usages_[category];
+  usage.bytes += bytes;
+  usage.count += count;
+  UpdatePeaksLocked(&usage);
+}
+
+void MemoryUsageTracker::Remove(Category category,
+                                uint64_t bytes,
+                                uint64_t count) {
+  DCHECK_LT(category, kNumCategories);
+  base::AutoLock auto_lock(lock_);
+  Usage& usage = usages_[category];
+  DCHECK_GE(usage.bytes, bytes);
+  DCHECK_GE(usage.count, count);
+  usage.bytes -= std::min(usage.bytes, bytes);
+  usage.count -= std::min(usage.count, count);
+}
+
+void MemoryUsageTracker::Set(Category category,
+                             uint64_t bytes,
+                             uint64_t count) {
+  DCHECK_LT(category, kNumCategories);
+  base::AutoLock auto_lock(lock_);
+  Usage& usage = usages_[category];
+  usage.bytes = bytes;
+  usage.count = count;
+  UpdatePeaksLocked(&usage);
+}
+
+MemoryUsageTracker::Usage MemoryUsageTracker::GetUsage(
+    Category category) const {
+  DCHECK_LT(category, kNumCategories);
+  base::AutoLock auto_lock(lock_);
+  return usages_[category];
+}
+
+uint64_t MemoryUsageTracker::GetTotalBytes() const {
+  base::AutoLock auto_lock(lock_);
+  return GetTotalBytesLocked();
+}
+
+uint64_t MemoryUsageTracker::GetPeakTotalBytes() const {
+  base::AutoLock auto_lock(lock_);
+  return peak_total_bytes_;
+}
+
+std::string MemoryUsageTracker::ToString() const {
+  base::AutoLock auto_lock(lock_);
+  std::ostringstream s;
+  s << "total: " << GetTotalBytesLocked() << " bytes (peak "
+    << peak_total_bytes_ << " bytes)";
+  for (int i = 0; i < kNumCategories; ++i) {
+    const Usage& usage = usages_[i];
+    s << ", " << CategoryToString(static_cast<Category>(i)) << ": " << usage.bytes
+      << " bytes in " << usage.count << " (peak " << usage.peak_bytes
+      << " bytes in " << usage.peak_count << ")";
+  }
+  return s.str();
+}
+
+uint64_t MemoryUsageTracker::GetTotalBytesLocked() const {
+  lock_.AssertAcquired();
+  uint64_t bytes = 0;
+  for (const Usage& usage : usages_)
+    bytes += usage.bytes;
+  return bytes;
+}
+
+void MemoryUsageTracker::UpdatePeaksLocked(Usage* usage) {
+  lock_.AssertAcquired();
+  usage->peak_bytes = std::max(usage->peak_bytes, usage->bytes);
+  usage->peak_count = std::max(usage->peak_count, usage->count);
+  peak_total_bytes_ = std::max(peak_total_bytes_, GetTotalBytesLocked());
+}
+
+}  // namespace media
@@ -0,0 +1,90 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef MEMORY_USAGE_TRACKER_H_
+#define MEMORY_USAGE_TRACKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+
+namespace media {
+
+// Accounts the memory held by a decoding session, by category, to size the
+// buffer pools and catch leaks under long-running load. It is shared by the
+// component and the VDA of the session, and is thread-safe.
+class MemoryUsageTracker
+    : public base::RefCountedThreadSafe<MemoryUsageTracker> {
+ public:
+  enum Category {
+    // Output graphic blocks allocated by the component.
+    kGraphicBlocks,
+    // Input buffers of the V4L2 device, mapped in the process.
+    kInputBuffers,
+    // Bitstream buffers of the client, mapped until decoded.
+    kBitstreamBuffers,
+    // Bitstream parser state, e.g. the H.264 parameter sets.
+    kParserState,
+    kNumCategories,
+  };
+
+  // Usage of a category. The peaks are the high-water marks since the
+  // tracker was created, they are not reached simultaneously in general.
+  struct Usage {
+    Usage();
+
+    uint64_t bytes;
+    uint64_t count;
+    uint64_t peak_bytes;
+    uint64_t peak_count;
+  };
+
+  MemoryUsageTracker();
+
+  static const char* CategoryToString(Category category);
+
+  // Account |count| more allocations of |bytes| in total in |category|.
+  void Add(Category category, uint64_t bytes, uint64_t count);
+
+  // Remove |count| allocations of |bytes| in total from |category|, which
+  // must have been added before.
+  void Remove(Category category, uint64_t bytes, uint64_t count);
+
+  // Set the usage of |category|, for the categories whose size is measured
+  // rather than accounted per allocation.
+  void Set(Category category, uint64_t bytes, uint64_t count);
+
+  Usage GetUsage(Category category) const;
+
+  // Return the current bytes of all the categories, and their high-water
+  // mark.
+  uint64_t GetTotalBytes() const;
+  uint64_t GetPeakTotalBytes() const;
+
+  // Format the usage of all the categories, for dumps.
+  std::string ToString() const;
+
+ private:
+  friend class base::RefCountedThreadSafe<MemoryUsageTracker>;
+  ~MemoryUsageTracker();
+
+  uint64_t GetTotalBytesLocked() const;
+  void UpdatePeaksLocked(Usage* usage);
+
+  mutable base::Lock lock_;
+  // Usage by category and peak of their sum, guarded by |lock_|.
+  Usage usages_[kNumCategories];
+  uint64_t peak_total_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryUsageTracker);
+};
+
+}  // namespace media
+
+#endif  // MEMORY_USAGE_TRACKER_H_
@@ -61,12 +61,14 @@ size_t Ranges<T>::Add(T start, T end) {
     return ranges_.size();
 
   DCheckLT(start, end);
-  size_t i;
-  // Walk along the array of ranges until |start| is no longer larger than the
-  // current interval's end.
-  for (i = 0; i < ranges_.size() && ranges_[i].second < start; ++i) {
-    // Empty body
-  }
+  // Find the first range whose end is no smaller than |start|. The ranges are
+  // disjoint and sorted, so their ends are sorted too, and adding ranges in
+  // increasing order does not walk the whole array each time.
+  size_t i = std::lower_bound(ranges_.begin(), ranges_.end(), start,
+                              [](const std::pair<T, T>& range, const T& value) {
+                                return range.second < value;
+                              }) -
+             ranges_.begin();
 
   // Now we know |start| belongs in the i'th slot.
   // If i is the end of the range, append new range and done.
@@ -0,0 +1,230 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "software_image_processor.h"
+
+#include <linux/dma-buf.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "base/posix/eintr_wrapper.h"
+#include "base/threading/thread_task_runner_handle.h"
+#include "v4l2_device.h"
+#include "yuv_row.h"
+
+#define VLOGF(level) VLOG(level) << __func__ << "(): "
+#define VPLOGF(level) VPLOG(level) << __func__ << "(): "
+
+namespace media {
+
+namespace {
+
+// Number of converted frames between two logs of the conversion cost.
+constexpr int64_t kStatsLogInterval = 300;
+
+// Returns the address of row |y| in the first tile of a plane whose rows are
+// |stride| bytes wide, stored in |tile_height| rows high tiles.
+const uint8_t* GetTiledRow(const uint8_t* plane,
+                           int stride,
+                           int tile_height,
+                           int y) {
+  return plane + (y / tile_height) * stride * tile_height +
+         (y % tile_height) * kTileWidth;
+}
+
+int GetTileHeight(uint32_t fourcc) {
+  return fourcc == V4L2_PIX_FMT_NV12MT_16X16 ? 16 : 0;
+}
+
+}  // namespace
+
+SoftwareImageProcessor::MappedFrame::MappedFrame() {
+  memset(data, 0, sizeof(data));
+  memset(stride, 0, sizeof(stride));
+  memset(dmabuf_fds, -1, sizeof(dmabuf_fds));
+  num_dmabufs = 0;
+}
+
+SoftwareImageProcessor::SoftwareImageProcessor(uint32_t input_fourcc,
+                                               VideoPixelFormat output_format,
+                                               const Size& size)
+    : input_fourcc_(input_fourcc),
+      output_format_(output_format),
+      size_(size),
+      tile_height_(GetTileHeight(input_fourcc)),
+      client_task_runner_(base::ThreadTaskRunnerHandle::Get()),
+      processor_thread_("SWImageProcessorThread"),
+      destroying_(false),
+      chroma_row_((size.width() + 1) / 2 * 2),
+      frames_converted_(0) {}
+
+SoftwareImageProcessor::~SoftwareImageProcessor() {
+  destroying_ = true;
+  processor_thread_.Stop();
+  if (frames_converted_ > 0)
+    LogConversionStats();
+}
+
+// static
+bool SoftwareImageProcessor::IsSupported(uint32_t input_fourcc,
+                                         VideoPixelFormat output_format) {
+  switch (input_fourcc) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+    case V4L2_PIX_FMT_NV12MT_16X16:
+      break;
+    // MT21 is not handled: besides its tiles, its planes are compressed in a
+    // layout that is not documented, so it cannot be converted correctly.
+    default:
+      return false;
+  }
+  return output_format == PIXEL_FORMAT_NV12 ||
+         output_format == PIXEL_FORMAT_I420 ||
+         output_format == PIXEL_FORMAT_YV12;
+}
+
+// static
+std::unique_ptr<SoftwareImageProcessor> SoftwareImageProcessor::Create(
+    uint32_t input_fourcc,
+    VideoPixelFormat output_format,
+    const Size& size) {
+  if (!IsSupported(input_fourcc, output_format)) {
+    VLOGF(1) << "Unsupported conversion from fourcc 0x" << std::hex
+             << input_fourcc << " to format " << std::dec << output_format;
+    return nullptr;
+  }
+  if (size.IsEmpty()) {
+    VLOGF(1) << "Invalid size: " << size.ToString();
+    return nullptr;
+  }
+
+  std::unique_ptr<SoftwareImageProcessor> processor(
+      new SoftwareImageProcessor(input_fourcc, output_format, size));
+  if (!processor->processor_thread_.Start()) {
+    VLOGF(1) << "Failed to start processor thread";
+    return nullptr;
+  }
+  VLOGF(2) << "Converting fourcc 0x" << std::hex << input_fourcc
+           << " to format " << std::dec << output_format
+           << ", size: " << size.ToString();
+  return processor;
+}
+
+void SoftwareImageProcessor::Process(const MappedFrame& input,
+                                     const MappedFrame& output,
+                                     const base::Closure& frame_ready_cb) {
+  DCHECK(client_task_runner_->BelongsToCurrentThread());
+  processor_thread_.task_runner()->PostTask(
+      FROM_HERE,
+      base::Bind(&SoftwareImageProcessor::ProcessTask, base::Unretained(this),
+                 input, output, frame_ready_cb));
+}
+
+void SoftwareImageProcessor::ProcessTask(const MappedFrame& input,
+                                         const MappedFrame& output,
+                                         const base::Closure& frame_ready_cb) {
+  DCHECK(processor_thread_.task_runner()->BelongsToCurrentThread());
+  if (destroying_)
+    return;
+
+  const base::TimeTicks start = base::TimeTicks::Now();
+  // Without the synchronization, the CPU caches may hold stale lines of the
+  // output on platforms where the devices do not snoop them.
+  if (!SyncDmabufs(output, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE))
+    VLOGF(1) << "Writing to the output without synchronizing it";
+  ConvertLumaPlane(input, output);
+  ConvertChromaPlane(input, output);
+  SyncDmabufs(output, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+  RecordConversionTime(base::TimeTicks::Now() - start);
+
+  client_task_runner_->PostTask(FROM_HERE, frame_ready_cb);
+}
+
+// static
+bool SoftwareImageProcessor::SyncDmabufs(const MappedFrame& frame,
+                                         uint64_t flags) {
+  bool success = true;
+  for (size_t i = 0; i < frame.num_dmabufs; ++i) {
+    struct dma_buf_sync sync;
+    sync.flags = flags;
+    if (HANDLE_EINTR(ioctl(frame.dmabuf_fds[i], DMA_BUF_IOCTL_SYNC, &sync)) !=
+        0) {
+      VPLOGF(1) << "ioctl() failed: DMA_BUF_IOCTL_SYNC, flags: " << flags;
+      success = false;
+    }
+  }
+  return success;
+}
+
+void SoftwareImageProcessor::ConvertLumaPlane(const MappedFrame& input,
+                                              const MappedFrame& output) {
+  const int width = size_.width();
+  const ptrdiff_t tile_stride = kTileWidth * tile_height_;
+  for (int y = 0; y < size_.height(); ++y) {
+    uint8_t* dst = output.data[0] + y * output.stride[0];
+    if (tile_height_) {
+      DetileRow(GetTiledRow(input.data[0], input.stride[0], tile_height_, y),
+                tile_stride, dst, width);
+    } else {
+      CopyRow(input.data[0] + y * input.stride[0], dst, width);
+    }
+  }
+}
+
+void SoftwareImageProcessor::ConvertChromaPlane(const MappedFrame& input,
+                                                const MappedFrame& output) {
+  // Both dimensions are in chroma samples, the input holds a pair of bytes
+  // per sample.
+  const int width = (size_.width() + 1) / 2;
+  const int height = (size_.height() + 1) / 2;
+  const ptrdiff_t tile_stride = kTileWidth * tile_height_;
+
+  // The U and V planes of planar outputs.
+  const int u_plane = output_format_ == PIXEL_FORMAT_YV12 ? 2 : 1;
+  const int v_plane = output_format_ == PIXEL_FORMAT_YV12 ? 1 : 2;
+
+  for (int y = 0; y < height; ++y) {
+    const uint8_t* src;
+    if (tile_height_) {
+      const uint8_t* tiled_row = GetTiledRow(input.data[1], input.stride[1],
+                                             tile_height_, y);
+      if (output_format_ == PIXEL_FORMAT_NV12) {
+        DetileRow(tiled_row, tile_stride,
+                  output.data[1] + y * output.stride[1], width * 2);
+        continue;
+      }
+      DetileRow(tiled_row, tile_stride, chroma_row_.data(), width * 2);
+      src = chroma_row_.data();
+    } else {
+      src = input.data[1] + y * input.stride[1];
+    }
+
+    if (output_format_ == PIXEL_FORMAT_NV12) {
+      CopyRow(src, output.data[1] + y * output.stride[1], width * 2);
+    } else {
+      SplitUVRow(src, output.data[u_plane] + y * output.stride[u_plane],
+                 output.data[v_plane] + y * output.stride[v_plane], width);
+    }
+  }
+}
+
+void SoftwareImageProcessor::RecordConversionTime(base::TimeDelta elapsed) {
+  frames_converted_++;
+  total_conversion_time_ += elapsed;
+  if (elapsed > max_conversion_time_)
+    max_conversion_time_ = elapsed;
+  if (frames_converted_ % kStatsLogInterval == 0)
+    LogConversionStats();
+}
+
+void SoftwareImageProcessor::LogConversionStats() const {
+  VLOGF(3) << "Converted " << frames_converted_ << " frames of "
+           << size_.ToString() << ", average: "
+           << total_conversion_time_.InMicroseconds() / frames_converted_
+           << " us, max: " << max_conversion_time_.InMicroseconds() << " us";
+}
+
+}  // namespace media
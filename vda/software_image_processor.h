@@ -0,0 +1,126 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SOFTWARE_IMAGE_PROCESSOR_H_
+#define SOFTWARE_IMAGE_PROCESSOR_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/single_thread_task_runner.h"
+#include "base/threading/thread.h"
+#include "base/time/time.h"
+#include "size.h"
+#include "video_pixel_format.h"
+
+namespace media {
+
+// Converts decoded frames from the pixel format written by a V4L2 decoder to
+// the pixel format of the client buffers, on the CPU. This handles the tiled
+// formats some decoders produce, which clients cannot use directly, and the
+// conversions between the semi-planar and planar 4:2:0 formats.
+//
+// Frames are converted on a thread owned by this class, in the order they are
+// passed to Process(), so that the decoder can keep decoding while earlier
+// frames are being converted.
+class SoftwareImageProcessor {
+ public:
+  enum { kMaxPlanes = 3 };
+
+  // A frame mapped in memory, with its planes in the order of its pixel
+  // format, e.g. Y, UV for NV12 and Y, V, U for YV12. If the frame is in
+  // dmabufs, |dmabuf_fds| are the |num_dmabufs| of them, whose CPU access is
+  // synchronized with DMA_BUF_IOCTL_SYNC.
+  struct MappedFrame {
+    MappedFrame();
+    uint8_t* data[kMaxPlanes];
+    int stride[kMaxPlanes];
+    int dmabuf_fds[kMaxPlanes];
+    size_t num_dmabufs;
+  };
+
+  ~SoftwareImageProcessor();
+
+  // Returns true if frames of V4L2 format |input_fourcc| can be converted to
+  // |output_format|.
+  static bool IsSupported(uint32_t input_fourcc,
+                          VideoPixelFormat output_format);
+
+  // Returns a processor converting the |size| top-left pixels of frames of
+  // V4L2 format |input_fourcc| to |output_format|, or nullptr on failure.
+  static std::unique_ptr<SoftwareImageProcessor> Create(
+      uint32_t input_fourcc,
+      VideoPixelFormat output_format,
+      const Size& size);
+
+  // Convert |input| to |output| and run |frame_ready_cb| on the thread
+  // calling this method once done. Both frames must stay mapped until then,
+  // or until the processor is destroyed. Frames that are not converted yet
+  // when the processor is destroyed are dropped, and their |frame_ready_cb| is
+  // not run.
+  void Process(const MappedFrame& input,
+               const MappedFrame& output,
+               const base::Closure& frame_ready_cb);
+
+ private:
+  SoftwareImageProcessor(uint32_t input_fourcc,
+                         VideoPixelFormat output_format,
+                         const Size& size);
+
+  // Conversion task, run on |processor_thread_|.
+  void ProcessTask(const MappedFrame& input,
+                   const MappedFrame& output,
+                   const base::Closure& frame_ready_cb);
+
+  // Start or end the CPU access to the dmabufs of |frame|, as in
+  // struct dma_buf_sync. Return false on failure.
+  static bool SyncDmabufs(const MappedFrame& frame, uint64_t flags);
+
+  void ConvertLumaPlane(const MappedFrame& input, const MappedFrame& output);
+  void ConvertChromaPlane(const MappedFrame& input, const MappedFrame& output);
+
+  // Account the cost of one conversion, and log the statistics periodically.
+  void RecordConversionTime(base::TimeDelta elapsed);
+  void LogConversionStats() const;
+
+  const uint32_t input_fourcc_;
+  const VideoPixelFormat output_format_;
+  const Size size_;
+
+  // Height of the tiles of the input planes, 0 if they are linear.
+  const int tile_height_;
+
+  // Task runner of the thread calling Process(), |frame_ready_cb| runs on it.
+  scoped_refptr<base::SingleThreadTaskRunner> client_task_runner_;
+
+  base::Thread processor_thread_;
+
+  // Set in the destructor to drop the frames not converted yet.
+  std::atomic<bool> destroying_;
+
+  //
+  // State owned by |processor_thread_|.
+  //
+
+  // Linear copy of a tiled chroma row, for the conversions that cannot detile
+  // directly to the output.
+  std::vector<uint8_t> chroma_row_;
+
+  // Per-frame conversion cost.
+  int64_t frames_converted_;
+  base::TimeDelta total_conversion_time_;
+  base::TimeDelta max_conversion_time_;
+
+  DISALLOW_COPY_AND_ASSIGN(SoftwareImageProcessor);
+};
+
+}  // namespace media
+
+#endif  // SOFTWARE_IMAGE_PROCESSOR_H_
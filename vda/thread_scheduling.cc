@@ -0,0 +1,201 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "thread_scheduling.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include <cutils/properties.h>
+
+#include "base/bind.h"
+#include "base/bind_helpers.h"
+#include "base/logging.h"
+#include "base/single_thread_task_runner.h"
+
+#define VLOGF(level) VLOG(level) << __func__ << "(): "
+#define VPLOGF(level) VPLOG(level) << __func__ << "(): "
+
+namespace media {
+
+namespace {
+
+const int kMinNiceValue = -20;
+const int kMaxNiceValue = 19;
+const int kMaxRealtimePriority = 99;
+const int kMaxCpus = 64;
+
+pid_t GetCurrentThreadId() {
+  return static_cast<pid_t>(syscall(SYS_gettid));
+}
+
+// Parses |str| as an integer of base |base|, 0 to accept the 0x prefix.
+bool ParseInteger(const std::string& str, int base, long long* value) {
+  if (str.empty())
+    return false;
+  char* end = nullptr;
+  errno = 0;
+  long long parsed = strtoll(str.c_str(), &end, base);
+  if (errno != 0 || *end != '\0')
+    return false;
+  *value = parsed;
+  return true;
+}
+
+}  // namespace
+
+ThreadSchedulingConfig::ThreadSchedulingConfig()
+    : has_nice_value(false),
+      nice_value(0),
+      realtime_priority(0),
+      cpu_affinity_mask(0) {}
+
+bool ThreadSchedulingConfig::IsDefault() const {
+  return !has_nice_value && realtime_priority == 0 && cpu_affinity_mask == 0;
+}
+
+std::string ThreadSchedulingConfig::AsHumanReadableString() const {
+  std::ostringstream s;
+  if (realtime_priority > 0)
+    s << "SCHED_FIFO priority " << realtime_priority;
+  else if (has_nice_value)
+    s << "nice " << nice_value;
+  else
+    s << "default priority";
+  if (cpu_affinity_mask != 0)
+    s << ", CPUs 0x" << std::hex << cpu_affinity_mask;
+  return s.str();
+}
+
+bool ParseThreadSchedulingConfig(const std::string& str,
+                                 ThreadSchedulingConfig* config) {
+  ThreadSchedulingConfig parsed;
+  std::istringstream items(str);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    const size_t separator = item.find('=');
+    if (separator == std::string::npos) {
+      VLOGF(1) << "Malformed item: " << item;
+      return false;
+    }
+    const std::string key = item.substr(0, separator);
+    long long value;
+    if (!ParseInteger(item.substr(separator + 1), 0, &value)) {
+      VLOGF(1) << "Malformed value: " << item;
+      return false;
+    }
+
+    if (key == "nice" && value >= kMinNiceValue && value <= kMaxNiceValue) {
+      parsed.has_nice_value = true;
+      parsed.nice_value = static_cast<int>(value);
+    } else if (key == "rtprio" && value >= 0 &&
+               value <= kMaxRealtimePriority) {
+      parsed.realtime_priority = static_cast<int>(value);
+    } else if (key == "cpus" && value >= 0) {
+      parsed.cpu_affinity_mask = static_cast<uint64_t>(value);
+    } else {
+      VLOGF(1) << "Unknown key or value out of range: " << item;
+      return false;
+    }
+  }
+
+  *config = parsed;
+  return true;
+}
+
+ThreadSchedulingConfig GetThreadSchedulingConfigFromProperty(
+    const char* property) {
+  char value[PROPERTY_VALUE_MAX];
+  property_get(property, value, "");
+  ThreadSchedulingConfig config;
+  if (!ParseThreadSchedulingConfig(value, &config))
+    LOG(WARNING) << "Ignoring malformed " << property << ": \"" << value
+                 << "\"";
+  return config;
+}
+
+bool ApplyThreadSchedulingConfig(const ThreadSchedulingConfig& config) {
+  const pid_t tid = GetCurrentThreadId();
+  bool applied = true;
+
+  if (config.cpu_affinity_mask != 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < kMaxCpus; ++cpu) {
+      if (config.cpu_affinity_mask & (1ull << cpu))
+        CPU_SET(cpu, &cpus);
+    }
+    if (sched_setaffinity(tid, sizeof(cpus), &cpus) != 0) {
+      VPLOGF(1) << "sched_setaffinity() failed, mask 0x" << std::hex
+                << config.cpu_affinity_mask;
+      applied = false;
+    }
+  }
+
+  if (config.realtime_priority > 0) {
+    struct sched_param param = {};
+    param.sched_priority = config.realtime_priority;
+    if (sched_setscheduler(tid, SCHED_FIFO, &param) != 0) {
+      VPLOGF(1) << "sched_setscheduler() failed, priority "
+                << config.realtime_priority;
+      applied = false;
+    }
+  } else if (config.has_nice_value) {
+    if (setpriority(PRIO_PROCESS, tid, config.nice_value) != 0) {
+      VPLOGF(1) << "setpriority() failed, nice " << config.nice_value;
+      applied = false;
+    }
+  }
+
+  VLOGF(2) << "Thread " << tid << ": " << config.AsHumanReadableString()
+           << (applied ? "" : " (partially applied)");
+  return applied;
+}
+
+void PostApplyThreadSchedulingConfig(
+    const scoped_refptr<base::SingleThreadTaskRunner>& task_runner,
+    const ThreadSchedulingConfig& config) {
+  if (config.IsDefault())
+    return;
+  task_runner->PostTask(
+      FROM_HERE,
+      base::Bind(base::IgnoreResult(&ApplyThreadSchedulingConfig), config));
+}
+
+ThreadSchedulingConfig GetCurrentThreadSchedulingConfig() {
+  const pid_t tid = GetCurrentThreadId();
+  ThreadSchedulingConfig config;
+
+  if (sched_getscheduler(tid) == SCHED_FIFO) {
+    struct sched_param param = {};
+    if (sched_getparam(tid, &param) == 0)
+      config.realtime_priority = param.sched_priority;
+  } else {
+    // getpriority() can legitimately return -1.
+    errno = 0;
+    const int nice_value = getpriority(PRIO_PROCESS, tid);
+    if (errno == 0) {
+      config.has_nice_value = true;
+      config.nice_value = nice_value;
+    }
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (sched_getaffinity(tid, sizeof(cpus), &cpus) == 0) {
+    for (int cpu = 0; cpu < kMaxCpus; ++cpu) {
+      if (CPU_ISSET(cpu, &cpus))
+        config.cpu_affinity_mask |= 1ull << cpu;
+    }
+  }
+  return config;
+}
+
+}  // namespace media
@@ -0,0 +1,78 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef THREAD_SCHEDULING_H_
+#define THREAD_SCHEDULING_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "base/memory/ref_counted.h"
+
+namespace base {
+class SingleThreadTaskRunner;
+}
+
+namespace media {
+
+// Scheduling parameters of a thread of the decode pipeline. Threads are
+// created with the scheduling of the thread starting them, which lets the
+// scheduler place latency sensitive threads, e.g. the decoder thread, on
+// little cores of big.LITTLE systems and miss frame deadlines under load.
+struct ThreadSchedulingConfig {
+  ThreadSchedulingConfig();
+
+  // Returns true if no parameter is set, i.e. applying the config does not
+  // change the scheduling of the thread.
+  bool IsDefault() const;
+
+  std::string AsHumanReadableString() const;
+
+  // Nice value of the thread, from -20 to 19, used if |has_nice_value| is set
+  // and |realtime_priority| is not.
+  bool has_nice_value;
+  int nice_value;
+
+  // SCHED_FIFO priority of the thread, from 1 to 99, or 0 to keep the thread
+  // in SCHED_OTHER.
+  int realtime_priority;
+
+  // Bit i allows the thread to run on CPU i, 0 to keep the affinity of the
+  // thread.
+  uint64_t cpu_affinity_mask;
+};
+
+// Parses |str|, a comma-separated list of "nice=<n>", "rtprio=<n>" and
+// "cpus=<mask>" items, e.g. "nice=-10,cpus=0xf0", into |config|. An empty
+// string is the default config. Returns false if |str| is malformed or a
+// value is out of range, leaving |config| unchanged.
+bool ParseThreadSchedulingConfig(const std::string& str,
+                                 ThreadSchedulingConfig* config);
+
+// Returns the config of system property |property|, parsed by
+// ParseThreadSchedulingConfig(), or the default config if it is not set or is
+// malformed.
+ThreadSchedulingConfig GetThreadSchedulingConfigFromProperty(
+    const char* property);
+
+// Applies |config| to the calling thread. All the parameters are attempted
+// even if one fails, e.g. SCHED_FIFO without the privilege to use it. Returns
+// true if all of them were applied.
+bool ApplyThreadSchedulingConfig(const ThreadSchedulingConfig& config);
+
+// Applies |config| to the thread of |task_runner|, unless it is the default
+// config. Posted right after the thread is started, this runs before any other
+// task of the thread.
+void PostApplyThreadSchedulingConfig(
+    const scoped_refptr<base::SingleThreadTaskRunner>& task_runner,
+    const ThreadSchedulingConfig& config);
+
+// Returns the scheduling parameters of the calling thread. Only the first 64
+// CPUs are reported in |cpu_affinity_mask|.
+ThreadSchedulingConfig GetCurrentThreadSchedulingConfig();
+
+}  // namespace media
+
+#endif  // THREAD_SCHEDULING_H_
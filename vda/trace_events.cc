@@ -0,0 +1,46 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#define ATRACE_TAG ATRACE_TAG_VIDEO
+
+#include "trace_events.h"
+
+#include <stdio.h>
+
+#include <cutils/trace.h>
+
+namespace media {
+
+const char kBitstreamBufferTraceName[] = "V4L2 bitstream buffer";
+const char kWorkTraceName[] = "C2VDA work";
+
+ScopedTraceEvent::ScopedTraceEvent(const char* name)
+    : began_(ATRACE_ENABLED()) {
+  if (began_)
+    ATRACE_BEGIN(name);
+}
+
+ScopedTraceEvent::ScopedTraceEvent(const char* name, int32_t bitstream_id)
+    : began_(ATRACE_ENABLED()) {
+  if (!began_)
+    return;
+  char slice_name[64];
+  snprintf(slice_name, sizeof(slice_name), "%s %d", name, bitstream_id);
+  ATRACE_BEGIN(slice_name);
+}
+
+ScopedTraceEvent::~ScopedTraceEvent() {
+  if (began_)
+    ATRACE_END();
+}
+
+void TraceAsyncBegin(const char* name, int32_t bitstream_id) {
+  ATRACE_ASYNC_BEGIN(name, bitstream_id);
+}
+
+void TraceAsyncEnd(const char* name, int32_t bitstream_id) {
+  ATRACE_ASYNC_END(name, bitstream_id);
+}
+
+}  // namespace media
@@ -0,0 +1,50 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef TRACE_EVENTS_H_
+#define TRACE_EVENTS_H_
+
+#include <stdint.h>
+
+#include "base/macros.h"
+
+namespace media {
+
+// Trace events of the decode pipeline, written to the ftrace trace_marker
+// through atrace under the "video" category, so that they can be viewed in
+// systrace or Perfetto along with the events of the V4L2 driver. They cost a
+// flag check when tracing is off.
+//
+// The journey of a frame is followed by its bitstream id: the slices of each
+// stage have it in their name, and the async slices spanning several stages
+// use it as cookie.
+
+// Names of the async slices: a bitstream buffer in a VDA, from its decode
+// task to the end of its use, and a C2 work in the component, from queue_nb()
+// to onWorkDone_nb().
+extern const char kBitstreamBufferTraceName[];
+extern const char kWorkTraceName[];
+
+// Slice on the calling thread, from construction to destruction, named
+// "|name| |bitstream_id|", or |name| for the stages handling several frames.
+class ScopedTraceEvent {
+ public:
+  explicit ScopedTraceEvent(const char* name);
+  ScopedTraceEvent(const char* name, int32_t bitstream_id);
+  ~ScopedTraceEvent();
+
+ private:
+  bool began_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTraceEvent);
+};
+
+// Begin and end the async slice |name| of |bitstream_id|. The end may happen
+// on another thread than the beginning.
+void TraceAsyncBegin(const char* name, int32_t bitstream_id);
+void TraceAsyncEnd(const char* name, int32_t bitstream_id);
+
+}  // namespace media
+
+#endif  // TRACE_EVENTS_H_
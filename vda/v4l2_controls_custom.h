@@ -19,6 +19,16 @@
 #define V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAM (V4L2_CID_MPEG_BASE+387)
 #define V4L2_CID_MPEG_VIDEO_H264_SPS_PPS_BEFORE_IDR (V4L2_CID_MPEG_BASE+388)
 
+// Decoding mode of the driver, as defined by the staging H.264 stateless
+// controls of Linux 5.3, for headers that predate them.
+#ifndef V4L2_CID_MPEG_VIDEO_H264_DECODE_MODE
+#define V4L2_CID_MPEG_VIDEO_H264_DECODE_MODE (V4L2_CID_MPEG_BASE+1015)
+enum v4l2_mpeg_video_h264_decode_mode {
+  V4L2_MPEG_VIDEO_H264_DECODE_MODE_SLICE_BASED,
+  V4L2_MPEG_VIDEO_H264_DECODE_MODE_FRAME_BASED,
+};
+#endif
+
 #define V4L2_CID_MPEG_VIDEO_VP8_FRAME_HDR (V4L2_CID_MPEG_BASE+512)
 
 #define V4L2_CID_MPEG_VIDEO_VP9_FRAME_HDR (V4L2_CID_MPEG_BASE+513)
@@ -11,11 +11,15 @@
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 #include "base/numerics/safe_conversions.h"
 #include "base/posix/eintr_wrapper.h"
 #include "base/strings/stringprintf.h"
 #include "v4l2_device.h"
+#include "v4l2_device_selector.h"
 
 #define DVLOGF(level) DVLOG(level) << __func__ << "(): "
 #define VLOGF(level) VLOG(level) << __func__ << "(): "
@@ -23,10 +27,15 @@
 
 namespace media {
 
-V4L2Device::V4L2Device() {}
+V4L2Device::V4L2Device()
+    : session_macroblock_rate_(0), out_of_capacity_(false) {}
 
 V4L2Device::~V4L2Device() {
   CloseDevice();
+  if (!session_path_.empty()) {
+    V4L2DeviceSelector::GetInstance()->ReleaseNode(session_path_,
+                                                   session_macroblock_rate_);
+  }
 }
 
 // static
@@ -149,11 +158,43 @@ std::vector<VideoCodecProfile> V4L2Device::V4L2PixFmtToVideoCodecProfiles(
 
 int V4L2Device::Ioctl(int request, void* arg) {
   DCHECK(device_fd_.is_valid());
-  return HANDLE_EINTR(ioctl(device_fd_.get(), request, arg));
+  return IoctlOnFd(device_fd_.get(), request, arg);
+}
+
+void V4L2Device::EnableIoctlStats() {
+  if (!ioctl_stats_)
+    ioctl_stats_.reset(new V4L2IoctlStats());
+}
+
+std::vector<V4L2IoctlStats::RequestStats> V4L2Device::GetIoctlStatsSnapshot()
+    const {
+  if (!ioctl_stats_)
+    return std::vector<V4L2IoctlStats::RequestStats>();
+  return ioctl_stats_->GetSnapshot();
+}
+
+int V4L2Device::IoctlOnFd(int fd, int request, void* arg) {
+  if (!ioctl_stats_)
+    return HANDLE_EINTR(ioctl(fd, request, arg));
+
+  const base::TimeTicks start = base::TimeTicks::Now();
+  const int ret = HANDLE_EINTR(ioctl(fd, request, arg));
+  const int error = errno;
+  ioctl_stats_->Record(static_cast<uint32_t>(request), ret, error,
+                       base::TimeTicks::Now() - start);
+  // Callers log the failures with PLOG.
+  errno = error;
+  return ret;
 }
 
 bool V4L2Device::Poll(bool poll_device, bool* event_pending) {
-  struct pollfd pollfds[2];
+  return Poll(poll_device, std::vector<int>(), event_pending);
+}
+
+bool V4L2Device::Poll(bool poll_device,
+                      const std::vector<int>& request_fds,
+                      bool* event_pending) {
+  std::vector<struct pollfd> pollfds(2 + request_fds.size());
   nfds_t nfds;
   int pollfd = -1;
 
@@ -169,7 +210,14 @@ bool V4L2Device::Poll(bool poll_device, bool* event_pending) {
     nfds++;
   }
 
-  if (HANDLE_EINTR(poll(pollfds, nfds, -1)) == -1) {
+  // A completed request signals POLLPRI on its fd.
+  for (int request_fd : request_fds) {
+    pollfds[nfds].fd = request_fd;
+    pollfds[nfds].events = POLLPRI;
+    nfds++;
+  }
+
+  if (HANDLE_EINTR(poll(pollfds.data(), nfds, -1)) == -1) {
     VPLOGF(1) << "poll() failed";
     return false;
   }
@@ -219,20 +267,120 @@ bool V4L2Device::ClearDevicePollInterrupt() {
   return true;
 }
 
+bool V4L2Device::OpenMediaDevice() {
+  DCHECK(device_fd_.is_valid());
+  DCHECK(!media_fd_.is_valid());
+
+  struct v4l2_capability caps;
+  memset(&caps, 0, sizeof(caps));
+  if (Ioctl(VIDIOC_QUERYCAP, &caps) != 0) {
+    VPLOGF(1) << "ioctl() failed: VIDIOC_QUERYCAP";
+    return false;
+  }
+
+  // As for video devices, we can't list the directory, so try the first 10
+  // media devices and pick the one on the same bus as the video device.
+  for (int i = 0; i < 10; ++i) {
+    const std::string path = base::StringPrintf("/dev/media%d", i);
+    base::ScopedFD media_fd(
+        HANDLE_EINTR(open(path.c_str(), O_RDWR | O_CLOEXEC)));
+    if (!media_fd.is_valid())
+      continue;
+
+    struct media_device_info info;
+    memset(&info, 0, sizeof(info));
+    if (HANDLE_EINTR(ioctl(media_fd.get(), MEDIA_IOC_DEVICE_INFO, &info)) != 0)
+      continue;
+    if (strncmp(reinterpret_cast<const char*>(caps.bus_info), info.bus_info,
+                std::min(sizeof(caps.bus_info), sizeof(info.bus_info))) != 0) {
+      continue;
+    }
+
+    // Drivers without request support reject the allocation.
+    int request_fd;
+    if (HANDLE_EINTR(ioctl(media_fd.get(), MEDIA_IOC_REQUEST_ALLOC,
+                           &request_fd)) != 0) {
+      VLOGF(2) << path << " does not support requests";
+      return false;
+    }
+    close(request_fd);
+
+    VLOGF(2) << "Using media device " << path;
+    media_fd_ = std::move(media_fd);
+    return true;
+  }
+
+  return false;
+}
+
+base::ScopedFD V4L2Device::AllocateMediaRequest() {
+  DCHECK(media_fd_.is_valid());
+  int request_fd;
+  if (IoctlOnFd(media_fd_.get(), MEDIA_IOC_REQUEST_ALLOC, &request_fd) != 0) {
+    VPLOGF(1) << "ioctl() failed: MEDIA_IOC_REQUEST_ALLOC";
+    return base::ScopedFD();
+  }
+  return base::ScopedFD(request_fd);
+}
+
+bool V4L2Device::QueueMediaRequest(int request_fd) {
+  if (IoctlOnFd(request_fd, MEDIA_REQUEST_IOC_QUEUE, nullptr) != 0) {
+    VPLOGF(1) << "ioctl() failed: MEDIA_REQUEST_IOC_QUEUE";
+    return false;
+  }
+  return true;
+}
+
+bool V4L2Device::IsMediaRequestCompleted(int request_fd) {
+  struct pollfd pollfd;
+  pollfd.fd = request_fd;
+  pollfd.events = POLLPRI;
+  pollfd.revents = 0;
+  int ret = HANDLE_EINTR(poll(&pollfd, 1, 0));
+  if (ret < 0) {
+    VPLOGF(1) << "poll() failed";
+    return false;
+  }
+  return ret > 0 && (pollfd.revents & POLLPRI);
+}
+
+bool V4L2Device::ReinitMediaRequest(int request_fd) {
+  if (IoctlOnFd(request_fd, MEDIA_REQUEST_IOC_REINIT, nullptr) != 0) {
+    VPLOGF(1) << "ioctl() failed: MEDIA_REQUEST_IOC_REINIT";
+    return false;
+  }
+  return true;
+}
+
 bool V4L2Device::Open(Type type, uint32_t v4l2_pixfmt) {
   VLOGF(2);
-  std::string path = GetDevicePathFor(type, v4l2_pixfmt);
+  DCHECK(session_path_.empty());
+  std::vector<std::string> paths = GetDevicePathsFor(type, v4l2_pixfmt);
 
-  if (path.empty()) {
+  if (paths.empty()) {
     VLOGF(1) << "No devices supporting " << std::hex << "0x" << v4l2_pixfmt
              << " for type: " << static_cast<int>(type);
     return false;
   }
 
+  V4L2DeviceSelector* selector = V4L2DeviceSelector::GetInstance();
+  for (const auto& path : paths) {
+    if (!selector->HasNodeCapacity(path))
+      ProbeNodeCapacity(path, type, v4l2_pixfmt);
+  }
+
+  std::string path = selector->AcquireNode(paths, session_macroblock_rate_);
+  if (path.empty()) {
+    out_of_capacity_ = true;
+    return false;
+  }
   if (!OpenDevicePath(path, type)) {
     VLOGF(1) << "Failed opening " << path;
+    selector->ReleaseNode(path, session_macroblock_rate_);
     return false;
   }
+  session_path_ = path;
+  VLOGF(2) << "Opened " << path << " among " << paths.size() << " devices";
 
   device_poll_interrupt_fd_.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
   if (!device_poll_interrupt_fd_.is_valid()) {
@@ -243,6 +391,35 @@ bool V4L2Device::Open(Type type, uint32_t v4l2_pixfmt) {
   return true;
 }
 
+void V4L2Device::SetSessionMacroblockRate(uint64_t macroblock_rate) {
+  if (!session_path_.empty()) {
+    V4L2DeviceSelector::GetInstance()->UpdateSession(
+        session_path_, session_macroblock_rate_, macroblock_rate);
+  }
+  session_macroblock_rate_ = macroblock_rate;
+}
+
+void V4L2Device::ProbeNodeCapacity(const std::string& path,
+                                   Type type,
+                                   uint32_t v4l2_pixfmt) {
+  // The devices do not report their throughput, they are assumed to decode
+  // their maximum resolution in real time. A node failing to be probed is
+  // recorded with an unknown capacity, so that it is not probed again by each
+  // session.
+  Size max_resolution;
+  if (OpenDevicePath(path, type)) {
+    Size min_resolution;
+    GetSupportedResolution(v4l2_pixfmt, &min_resolution, &max_resolution);
+    CloseDevice();
+  } else {
+    VLOGF(1) << "Failed opening " << path << " to probe its capacity";
+  }
+
+  V4L2DeviceSelector::GetInstance()->SetNodeCapacity(
+      path, V4L2DeviceSelector::GetMacroblockRate(max_resolution,
+                                                  kProbedFrameRate));
+}
+
 std::vector<base::ScopedFD> V4L2Device::GetDmabufsForV4L2Buffer(
     int index,
     size_t num_planes,
@@ -403,6 +580,7 @@ bool V4L2Device::OpenDevicePath(const std::string& path, Type type) {
 
 void V4L2Device::CloseDevice() {
   VLOGF(2);
+  media_fd_.reset();
   device_fd_.reset();
 }
 
@@ -461,16 +639,18 @@ const V4L2Device::Devices& V4L2Device::GetDevicesForType(Type type) {
   return devices_by_type_[type];
 }
 
-std::string V4L2Device::GetDevicePathFor(Type type, uint32_t pixfmt) {
+std::vector<std::string> V4L2Device::GetDevicePathsFor(Type type,
+                                                       uint32_t pixfmt) {
   const Devices& devices = GetDevicesForType(type);
 
+  std::vector<std::string> paths;
   for (const auto& device : devices) {
     if (std::find(device.second.begin(), device.second.end(), pixfmt) !=
         device.second.end())
-      return device.first;
+      paths.push_back(device.first);
   }
 
-  return std::string();
+  return paths;
 }
 
 }  //  namespace media
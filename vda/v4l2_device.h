@@ -11,13 +11,18 @@
 #ifndef V4L2_DEVICE_H_
 #define V4L2_DEVICE_H_
 
+#include <linux/media.h>
 #include <map>
+#include <memory>
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/files/scoped_file.h"
 #include "base/memory/ref_counted.h"
 #include "size.h"
+#include "v4l2_ioctl_stats.h"
 #include "video_codecs.h"
 #include "video_decode_accelerator.h"
 #include "video_pixel_format.h"
@@ -29,6 +34,19 @@
 #define V4L2_BUF_FLAG_LAST 0x00100000
 #endif
 
+// Media Request API, from Linux 4.20 headers.
+#ifndef MEDIA_IOC_REQUEST_ALLOC
+#define MEDIA_IOC_REQUEST_ALLOC _IOR('|', 0x05, int)
+#define MEDIA_REQUEST_IOC_QUEUE _IO('|', 0x80)
+#define MEDIA_REQUEST_IOC_REINIT _IO('|', 0x81)
+#endif
+#ifndef V4L2_BUF_FLAG_REQUEST_FD
+#define V4L2_BUF_FLAG_REQUEST_FD 0x00800000
+#endif
+#ifndef V4L2_CTRL_WHICH_REQUEST_VAL
+#define V4L2_CTRL_WHICH_REQUEST_VAL 0x0f010000
+#endif
+
 namespace media {
 
 // Implemented for decoder usage only.
@@ -53,15 +71,38 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
     kJpegDecoder,
   };
 
-  // Open a V4L2 device of |type| for use with |v4l2_pixfmt|.
-  // Return true on success.
+  // Open a V4L2 device of |type| for use with |v4l2_pixfmt|. If several
+  // device nodes support it, the least loaded one with enough capacity left
+  // for the session is chosen by V4L2DeviceSelector, and the session is
+  // accounted on it until this object is destroyed.
+  // Return true on success. On failure, IsOutOfCapacity() tells whether it
+  // is because no node has enough capacity left.
   // The device will be closed in the destructor.
   bool Open(Type type, uint32_t v4l2_pixfmt);
 
+  // Set the macroblock rate of the session, in macroblocks per second. This
+  // is its expected load if called before Open(), and is accounted in the
+  // load of its node once open.
+  void SetSessionMacroblockRate(uint64_t macroblock_rate);
+
+  // Return true if Open() failed because every device node supporting the
+  // format is at the capacity configured for it.
+  bool IsOutOfCapacity() const { return out_of_capacity_; }
+
   // Parameters and return value are the same as for the standard ioctl() system
   // call.
   int Ioctl(int request, void* arg);
 
+  // Start recording the count, failures and latency of the ioctls issued on
+  // the device and its media requests, by request code. Must be called before
+  // the device is used from several threads. Disabled by default, as it reads
+  // the clock twice per ioctl.
+  void EnableIoctlStats();
+
+  // Return the counters recorded since EnableIoctlStats(), or an empty vector
+  // if it was not called.
+  std::vector<V4L2IoctlStats::RequestStats> GetIoctlStatsSnapshot() const;
+
   // This method sleeps until either:
   // - SetDevicePollInterrupt() is called (on another thread),
   // - |poll_device| is true, and there is new data to be read from the device,
@@ -71,6 +112,12 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
   // This method should be called from a separate thread.
   bool Poll(bool poll_device, bool* event_pending);
 
+  // Same as above, but also returns when one of the queued media requests
+  // |request_fds| completes.
+  bool Poll(bool poll_device,
+            const std::vector<int>& request_fds,
+            bool* event_pending);
+
   // These methods are used to interrupt the thread sleeping on Poll() and force
   // it to return regardless of device state, which is usually when the client
   // is no longer interested in what happens with the device (on cleanup,
@@ -97,6 +144,26 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
       size_t num_planes,
       enum v4l2_buf_type type);
 
+  // Open the media device of the currently open video device, for use with
+  // the Media Request API. Return true if the media device supports requests.
+  bool OpenMediaDevice();
+
+  // Allocate a new media request. Return an invalid fd on failure.
+  // Must only be called after OpenMediaDevice() returned true.
+  base::ScopedFD AllocateMediaRequest();
+
+  // Queue the request |request_fd|, with all the controls and buffers set for
+  // it, to the driver.
+  bool QueueMediaRequest(int request_fd);
+
+  // Return whether the queued request |request_fd| is completed. Does not
+  // block, Poll() can be used to wait for the completion.
+  bool IsMediaRequestCompleted(int request_fd);
+
+  // Return the completed request |request_fd| to the idle state so that it can
+  // be reused.
+  bool ReinitMediaRequest(int request_fd);
+
   // NOTE: The below methods to query capabilities have a side effect of
   // closing the previously-open device, if any, and should not be called after
   // Open().
@@ -117,6 +184,10 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
  private:
   friend class base::RefCountedThreadSafe<V4L2Device>;
 
+  // Frame rate at which the devices are assumed to decode their maximum
+  // resolution, when probing their capacity.
+  static constexpr int kProbedFrameRate = 30;
+
   // Vector of video device node paths and corresponding pixelformats supported
   // by each device node.
   using Devices = std::vector<std::pair<std::string, std::vector<uint32_t>>>;
@@ -133,6 +204,16 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
   // Close the currently open device.
   void CloseDevice();
 
+  // ioctl() on |fd|, accounted in |ioctl_stats_| if enabled.
+  int IoctlOnFd(int fd, int request, void* arg);
+
+  // Set the estimated capacity of the device node at |path| from its maximum
+  // resolution for |v4l2_pixfmt|, or an unknown one if that fails. Must be
+  // called while no device is open.
+  void ProbeNodeCapacity(const std::string& path,
+                         Type type,
+                         uint32_t v4l2_pixfmt);
+
   // Enumerate all V4L2 devices on the system for |type| and store the results
   // under devices_by_type_[type].
   void EnumerateDevicesForType(Type type);
@@ -142,9 +223,10 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
   // for subsequent calls.
   const Devices& GetDevicesForType(Type type);
 
-  // Return device node path for device of |type| supporting |pixfmt|, or
-  // an empty string if the given combination is not supported by the system.
-  std::string GetDevicePathFor(Type type, uint32_t pixfmt);
+  // Return device node paths for devices of |type| supporting |pixfmt|, in
+  // enumeration order, or an empty vector if the given combination is not
+  // supported by the system.
+  std::vector<std::string> GetDevicePathsFor(Type type, uint32_t pixfmt);
 
   // Stores information for all devices available on the system
   // for each device Type.
@@ -153,10 +235,23 @@ class V4L2Device : public base::RefCountedThreadSafe<V4L2Device> {
   // The actual device fd.
   base::ScopedFD device_fd_;
 
+  // The node path of the device opened by Open(), and the macroblock rate of
+  // the session accounted on it.
+  std::string session_path_;
+  uint64_t session_macroblock_rate_;
+  // Set if Open() failed because of the capacity of the device nodes.
+  bool out_of_capacity_;
+
+  // The media device fd, if opened by OpenMediaDevice().
+  base::ScopedFD media_fd_;
+
   // eventfd fd to signal device poll thread when its poll() should be
   // interrupted.
   base::ScopedFD device_poll_interrupt_fd_;
 
+  // Set by EnableIoctlStats().
+  std::unique_ptr<V4L2IoctlStats> ioctl_stats_;
+
   DISALLOW_COPY_AND_ASSIGN(V4L2Device);
 };
 
@@ -0,0 +1,199 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "v4l2_device_selector.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <sstream>
+
+#include "base/logging.h"
+
+#define VLOGF(level) VLOG(level) << __func__ << "(): "
+
+namespace media {
+
+// static
+const char V4L2DeviceSelector::kCapacityConfigPath[] =
+    "/vendor/etc/v4l2_codec2_device_capacity.conf";
+
+V4L2DeviceSelector::NodeLoad::NodeLoad()
+    : num_sessions(0),
+      macroblock_rate(0),
+      max_macroblock_rate(0),
+      enforced(false),
+      total_sessions(0),
+      refused_sessions(0) {}
+
+// static
+V4L2DeviceSelector* V4L2DeviceSelector::GetInstance() {
+  // Leaked on purpose, sessions may be released during process shutdown.
+  static V4L2DeviceSelector* selector = new V4L2DeviceSelector();
+  return selector;
+}
+
+// static
+uint64_t V4L2DeviceSelector::GetMacroblockRate(const Size& coded_size,
+                                               int frame_rate) {
+  const uint64_t width_in_mbs = (coded_size.width() + 15) / 16;
+  const uint64_t height_in_mbs = (coded_size.height() + 15) / 16;
+  return width_in_mbs * height_in_mbs * frame_rate;
+}
+
+V4L2DeviceSelector::V4L2DeviceSelector() {
+  ReadCapacityConfig();
+}
+
+V4L2DeviceSelector::~V4L2DeviceSelector() {}
+
+void V4L2DeviceSelector::ReadCapacityConfig() {
+  FILE* file = fopen(kCapacityConfigPath, "r");
+  if (!file)
+    return;
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    char path[128];
+    uint64_t max_macroblock_rate;
+    if (line[0] == '#' ||
+        sscanf(line, "%127s %" SCNu64, path, &max_macroblock_rate) != 2)
+      continue;
+    NodeLoad& load = loads_[path];
+    load.path = path;
+    load.max_macroblock_rate = max_macroblock_rate;
+    load.enforced = true;
+    VLOGF(2) << "Capacity of " << path << ": " << max_macroblock_rate
+             << " macroblocks/s";
+  }
+  fclose(file);
+}
+
+bool V4L2DeviceSelector::HasNodeCapacity(const std::string& path) const {
+  base::AutoLock auto_lock(lock_);
+  return loads_.count(path) > 0;
+}
+
+void V4L2DeviceSelector::SetNodeCapacity(const std::string& path,
+                                         uint64_t max_macroblock_rate) {
+  base::AutoLock auto_lock(lock_);
+  if (loads_.count(path) > 0)
+    return;
+
+  NodeLoad& load = loads_[path];
+  load.path = path;
+  load.max_macroblock_rate = max_macroblock_rate;
+  VLOGF(2) << "Estimated capacity of " << path << ": " << max_macroblock_rate
+           << " macroblocks/s";
+}
+
+std::string V4L2DeviceSelector::AcquireNode(
+    const std::vector<std::string>& paths,
+    uint64_t macroblock_rate) {
+  DCHECK(!paths.empty());
+  base::AutoLock auto_lock(lock_);
+
+  // |paths| are in enumeration order, which is kept between equally loaded
+  // nodes.
+  NodeLoad* selected = nullptr;
+  for (const auto& path : paths) {
+    NodeLoad* load = &loads_[path];
+    load->path = path;
+    if (!HasCapacityFor(*load, macroblock_rate))
+      continue;
+    if (!selected || IsLessLoaded(*load, *selected))
+      selected = load;
+  }
+
+  if (!selected) {
+    for (const auto& path : paths) {
+      loads_[path].refused_sessions++;
+      LogNodeLoad(loads_[path]);
+    }
+    VLOGF(1) << "No device has capacity left for " << macroblock_rate
+             << " macroblocks/s";
+    return std::string();
+  }
+
+  selected->num_sessions++;
+  selected->macroblock_rate += macroblock_rate;
+  selected->total_sessions++;
+  LogNodeLoad(*selected);
+  return selected->path;
+}
+
+void V4L2DeviceSelector::UpdateSession(const std::string& path,
+                                       uint64_t old_macroblock_rate,
+                                       uint64_t new_macroblock_rate) {
+  base::AutoLock auto_lock(lock_);
+  auto it = loads_.find(path);
+  DCHECK(it != loads_.end());
+  NodeLoad& load = it->second;
+  DCHECK_GE(load.macroblock_rate, old_macroblock_rate);
+  load.macroblock_rate =
+      load.macroblock_rate - old_macroblock_rate + new_macroblock_rate;
+  LogNodeLoad(load);
+}
+
+void V4L2DeviceSelector::ReleaseNode(const std::string& path,
+                                     uint64_t macroblock_rate) {
+  base::AutoLock auto_lock(lock_);
+  auto it = loads_.find(path);
+  DCHECK(it != loads_.end());
+  NodeLoad& load = it->second;
+  DCHECK_GT(load.num_sessions, 0u);
+  DCHECK_GE(load.macroblock_rate, macroblock_rate);
+  load.num_sessions--;
+  load.macroblock_rate -= macroblock_rate;
+  LogNodeLoad(load);
+}
+
+std::vector<V4L2DeviceSelector::NodeLoad> V4L2DeviceSelector::GetNodeLoads()
+    const {
+  base::AutoLock auto_lock(lock_);
+  std::vector<NodeLoad> loads;
+  for (const auto& it : loads_)
+    loads.push_back(it.second);
+  return loads;
+}
+
+// static
+bool V4L2DeviceSelector::HasCapacityFor(const NodeLoad& load,
+                                        uint64_t macroblock_rate) {
+  return !load.enforced || load.max_macroblock_rate == 0 ||
+         load.macroblock_rate + macroblock_rate <= load.max_macroblock_rate;
+}
+
+// static
+bool V4L2DeviceSelector::IsLessLoaded(const NodeLoad& a, const NodeLoad& b) {
+  if (a.max_macroblock_rate > 0 && b.max_macroblock_rate > 0) {
+    // Compare a.macroblock_rate / a.max_macroblock_rate to the ratio of b.
+    const uint64_t a_load = a.macroblock_rate * b.max_macroblock_rate;
+    const uint64_t b_load = b.macroblock_rate * a.max_macroblock_rate;
+    if (a_load != b_load)
+      return a_load < b_load;
+  } else if (a.macroblock_rate != b.macroblock_rate) {
+    return a.macroblock_rate < b.macroblock_rate;
+  }
+  return a.num_sessions < b.num_sessions;
+}
+
+// static
+std::string V4L2DeviceSelector::NodeLoadToString(const NodeLoad& load) {
+  std::ostringstream s;
+  s << load.path << ": " << load.num_sessions << " sessions, "
+    << load.macroblock_rate << "/" << load.max_macroblock_rate
+    << " macroblocks/s";
+  if (load.max_macroblock_rate > 0)
+    s << " (" << load.macroblock_rate * 100 / load.max_macroblock_rate << "%)";
+  s << ", " << load.total_sessions << " sessions assigned and "
+    << load.refused_sessions << " refused so far";
+  return s.str();
+}
+
+void V4L2DeviceSelector::LogNodeLoad(const NodeLoad& load) const {
+  VLOGF(2) << NodeLoadToString(load);
+}
+
+}  // namespace media
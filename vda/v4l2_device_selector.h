@@ -0,0 +1,124 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef V4L2_DEVICE_SELECTOR_H_
+#define V4L2_DEVICE_SELECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+#include "size.h"
+
+namespace media {
+
+// Spreads the decoding sessions of the process over the device nodes able to
+// decode their format, so that SoCs with several decoder cores, each exposed
+// as a /dev/video-dec* node, use all of them.
+//
+// The load of a node is the macroblock rate of its sessions, i.e. the sum of
+// their number of macroblocks per frame times frame rate. The capacity of a
+// node is read from |kCapacityConfigPath| if listed there, or else estimated
+// by the first V4L2Device probing it. Only the capacities of the config file
+// are enforced, i.e. the sessions which would oversubscribe every capable
+// node listed there are refused; the estimated ones only weigh the loads of
+// the nodes. The number of sessions breaks ties while the macroblock rate of
+// the sessions is not known yet. This class is thread-safe, it is shared by
+// all the V4L2Device instances.
+class V4L2DeviceSelector {
+ public:
+  // Utilisation counters of a device node.
+  struct NodeLoad {
+    NodeLoad();
+
+    std::string path;
+    // Number of sessions currently using the node.
+    size_t num_sessions;
+    // Sum of the macroblock rates of these sessions, in macroblocks per
+    // second.
+    uint64_t macroblock_rate;
+    // Maximum macroblock rate of the node, 0 if unlimited or not known yet.
+    uint64_t max_macroblock_rate;
+    // Whether |max_macroblock_rate| is read from |kCapacityConfigPath|, and
+    // sessions exceeding it are refused.
+    bool enforced;
+    // Number of sessions assigned to the node since the process started, and
+    // refused by it because of its capacity.
+    uint64_t total_sessions;
+    uint64_t refused_sessions;
+  };
+
+  // Lines of this file are a device node path and its maximum macroblock
+  // rate, separated by a space. Lines starting with '#' are ignored.
+  static const char kCapacityConfigPath[];
+
+  static V4L2DeviceSelector* GetInstance();
+
+  // Return the macroblock rate of a stream of |coded_size| at |frame_rate|.
+  static uint64_t GetMacroblockRate(const Size& coded_size, int frame_rate);
+
+  // Return true if the capacity of node |path| is set already, or probing it
+  // failed.
+  bool HasNodeCapacity(const std::string& path) const;
+
+  // Set the estimated capacity of node |path| to |max_macroblock_rate|, 0 if
+  // probing it failed, unless it is set already. It is not enforced.
+  void SetNodeCapacity(const std::string& path, uint64_t max_macroblock_rate);
+
+  // Return the least loaded node of |paths|, which must not be empty, among
+  // those with enough enforced capacity left for |macroblock_rate|, and
+  // account a new session of |macroblock_rate| on it. Return an empty string
+  // if no node has enough capacity left.
+  std::string AcquireNode(const std::vector<std::string>& paths,
+                          uint64_t macroblock_rate);
+
+  // Change the macroblock rate of a session on node |path| from
+  // |old_macroblock_rate| to |new_macroblock_rate|. Sessions are never
+  // refused here, even if the node is oversubscribed then.
+  void UpdateSession(const std::string& path,
+                     uint64_t old_macroblock_rate,
+                     uint64_t new_macroblock_rate);
+
+  // Remove a session of |macroblock_rate| from node |path|.
+  void ReleaseNode(const std::string& path, uint64_t macroblock_rate);
+
+  // Return the counters of all the nodes sessions were assigned to.
+  std::vector<NodeLoad> GetNodeLoads() const;
+
+  // Return the counters of |load| and its utilisation, for logs and dumps.
+  static std::string NodeLoadToString(const NodeLoad& load);
+
+ private:
+  V4L2DeviceSelector();
+  ~V4L2DeviceSelector();
+
+  // Read the capacities of |kCapacityConfigPath|, if it exists.
+  void ReadCapacityConfig();
+
+  // Return true if |load| has enough capacity left for |macroblock_rate|, or
+  // its capacity is not enforced.
+  static bool HasCapacityFor(const NodeLoad& load, uint64_t macroblock_rate);
+
+  // Return true if |a| is less loaded than |b|, relatively to their capacity
+  // if both are known.
+  static bool IsLessLoaded(const NodeLoad& a, const NodeLoad& b);
+
+  void LogNodeLoad(const NodeLoad& load) const;
+
+  mutable base::Lock lock_;
+  // Counters by node path, guarded by |lock_|. Nodes are added as soon as
+  // their capacity is known.
+  std::map<std::string, NodeLoad> loads_;
+
+  DISALLOW_COPY_AND_ASSIGN(V4L2DeviceSelector);
+};
+
+}  // namespace media
+
+#endif  // V4L2_DEVICE_SELECTOR_H_
@@ -0,0 +1,135 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "v4l2_ioctl_stats.h"
+
+#include <errno.h>
+#include <linux/media.h>
+
+#include <sstream>
+
+#include "base/strings/stringprintf.h"
+#include "v4l2_device.h"
+#include "videodev2_custom.h"
+
+namespace media {
+
+V4L2IoctlStats::RequestStats::RequestStats()
+    : request(0),
+      calls(0),
+      failures(0),
+      eagain_failures(0),
+      latency_histogram() {}
+
+V4L2IoctlStats::V4L2IoctlStats() {}
+
+V4L2IoctlStats::~V4L2IoctlStats() {}
+
+// static
+std::string V4L2IoctlStats::RequestToString(uint32_t request) {
+#define REQUEST_NAME(x) \
+  case x:               \
+    return #x;
+  switch (request) {
+    REQUEST_NAME(VIDIOC_QUERYCAP)
+    REQUEST_NAME(VIDIOC_ENUM_FMT)
+    REQUEST_NAME(VIDIOC_G_FMT)
+    REQUEST_NAME(VIDIOC_S_FMT)
+    REQUEST_NAME(VIDIOC_TRY_FMT)
+    REQUEST_NAME(VIDIOC_REQBUFS)
+    REQUEST_NAME(VIDIOC_QUERYBUF)
+    REQUEST_NAME(VIDIOC_QBUF)
+    REQUEST_NAME(VIDIOC_DQBUF)
+    REQUEST_NAME(VIDIOC_EXPBUF)
+    REQUEST_NAME(VIDIOC_STREAMON)
+    REQUEST_NAME(VIDIOC_STREAMOFF)
+    REQUEST_NAME(VIDIOC_G_CTRL)
+    REQUEST_NAME(VIDIOC_S_CTRL)
+    REQUEST_NAME(VIDIOC_G_EXT_CTRLS)
+    REQUEST_NAME(VIDIOC_S_EXT_CTRLS)
+    REQUEST_NAME(VIDIOC_QUERYCTRL)
+    REQUEST_NAME(VIDIOC_QUERY_EXT_CTRL)
+    REQUEST_NAME(VIDIOC_G_SELECTION)
+    REQUEST_NAME(VIDIOC_G_CROP)
+    REQUEST_NAME(VIDIOC_ENUM_FRAMESIZES)
+    REQUEST_NAME(VIDIOC_SUBSCRIBE_EVENT)
+    REQUEST_NAME(VIDIOC_DQEVENT)
+    REQUEST_NAME(VIDIOC_DECODER_CMD)
+    REQUEST_NAME(VIDIOC_TRY_DECODER_CMD)
+    REQUEST_NAME(MEDIA_IOC_REQUEST_ALLOC)
+    REQUEST_NAME(MEDIA_REQUEST_IOC_QUEUE)
+    REQUEST_NAME(MEDIA_REQUEST_IOC_REINIT)
+  }
+#undef REQUEST_NAME
+  return base::StringPrintf("0x%x", request);
+}
+
+// static
+base::TimeDelta V4L2IoctlStats::GetBucketLowerBound(size_t bucket) {
+  return bucket == 0 ? base::TimeDelta()
+                     : base::TimeDelta::FromMicroseconds(1ll << bucket);
+}
+
+// static
+size_t V4L2IoctlStats::GetBucket(base::TimeDelta elapsed) {
+  size_t bucket = 0;
+  for (int64_t us = elapsed.InMicroseconds() >> 1;
+       us > 0 && bucket + 1 < kNumLatencyBuckets; us >>= 1) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+void V4L2IoctlStats::Record(uint32_t request,
+                            int result,
+                            int error,
+                            base::TimeDelta elapsed) {
+  const size_t bucket = GetBucket(elapsed);
+
+  base::AutoLock auto_lock(lock_);
+  RequestStats& stats = stats_[request];
+  stats.request = request;
+  stats.calls++;
+  if (result < 0) {
+    stats.failures++;
+    if (error == EAGAIN)
+      stats.eagain_failures++;
+  }
+  stats.total_time += elapsed;
+  if (elapsed > stats.max_time)
+    stats.max_time = elapsed;
+  stats.latency_histogram[bucket]++;
+}
+
+std::vector<V4L2IoctlStats::RequestStats> V4L2IoctlStats::GetSnapshot()
+    const {
+  base::AutoLock auto_lock(lock_);
+  std::vector<RequestStats> snapshot;
+  for (const auto& it : stats_)
+    snapshot.push_back(it.second);
+  return snapshot;
+}
+
+// static
+std::string V4L2IoctlStats::SnapshotToString(
+    const std::vector<RequestStats>& snapshot) {
+  std::ostringstream s;
+  for (const RequestStats& stats : snapshot) {
+    s << RequestToString(stats.request) << ": " << stats.calls << " calls, "
+      << stats.failures << " failed (" << stats.eagain_failures
+      << " EAGAIN), average " << stats.total_time.InMicroseconds() / stats.calls
+      << " us, max " << stats.max_time.InMicroseconds() << " us, histogram";
+    // Only the non-empty buckets, as "[lower bound in us]:count".
+    for (size_t i = 0; i < kNumLatencyBuckets; ++i) {
+      if (stats.latency_histogram[i] > 0) {
+        s << " [" << GetBucketLowerBound(i).InMicroseconds()
+          << "]:" << stats.latency_histogram[i];
+      }
+    }
+    s << "\n";
+  }
+  return s.str();
+}
+
+}  // namespace media
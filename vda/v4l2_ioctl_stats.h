@@ -0,0 +1,83 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef V4L2_IOCTL_STATS_H_
+#define V4L2_IOCTL_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+#include "base/time/time.h"
+
+namespace media {
+
+// Counts the ioctls issued on a V4L2Device and how long the driver blocks in
+// them, by request code, to tell how many QBUF/DQBUF/S_EXT_CTRLS calls each
+// frame costs. This class is thread-safe, the ioctls of a device are issued
+// from several threads.
+class V4L2IoctlStats {
+ public:
+  // Latency histogram buckets: bucket 0 holds the calls under 2 us, bucket i
+  // the calls from 2^i to 2^(i+1) us, and the last one all the longer calls,
+  // i.e. 32 ms and more.
+  enum { kNumLatencyBuckets = 16 };
+
+  // Counters of one request code.
+  struct RequestStats {
+    RequestStats();
+
+    uint32_t request;
+    uint64_t calls;
+    // Failed calls, including the EAGAIN ones, e.g. a DQBUF while no buffer
+    // is ready, which are also counted separately.
+    uint64_t failures;
+    uint64_t eagain_failures;
+    base::TimeDelta total_time;
+    base::TimeDelta max_time;
+    uint64_t latency_histogram[kNumLatencyBuckets];
+  };
+
+  V4L2IoctlStats();
+  ~V4L2IoctlStats();
+
+  // Return the name of ioctl |request|, e.g. "VIDIOC_QBUF", or its value in
+  // hexadecimal if unknown.
+  static std::string RequestToString(uint32_t request);
+
+  // Return the lower bound of latency histogram bucket |bucket|.
+  static base::TimeDelta GetBucketLowerBound(size_t bucket);
+
+  // Account a call of |request| which returned |result|, with errno |error|
+  // if it failed, after blocking for |elapsed|.
+  void Record(uint32_t request,
+              int result,
+              int error,
+              base::TimeDelta elapsed);
+
+  // Return the counters of the requests issued so far, by request code.
+  std::vector<RequestStats> GetSnapshot() const;
+
+  // Format |snapshot| for dumps, one request code per line.
+  static std::string SnapshotToString(
+      const std::vector<RequestStats>& snapshot);
+
+ private:
+  static size_t GetBucket(base::TimeDelta elapsed);
+
+  mutable base::Lock lock_;
+  // Counters by request code, guarded by |lock_|.
+  std::map<uint32_t, RequestStats> stats_;
+
+  DISALLOW_COPY_AND_ASSIGN(V4L2IoctlStats);
+};
+
+}  // namespace media
+
+#endif  // V4L2_IOCTL_STATS_H_
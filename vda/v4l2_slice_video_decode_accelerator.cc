@@ -13,6 +13,7 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <memory>
 
 #include "base/bind.h"
@@ -27,6 +28,8 @@
 #include "base/strings/stringprintf.h"
 #include "base/threading/thread_task_runner_handle.h"
 #include "shared_memory_region.h"
+#include "trace_events.h"
+#include "v4l2_device_selector.h"
 
 #define DVLOGF(level) DVLOG(level) << __func__ << "(): "
 #define VLOGF(level) VLOG(level) << __func__ << "(): "
@@ -68,12 +71,17 @@ const uint32_t V4L2SliceVideoDecodeAccelerator::supported_input_fourccs_[] = {
 class V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface
     : public base::RefCounted<V4L2DecodeSurface> {
  public:
-  using ReleaseCB = base::Callback<void(int)>;
+  // A surface is created once for each output buffer, and reused for every
+  // frame decoded into that buffer.
+  explicit V4L2DecodeSurface(int output_record);
 
-  V4L2DecodeSurface(int32_t bitstream_id,
-                    int input_record,
-                    int output_record,
-                    const ReleaseCB& release_cb);
+  // Prepare the surface for decoding |bitstream_id| using input buffer
+  // |input_record|.
+  void Reset(int32_t bitstream_id, int input_record);
+
+  // Drop the references and done callback of a surface that will not be
+  // decoded, e.g. because it was removed from the device on reset.
+  void ReleaseReferences();
 
   // Mark the surface as decoded. This will also release all references, as
   // they are not needed anymore and execute the done callback, if not null.
@@ -116,7 +124,6 @@ class V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface
   Rect visible_rect_;
 
   bool decoded_;
-  ReleaseCB release_cb_;
   base::Closure done_cb_;
 
   std::vector<scoped_refptr<V4L2DecodeSurface>> reference_surfaces_;
@@ -125,20 +132,30 @@ class V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface
 };
 
 V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface::V4L2DecodeSurface(
-    int32_t bitstream_id,
-    int input_record,
-    int output_record,
-    const ReleaseCB& release_cb)
-    : bitstream_id_(bitstream_id),
-      input_record_(input_record),
+    int output_record)
+    : bitstream_id_(-1),
+      input_record_(-1),
       output_record_(output_record),
-      config_store_(input_record + 1),
-      decoded_(false),
-      release_cb_(release_cb) {}
+      config_store_(0),
+      decoded_(false) {}
+
+V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface::~V4L2DecodeSurface() {}
 
-V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface::~V4L2DecodeSurface() {
-  DVLOGF(5) << "Releasing output record id=" << output_record_;
-  release_cb_.Run(output_record_);
+void V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface::Reset(
+    int32_t bitstream_id,
+    int input_record) {
+  DCHECK(reference_surfaces_.empty());
+  DCHECK(done_cb_.is_null());
+  bitstream_id_ = bitstream_id;
+  input_record_ = input_record;
+  config_store_ = input_record + 1;
+  visible_rect_ = Rect();
+  decoded_ = false;
+}
+
+void V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface::ReleaseReferences() {
+  reference_surfaces_.clear();
+  done_cb_.Reset();
 }
 
 void V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface::SetReferenceSurfaces(
@@ -177,13 +194,19 @@ V4L2SliceVideoDecodeAccelerator::InputRecord::InputRecord()
       address(nullptr),
       length(0),
       bytes_used(0),
-      at_device(false) {}
+      at_device(false),
+      next_free(kNotFree),
+      request_queued(false) {}
 
 V4L2SliceVideoDecodeAccelerator::OutputRecord::OutputRecord()
     : at_device(false),
       at_client(false),
+      at_display(false),
       picture_id(-1),
-      cleared(false) {}
+      cleared(false),
+      next_free(kNotFree) {}
+
+V4L2SliceVideoDecodeAccelerator::OutputRecord::~OutputRecord() {}
 
 struct V4L2SliceVideoDecodeAccelerator::BitstreamBufferRef {
   BitstreamBufferRef(
@@ -197,6 +220,16 @@ struct V4L2SliceVideoDecodeAccelerator::BitstreamBufferRef {
   const std::unique_ptr<SharedMemoryRegion> shm;
   off_t bytes_used;
   const int32_t input_id;
+  // Whether the non-reference frames of this buffer are to be skipped, as
+  // requested when it was passed to Decode().
+  bool skip_non_reference_frames;
+  // Whether a surface was created to decode this buffer, and the number of
+  // frames the decoder had skipped when it started parsing it.
+  bool surface_created;
+  size_t num_skipped_frames_at_start;
+  // Set once |shm| is mapped and accounted in it, to remove it when the
+  // buffer is returned.
+  scoped_refptr<MemoryUsageTracker> memory_usage_tracker;
 };
 
 V4L2SliceVideoDecodeAccelerator::BitstreamBufferRef::BitstreamBufferRef(
@@ -208,11 +241,22 @@ V4L2SliceVideoDecodeAccelerator::BitstreamBufferRef::BitstreamBufferRef(
       client_task_runner(client_task_runner),
       shm(shm),
       bytes_used(0),
-      input_id(input_id) {}
+      input_id(input_id),
+      skip_non_reference_frames(false),
+      surface_created(false),
+      num_skipped_frames_at_start(0) {
+  if (input_id >= 0)
+    TraceAsyncBegin(kBitstreamBufferTraceName, input_id);
+}
 
 V4L2SliceVideoDecodeAccelerator::BitstreamBufferRef::~BitstreamBufferRef() {
+  if (memory_usage_tracker) {
+    memory_usage_tracker->Remove(MemoryUsageTracker::kBitstreamBuffers,
+                                 shm->size(), 1);
+  }
   if (input_id >= 0) {
     DVLOGF(5) << "returning input_id: " << input_id;
+    TraceAsyncEnd(kBitstreamBufferTraceName, input_id);
     client_task_runner->PostTask(
         FROM_HERE,
         base::Bind(&VideoDecodeAccelerator::Client::NotifyEndOfBitstreamBuffer,
@@ -257,6 +301,10 @@ class V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator
 
   void Reset() override;
 
+  // Drop the surfaces of pooled pictures that are no longer used by the
+  // decoder, so that their output buffers return to the free list.
+  void ReleaseUnusedPictures();
+
  private:
   // Max size of reference list.
   static const size_t kDPBIndicesListSize = 32;
@@ -273,11 +321,35 @@ class V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator
   size_t num_slices_;
   V4L2SliceVideoDecodeAccelerator* v4l2_dec_;
 
-  // TODO(posciak): This should be queried from hardware once supported.
-  static const size_t kMaxSlices = 16;
-  struct v4l2_ctrl_h264_slice_param v4l2_slice_params_[kMaxSlices];
+  // Size of the start code prepended to each slice in the input buffer.
+  static const size_t kStartCodeSize = 3;
+
+  // Number of slices the driver takes parameters for, assumed for drivers
+  // that do not report the size of the slice parameters control.
+  static const size_t kDefaultMaxDriverSlices = 16;
+  size_t max_driver_slices_;
+  // Whether the driver decodes whole frames, parsing the slice headers
+  // itself, see V4L2_CID_MPEG_VIDEO_H264_DECODE_MODE. Assumed for drivers not
+  // exposing the control.
+  bool frame_based_;
+
+  // Parameters of the slices of the current frame. Has room for at least
+  // |max_driver_slices_| slices, and grows for frames with more slices.
+  std::vector<struct v4l2_ctrl_h264_slice_param> v4l2_slice_params_;
   struct v4l2_ctrl_h264_decode_param v4l2_decode_param_;
 
+  // Parameter sets of the current frame, set by SubmitFrameMetadata().
+  struct v4l2_ctrl_h264_sps v4l2_sps_;
+  struct v4l2_ctrl_h264_pps v4l2_pps_;
+  struct v4l2_ctrl_h264_scaling_matrix v4l2_scaling_matrix_;
+
+  // Pictures handed out by CreateH264Picture(). A picture referenced only
+  // from here is unused by the decoder and is reused for the next frame.
+  std::vector<scoped_refptr<V4L2H264Picture>> picture_pool_;
+
+  // Slice data with the start code prepended, reused across slices.
+  std::vector<uint8_t> slice_data_;
+
   DISALLOW_COPY_AND_ASSIGN(V4L2H264Accelerator);
 };
 
@@ -355,6 +427,11 @@ class V4L2H264Picture : public H264Picture {
   dec_surface() {
     return dec_surface_;
   }
+  void set_dec_surface(
+      const scoped_refptr<V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface>&
+          dec_surface) {
+    dec_surface_ = dec_surface;
+  }
 
  private:
   ~V4L2H264Picture() override;
@@ -436,11 +513,21 @@ V4L2SliceVideoDecodeAccelerator::V4L2SliceVideoDecodeAccelerator(
       device_(device),
       decoder_thread_("V4L2SliceVideoDecodeAcceleratorThread"),
       device_poll_thread_("V4L2SliceVideoDecodeAcceleratorDevicePollThread"),
+      poll_pending_(false),
+      poll_pending_device_(false),
       input_streamon_(false),
       input_buffer_queued_count_(0),
+      free_input_buffers_(&input_buffer_map_),
+      input_buffer_size_(0),
       output_streamon_(false),
       output_buffer_queued_count_(0),
+      free_output_buffers_(&output_buffer_map_),
+      decoded_frame_count_(0),
+      skip_non_reference_frames_(false),
+      error_resilient_(false),
+      error_recovery_count_(0),
       video_profile_(VIDEO_CODEC_PROFILE_UNKNOWN),
+      frame_rate_(0),
       input_format_fourcc_(0),
       output_format_fourcc_(0),
       state_(kUninitialized),
@@ -449,6 +536,7 @@ V4L2SliceVideoDecodeAccelerator::V4L2SliceVideoDecodeAccelerator(
       decoder_resetting_(false),
       surface_set_change_pending_(false),
       picture_clearing_count_(0),
+      use_media_requests_(false),
       weak_this_factory_(this) {
   weak_this_ = weak_this_factory_.GetWeakPtr();
 }
@@ -511,6 +599,9 @@ bool V4L2SliceVideoDecodeAccelerator::Initialize(const Config& config,
   input_format_fourcc_ =
       V4L2Device::VideoCodecProfileToV4L2PixFmt(video_profile_, true);
 
+  frame_rate_ = config.frame_rate > 0 ? config.frame_rate : kDefaultFrameRate;
+  device_->SetSessionMacroblockRate(V4L2DeviceSelector::GetMacroblockRate(
+      config.initial_expected_coded_size, frame_rate_));
   if (!device_->Open(V4L2Device::Type::kDecoder, input_format_fourcc_)) {
     VLOGF(1) << "Failed to open device for profile: " << config.profile
              << " fourcc: " << std::hex << "0x" << input_format_fourcc_;
@@ -532,6 +623,15 @@ bool V4L2SliceVideoDecodeAccelerator::Initialize(const Config& config,
     NOTREACHED() << "Unsupported profile " << video_profile_;
     return false;
   }
+  decoder_->SetDecodeKeyframesOnly(config.keyframes_only);
+  error_resilient_ = config.error_resilient;
+
+  // The level of the stream is not known yet, the buffers are resized if
+  // needed once it is.
+  input_buffer_size_ =
+      GetInputBufferSize(AcceleratedVideoDecoder::GetMaxCodedFrameSizeFor(
+          config.initial_expected_coded_size, frame_rate_, 0,
+          AcceleratedVideoDecoder::kDefaultMinCompressionRatio));
 
   // Capabilities check.
   struct v4l2_capability caps;
@@ -543,6 +643,23 @@ bool V4L2SliceVideoDecodeAccelerator::Initialize(const Config& config,
     return false;
   }
 
+  // Prefer passing the controls of each frame in a media request over the
+  // configuration stores, whose number limits how many frames can be queued.
+  // The controls are the custom ones of v4l2_controls_custom.h, which drivers
+  // supporting requests do not necessarily take in a request, so check that
+  // the driver does with the control of the frame parameters.
+  uint32_t frame_ctrl_id;
+  if (h264_accelerator_)
+    frame_ctrl_id = V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAM;
+  else if (vp8_accelerator_)
+    frame_ctrl_id = V4L2_CID_MPEG_VIDEO_VP8_FRAME_HDR;
+  else
+    frame_ctrl_id = V4L2_CID_MPEG_VIDEO_VP9_FRAME_HDR;
+  use_media_requests_ = device_->OpenMediaDevice() &&
+                        CanSetCtrlInMediaRequest(frame_ctrl_id);
+  VLOGF(2) << "Submitting frames with "
+           << (use_media_requests_ ? "media requests" : "configuration stores");
+
   if (!SetupFormats())
     return false;
 
@@ -551,6 +668,10 @@ bool V4L2SliceVideoDecodeAccelerator::Initialize(const Config& config,
     return false;
   }
   decoder_thread_task_runner_ = decoder_thread_.task_runner();
+  PostApplyThreadSchedulingConfig(decoder_thread_task_runner_,
+                                  config.decoder_thread_scheduling);
+  device_poll_thread_scheduling_ = config.device_poll_thread_scheduling;
+  memory_usage_tracker_ = config.memory_usage_tracker;
 
   state_ = kInitialized;
   output_mode_ = config.output_mode;
@@ -601,19 +722,27 @@ void V4L2SliceVideoDecodeAccelerator::DestroyTask() {
   state_ = kError;
 
   decoder_->Reset();
+  pending_enqueue_surfaces_.clear();
 
   decoder_current_bitstream_buffer_.reset();
   while (!decoder_input_queue_.empty())
     decoder_input_queue_.pop();
 
+  LogBufferIoctlStats();
+  if (decoder_->GetNumSkippedFrames() > 0) {
+    VLOGF(2) << "Skipped " << decoder_->GetNumSkippedFrames() << " frames";
+  }
+  if (error_recovery_count_ > 0)
+    VLOGF(2) << "Recovered from " << error_recovery_count_ << " decode errors";
+
   // Stop streaming and the device_poll_thread_.
   StopDevicePoll(false);
 
   DestroyInputBuffers();
   DestroyOutputs(false);
 
-  DCHECK(surfaces_at_device_.empty());
-  DCHECK(surfaces_at_display_.empty());
+  DCHECK_EQ(output_buffer_queued_count_, 0);
+  DCHECK_EQ(CountSurfacesAtDisplay(), 0u);
   DCHECK(decoder_display_queue_.empty());
 }
 
@@ -631,15 +760,6 @@ static bool IsSupportedOutputFormat(uint32_t v4l2_format) {
 bool V4L2SliceVideoDecodeAccelerator::SetupFormats() {
   DCHECK_EQ(state_, kUninitialized);
 
-  size_t input_size;
-  Size max_resolution, min_resolution;
-  device_->GetSupportedResolution(input_format_fourcc_, &min_resolution,
-                                  &max_resolution);
-  if (max_resolution.width() > 1920 && max_resolution.height() > 1088)
-    input_size = kInputBufferMaxSizeFor4k;
-  else
-    input_size = kInputBufferMaxSizeFor1080p;
-
   struct v4l2_fmtdesc fmtdesc;
   memset(&fmtdesc, 0, sizeof(fmtdesc));
   fmtdesc.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
@@ -658,13 +778,8 @@ bool V4L2SliceVideoDecodeAccelerator::SetupFormats() {
     return false;
   }
 
-  struct v4l2_format format;
-  memset(&format, 0, sizeof(format));
-  format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-  format.fmt.pix_mp.pixelformat = input_format_fourcc_;
-  format.fmt.pix_mp.plane_fmt[0].sizeimage = input_size;
-  format.fmt.pix_mp.num_planes = input_planes_count_;
-  IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_S_FMT, &format);
+  if (!SetInputFormat())
+    return false;
 
   // We have to set up the format for output, because the driver may not allow
   // changing it once we start streaming; whether it can support our chosen
@@ -687,6 +802,7 @@ bool V4L2SliceVideoDecodeAccelerator::SetupFormats() {
 
   // Only set fourcc for output; resolution, etc., will come from the
   // driver once it extracts it from the stream.
+  struct v4l2_format format;
   memset(&format, 0, sizeof(format));
   format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
   format.fmt.pix_mp.pixelformat = output_format_fourcc_;
@@ -696,25 +812,78 @@ bool V4L2SliceVideoDecodeAccelerator::SetupFormats() {
   return true;
 }
 
+bool V4L2SliceVideoDecodeAccelerator::SetInputFormat() {
+  struct v4l2_format format;
+  memset(&format, 0, sizeof(format));
+  format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  format.fmt.pix_mp.pixelformat = input_format_fourcc_;
+  format.fmt.pix_mp.plane_fmt[0].sizeimage = input_buffer_size_;
+  format.fmt.pix_mp.num_planes = input_planes_count_;
+  IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_S_FMT, &format);
+  return true;
+}
+
+size_t V4L2SliceVideoDecodeAccelerator::GetInputBufferSize(
+    size_t max_frame_size) const {
+  // Leave room for the start codes the H264 accelerator adds before each
+  // slice.
+  return std::max(max_frame_size + max_frame_size / 16, kMinInputBufferSize);
+}
+
+bool V4L2SliceVideoDecodeAccelerator::IsInputBufferResizeNeeded() const {
+  // Shrink the buffers only if they are more than twice the needed size, to
+  // avoid reallocating them for small changes.
+  const size_t size =
+      GetInputBufferSize(decoder_->GetMaxCodedFrameSize(frame_rate_));
+  return size > input_buffer_size_ || size * 2 <= input_buffer_size_;
+}
+
+bool V4L2SliceVideoDecodeAccelerator::ResizeInputBuffersIfNeeded() {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+
+  if (!IsInputBufferResizeNeeded())
+    return true;
+
+  // FinishSurfaceSetChange() waits for all of them to be idle.
+  DCHECK_EQ(free_input_buffers_.size(), input_buffer_map_.size());
+  const size_t size =
+      GetInputBufferSize(decoder_->GetMaxCodedFrameSize(frame_rate_));
+  VLOGF(2) << "Resizing input buffers from " << input_buffer_size_ << " to "
+           << size << " bytes";
+  if (input_streamon_) {
+    __u32 type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_STREAMOFF, &type);
+    input_streamon_ = false;
+  }
+  DestroyInputBuffers();
+  input_buffer_size_ = size;
+  return SetInputFormat() && CreateInputBuffers();
+}
+
 bool V4L2SliceVideoDecodeAccelerator::CreateInputBuffers() {
   VLOGF(2);
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
   DCHECK(!input_streamon_);
   DCHECK(input_buffer_map_.empty());
 
+  const size_t num_buffers =
+      std::min(std::max(kInputBufferMemoryBudget / input_buffer_size_,
+                        kMinNumInputBuffers),
+               kMaxNumInputBuffers);
+
   struct v4l2_requestbuffers reqbufs;
   memset(&reqbufs, 0, sizeof(reqbufs));
-  reqbufs.count = kNumInputBuffers;
+  reqbufs.count = num_buffers;
   reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
   reqbufs.memory = V4L2_MEMORY_MMAP;
   IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_REQBUFS, &reqbufs);
-  if (reqbufs.count < kNumInputBuffers) {
+  if (reqbufs.count < num_buffers) {
     VLOGF(1) << "Could not allocate enough output buffers";
     return false;
   }
   input_buffer_map_.resize(reqbufs.count);
   for (size_t i = 0; i < input_buffer_map_.size(); ++i) {
-    free_input_buffers_.push_back(i);
+    free_input_buffers_.Push(i);
 
     // Query for the MEMORY_MMAP pointer.
     struct v4l2_plane planes[VIDEO_MAX_PLANES];
@@ -738,8 +907,23 @@ bool V4L2SliceVideoDecodeAccelerator::CreateInputBuffers() {
     }
     input_buffer_map_[i].address = address;
     input_buffer_map_[i].length = buffer.m.planes[0].length;
+    if (memory_usage_tracker_) {
+      memory_usage_tracker_->Add(MemoryUsageTracker::kInputBuffers,
+                                 input_buffer_map_[i].length, 1);
+    }
+
+    if (use_media_requests_) {
+      input_buffer_map_[i].request_fd = device_->AllocateMediaRequest();
+      if (!input_buffer_map_[i].request_fd.is_valid())
+        return false;
+    }
   }
 
+  size_t bitstream_memory = 0;
+  for (const auto& input_record : input_buffer_map_)
+    bitstream_memory += input_record.length;
+  VLOGF(2) << "Allocated " << input_buffer_map_.size() << " input buffers, "
+           << bitstream_memory << " bytes of bitstream memory";
   return true;
 }
 
@@ -748,8 +932,6 @@ bool V4L2SliceVideoDecodeAccelerator::CreateOutputBuffers() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
   DCHECK(!output_streamon_);
   DCHECK(output_buffer_map_.empty());
-  DCHECK(surfaces_at_display_.empty());
-  DCHECK(surfaces_at_device_.empty());
 
   Size pic_size = decoder_->GetPicSize();
   size_t num_pictures = decoder_->GetRequiredNumOfPictures();
@@ -780,6 +962,8 @@ bool V4L2SliceVideoDecodeAccelerator::CreateOutputBuffers() {
     VLOGF(1) << "Got invalid adjusted coded size: " << coded_size_.ToString();
     return false;
   }
+  device_->SetSessionMacroblockRate(
+      V4L2DeviceSelector::GetMacroblockRate(coded_size_, frame_rate_));
 
   DVLOGF(3) << "buffer_count=" << num_pictures
             << ", pic size=" << pic_size.ToString()
@@ -815,8 +999,13 @@ void V4L2SliceVideoDecodeAccelerator::DestroyInputBuffers() {
     return;
 
   for (auto& input_record : input_buffer_map_) {
-    if (input_record.address != nullptr)
-      device_->Munmap(input_record.address, input_record.length);
+    if (input_record.address == nullptr)
+      continue;
+    device_->Munmap(input_record.address, input_record.length);
+    if (memory_usage_tracker_) {
+      memory_usage_tracker_->Remove(MemoryUsageTracker::kInputBuffers,
+                                    input_record.length, 1);
+    }
   }
 
   struct v4l2_requestbuffers reqbufs;
@@ -826,8 +1015,9 @@ void V4L2SliceVideoDecodeAccelerator::DestroyInputBuffers() {
   reqbufs.memory = V4L2_MEMORY_MMAP;
   IOCTL_OR_LOG_ERROR(VIDIOC_REQBUFS, &reqbufs);
 
-  input_buffer_map_.clear();
   free_input_buffers_.clear();
+  input_buffers_awaiting_request_.clear();
+  input_buffer_map_.clear();
 }
 
 void V4L2SliceVideoDecodeAccelerator::DismissPictures(
@@ -844,12 +1034,14 @@ void V4L2SliceVideoDecodeAccelerator::DismissPictures(
   done->Signal();
 }
 
-void V4L2SliceVideoDecodeAccelerator::DevicePollTask(bool poll_device) {
+void V4L2SliceVideoDecodeAccelerator::DevicePollTask(
+    bool poll_device,
+    const std::vector<int>& request_fds) {
   DVLOGF(3);
   DCHECK(device_poll_thread_.task_runner()->BelongsToCurrentThread());
 
   bool event_pending;
-  if (!device_->Poll(poll_device, &event_pending)) {
+  if (!device_->Poll(poll_device, request_fds, &event_pending)) {
     NOTIFY_ERROR(PLATFORM_FAILURE);
     return;
   }
@@ -866,7 +1058,14 @@ void V4L2SliceVideoDecodeAccelerator::ServiceDeviceTask() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
 
   // ServiceDeviceTask() should only ever be scheduled from DevicePollTask().
+  poll_pending_ = false;
+  // The poll may have been interrupted by SchedulePollIfNeeded().
+  if (!device_->ClearDevicePollInterrupt()) {
+    NOTIFY_ERROR(PLATFORM_FAILURE);
+    return;
+  }
 
+  ReuseInputBuffersWithCompletedRequests();
   Dequeue();
   SchedulePollIfNeeded();
 }
@@ -881,16 +1080,37 @@ void V4L2SliceVideoDecodeAccelerator::SchedulePollIfNeeded() {
 
   DCHECK(input_streamon_ || output_streamon_);
 
-  if (input_buffer_queued_count_ + output_buffer_queued_count_ == 0) {
+  const bool poll_device =
+      input_buffer_queued_count_ + output_buffer_queued_count_ > 0;
+  if (!poll_device && input_buffers_awaiting_request_.empty()) {
     DVLOGF(4) << "No buffers queued, will not schedule poll";
     return;
   }
 
+  std::vector<int> request_fds;
+  for (int index : input_buffers_awaiting_request_)
+    request_fds.push_back(input_buffer_map_[index].request_fd.get());
+
+  if (poll_pending_) {
+    // ServiceDeviceTask() schedules the next poll. If the outstanding poll
+    // does not wait for all of the above, wake it up so that it does so now.
+    if ((poll_device && !poll_pending_device_) ||
+        request_fds != poll_pending_request_fds_) {
+      DVLOGF(4) << "Interrupting device poll task";
+      if (!device_->SetDevicePollInterrupt())
+        NOTIFY_ERROR(PLATFORM_FAILURE);
+    }
+    return;
+  }
+
   DVLOGF(4) << "Scheduling device poll task";
 
+  poll_pending_ = true;
+  poll_pending_device_ = poll_device;
+  poll_pending_request_fds_ = request_fds;
   device_poll_thread_.task_runner()->PostTask(
       FROM_HERE, base::Bind(&V4L2SliceVideoDecodeAccelerator::DevicePollTask,
-                            base::Unretained(this), true));
+                            base::Unretained(this), poll_device, request_fds));
 
   DVLOGF(3) << "buffer counts: "
             << "INPUT[" << decoder_input_queue_.size() << "]"
@@ -902,35 +1122,38 @@ void V4L2SliceVideoDecodeAccelerator::SchedulePollIfNeeded() {
             << output_buffer_queued_count_ << "/"
             << output_buffer_map_.size() << "]"
             << " => DISPLAYQ[" << decoder_display_queue_.size() << "]"
-            << " => CLIENT[" << surfaces_at_display_.size() << "]";
+            << " => CLIENT[" << CountSurfacesAtDisplay() << "]";
 }
 
-void V4L2SliceVideoDecodeAccelerator::Enqueue(
-    const scoped_refptr<V4L2DecodeSurface>& dec_surface) {
+void V4L2SliceVideoDecodeAccelerator::EnqueuePendingSurfaces() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
 
+  if (pending_enqueue_surfaces_.empty())
+    return;
+
   const int old_inputs_queued = input_buffer_queued_count_;
   const int old_outputs_queued = output_buffer_queued_count_;
 
-  if (!EnqueueInputRecord(dec_surface->input_record(),
-                          dec_surface->config_store())) {
-    VLOGF(1) << "Failed queueing an input buffer";
-    NOTIFY_ERROR(PLATFORM_FAILURE);
-    return;
-  }
+  // Queue each input buffer with its output buffer, so that the device pairs
+  // them in submission order.
+  for (const auto& dec_surface : pending_enqueue_surfaces_) {
+    ScopedTraceEvent trace_event("Enqueue", dec_surface->bitstream_id());
+    if (!EnqueueInputRecord(dec_surface->input_record(),
+                            dec_surface->config_store())) {
+      VLOGF(1) << "Failed queueing an input buffer";
+      NOTIFY_ERROR(PLATFORM_FAILURE);
+      break;
+    }
 
-  if (!EnqueueOutputRecord(dec_surface->output_record())) {
-    VLOGF(1) << "Failed queueing an output buffer";
-    NOTIFY_ERROR(PLATFORM_FAILURE);
-    return;
+    if (!EnqueueOutputRecord(dec_surface->output_record())) {
+      VLOGF(1) << "Failed queueing an output buffer";
+      NOTIFY_ERROR(PLATFORM_FAILURE);
+      break;
+    }
   }
+  pending_enqueue_surfaces_.clear();
 
-  bool inserted =
-      surfaces_at_device_
-          .insert(std::make_pair(dec_surface->output_record(), dec_surface))
-          .second;
-  DCHECK(inserted);
-
+  // One poll task serves the whole batch.
   if (old_inputs_queued == 0 && old_outputs_queued == 0)
     SchedulePollIfNeeded();
 }
@@ -938,17 +1161,20 @@ void V4L2SliceVideoDecodeAccelerator::Enqueue(
 void V4L2SliceVideoDecodeAccelerator::Dequeue() {
   DVLOGF(4);
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+  ScopedTraceEvent trace_event("Dequeue");
 
+  // The driver fills in the dequeued buffer and keeps the type, memory and
+  // planes array, so the same request is reused for every buffer of a queue.
   struct v4l2_buffer_custom dqbuf;
   struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  memset(&dqbuf, 0, sizeof(dqbuf));
+  memset(&planes, 0, sizeof(planes));
+  dqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  dqbuf.memory = V4L2_MEMORY_MMAP;
+  dqbuf.m.planes = planes;
+  dqbuf.length = input_planes_count_;
   while (input_buffer_queued_count_ > 0) {
     DCHECK(input_streamon_);
-    memset(&dqbuf, 0, sizeof(dqbuf));
-    memset(&planes, 0, sizeof(planes));
-    dqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    dqbuf.memory = V4L2_MEMORY_MMAP;
-    dqbuf.m.planes = planes;
-    dqbuf.length = input_planes_count_;
     if (device_->Ioctl(VIDIOC_DQBUF, &dqbuf) != 0) {
       if (errno == EAGAIN) {
         // EAGAIN if we're just out of buffers to dequeue.
@@ -967,16 +1193,16 @@ void V4L2SliceVideoDecodeAccelerator::Dequeue() {
               << " count: " << input_buffer_queued_count_;
   }
 
+  memset(&dqbuf, 0, sizeof(dqbuf));
+  memset(&planes, 0, sizeof(planes));
+  dqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  dqbuf.memory =
+      (output_mode_ == Config::OutputMode::ALLOCATE ? V4L2_MEMORY_MMAP
+                                                    : V4L2_MEMORY_DMABUF);
+  dqbuf.m.planes = planes;
+  dqbuf.length = output_planes_count_;
   while (output_buffer_queued_count_ > 0) {
     DCHECK(output_streamon_);
-    memset(&dqbuf, 0, sizeof(dqbuf));
-    memset(&planes, 0, sizeof(planes));
-    dqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    dqbuf.memory =
-        (output_mode_ == Config::OutputMode::ALLOCATE ? V4L2_MEMORY_MMAP
-                                                      : V4L2_MEMORY_DMABUF);
-    dqbuf.m.planes = planes;
-    dqbuf.length = output_planes_count_;
     if (device_->Ioctl(VIDIOC_DQBUF, &dqbuf) != 0) {
       if (errno == EAGAIN) {
         // EAGAIN if we're just out of buffers to dequeue.
@@ -987,22 +1213,18 @@ void V4L2SliceVideoDecodeAccelerator::Dequeue() {
       return;
     }
     OutputRecord& output_record = output_buffer_map_[dqbuf.index];
-    DCHECK(output_record.at_device);
-    output_record.at_device = false;
-    output_buffer_queued_count_--;
-    DVLOGF(4) << "Dequeued output=" << dqbuf.index << " count "
-              << output_buffer_queued_count_;
-
-    V4L2DecodeSurfaceByOutputId::iterator it =
-        surfaces_at_device_.find(dqbuf.index);
-    if (it == surfaces_at_device_.end()) {
+    if (!output_record.at_device) {
       VLOGF(1) << "Got invalid surface from device.";
       NOTIFY_ERROR(PLATFORM_FAILURE);
       return;
     }
+    output_record.at_device = false;
+    output_buffer_queued_count_--;
+    decoded_frame_count_++;
+    DVLOGF(4) << "Dequeued output=" << dqbuf.index << " count "
+              << output_buffer_queued_count_;
 
-    it->second->SetDecoded();
-    surfaces_at_device_.erase(it);
+    output_record.surface->SetDecoded();
   }
 
   // A frame was decoded, see if we can output it.
@@ -1066,10 +1288,38 @@ void V4L2SliceVideoDecodeAccelerator::ReuseInputBuffer(int index) {
   input_record.input_id = -1;
   input_record.bytes_used = 0;
 
-  DCHECK_EQ(
-      std::count(free_input_buffers_.begin(), free_input_buffers_.end(), index),
-      0);
-  free_input_buffers_.push_back(index);
+  free_input_buffers_.Push(index);
+}
+
+int V4L2SliceVideoDecodeAccelerator::PopIdleInputBuffer() {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+
+  while (!free_input_buffers_.empty()) {
+    int index = free_input_buffers_.Pop();
+    const InputRecord& input_record = input_buffer_map_[index];
+    if (!input_record.request_queued ||
+        device_->IsMediaRequestCompleted(input_record.request_fd.get())) {
+      return index;
+    }
+    DVLOGF(4) << "Request of input buffer " << index << " not completed yet";
+    input_buffers_awaiting_request_.push_back(index);
+  }
+  return -1;
+}
+
+void V4L2SliceVideoDecodeAccelerator::ReuseInputBuffersWithCompletedRequests() {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+
+  auto it = input_buffers_awaiting_request_.begin();
+  while (it != input_buffers_awaiting_request_.end()) {
+    if (device_->IsMediaRequestCompleted(
+            input_buffer_map_[*it].request_fd.get())) {
+      free_input_buffers_.Push(*it);
+      it = input_buffers_awaiting_request_.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
 void V4L2SliceVideoDecodeAccelerator::ReuseOutputBuffer(int index) {
@@ -1081,14 +1331,39 @@ void V4L2SliceVideoDecodeAccelerator::ReuseOutputBuffer(int index) {
   DCHECK(!output_record.at_device);
   DCHECK(!output_record.at_client);
 
-  DCHECK_EQ(std::count(free_output_buffers_.begin(), free_output_buffers_.end(),
-                       index),
-            0);
-  free_output_buffers_.push_back(index);
+  free_output_buffers_.Push(index);
 
   ScheduleDecodeBufferTaskIfNeeded();
 }
 
+void V4L2SliceVideoDecodeAccelerator::ReclaimOutputBuffers() {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+
+  // Dropping the references of a reclaimed surface may leave the surfaces it
+  // referred to unused as well, so repeat until nothing more is reclaimed.
+  bool reclaimed;
+  do {
+    reclaimed = false;
+    for (size_t i = 0; i < output_buffer_map_.size(); ++i) {
+      OutputRecord& output_record = output_buffer_map_[i];
+      if (output_record.at_device || output_record.at_client ||
+          free_output_buffers_.Contains(i) ||
+          !output_record.surface->HasOneRef()) {
+        continue;
+      }
+      output_record.surface->ReleaseReferences();
+      ReuseOutputBuffer(i);
+      reclaimed = true;
+    }
+  } while (reclaimed);
+}
+
+size_t V4L2SliceVideoDecodeAccelerator::CountSurfacesAtDisplay() const {
+  return std::count_if(
+      output_buffer_map_.begin(), output_buffer_map_.end(),
+      [](const OutputRecord& record) { return record.at_display; });
+}
+
 bool V4L2SliceVideoDecodeAccelerator::EnqueueInputRecord(
     int index,
     uint32_t config_store) {
@@ -1109,8 +1384,21 @@ bool V4L2SliceVideoDecodeAccelerator::EnqueueInputRecord(
   qbuf.m.planes = qbuf_planes;
   qbuf.m.planes[0].bytesused = input_record.bytes_used;
   qbuf.length = input_planes_count_;
-  qbuf.config_store = config_store;
+  if (use_media_requests_) {
+    // The buffer is part of the request, which then carries the controls and
+    // the bitstream of the frame to the driver together.
+    DCHECK(!input_record.request_queued);
+    qbuf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+    qbuf.request_fd = input_record.request_fd.get();
+  } else {
+    qbuf.config_store = config_store;
+  }
   IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_QBUF, &qbuf);
+  if (use_media_requests_) {
+    if (!device_->QueueMediaRequest(input_record.request_fd.get()))
+      return false;
+    input_record.request_queued = true;
+  }
   input_record.at_device = true;
   input_buffer_queued_count_++;
   DVLOGF(4) << "Enqueued input=" << qbuf.index
@@ -1156,6 +1444,25 @@ bool V4L2SliceVideoDecodeAccelerator::EnqueueOutputRecord(int index) {
   return true;
 }
 
+void V4L2SliceVideoDecodeAccelerator::LogBufferIoctlStats() const {
+  if (decoded_frame_count_ == 0)
+    return;
+  // Only counted if the ioctl stats of the device are enabled.
+  uint64_t num_calls = 0;
+  for (const auto& stats : device_->GetIoctlStatsSnapshot()) {
+    if (stats.request == static_cast<uint32_t>(VIDIOC_QBUF) ||
+        stats.request == static_cast<uint32_t>(VIDIOC_DQBUF)) {
+      num_calls += stats.calls;
+    }
+  }
+  if (num_calls == 0)
+    return;
+  VLOGF(2) << "Decoded " << decoded_frame_count_ << " frames with "
+           << num_calls << " QBUF and DQBUF ioctls ("
+           << static_cast<double>(num_calls) / decoded_frame_count_
+           << " per frame)";
+}
+
 bool V4L2SliceVideoDecodeAccelerator::StartDevicePoll() {
   DVLOGF(3) << "Starting device poll";
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
@@ -1167,6 +1474,8 @@ bool V4L2SliceVideoDecodeAccelerator::StartDevicePoll() {
     NOTIFY_ERROR(PLATFORM_FAILURE);
     return false;
   }
+  PostApplyThreadSchedulingConfig(device_poll_thread_.task_runner(),
+                                  device_poll_thread_scheduling_);
   if (!input_streamon_) {
     __u32 type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_STREAMON, &type);
@@ -1179,9 +1488,12 @@ bool V4L2SliceVideoDecodeAccelerator::StartDevicePoll() {
     output_streamon_ = true;
   }
 
+  poll_pending_ = true;
+  poll_pending_device_ = true;
+  poll_pending_request_fds_.clear();
   device_poll_thread_.task_runner()->PostTask(
       FROM_HERE, base::Bind(&V4L2SliceVideoDecodeAccelerator::DevicePollTask,
-                            base::Unretained(this), true));
+                            base::Unretained(this), true, std::vector<int>()));
 
   return true;
 }
@@ -1198,6 +1510,7 @@ bool V4L2SliceVideoDecodeAccelerator::StopDevicePoll(bool keep_input_state) {
     return false;
   }
   device_poll_thread_.Stop();
+  poll_pending_ = false;
   DVLOGF(3) << "Device poll thread stopped";
 
   // Clear the interrupt now, to be sure.
@@ -1233,7 +1546,8 @@ bool V4L2SliceVideoDecodeAccelerator::StopDevicePoll(bool keep_input_state) {
   }
 
   // STREAMOFF makes the driver drop all buffers without decoding and DQBUFing,
-  // so we mark them all as at_device = false and clear surfaces_at_device_.
+  // so we mark them all as at_device = false and reclaim the buffers whose
+  // surfaces are not used by the decoder anymore.
   for (size_t i = 0; i < output_buffer_map_.size(); ++i) {
     OutputRecord& output_record = output_buffer_map_[i];
     if (output_record.at_device) {
@@ -1241,7 +1555,7 @@ bool V4L2SliceVideoDecodeAccelerator::StopDevicePoll(bool keep_input_state) {
       output_buffer_queued_count_--;
     }
   }
-  surfaces_at_device_.clear();
+  ReclaimOutputBuffers();
   DCHECK_EQ(output_buffer_queued_count_, 0);
 
   // Drop all surfaces that were awaiting decode before being displayed,
@@ -1277,10 +1591,14 @@ void V4L2SliceVideoDecodeAccelerator::DecodeTask(
   DVLOGF(4) << "input_id=" << bitstream_buffer.id()
             << " size=" << bitstream_buffer.size();
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+  ScopedTraceEvent trace_event("DecodeTask", bitstream_buffer.id());
 
   std::unique_ptr<BitstreamBufferRef> bitstream_record(new BitstreamBufferRef(
       decode_client_, decode_task_runner_,
       new SharedMemoryRegion(bitstream_buffer, true), bitstream_buffer.id()));
+  // The decoder only parses the buffer later, when the setting may have
+  // changed already.
+  bitstream_record->skip_non_reference_frames = skip_non_reference_frames_;
 
   // Skip empty buffer.
   if (bitstream_buffer.size() == 0)
@@ -1292,9 +1610,13 @@ void V4L2SliceVideoDecodeAccelerator::DecodeTask(
     return;
   }
   DVLOGF(4) << "mapped at=" << bitstream_record->shm->memory();
+  if (memory_usage_tracker_) {
+    memory_usage_tracker_->Add(MemoryUsageTracker::kBitstreamBuffers,
+                               bitstream_record->shm->size(), 1);
+    bitstream_record->memory_usage_tracker = memory_usage_tracker_;
+  }
 
-  decoder_input_queue_.push(
-      linked_ptr<BitstreamBufferRef>(bitstream_record.release()));
+  decoder_input_queue_.push(std::move(bitstream_record));
 
   ScheduleDecodeBufferTaskIfNeeded();
 }
@@ -1306,8 +1628,7 @@ bool V4L2SliceVideoDecodeAccelerator::TrySetNewBistreamBuffer() {
   if (decoder_input_queue_.empty())
     return false;
 
-  decoder_current_bitstream_buffer_.reset(
-      decoder_input_queue_.front().release());
+  decoder_current_bitstream_buffer_ = std::move(decoder_input_queue_.front());
   decoder_input_queue_.pop();
 
   if (decoder_current_bitstream_buffer_->input_id == kFlushBufferId) {
@@ -1319,11 +1640,33 @@ bool V4L2SliceVideoDecodeAccelerator::TrySetNewBistreamBuffer() {
   const uint8_t* const data = reinterpret_cast<const uint8_t*>(
       decoder_current_bitstream_buffer_->shm->memory());
   const size_t data_size = decoder_current_bitstream_buffer_->shm->size();
+  decoder_current_bitstream_buffer_->num_skipped_frames_at_start =
+      decoder_->GetNumSkippedFrames();
+  decoder_->SetSkipNonReferenceFrames(
+      decoder_current_bitstream_buffer_->skip_non_reference_frames);
   decoder_->SetStream(data, data_size);
 
   return true;
 }
 
+void V4L2SliceVideoDecodeAccelerator::ReleaseCurrentBitstreamBuffer() {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+  DCHECK(decoder_current_bitstream_buffer_);
+
+  BitstreamBufferRef* ref = decoder_current_bitstream_buffer_.get();
+  if (!ref->surface_created &&
+      decoder_->GetNumSkippedFrames() > ref->num_skipped_frames_at_start) {
+    DVLOGF(4) << "Skipped input_id: " << ref->input_id;
+    // Posted before ~BitstreamBufferRef() posts NotifyEndOfBitstreamBuffer().
+    ref->client_task_runner->PostTask(
+        FROM_HERE,
+        base::Bind(
+            &VideoDecodeAccelerator::Client::NotifyBitstreamBufferSkipped,
+            ref->client, ref->input_id));
+  }
+  decoder_current_bitstream_buffer_.reset();
+}
+
 void V4L2SliceVideoDecodeAccelerator::ScheduleDecodeBufferTaskIfNeeded() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
   if (state_ == kDecoding) {
@@ -1343,39 +1686,76 @@ void V4L2SliceVideoDecodeAccelerator::DecodeBufferTask() {
     return;
   }
 
-  while (true) {
-    AcceleratedVideoDecoder::DecodeResult res;
+  AcceleratedVideoDecoder::DecodeResult res;
+  do {
     res = decoder_->Decode();
-    switch (res) {
-      case AcceleratedVideoDecoder::kAllocateNewSurfaces:
-        VLOGF(2) << "Decoder requesting a new set of surfaces";
-        InitiateSurfaceSetChange();
-        return;
+    if (res != AcceleratedVideoDecoder::kRanOutOfStreamData)
+      break;
+    ReleaseCurrentBitstreamBuffer();
+  } while (TrySetNewBistreamBuffer());
 
-      case AcceleratedVideoDecoder::kRanOutOfStreamData:
-        decoder_current_bitstream_buffer_.reset();
-        if (!TrySetNewBistreamBuffer())
-          return;
+  // Queue all the frames decoded in this run to the device at once.
+  EnqueuePendingSurfaces();
 
-        break;
+  // The parameter sets parsed in this run may have grown the parser state.
+  if (memory_usage_tracker_) {
+    memory_usage_tracker_->Set(MemoryUsageTracker::kParserState,
+                               decoder_->GetParserStateSize(), 1);
+  }
 
-      case AcceleratedVideoDecoder::kRanOutOfSurfaces:
-        // No more surfaces for the decoder, we'll come back once we have more.
-        DVLOGF(4) << "Ran out of surfaces";
-        return;
+  switch (res) {
+    case AcceleratedVideoDecoder::kAllocateNewSurfaces:
+      VLOGF(2) << "Decoder requesting a new set of surfaces";
+      InitiateSurfaceSetChange();
+      break;
 
-      case AcceleratedVideoDecoder::kNeedContextUpdate:
-        DVLOGF(4) << "Awaiting context update";
-        return;
+    case AcceleratedVideoDecoder::kRanOutOfStreamData:
+      break;
 
-      case AcceleratedVideoDecoder::kDecodeError:
-        VLOGF(1) << "Error decoding stream";
-        NOTIFY_ERROR(PLATFORM_FAILURE);
-        return;
-    }
+    case AcceleratedVideoDecoder::kRanOutOfSurfaces:
+      // No more surfaces for the decoder, we'll come back once we have more.
+      DVLOGF(4) << "Ran out of surfaces";
+      break;
+
+    case AcceleratedVideoDecoder::kNeedContextUpdate:
+      DVLOGF(4) << "Awaiting context update";
+      break;
+
+    case AcceleratedVideoDecoder::kDecodeError:
+      if (error_resilient_) {
+        RecoverFromDecodeError();
+        break;
+      }
+      VLOGF(1) << "Error decoding stream";
+      NOTIFY_ERROR(PLATFORM_FAILURE);
+      break;
   }
 }
 
+void V4L2SliceVideoDecodeAccelerator::RecoverFromDecodeError() {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+  error_recovery_count_++;
+  VLOGF(1) << "Error decoding stream, resuming at the next keyframe ("
+           << error_recovery_count_ << " recoveries)";
+
+  // The surfaces of the pictures decoded already are still decoded and
+  // outputted, only the current one is dropped.
+  decoder_->ResetAfterError();
+  EnqueuePendingSurfaces();
+
+  if (decoder_current_bitstream_buffer_) {
+    BitstreamBufferRef* ref = decoder_current_bitstream_buffer_.get();
+    // Posted before ~BitstreamBufferRef() posts NotifyEndOfBitstreamBuffer().
+    ref->client_task_runner->PostTask(
+        FROM_HERE,
+        base::Bind(&VideoDecodeAccelerator::Client::NotifyBitstreamBufferError,
+                   ref->client, ref->input_id));
+    decoder_current_bitstream_buffer_.reset();
+  }
+
+  ScheduleDecodeBufferTaskIfNeeded();
+}
+
 void V4L2SliceVideoDecodeAccelerator::InitiateSurfaceSetChange() {
   VLOGF(2);
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
@@ -1393,15 +1773,30 @@ bool V4L2SliceVideoDecodeAccelerator::FinishSurfaceSetChange() {
   if (!surface_set_change_pending_)
     return true;
 
-  if (!surfaces_at_device_.empty())
+  if (output_buffer_queued_count_ > 0)
     return false;
 
+  // The input buffers can only be resized once the frames queued with them
+  // are decoded and their requests completed. This is retried from
+  // ServiceDeviceTask() until then.
+  if (IsInputBufferResizeNeeded() &&
+      free_input_buffers_.size() != input_buffer_map_.size()) {
+    DVLOGF(3) << "Waiting for the input buffers to be idle to resize them";
+    return false;
+  }
+
   DCHECK_EQ(state_, kIdle);
   DCHECK(decoder_display_queue_.empty());
+  // Pictures pooled by the accelerator may still hold surfaces the decoder
+  // has already dropped, return them before checking.
+  if (h264_accelerator_)
+    h264_accelerator_->ReleaseUnusedPictures();
+  ReclaimOutputBuffers();
+
   // All output buffers should've been returned from decoder and device by now.
   // The only remaining owner of surfaces may be display (client), and we will
   // dismiss them when destroying output buffers below.
-  DCHECK_EQ(free_output_buffers_.size() + surfaces_at_display_.size(),
+  DCHECK_EQ(free_output_buffers_.size() + CountSurfacesAtDisplay(),
             output_buffer_map_.size());
 
   // Keep input queue running while we switch outputs.
@@ -1425,6 +1820,12 @@ bool V4L2SliceVideoDecodeAccelerator::FinishSurfaceSetChange() {
     return false;
   }
 
+  // The new stream parameters may also change the largest frame size.
+  if (!ResizeInputBuffersIfNeeded()) {
+    NOTIFY_ERROR(PLATFORM_FAILURE);
+    return false;
+  }
+
   if (!CreateOutputBuffers()) {
     NOTIFY_ERROR(PLATFORM_FAILURE);
     return false;
@@ -1468,9 +1869,9 @@ bool V4L2SliceVideoDecodeAccelerator::DestroyOutputBuffers() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread() ||
          !decoder_thread_.IsRunning());
   DCHECK(!output_streamon_);
-  DCHECK(surfaces_at_device_.empty());
+  DCHECK_EQ(output_buffer_queued_count_, 0);
   DCHECK(decoder_display_queue_.empty());
-  DCHECK_EQ(surfaces_at_display_.size() + free_output_buffers_.size(),
+  DCHECK_EQ(CountSurfacesAtDisplay() + free_output_buffers_.size(),
             output_buffer_map_.size());
 
   if (output_buffer_map_.empty())
@@ -1481,14 +1882,16 @@ bool V4L2SliceVideoDecodeAccelerator::DestroyOutputBuffers() {
   // This will prevent us from reusing old surfaces in case we have some
   // ReusePictureBuffer() pending on ChildThread already. It's ok to ignore
   // them, because we have already dismissed them (in DestroyOutputs()).
-  for (const auto& surface_at_display : surfaces_at_display_) {
-    size_t index = surface_at_display.second->output_record();
-    DCHECK_LT(index, output_buffer_map_.size());
-    OutputRecord& output_record = output_buffer_map_[index];
+  for (size_t i = 0; i < output_buffer_map_.size(); ++i) {
+    OutputRecord& output_record = output_buffer_map_[i];
+    if (!output_record.at_display)
+      continue;
     DCHECK(output_record.at_client);
     output_record.at_client = false;
+    output_record.at_display = false;
+    if (output_record.surface->HasOneRef())
+      free_output_buffers_.Push(i);
   }
-  surfaces_at_display_.clear();
   DCHECK_EQ(free_output_buffers_.size(), output_buffer_map_.size());
 
   free_output_buffers_.clear();
@@ -1561,6 +1964,7 @@ void V4L2SliceVideoDecodeAccelerator::AssignPictureBuffersTask(
     DCHECK_EQ(output_record.cleared, false);
 
     output_record.picture_id = buffers[i].id();
+    output_record.surface = new V4L2DecodeSurface(i);
 
     // This will remain true until ImportBufferForPicture is called, either by
     // the client, or by ourselves, if we are allocating.
@@ -1654,16 +2058,13 @@ void V4L2SliceVideoDecodeAccelerator::ImportBufferForPictureTask(
   }
 
   size_t index = iter - output_buffer_map_.begin();
-  DCHECK_EQ(std::count(free_output_buffers_.begin(), free_output_buffers_.end(),
-                       index),
-            0);
-
   DCHECK(!iter->at_device);
+  DCHECK(!iter->at_display);
   iter->at_client = false;
 
   DCHECK_EQ(output_planes_count_, passed_dmabuf_fds->size());
   iter->dmabuf_fds.swap(*passed_dmabuf_fds);
-  free_output_buffers_.push_back(index);
+  free_output_buffers_.Push(index);
   ScheduleDecodeBufferTaskIfNeeded();
 }
 
@@ -1683,9 +2084,13 @@ void V4L2SliceVideoDecodeAccelerator::ReusePictureBufferTask(
   DVLOGF(4) << "picture_buffer_id=" << picture_buffer_id;
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
 
-  V4L2DecodeSurfaceByPictureBufferId::iterator it =
-      surfaces_at_display_.find(picture_buffer_id);
-  if (it == surfaces_at_display_.end()) {
+  const auto iter =
+      std::find_if(output_buffer_map_.begin(), output_buffer_map_.end(),
+                   [picture_buffer_id](const OutputRecord& output_record) {
+                     return output_record.at_display &&
+                            output_record.picture_id == picture_buffer_id;
+                   });
+  if (iter == output_buffer_map_.end()) {
     // It's possible that we've already posted a DismissPictureBuffer for this
     // picture, but it has not yet executed when this ReusePictureBuffer was
     // posted to us by the client. In that case just ignore this (we've already
@@ -1696,7 +2101,7 @@ void V4L2SliceVideoDecodeAccelerator::ReusePictureBufferTask(
     return;
   }
 
-  OutputRecord& output_record = output_buffer_map_[it->second->output_record()];
+  OutputRecord& output_record = *iter;
   if (output_record.at_device || !output_record.at_client) {
     VLOGF(1) << "picture_buffer_id not reusable";
     NOTIFY_ERROR(INVALID_ARGUMENT);
@@ -1705,8 +2110,10 @@ void V4L2SliceVideoDecodeAccelerator::ReusePictureBufferTask(
 
   DCHECK(!output_record.at_device);
   output_record.at_client = false;
+  output_record.at_display = false;
 
-  surfaces_at_display_.erase(it);
+  // The buffer becomes free unless the decoder still uses it for reference.
+  ReclaimOutputBuffers();
 }
 
 void V4L2SliceVideoDecodeAccelerator::Flush() {
@@ -1723,9 +2130,9 @@ void V4L2SliceVideoDecodeAccelerator::FlushTask() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
 
   // Queue an empty buffer which - when reached - will trigger flush sequence.
-  decoder_input_queue_.push(
-      linked_ptr<BitstreamBufferRef>(new BitstreamBufferRef(
-          decode_client_, decode_task_runner_, nullptr, kFlushBufferId)));
+  decoder_input_queue_.push(std::unique_ptr<BitstreamBufferRef>(
+      new BitstreamBufferRef(decode_client_, decode_task_runner_, nullptr,
+                             kFlushBufferId)));
 
   ScheduleDecodeBufferTaskIfNeeded();
 }
@@ -1742,6 +2149,7 @@ void V4L2SliceVideoDecodeAccelerator::InitiateFlush() {
     NOTIFY_ERROR(PLATFORM_FAILURE);
     return;
   }
+  EnqueuePendingSurfaces();
 
   // Put the decoder in an idle state, ready to resume.
   decoder_->Reset();
@@ -1758,7 +2166,7 @@ bool V4L2SliceVideoDecodeAccelerator::FinishFlush() {
   if (!decoder_flushing_)
     return true;
 
-  if (!surfaces_at_device_.empty())
+  if (output_buffer_queued_count_ > 0)
     return false;
 
   DCHECK_EQ(state_, kIdle);
@@ -1773,12 +2181,14 @@ bool V4L2SliceVideoDecodeAccelerator::FinishFlush() {
 
   // Decoder should have already returned all surfaces and all surfaces are
   // out of hardware. There can be no other owners of input buffers.
-  DCHECK_EQ(free_input_buffers_.size(), input_buffer_map_.size());
+  DCHECK_EQ(free_input_buffers_.size() + input_buffers_awaiting_request_.size(),
+            input_buffer_map_.size());
 
   SendPictureReady();
 
   decoder_flushing_ = false;
   VLOGF(2) << "Flush finished";
+  LogBufferIoctlStats();
 
   child_task_runner_->PostTask(FROM_HERE,
                                base::Bind(&Client::NotifyFlushDone, client_));
@@ -1786,6 +2196,25 @@ bool V4L2SliceVideoDecodeAccelerator::FinishFlush() {
   return true;
 }
 
+void V4L2SliceVideoDecodeAccelerator::SetSkipNonReferenceFrames(bool skip) {
+  VLOGF(2) << "skip: " << skip;
+  DCHECK(child_task_runner_->BelongsToCurrentThread());
+
+  decoder_thread_task_runner_->PostTask(
+      FROM_HERE,
+      base::Bind(
+          &V4L2SliceVideoDecodeAccelerator::SetSkipNonReferenceFramesTask,
+          base::Unretained(this), skip));
+}
+
+void V4L2SliceVideoDecodeAccelerator::SetSkipNonReferenceFramesTask(
+    bool skip) {
+  DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
+  // This task runs in order with the DecodeTask() of the buffers passed to
+  // Decode() before and after the call, see DecodeTask().
+  skip_non_reference_frames_ = skip;
+}
+
 void V4L2SliceVideoDecodeAccelerator::Reset() {
   VLOGF(2);
   DCHECK(child_task_runner_->BelongsToCurrentThread());
@@ -1825,7 +2254,7 @@ bool V4L2SliceVideoDecodeAccelerator::FinishReset() {
   if (!decoder_resetting_)
     return true;
 
-  if (!surfaces_at_device_.empty())
+  if (output_buffer_queued_count_ > 0)
     return false;
 
   DCHECK_EQ(state_, kIdle);
@@ -1839,11 +2268,12 @@ bool V4L2SliceVideoDecodeAccelerator::FinishReset() {
   // At this point we can have no input buffers in the decoder, because we
   // Reset()ed it in ResetTask(), and have not scheduled any new Decode()s
   // having been in kIdle since. We don't have any surfaces in the HW either -
-  // we just checked that surfaces_at_device_.empty(), and inputs are tied
+  // we just checked that no output buffers are queued, and inputs are tied
   // to surfaces. Since there can be no other owners of input buffers, we can
   // simply mark them all as available.
   DCHECK_EQ(input_buffer_queued_count_, 0);
   free_input_buffers_.clear();
+  input_buffers_awaiting_request_.clear();
   for (size_t i = 0; i < input_buffer_map_.size(); ++i) {
     DCHECK(!input_buffer_map_[i].at_device);
     ReuseInputBuffer(i);
@@ -1881,17 +2311,59 @@ V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::V4L2H264Accelerator(
     V4L2SliceVideoDecodeAccelerator* v4l2_dec)
     : num_slices_(0), v4l2_dec_(v4l2_dec) {
   DCHECK(v4l2_dec_);
+
+  max_driver_slices_ = v4l2_dec_->GetCtrlElemCount(
+      V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAM, sizeof(v4l2_slice_params_[0]));
+  if (max_driver_slices_ == 0)
+    max_driver_slices_ = kDefaultMaxDriverSlices;
+  v4l2_slice_params_.resize(max_driver_slices_);
+
+  // Slice-based drivers have to expose the decoding mode, as the drivers of
+  // the staging stateless controls do. The drivers of the custom controls do
+  // not expose it, and decode the whole input buffer of a frame, parsing the
+  // slice headers themselves, so they are frame-based: a frame with more
+  // slices than |max_driver_slices_| decodes as one slice on them.
+  int32_t decode_mode;
+  if (v4l2_dec_->GetCtrlValue(V4L2_CID_MPEG_VIDEO_H264_DECODE_MODE,
+                              &decode_mode)) {
+    frame_based_ =
+        decode_mode == V4L2_MPEG_VIDEO_H264_DECODE_MODE_FRAME_BASED;
+  } else {
+    frame_based_ = true;
+  }
+  DVLOGF(2) << "Driver takes parameters for up to " << max_driver_slices_
+            << " slices, " << (frame_based_ ? "frame" : "slice")
+            << "-based decoding";
 }
 
 V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::~V4L2H264Accelerator() {}
 
 scoped_refptr<H264Picture>
 V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::CreateH264Picture() {
+  ReleaseUnusedPictures();
+
   scoped_refptr<V4L2DecodeSurface> dec_surface = v4l2_dec_->CreateSurface();
   if (!dec_surface)
     return nullptr;
 
-  return new V4L2H264Picture(dec_surface);
+  for (const auto& pic : picture_pool_) {
+    if (pic->HasOneRef()) {
+      pic->ResetForReuse();
+      pic->set_dec_surface(dec_surface);
+      return pic;
+    }
+  }
+
+  picture_pool_.push_back(new V4L2H264Picture(dec_surface));
+  return picture_pool_.back();
+}
+
+void V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::
+    ReleaseUnusedPictures() {
+  for (const auto& pic : picture_pool_) {
+    if (pic->HasOneRef())
+      pic->set_dec_surface(nullptr);
+  }
 }
 
 void V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::
@@ -1911,11 +2383,13 @@ void V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::H264DPBToV4L2DPB(
     const H264DPB& dpb,
     std::vector<scoped_refptr<V4L2DecodeSurface>>* ref_surfaces) {
   memset(v4l2_decode_param_.dpb, 0, sizeof(v4l2_decode_param_.dpb));
-  size_t i = 0;
+  // Entries are placed at the DPB slot of each picture, which is also what
+  // the reference lists refer to.
   for (const auto& pic : dpb) {
+    size_t i = pic->dpb_position;
     if (i >= arraysize(v4l2_decode_param_.dpb)) {
-      VLOGF(1) << "Invalid DPB size";
-      break;
+      VLOGF(1) << "Invalid DPB position: " << i;
+      continue;
     }
 
     int index = VIDEO_MAX_FRAME;
@@ -1926,7 +2400,7 @@ void V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::H264DPBToV4L2DPB(
       ref_surfaces->push_back(dec_surface);
     }
 
-    struct v4l2_h264_dpb_entry& entry = v4l2_decode_param_.dpb[i++];
+    struct v4l2_h264_dpb_entry& entry = v4l2_decode_param_.dpb[i];
     entry.buf_index = index;
     entry.frame_num = pic->frame_num;
     entry.pic_num = pic->pic_num;
@@ -1945,19 +2419,17 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitFrameMetadata(
     const H264Picture::Vector& ref_pic_listb0,
     const H264Picture::Vector& ref_pic_listb1,
     const scoped_refptr<H264Picture>& pic) {
-  struct v4l2_ext_control_custom ctrl;
-  std::vector<struct v4l2_ext_control_custom> ctrls;
-
-  struct v4l2_ctrl_h264_sps v4l2_sps;
-  memset(&v4l2_sps, 0, sizeof(v4l2_sps));
-  v4l2_sps.constraint_set_flags =
+  // The parameter sets are submitted with the other controls of the frame in
+  // SubmitDecode().
+  memset(&v4l2_sps_, 0, sizeof(v4l2_sps_));
+  v4l2_sps_.constraint_set_flags =
       (sps->constraint_set0_flag ? V4L2_H264_SPS_CONSTRAINT_SET0_FLAG : 0) |
       (sps->constraint_set1_flag ? V4L2_H264_SPS_CONSTRAINT_SET1_FLAG : 0) |
       (sps->constraint_set2_flag ? V4L2_H264_SPS_CONSTRAINT_SET2_FLAG : 0) |
       (sps->constraint_set3_flag ? V4L2_H264_SPS_CONSTRAINT_SET3_FLAG : 0) |
       (sps->constraint_set4_flag ? V4L2_H264_SPS_CONSTRAINT_SET4_FLAG : 0) |
       (sps->constraint_set5_flag ? V4L2_H264_SPS_CONSTRAINT_SET5_FLAG : 0);
-#define SPS_TO_V4L2SPS(a) v4l2_sps.a = sps->a
+#define SPS_TO_V4L2SPS(a) v4l2_sps_.a = sps->a
   SPS_TO_V4L2SPS(profile_idc);
   SPS_TO_V4L2SPS(level_idc);
   SPS_TO_V4L2SPS(seq_parameter_set_id);
@@ -1971,18 +2443,18 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitFrameMetadata(
   SPS_TO_V4L2SPS(offset_for_top_to_bottom_field);
   SPS_TO_V4L2SPS(num_ref_frames_in_pic_order_cnt_cycle);
 
-  static_assert(arraysize(v4l2_sps.offset_for_ref_frame) ==
+  static_assert(arraysize(v4l2_sps_.offset_for_ref_frame) ==
                     arraysize(sps->offset_for_ref_frame),
                 "offset_for_ref_frame arrays must be same size");
-  for (size_t i = 0; i < arraysize(v4l2_sps.offset_for_ref_frame); ++i)
-    v4l2_sps.offset_for_ref_frame[i] = sps->offset_for_ref_frame[i];
+  for (size_t i = 0; i < arraysize(v4l2_sps_.offset_for_ref_frame); ++i)
+    v4l2_sps_.offset_for_ref_frame[i] = sps->offset_for_ref_frame[i];
   SPS_TO_V4L2SPS(max_num_ref_frames);
   SPS_TO_V4L2SPS(pic_width_in_mbs_minus1);
   SPS_TO_V4L2SPS(pic_height_in_map_units_minus1);
 #undef SPS_TO_V4L2SPS
 
 #define SET_V4L2_SPS_FLAG_IF(cond, flag) \
-  v4l2_sps.flags |= ((sps->cond) ? (flag) : 0)
+  v4l2_sps_.flags |= ((sps->cond) ? (flag) : 0)
   SET_V4L2_SPS_FLAG_IF(separate_colour_plane_flag,
                        V4L2_H264_SPS_FLAG_SEPARATE_COLOUR_PLANE);
   SET_V4L2_SPS_FLAG_IF(qpprime_y_zero_transform_bypass_flag,
@@ -1997,15 +2469,9 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitFrameMetadata(
   SET_V4L2_SPS_FLAG_IF(direct_8x8_inference_flag,
                        V4L2_H264_SPS_FLAG_DIRECT_8X8_INFERENCE);
 #undef SET_V4L2_SPS_FLAG_IF
-  memset(&ctrl, 0, sizeof(ctrl));
-  ctrl.id = V4L2_CID_MPEG_VIDEO_H264_SPS;
-  ctrl.size = sizeof(v4l2_sps);
-  ctrl.p_h264_sps = &v4l2_sps;
-  ctrls.push_back(ctrl);
 
-  struct v4l2_ctrl_h264_pps v4l2_pps;
-  memset(&v4l2_pps, 0, sizeof(v4l2_pps));
-#define PPS_TO_V4L2PPS(a) v4l2_pps.a = pps->a
+  memset(&v4l2_pps_, 0, sizeof(v4l2_pps_));
+#define PPS_TO_V4L2PPS(a) v4l2_pps_.a = pps->a
   PPS_TO_V4L2PPS(pic_parameter_set_id);
   PPS_TO_V4L2PPS(seq_parameter_set_id);
   PPS_TO_V4L2PPS(num_slice_groups_minus1);
@@ -2019,7 +2485,7 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitFrameMetadata(
 #undef PPS_TO_V4L2PPS
 
 #define SET_V4L2_PPS_FLAG_IF(cond, flag) \
-  v4l2_pps.flags |= ((pps->cond) ? (flag) : 0)
+  v4l2_pps_.flags |= ((pps->cond) ? (flag) : 0)
   SET_V4L2_PPS_FLAG_IF(entropy_coding_mode_flag,
                        V4L2_H264_PPS_FLAG_ENTROPY_CODING_MODE);
   SET_V4L2_PPS_FLAG_IF(
@@ -2037,31 +2503,25 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitFrameMetadata(
   SET_V4L2_PPS_FLAG_IF(pic_scaling_matrix_present_flag,
                        V4L2_H264_PPS_FLAG_PIC_SCALING_MATRIX_PRESENT);
 #undef SET_V4L2_PPS_FLAG_IF
-  memset(&ctrl, 0, sizeof(ctrl));
-  ctrl.id = V4L2_CID_MPEG_VIDEO_H264_PPS;
-  ctrl.size = sizeof(v4l2_pps);
-  ctrl.p_h264_pps = &v4l2_pps;
-  ctrls.push_back(ctrl);
 
-  struct v4l2_ctrl_h264_scaling_matrix v4l2_scaling_matrix;
-  memset(&v4l2_scaling_matrix, 0, sizeof(v4l2_scaling_matrix));
+  memset(&v4l2_scaling_matrix_, 0, sizeof(v4l2_scaling_matrix_));
 
-  static_assert(arraysize(v4l2_scaling_matrix.scaling_list_4x4) <=
+  static_assert(arraysize(v4l2_scaling_matrix_.scaling_list_4x4) <=
                         arraysize(pps->scaling_list4x4) &&
-                    arraysize(v4l2_scaling_matrix.scaling_list_4x4[0]) <=
+                    arraysize(v4l2_scaling_matrix_.scaling_list_4x4[0]) <=
                         arraysize(pps->scaling_list4x4[0]) &&
-                    arraysize(v4l2_scaling_matrix.scaling_list_8x8) <=
+                    arraysize(v4l2_scaling_matrix_.scaling_list_8x8) <=
                         arraysize(pps->scaling_list8x8) &&
-                    arraysize(v4l2_scaling_matrix.scaling_list_8x8[0]) <=
+                    arraysize(v4l2_scaling_matrix_.scaling_list_8x8[0]) <=
                         arraysize(pps->scaling_list8x8[0]),
                 "scaling_lists must be of correct size");
-  static_assert(arraysize(v4l2_scaling_matrix.scaling_list_4x4) <=
+  static_assert(arraysize(v4l2_scaling_matrix_.scaling_list_4x4) <=
                         arraysize(sps->scaling_list4x4) &&
-                    arraysize(v4l2_scaling_matrix.scaling_list_4x4[0]) <=
+                    arraysize(v4l2_scaling_matrix_.scaling_list_4x4[0]) <=
                         arraysize(sps->scaling_list4x4[0]) &&
-                    arraysize(v4l2_scaling_matrix.scaling_list_8x8) <=
+                    arraysize(v4l2_scaling_matrix_.scaling_list_8x8) <=
                         arraysize(sps->scaling_list8x8) &&
-                    arraysize(v4l2_scaling_matrix.scaling_list_8x8[0]) <=
+                    arraysize(v4l2_scaling_matrix_.scaling_list_8x8[0]) <=
                         arraysize(sps->scaling_list8x8[0]),
                 "scaling_lists must be of correct size");
 
@@ -2072,35 +2532,24 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitFrameMetadata(
     scaling_list8x8 = &pps->scaling_list8x8[0];
   }
 
-  for (size_t i = 0; i < arraysize(v4l2_scaling_matrix.scaling_list_4x4); ++i) {
-    for (size_t j = 0; j < arraysize(v4l2_scaling_matrix.scaling_list_4x4[i]);
+  for (size_t i = 0; i < arraysize(v4l2_scaling_matrix_.scaling_list_4x4);
+       ++i) {
+    for (size_t j = 0; j < arraysize(v4l2_scaling_matrix_.scaling_list_4x4[i]);
          ++j) {
-      v4l2_scaling_matrix.scaling_list_4x4[i][j] = scaling_list4x4[i][j];
+      v4l2_scaling_matrix_.scaling_list_4x4[i][j] = scaling_list4x4[i][j];
     }
   }
-  for (size_t i = 0; i < arraysize(v4l2_scaling_matrix.scaling_list_8x8); ++i) {
-    for (size_t j = 0; j < arraysize(v4l2_scaling_matrix.scaling_list_8x8[i]);
+  for (size_t i = 0; i < arraysize(v4l2_scaling_matrix_.scaling_list_8x8);
+       ++i) {
+    for (size_t j = 0; j < arraysize(v4l2_scaling_matrix_.scaling_list_8x8[i]);
          ++j) {
-      v4l2_scaling_matrix.scaling_list_8x8[i][j] = scaling_list8x8[i][j];
+      v4l2_scaling_matrix_.scaling_list_8x8[i][j] = scaling_list8x8[i][j];
     }
   }
 
-  memset(&ctrl, 0, sizeof(ctrl));
-  ctrl.id = V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX;
-  ctrl.size = sizeof(v4l2_scaling_matrix);
-  ctrl.p_h264_scal_mtrx = &v4l2_scaling_matrix;
-  ctrls.push_back(ctrl);
-
   scoped_refptr<V4L2DecodeSurface> dec_surface =
       H264PictureToV4L2DecodeSurface(pic);
 
-  struct v4l2_ext_controls_custom ext_ctrls;
-  memset(&ext_ctrls, 0, sizeof(ext_ctrls));
-  ext_ctrls.count = ctrls.size();
-  ext_ctrls.controls = &ctrls[0];
-  ext_ctrls.config_store = dec_surface->config_store();
-  v4l2_dec_->SubmitExtControls(&ext_ctrls);
-
   H264PictureListToDPBIndicesList(ref_pic_listp0,
                                   v4l2_decode_param_.ref_pic_list_p0);
   H264PictureListToDPBIndicesList(ref_pic_listb0,
@@ -2123,10 +2572,8 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitSlice(
     const scoped_refptr<H264Picture>& pic,
     const uint8_t* data,
     size_t size) {
-  if (num_slices_ == kMaxSlices) {
-    VLOGF(1) << "Over limit of supported slices per frame";
-    return false;
-  }
+  if (num_slices_ == v4l2_slice_params_.size())
+    v4l2_slice_params_.resize(num_slices_ * 2);
 
   struct v4l2_ctrl_h264_slice_param& v4l2_slice_param =
       v4l2_slice_params_[num_slices_++];
@@ -2227,13 +2674,13 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitSlice(
 
   // TODO(posciak): Don't add start code back here, but have it passed from
   // the parser.
-  size_t data_copy_size = size + 3;
-  std::unique_ptr<uint8_t[]> data_copy(new uint8_t[data_copy_size]);
-  memset(data_copy.get(), 0, data_copy_size);
-  data_copy[2] = 0x01;
-  memcpy(data_copy.get() + 3, data, size);
-  return v4l2_dec_->SubmitSlice(dec_surface->input_record(), data_copy.get(),
-                                data_copy_size);
+  slice_data_.resize(size + kStartCodeSize);
+  slice_data_[0] = 0x00;
+  slice_data_[1] = 0x00;
+  slice_data_[2] = 0x01;
+  memcpy(slice_data_.data() + kStartCodeSize, data, size);
+  return v4l2_dec_->SubmitSlice(dec_surface->input_record(),
+                                slice_data_.data(), slice_data_.size());
 }
 
 bool V4L2SliceVideoDecodeAccelerator::SubmitSlice(int index,
@@ -2255,22 +2702,103 @@ bool V4L2SliceVideoDecodeAccelerator::SubmitSlice(int index,
   return true;
 }
 
+void V4L2SliceVideoDecodeAccelerator::SetExtControlsTarget(
+    const scoped_refptr<V4L2DecodeSurface>& dec_surface,
+    struct v4l2_ext_controls_custom* ext_ctrls) {
+  if (use_media_requests_) {
+    const InputRecord& input_record =
+        input_buffer_map_[dec_surface->input_record()];
+    DCHECK(input_record.request_fd.is_valid());
+    ext_ctrls->which = V4L2_CTRL_WHICH_REQUEST_VAL;
+    ext_ctrls->request_fd = input_record.request_fd.get();
+  } else {
+    ext_ctrls->config_store = dec_surface->config_store();
+    DCHECK_GT(ext_ctrls->config_store, 0u);
+  }
+}
+
 bool V4L2SliceVideoDecodeAccelerator::SubmitExtControls(
+    const scoped_refptr<V4L2DecodeSurface>& dec_surface,
     struct v4l2_ext_controls_custom* ext_ctrls) {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
-  DCHECK_GT(ext_ctrls->config_store, 0u);
+  SetExtControlsTarget(dec_surface, ext_ctrls);
   IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_S_EXT_CTRLS, ext_ctrls);
   return true;
 }
 
 bool V4L2SliceVideoDecodeAccelerator::GetExtControls(
+    const scoped_refptr<V4L2DecodeSurface>& dec_surface,
     struct v4l2_ext_controls_custom* ext_ctrls) {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
-  DCHECK_GT(ext_ctrls->config_store, 0u);
+  SetExtControlsTarget(dec_surface, ext_ctrls);
   IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_G_EXT_CTRLS, ext_ctrls);
   return true;
 }
 
+size_t V4L2SliceVideoDecodeAccelerator::GetCtrlElemCount(uint32_t ctrl_id,
+                                                         size_t elem_size) {
+  struct v4l2_query_ext_ctrl query_ext_ctrl;
+  memset(&query_ext_ctrl, 0, sizeof(query_ext_ctrl));
+  query_ext_ctrl.id = ctrl_id;
+
+  if (device_->Ioctl(VIDIOC_QUERY_EXT_CTRL, &query_ext_ctrl) != 0)
+    return 0;
+  if (query_ext_ctrl.elem_size != elem_size) {
+    VLOGF(1) << "Control " << ctrl_id << " has elements of "
+             << query_ext_ctrl.elem_size << " bytes, expected " << elem_size;
+    return 0;
+  }
+  return query_ext_ctrl.elems;
+}
+
+bool V4L2SliceVideoDecodeAccelerator::GetCtrlValue(uint32_t ctrl_id,
+                                                   int32_t* value) {
+  struct v4l2_control ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = ctrl_id;
+
+  if (device_->Ioctl(VIDIOC_G_CTRL, &ctrl) != 0)
+    return false;
+  *value = ctrl.value;
+  return true;
+}
+
+bool V4L2SliceVideoDecodeAccelerator::CanSetCtrlInMediaRequest(
+    uint32_t ctrl_id) {
+  struct v4l2_query_ext_ctrl query_ext_ctrl;
+  memset(&query_ext_ctrl, 0, sizeof(query_ext_ctrl));
+  query_ext_ctrl.id = ctrl_id;
+  if (device_->Ioctl(VIDIOC_QUERY_EXT_CTRL, &query_ext_ctrl) != 0)
+    return false;
+
+  base::ScopedFD request_fd = device_->AllocateMediaRequest();
+  if (!request_fd.is_valid())
+    return false;
+
+  std::vector<uint8_t> payload(query_ext_ctrl.elem_size * query_ext_ctrl.elems);
+  struct v4l2_ext_control_custom ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = ctrl_id;
+  ctrl.size = payload.size();
+  ctrl.ptr = payload.data();
+
+  struct v4l2_ext_controls_custom ext_ctrls;
+  memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+  ext_ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+  ext_ctrls.count = 1;
+  ext_ctrls.controls = &ctrl;
+  if (device_->Ioctl(VIDIOC_G_EXT_CTRLS, &ext_ctrls) != 0)
+    return false;
+
+  ext_ctrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+  ext_ctrls.request_fd = request_fd.get();
+  if (device_->Ioctl(VIDIOC_S_EXT_CTRLS, &ext_ctrls) != 0) {
+    VPLOGF(2) << "Control " << ctrl_id << " cannot be set in a request";
+    return false;
+  }
+  return true;
+}
+
 bool V4L2SliceVideoDecodeAccelerator::IsCtrlExposed(uint32_t ctrl_id) {
   struct v4l2_queryctrl query_ctrl;
   memset(&query_ctrl, 0, sizeof(query_ctrl));
@@ -2283,33 +2811,58 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::SubmitDecode(
     const scoped_refptr<H264Picture>& pic) {
   scoped_refptr<V4L2DecodeSurface> dec_surface =
       H264PictureToV4L2DecodeSurface(pic);
+  ScopedTraceEvent trace_event("SubmitDecode", dec_surface->bitstream_id());
 
-  v4l2_decode_param_.num_slices = num_slices_;
+  size_t num_submitted_slices = num_slices_;
+  if (num_slices_ > max_driver_slices_) {
+    if (!frame_based_) {
+      VLOGF(1) << "Over limit of " << max_driver_slices_
+               << " supported slices per frame";
+      return false;
+    }
+    // The driver cannot take the parameters of every slice, but parses the
+    // slice headers itself. All the slices are in the input buffer already,
+    // so describe the whole access unit as its first slice.
+    DVLOGF(3) << num_slices_ << " slices, submitting the frame as one";
+    struct v4l2_ctrl_h264_slice_param& first = v4l2_slice_params_[0];
+    for (size_t i = 1; i < num_slices_; ++i)
+      first.size += kStartCodeSize + v4l2_slice_params_[i].size;
+    memset(&v4l2_slice_params_[1], 0,
+           sizeof(v4l2_slice_params_[0]) * (max_driver_slices_ - 1));
+    num_submitted_slices = 1;
+  }
+  v4l2_decode_param_.num_slices = num_submitted_slices;
   v4l2_decode_param_.idr_pic_flag = pic->idr;
   v4l2_decode_param_.top_field_order_cnt = pic->top_field_order_cnt;
   v4l2_decode_param_.bottom_field_order_cnt = pic->bottom_field_order_cnt;
 
-  struct v4l2_ext_control_custom ctrl;
-  std::vector<struct v4l2_ext_control_custom> ctrls;
-
-  memset(&ctrl, 0, sizeof(ctrl));
-  ctrl.id = V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAM;
-  ctrl.size = sizeof(v4l2_slice_params_);
-  ctrl.p_h264_slice_param = v4l2_slice_params_;
-  ctrls.push_back(ctrl);
-
-  memset(&ctrl, 0, sizeof(ctrl));
-  ctrl.id = V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAM;
-  ctrl.size = sizeof(v4l2_decode_param_);
-  ctrl.p_h264_decode_param = &v4l2_decode_param_;
-  ctrls.push_back(ctrl);
+  // Submit all the controls of the frame, including the parameter sets from
+  // SubmitFrameMetadata(), with a single ioctl.
+  struct v4l2_ext_control_custom ctrls[5];
+  memset(ctrls, 0, sizeof(ctrls));
+  ctrls[0].id = V4L2_CID_MPEG_VIDEO_H264_SPS;
+  ctrls[0].size = sizeof(v4l2_sps_);
+  ctrls[0].p_h264_sps = &v4l2_sps_;
+  ctrls[1].id = V4L2_CID_MPEG_VIDEO_H264_PPS;
+  ctrls[1].size = sizeof(v4l2_pps_);
+  ctrls[1].p_h264_pps = &v4l2_pps_;
+  ctrls[2].id = V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX;
+  ctrls[2].size = sizeof(v4l2_scaling_matrix_);
+  ctrls[2].p_h264_scal_mtrx = &v4l2_scaling_matrix_;
+  // The control is an array of |max_driver_slices_| entries, of the size the
+  // driver reported, whatever the number of slices in the frame.
+  ctrls[3].id = V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAM;
+  ctrls[3].size = sizeof(v4l2_slice_params_[0]) * max_driver_slices_;
+  ctrls[3].p_h264_slice_param = v4l2_slice_params_.data();
+  ctrls[4].id = V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAM;
+  ctrls[4].size = sizeof(v4l2_decode_param_);
+  ctrls[4].p_h264_decode_param = &v4l2_decode_param_;
 
   struct v4l2_ext_controls_custom ext_ctrls;
   memset(&ext_ctrls, 0, sizeof(ext_ctrls));
-  ext_ctrls.count = ctrls.size();
-  ext_ctrls.controls = &ctrls[0];
-  ext_ctrls.config_store = dec_surface->config_store();
-  if (!v4l2_dec_->SubmitExtControls(&ext_ctrls))
+  ext_ctrls.count = arraysize(ctrls);
+  ext_ctrls.controls = ctrls;
+  if (!v4l2_dec_->SubmitExtControls(dec_surface, &ext_ctrls))
     return false;
 
   Reset();
@@ -2328,9 +2881,11 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::OutputPicture(
 }
 
 void V4L2SliceVideoDecodeAccelerator::V4L2H264Accelerator::Reset() {
+  ReleaseUnusedPictures();
   num_slices_ = 0;
   memset(&v4l2_decode_param_, 0, sizeof(v4l2_decode_param_));
-  memset(&v4l2_slice_params_, 0, sizeof(v4l2_slice_params_));
+  memset(v4l2_slice_params_.data(), 0,
+         sizeof(v4l2_slice_params_[0]) * v4l2_slice_params_.size());
 }
 
 scoped_refptr<V4L2SliceVideoDecodeAccelerator::V4L2DecodeSurface>
@@ -2438,6 +2993,8 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2VP8Accelerator::SubmitDecode(
     const scoped_refptr<VP8Picture>& last_frame,
     const scoped_refptr<VP8Picture>& golden_frame,
     const scoped_refptr<VP8Picture>& alt_frame) {
+  ScopedTraceEvent trace_event(
+      "SubmitDecode", VP8PictureToV4L2DecodeSurface(pic)->bitstream_id());
   struct v4l2_ctrl_vp8_frame_hdr v4l2_frame_hdr;
   memset(&v4l2_frame_hdr, 0, sizeof(v4l2_frame_hdr));
 
@@ -2535,9 +3092,8 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2VP8Accelerator::SubmitDecode(
   memset(&ext_ctrls, 0, sizeof(ext_ctrls));
   ext_ctrls.count = 1;
   ext_ctrls.controls = &ctrl;
-  ext_ctrls.config_store = dec_surface->config_store();
 
-  if (!v4l2_dec_->SubmitExtControls(&ext_ctrls))
+  if (!v4l2_dec_->SubmitExtControls(dec_surface, &ext_ctrls))
     return false;
 
   dec_surface->SetReferenceSurfaces(ref_surfaces);
@@ -2699,6 +3255,8 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2VP9Accelerator::SubmitDecode(
     const Vp9LoopFilterParams& lf_params,
     const std::vector<scoped_refptr<VP9Picture>>& ref_pictures,
     const base::Closure& done_cb) {
+  ScopedTraceEvent trace_event(
+      "SubmitDecode", VP9PictureToV4L2DecodeSurface(pic)->bitstream_id());
   const Vp9FrameHeader* frame_hdr = pic->frame_hdr.get();
   DCHECK(frame_hdr);
 
@@ -2838,8 +3396,7 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2VP9Accelerator::SubmitDecode(
   memset(&ext_ctrls, 0, sizeof(ext_ctrls));
   ext_ctrls.count = ctrls.size();
   ext_ctrls.controls = &ctrls[0];
-  ext_ctrls.config_store = dec_surface->config_store();
-  if (!v4l2_dec_->SubmitExtControls(&ext_ctrls))
+  if (!v4l2_dec_->SubmitExtControls(dec_surface, &ext_ctrls))
     return false;
 
   dec_surface->SetReferenceSurfaces(ref_surfaces);
@@ -2916,9 +3473,8 @@ bool V4L2SliceVideoDecodeAccelerator::V4L2VP9Accelerator::GetFrameContext(
   memset(&ext_ctrls, 0, sizeof(ext_ctrls));
   ext_ctrls.count = 1;
   ext_ctrls.controls = &ctrl;
-  ext_ctrls.config_store = dec_surface->config_store();
 
-  if (!v4l2_dec_->GetExtControls(&ext_ctrls))
+  if (!v4l2_dec_->GetExtControls(dec_surface, &ext_ctrls))
     return false;
 
   FillVp9FrameContext(v4l2_entropy.current_entropy_ctx, frame_ctx);
@@ -2938,7 +3494,7 @@ void V4L2SliceVideoDecodeAccelerator::DecodeSurface(
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
 
   DVLOGF(4) << "Submitting decode for surface: " << dec_surface->ToString();
-  Enqueue(dec_surface);
+  pending_enqueue_surfaces_.push_back(dec_surface);
 }
 
 void V4L2SliceVideoDecodeAccelerator::SurfaceReady(
@@ -2970,16 +3526,11 @@ void V4L2SliceVideoDecodeAccelerator::OutputSurface(
   OutputRecord& output_record =
       output_buffer_map_[dec_surface->output_record()];
 
-  bool inserted =
-      surfaces_at_display_
-          .insert(std::make_pair(output_record.picture_id, dec_surface))
-          .second;
-  DCHECK(inserted);
-
   DCHECK(!output_record.at_client);
   DCHECK(!output_record.at_device);
   DCHECK_NE(output_record.picture_id, -1);
   output_record.at_client = true;
+  output_record.at_display = true;
 
   Picture picture(output_record.picture_id, dec_surface->bitstream_id(),
                   dec_surface->visible_rect(), true /* allow_overlay */);
@@ -2997,24 +3548,44 @@ V4L2SliceVideoDecodeAccelerator::CreateSurface() {
   DCHECK(decoder_thread_task_runner_->BelongsToCurrentThread());
   DCHECK_EQ(state_, kDecoding);
 
+  if (free_output_buffers_.empty())
+    ReclaimOutputBuffers();
+
   if (free_input_buffers_.empty() || free_output_buffers_.empty())
     return nullptr;
 
-  int input = free_input_buffers_.front();
-  free_input_buffers_.pop_front();
-  int output = free_output_buffers_.front();
-  free_output_buffers_.pop_front();
+  int input = PopIdleInputBuffer();
+  if (input == -1) {
+    // Decoding resumes from ServiceDeviceTask() once a request completes.
+    SchedulePollIfNeeded();
+    return nullptr;
+  }
+  int output = free_output_buffers_.Pop();
 
   InputRecord& input_record = input_buffer_map_[input];
   DCHECK_EQ(input_record.bytes_used, 0u);
   DCHECK_EQ(input_record.input_id, -1);
+  if (input_record.request_queued) {
+    // Reuse the request of the previous frame decoded from this buffer. This
+    // is only done now, as the controls of that frame may still be read after
+    // it is decoded, e.g. by V4L2VP9Accelerator::GetFrameContext(). The
+    // request has completed, so this does not block.
+    if (!device_->ReinitMediaRequest(input_record.request_fd.get())) {
+      NOTIFY_ERROR(PLATFORM_FAILURE);
+      free_input_buffers_.Push(input);
+      free_output_buffers_.Push(output);
+      return nullptr;
+    }
+    input_record.request_queued = false;
+  }
   DCHECK(decoder_current_bitstream_buffer_ != nullptr);
   input_record.input_id = decoder_current_bitstream_buffer_->input_id;
+  decoder_current_bitstream_buffer_->surface_created = true;
 
-  scoped_refptr<V4L2DecodeSurface> dec_surface = new V4L2DecodeSurface(
-      decoder_current_bitstream_buffer_->input_id, input, output,
-      base::Bind(&V4L2SliceVideoDecodeAccelerator::ReuseOutputBuffer,
-                 base::Unretained(this)));
+  DCHECK(output_buffer_map_[output].surface->HasOneRef());
+  scoped_refptr<V4L2DecodeSurface> dec_surface =
+      output_buffer_map_[output].surface;
+  dec_surface->Reset(decoder_current_bitstream_buffer_->input_id, input);
 
   DVLOGF(4) << "Created surface " << input << " -> " << output;
   return dec_surface;
@@ -3028,6 +3599,8 @@ void V4L2SliceVideoDecodeAccelerator::SendPictureReady() {
   while (!pending_picture_ready_.empty()) {
     bool cleared = pending_picture_ready_.front().cleared;
     const Picture& picture = pending_picture_ready_.front().picture;
+    ScopedTraceEvent trace_event("SendPictureReady",
+                                 picture.bitstream_buffer_id());
     if (cleared && picture_clearing_count_ == 0) {
       DVLOGF(4) << "Posting picture ready to decode task runner for: "
                 << picture.picture_buffer_id();
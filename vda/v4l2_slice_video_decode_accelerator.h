@@ -14,8 +14,8 @@
 #include <utility>
 #include <vector>
 
+#include "base/logging.h"
 #include "base/macros.h"
-#include "base/memory/linked_ptr.h"
 #include "base/memory/ref_counted.h"
 #include "base/memory/weak_ptr.h"
 #include "base/synchronization/waitable_event.h"
@@ -51,6 +51,7 @@ class V4L2SliceVideoDecodeAccelerator
       VideoPixelFormat pixel_format,
       const NativePixmapHandle& native_pixmap_handle) override;
   void ReusePictureBuffer(int32_t picture_buffer_id) override;
+  void SetSkipNonReferenceFrames(bool skip) override;
   void Flush() override;
   void Reset() override;
   void Destroy() override;
@@ -66,6 +67,12 @@ class V4L2SliceVideoDecodeAccelerator
   class V4L2VP8Accelerator;
   class V4L2VP9Accelerator;
 
+  // Values of |next_free| in buffer records, see FreeList.
+  enum {
+    kFreeListEnd = -1,
+    kNotFree = -2,
+  };
+
   // Record for input buffers.
   struct InputRecord {
     InputRecord();
@@ -74,25 +81,101 @@ class V4L2SliceVideoDecodeAccelerator
     size_t length;
     size_t bytes_used;
     bool at_device;
+    int next_free;
+    // Media request carrying the controls of the frame decoded from this
+    // buffer, if |use_media_requests_|, and whether it has been queued since
+    // it was last reinitialized.
+    base::ScopedFD request_fd;
+    bool request_queued;
   };
 
   // Record for output buffers.
   struct OutputRecord {
     OutputRecord();
     OutputRecord(OutputRecord&&) = default;
+    ~OutputRecord();
     bool at_device;
     bool at_client;
+    // Whether the buffer was sent to the client by OutputSurface(), as opposed
+    // to waiting to be imported.
+    bool at_display;
     int32_t picture_id;
     std::vector<base::ScopedFD> dmabuf_fds;
     bool cleared;
+    int next_free;
+    // The surface for this buffer, reused for every frame decoded into it.
+    // The buffer is in use while anyone else holds a reference to it.
+    scoped_refptr<V4L2DecodeSurface> surface;
+  };
+
+  // FIFO of free buffer indices, linked through the |next_free| member of the
+  // records in |records|, so that taking and returning buffers neither
+  // allocates nor searches.
+  template <typename Record>
+  class FreeList {
+   public:
+    explicit FreeList(std::vector<Record>* records)
+        : records_(records), head_(kFreeListEnd), tail_(kFreeListEnd),
+          size_(0) {}
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    bool Contains(int index) const {
+      return (*records_)[index].next_free != kNotFree;
+    }
+
+    void Push(int index) {
+      DCHECK(!Contains(index));
+      (*records_)[index].next_free = kFreeListEnd;
+      if (tail_ == kFreeListEnd)
+        head_ = index;
+      else
+        (*records_)[tail_].next_free = index;
+      tail_ = index;
+      ++size_;
+    }
+
+    int Pop() {
+      DCHECK(!empty());
+      int index = head_;
+      head_ = (*records_)[index].next_free;
+      if (head_ == kFreeListEnd)
+        tail_ = kFreeListEnd;
+      (*records_)[index].next_free = kNotFree;
+      --size_;
+      return index;
+    }
+
+    // Must be called before the records are destroyed.
+    void clear() {
+      while (!empty())
+        Pop();
+    }
+
+   private:
+    std::vector<Record>* const records_;
+    int head_;
+    int tail_;
+    size_t size_;
+
+    DISALLOW_COPY_AND_ASSIGN(FreeList);
   };
 
-  // See http://crbug.com/255116.
-  // Input bitstream buffer size for up to 1080p streams.
-  const size_t kInputBufferMaxSizeFor1080p = 1024 * 1024;
-  // Input bitstream buffer size for up to 4k streams.
-  const size_t kInputBufferMaxSizeFor4k = 4 * kInputBufferMaxSizeFor1080p;
-  const size_t kNumInputBuffers = 16;
+  // Each input bitstream buffer holds a coded frame, and is sized for the
+  // largest frame allowed by the level of the stream, with a minimum of
+  // kMinInputBufferSize. Fewer buffers are used for large frames, so that the
+  // input queue takes about kInputBufferMemoryBudget, down to
+  // kMinNumInputBuffers: frames above kInputBufferMemoryBudget /
+  // kMinNumInputBuffers, i.e. 2 MiB, exceed the budget, e.g. the input queue
+  // of 4K streams takes over 50 MiB.
+  const size_t kMinInputBufferSize = 64 * 1024;
+  const size_t kInputBufferMemoryBudget = 16 * 1024 * 1024;
+  const size_t kMinNumInputBuffers = 8;
+  const size_t kMaxNumInputBuffers = 16;
+  // Frame rate assumed to account the load of the streams whose frame rate
+  // is not known.
+  const int kDefaultFrameRate = 30;
 
   // Input format V4L2 fourccs this class supports.
   static const uint32_t supported_input_fourccs_[];
@@ -105,18 +188,37 @@ class V4L2SliceVideoDecodeAccelerator
   // on the next DecodeSurface(). Return true on success.
   bool SubmitSlice(int index, const uint8_t* data, size_t size);
 
-  // Submit controls in |ext_ctrls| to hardware. Return true on success.
-  bool SubmitExtControls(struct v4l2_ext_controls_custom* ext_ctrls);
-
-  // Gets current control values for controls in |ext_ctrls| from the driver.
+  // Submit controls in |ext_ctrls| to hardware, for decoding |dec_surface|.
   // Return true on success.
-  bool GetExtControls(struct v4l2_ext_controls_custom* ext_ctrls);
+  bool SubmitExtControls(const scoped_refptr<V4L2DecodeSurface>& dec_surface,
+                         struct v4l2_ext_controls_custom* ext_ctrls);
+
+  // Gets current control values for controls in |ext_ctrls| from the driver,
+  // as used for decoding |dec_surface|. Return true on success.
+  bool GetExtControls(const scoped_refptr<V4L2DecodeSurface>& dec_surface,
+                      struct v4l2_ext_controls_custom* ext_ctrls);
 
   // Return true if the driver exposes V4L2 control |ctrl_id|, false otherwise.
   bool IsCtrlExposed(uint32_t ctrl_id);
 
+  // Return the number of elements of array control |ctrl_id|, or 0 if the
+  // driver does not report it or reports elements other than |elem_size|
+  // bytes large.
+  size_t GetCtrlElemCount(uint32_t ctrl_id, size_t elem_size);
+
+  // Read the current value of control |ctrl_id| to |value|. Return false if
+  // the driver does not expose it.
+  bool GetCtrlValue(uint32_t ctrl_id, int32_t* value);
+
+  // Return true if the driver accepts setting control |ctrl_id| in a media
+  // request, by setting its current value in a request that is not queued.
+  // Must only be called after OpenMediaDevice() returned true.
+  bool CanSetCtrlInMediaRequest(uint32_t ctrl_id);
+
   // Decode of |dec_surface| is ready to be submitted and all codec-specific
-  // settings are set in hardware.
+  // settings are set in hardware. The surface is queued to the device with
+  // the others submitted in the same decoder run, see
+  // EnqueuePendingSurfaces().
   void DecodeSurface(const scoped_refptr<V4L2DecodeSurface>& dec_surface);
 
   // |dec_surface| is ready to be outputted once decode is finished.
@@ -130,14 +232,37 @@ class V4L2SliceVideoDecodeAccelerator
   //
   // Internal methods of this class.
   //
+  // Make |ext_ctrls| apply to the media request or configuration store of
+  // |dec_surface|.
+  void SetExtControlsTarget(const scoped_refptr<V4L2DecodeSurface>& dec_surface,
+                            struct v4l2_ext_controls_custom* ext_ctrls);
+
   // Recycle a V4L2 input buffer with |index| after dequeuing from device.
   void ReuseInputBuffer(int index);
 
-  // Recycle V4L2 output buffer with |index|. Used as surface release callback.
+  // Pop a free input buffer whose media request, if any, has completed, moving
+  // the ones whose request has not to |input_buffers_awaiting_request_|.
+  // Return -1 if there is none.
+  int PopIdleInputBuffer();
+
+  // Return the buffers of |input_buffers_awaiting_request_| whose request has
+  // completed to the free input buffers.
+  void ReuseInputBuffersWithCompletedRequests();
+
+  // Recycle V4L2 output buffer with |index|.
   void ReuseOutputBuffer(int index);
 
-  // Queue a |dec_surface| to device for decoding.
-  void Enqueue(const scoped_refptr<V4L2DecodeSurface>& dec_surface);
+  // Recycle the output buffers that are not at device or client, and whose
+  // surfaces are no longer referenced by anyone but their OutputRecord.
+  void ReclaimOutputBuffers();
+
+  // Return the number of output buffers sent to the client for display.
+  size_t CountSurfacesAtDisplay() const;
+
+  // Queue the surfaces in |pending_enqueue_surfaces_| to device for decoding.
+  // Must be called before returning from any task that may have run the
+  // decoder, so that the device state seen by other tasks is up to date.
+  void EnqueuePendingSurfaces();
 
   // Dequeue any V4L2 buffers available and process.
   void Dequeue();
@@ -146,9 +271,17 @@ class V4L2SliceVideoDecodeAccelerator
   bool EnqueueInputRecord(int index, uint32_t config_store);
   bool EnqueueOutputRecord(int index);
 
+  // Log the QBUF/DQBUF counts per decoded frame so far, from the ioctl stats
+  // of |device_| if enabled.
+  void LogBufferIoctlStats() const;
+
   // Set input and output formats in hardware.
   bool SetupFormats();
 
+  // Set the input format in hardware, for input buffers of
+  // |input_buffer_size_|.
+  bool SetInputFormat();
+
   // Create input and output buffers.
   bool CreateInputBuffers();
   bool CreateOutputBuffers();
@@ -156,6 +289,18 @@ class V4L2SliceVideoDecodeAccelerator
   // Destroy input buffers.
   void DestroyInputBuffers();
 
+  // Return the size of the input buffers for coded frames of up to
+  // |max_frame_size|.
+  size_t GetInputBufferSize(size_t max_frame_size) const;
+
+  // Return true if the size of the input buffers required by the stream
+  // parameters of decoder_ differs enough from |input_buffer_size_|.
+  bool IsInputBufferResizeNeeded() const;
+
+  // Recreate the input buffers if IsInputBufferResizeNeeded(). All of them
+  // must be free.
+  bool ResizeInputBuffersIfNeeded();
+
   // Destroy output buffers. If |dismiss| is true, also dismissing the
   // associated PictureBuffers.
   bool DestroyOutputs(bool dismiss);
@@ -254,8 +399,9 @@ class V4L2SliceVideoDecodeAccelerator
   bool StartDevicePoll();
   bool StopDevicePoll(bool keep_input_state);
 
-  // Ran on device_poll_thread_ to wait for device events.
-  void DevicePollTask(bool poll_device);
+  // Ran on device_poll_thread_ to wait for device events, and for the
+  // completion of the media requests |request_fds|.
+  void DevicePollTask(bool poll_device, const std::vector<int>& request_fds);
 
   enum State {
     // We are in this state until Initialize() returns successfully.
@@ -296,6 +442,19 @@ class V4L2SliceVideoDecodeAccelerator
   // Return false if no buffers are pending on decoder_input_queue_.
   bool TrySetNewBistreamBuffer();
 
+  // Drop decoder_current_bitstream_buffer_ once decoder_ is done with it,
+  // which returns it to the client. If decoder_ dropped the frames of the
+  // buffer without creating a surface from it, tell the client first.
+  void ReleaseCurrentBitstreamBuffer();
+
+  // Drop the frame decoder_ failed to decode and the rest of the current
+  // bitstream buffer, which is reported to the client, and resume decoding at
+  // the next keyframe.
+  void RecoverFromDecodeError();
+
+  // Handler for SetSkipNonReferenceFrames() on decoder_thread_.
+  void SetSkipNonReferenceFramesTask(bool skip);
+
   // Auto-destruction reference for EGLSync (for message-passing).
   void ReusePictureBufferTask(int32_t picture_buffer_id);
 
@@ -347,33 +506,64 @@ class V4L2SliceVideoDecodeAccelerator
 
   // Thread used to poll the device for events.
   base::Thread device_poll_thread_;
+  // Scheduling of |device_poll_thread_|, applied each time it starts.
+  ThreadSchedulingConfig device_poll_thread_scheduling_;
+  // True from posting a DevicePollTask() until the ServiceDeviceTask() it
+  // posts runs, so that at most one poll is outstanding. What that poll waits
+  // for: the device, and the media requests of |poll_pending_request_fds_|.
+  bool poll_pending_;
+  bool poll_pending_device_;
+  std::vector<int> poll_pending_request_fds_;
+
+  // Memory accounting of the session, may be null.
+  scoped_refptr<MemoryUsageTracker> memory_usage_tracker_;
 
   // Input queue state.
   bool input_streamon_;
   // Number of input buffers enqueued to the device.
   int input_buffer_queued_count_;
-  // Input buffers ready to use; LIFO since we don't care about ordering.
-  std::list<int> free_input_buffers_;
+  // Input buffers ready to use.
+  FreeList<InputRecord> free_input_buffers_;
+  // Input buffers dequeued from the device, whose media request has not
+  // completed yet. The device poll thread waits for them, so that the decoder
+  // thread does not block on the completion.
+  std::vector<int> input_buffers_awaiting_request_;
   // Mapping of int index to an input buffer record.
   std::vector<InputRecord> input_buffer_map_;
+  // Size requested for the input buffers.
+  size_t input_buffer_size_;
 
   // Output queue state.
   bool output_streamon_;
   // Number of output buffers enqueued to the device.
   int output_buffer_queued_count_;
   // Output buffers ready to use.
-  std::list<int> free_output_buffers_;
+  FreeList<OutputRecord> free_output_buffers_;
   // Mapping of int index to an output buffer record.
   std::vector<OutputRecord> output_buffer_map_;
 
+  // Number of decoded frames dequeued.
+  uint64_t decoded_frame_count_;
+
+  // Whether the non-reference frames of the bitstream buffers passed to
+  // Decode() from now on are to be skipped, see SetSkipNonReferenceFrames().
+  bool skip_non_reference_frames_;
+
+  // Whether decode errors are recovered from, see Config::error_resilient,
+  // and the number of recoveries.
+  bool error_resilient_;
+  uint64_t error_recovery_count_;
+
   VideoCodecProfile video_profile_;
+  // Frame rate of the stream, to account its load on the device.
+  int frame_rate_;
   uint32_t input_format_fourcc_;
   uint32_t output_format_fourcc_;
   Size coded_size_;
 
   struct BitstreamBufferRef;
   // Input queue of stream buffers coming from the client.
-  std::queue<linked_ptr<BitstreamBufferRef>> decoder_input_queue_;
+  std::queue<std::unique_ptr<BitstreamBufferRef>> decoder_input_queue_;
   // BitstreamBuffer currently being processed.
   std::unique_ptr<BitstreamBufferRef> decoder_current_bitstream_buffer_;
 
@@ -381,6 +571,9 @@ class V4L2SliceVideoDecodeAccelerator
   // decoded. The surfaces must be output in order they are queued.
   std::queue<scoped_refptr<V4L2DecodeSurface>> decoder_display_queue_;
 
+  // Surfaces submitted by the decoder and not queued to the device yet.
+  std::vector<scoped_refptr<V4L2DecodeSurface>> pending_enqueue_surfaces_;
+
   // Decoder state.
   State state_;
 
@@ -402,16 +595,6 @@ class V4L2SliceVideoDecodeAccelerator
   // Codec-specific software decoder in use.
   std::unique_ptr<AcceleratedVideoDecoder> decoder_;
 
-  // Surfaces queued to device to keep references to them while decoded.
-  using V4L2DecodeSurfaceByOutputId =
-      std::map<int, scoped_refptr<V4L2DecodeSurface>>;
-  V4L2DecodeSurfaceByOutputId surfaces_at_device_;
-
-  // Surfaces sent to client to keep references to them while displayed.
-  using V4L2DecodeSurfaceByPictureBufferId =
-      std::map<int32_t, scoped_refptr<V4L2DecodeSurface>>;
-  V4L2DecodeSurfaceByPictureBufferId surfaces_at_display_;
-
   // Record for decoded pictures that can be sent to PictureReady.
   struct PictureRecord {
     PictureRecord(bool cleared, const Picture& picture);
@@ -426,6 +609,10 @@ class V4L2SliceVideoDecodeAccelerator
   // The number of pictures that are sent to PictureReady and will be cleared.
   int picture_clearing_count_;
 
+  // True if frames are submitted with media requests rather than with the
+  // configuration stores selected by the config_store fields.
+  bool use_media_requests_;
+
   // The WeakPtrFactory for |weak_this_|.
   base::WeakPtrFactory<V4L2SliceVideoDecodeAccelerator> weak_this_factory_;
 
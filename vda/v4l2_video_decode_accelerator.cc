@@ -2,7 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 // Note: ported from Chromium commit head: 91175b1
-// Note: image processor is not ported.
+// Note: V4L2 image processor is not ported, SoftwareImageProcessor converts the
+// output instead.
 
 #include "v4l2_video_decode_accelerator.h"
 
@@ -14,6 +15,7 @@
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "base/bind.h"
 #include "base/command_line.h"
@@ -27,6 +29,8 @@
 #include "h264_parser.h"
 #include "rect.h"
 #include "shared_memory_region.h"
+#include "trace_events.h"
+#include "v4l2_device_selector.h"
 #include "videodev2_custom.h"
 
 #define DVLOGF(level) DVLOG(level) << __func__ << "(): "
@@ -79,6 +83,9 @@ struct V4L2VideoDecodeAccelerator::BitstreamBufferRef {
   const std::unique_ptr<SharedMemoryRegion> shm;
   size_t bytes_used;
   const int32_t input_id;
+  // Set once |shm| is mapped and accounted in it, to remove it when the
+  // buffer is returned.
+  scoped_refptr<MemoryUsageTracker> memory_usage_tracker;
 };
 
 V4L2VideoDecodeAccelerator::BitstreamBufferRef::BitstreamBufferRef(
@@ -90,10 +97,18 @@ V4L2VideoDecodeAccelerator::BitstreamBufferRef::BitstreamBufferRef(
       client_task_runner(client_task_runner),
       shm(std::move(shm)),
       bytes_used(0),
-      input_id(input_id) {}
+      input_id(input_id) {
+  if (input_id >= 0)
+    TraceAsyncBegin(kBitstreamBufferTraceName, input_id);
+}
 
 V4L2VideoDecodeAccelerator::BitstreamBufferRef::~BitstreamBufferRef() {
+  if (memory_usage_tracker) {
+    memory_usage_tracker->Remove(MemoryUsageTracker::kBitstreamBuffers,
+                                 shm->size(), 1);
+  }
   if (input_id >= 0) {
+    TraceAsyncEnd(kBitstreamBufferTraceName, input_id);
     client_task_runner->PostTask(
         FROM_HERE,
         base::Bind(&Client::NotifyEndOfBitstreamBuffer, client, input_id));
@@ -140,9 +155,14 @@ V4L2VideoDecodeAccelerator::V4L2VideoDecodeAccelerator(
       output_buffer_queued_count_(0),
       output_dpb_size_(0),
       output_planes_count_(0),
+      output_memory_type_(V4L2_MEMORY_MMAP),
+      output_buffers_requested_(false),
+      output_client_format_(PIXEL_FORMAT_UNKNOWN),
+      image_processor_frames_to_drop_(0),
       picture_clearing_count_(0),
       device_poll_thread_("V4L2DevicePollThread"),
       video_profile_(VIDEO_CODEC_PROFILE_UNKNOWN),
+      frame_rate_(0),
       input_format_fourcc_(0),
       output_format_fourcc_(0),
       weak_this_factory_(this) {
@@ -172,6 +192,16 @@ bool V4L2VideoDecodeAccelerator::Initialize(const Config& config,
     return false;
   }
 
+  // The device parses the bitstream, frames cannot be dropped before it.
+  if (config.keyframes_only) {
+    VLOGF(1) << "Keyframe-only decoding is not supported";
+    return false;
+  }
+  if (config.error_resilient) {
+    VLOGF(1) << "Error resilient decoding is not supported";
+    return false;
+  }
+
   client_ptr_factory_.reset(new base::WeakPtrFactory<Client>(client));
   client_ = client_ptr_factory_->GetWeakPtr();
   // If we haven't been set up to decode on separate thread via
@@ -188,6 +218,9 @@ bool V4L2VideoDecodeAccelerator::Initialize(const Config& config,
   input_format_fourcc_ =
       V4L2Device::VideoCodecProfileToV4L2PixFmt(video_profile_, false);
 
+  frame_rate_ = config.frame_rate > 0 ? config.frame_rate : kDefaultFrameRate;
+  device_->SetSessionMacroblockRate(V4L2DeviceSelector::GetMacroblockRate(
+      config.initial_expected_coded_size, frame_rate_));
   if (!device_->Open(V4L2Device::Type::kDecoder, input_format_fourcc_)) {
     VLOGF(1) << "Failed to open device for profile: " << config.profile
              << " fourcc: " << std::hex << "0x" << input_format_fourcc_;
@@ -215,6 +248,15 @@ bool V4L2VideoDecodeAccelerator::Initialize(const Config& config,
     VLOGF(1) << "decoder thread failed to start";
     return false;
   }
+  PostApplyThreadSchedulingConfig(decoder_thread_.task_runner(),
+                                  config.decoder_thread_scheduling);
+  device_poll_thread_scheduling_ = config.device_poll_thread_scheduling;
+  memory_usage_tracker_ = config.memory_usage_tracker;
+  // The parser only looks for frame boundaries, its state does not grow.
+  if (memory_usage_tracker_ && decoder_h264_parser_) {
+    memory_usage_tracker_->Set(MemoryUsageTracker::kParserState,
+                               decoder_h264_parser_->GetStateSize(), 1);
+  }
 
   decoder_state_ = kInitialized;
   output_mode_ = config.output_mode;
@@ -286,7 +328,7 @@ void V4L2VideoDecodeAccelerator::AssignPictureBuffersTask(
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
   DCHECK_EQ(decoder_state_, kAwaitingPictureBuffers);
 
-  uint32_t req_buffer_count = output_dpb_size_ + kDpbOutputBufferExtraCount;
+  uint32_t req_buffer_count = GetRequiredOutputBufferCount();
 
   if (buffers.size() < req_buffer_count) {
     VLOGF(1) << "Failed to provide requested picture buffers. (Got "
@@ -295,20 +337,9 @@ void V4L2VideoDecodeAccelerator::AssignPictureBuffersTask(
     return;
   }
 
-  // Allocate the output buffers.
-  struct v4l2_requestbuffers reqbufs;
-  memset(&reqbufs, 0, sizeof(reqbufs));
-  reqbufs.count = buffers.size();
-  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  reqbufs.memory = V4L2_MEMORY_MMAP;
-  IOCTL_OR_ERROR_RETURN(VIDIOC_REQBUFS, &reqbufs);
-
-  if (reqbufs.count != buffers.size()) {
-    VLOGF(1) << "Could not allocate enough output buffers";
-    NOTIFY_ERROR(PLATFORM_FAILURE);
-    return;
-  }
-
+  // The output buffers are requested to the device when the first buffer is
+  // imported, as their memory type depends on the client buffer layout.
+  DCHECK(!output_buffers_requested_);
   DCHECK(free_output_buffers_.empty());
   DCHECK(output_buffer_map_.empty());
   output_buffer_map_.resize(buffers.size());
@@ -346,7 +377,9 @@ void V4L2VideoDecodeAccelerator::ImportBufferForPicture(
   }
 
   if (pixel_format !=
-      V4L2Device::V4L2PixFmtToVideoPixelFormat(output_format_fourcc_)) {
+          V4L2Device::V4L2PixFmtToVideoPixelFormat(output_format_fourcc_) &&
+      !SoftwareImageProcessor::IsSupported(output_format_fourcc_,
+                                           pixel_format)) {
     VLOGF(1) << "Unsupported import format: " << pixel_format;
     NOTIFY_ERROR(INVALID_ARGUMENT);
     return;
@@ -361,13 +394,15 @@ void V4L2VideoDecodeAccelerator::ImportBufferForPicture(
   decoder_thread_.task_runner()->PostTask(
       FROM_HERE,
       base::Bind(&V4L2VideoDecodeAccelerator::ImportBufferForPictureTask,
-                 base::Unretained(this), picture_buffer_id,
-                 base::Passed(&dmabuf_fds)));
+                 base::Unretained(this), picture_buffer_id, pixel_format,
+                 base::Passed(&dmabuf_fds), native_pixmap_handle.planes));
 }
 
 void V4L2VideoDecodeAccelerator::ImportBufferForPictureTask(
     int32_t picture_buffer_id,
-    std::vector<base::ScopedFD> dmabuf_fds) {
+    VideoPixelFormat pixel_format,
+    std::vector<base::ScopedFD> dmabuf_fds,
+    const std::vector<NativePixmapPlane>& planes) {
   DVLOGF(3) << "picture_buffer_id=" << picture_buffer_id
             << ", dmabuf_fds.size()=" << dmabuf_fds.size();
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
@@ -398,11 +433,30 @@ void V4L2VideoDecodeAccelerator::ImportBufferForPictureTask(
                        index),
             0);
 
-  iter->state = kFree;
+  if (!output_buffers_requested_) {
+    if (!RequestOutputBuffers(pixel_format, dmabuf_fds.size(), planes))
+      return;
+  } else if (pixel_format != output_client_format_) {
+    VLOGF(1) << "Imported buffers have different formats: " << pixel_format
+             << " and " << output_client_format_;
+    NOTIFY_ERROR(INVALID_ARGUMENT);
+    return;
+  }
 
-  DCHECK_EQ(output_planes_count_, dmabuf_fds.size());
+  iter->output_fds.swap(dmabuf_fds);
+  if (image_processor_) {
+    if (!MapClientBuffer(planes, &*iter)) {
+      NOTIFY_ERROR(PLATFORM_FAILURE);
+      return;
+    }
+  } else if (iter->output_fds.size() != output_planes_count_) {
+    VLOGF(1) << "Expected " << output_planes_count_ << " dmabufs, got "
+             << iter->output_fds.size();
+    NOTIFY_ERROR(INVALID_ARGUMENT);
+    return;
+  }
 
-  iter->processor_output_fds.swap(dmabuf_fds);
+  iter->state = kFree;
   free_output_buffers_.push_back(index);
   if (decoder_state_ != kChangingResolution) {
       Enqueue();
@@ -410,6 +464,168 @@ void V4L2VideoDecodeAccelerator::ImportBufferForPictureTask(
   }
 }
 
+bool V4L2VideoDecodeAccelerator::RequestOutputBuffers(
+    VideoPixelFormat pixel_format,
+    size_t num_fds,
+    const std::vector<NativePixmapPlane>& planes) {
+  DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
+  DCHECK(!output_buffers_requested_);
+  DCHECK(!image_processor_);
+
+  // The device can decode to the client buffers if they have its format, one
+  // dmabuf per V4L2 plane, and the strides it uses.
+  bool direct =
+      pixel_format ==
+          V4L2Device::V4L2PixFmtToVideoPixelFormat(output_format_fourcc_) &&
+      num_fds == output_planes_count_ && planes.size() >= output_planes_count_;
+  if (direct && output_planes_count_ == 1 && planes.size() == 2) {
+    // Semi-planar format in a single V4L2 plane, the chroma plane follows the
+    // luma rows.
+    const int stride = output_plane_strides_[0];
+    direct = planes[0].offset == 0 && planes[0].stride == stride &&
+             planes[1].offset == stride * coded_size_.height() &&
+             planes[1].stride == stride;
+  } else {
+    for (size_t i = 0; direct && i < output_planes_count_; ++i) {
+      direct = planes[i].offset == 0 &&
+               planes[i].stride == output_plane_strides_[i];
+    }
+  }
+
+  if (!direct) {
+    image_processor_ = SoftwareImageProcessor::Create(
+        output_format_fourcc_, pixel_format, visible_size_);
+    if (!image_processor_) {
+      VLOGF(1) << "Failed to create image processor";
+      NOTIFY_ERROR(PLATFORM_FAILURE);
+      return false;
+    }
+  }
+
+  struct v4l2_requestbuffers reqbufs;
+  memset(&reqbufs, 0, sizeof(reqbufs));
+  reqbufs.count = output_buffer_map_.size();
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = direct ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+  IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_REQBUFS, &reqbufs);
+
+  if (reqbufs.count != output_buffer_map_.size()) {
+    VLOGF(1) << "Could not allocate enough output buffers";
+    NOTIFY_ERROR(PLATFORM_FAILURE);
+    return false;
+  }
+  output_memory_type_ = static_cast<enum v4l2_memory>(reqbufs.memory);
+  output_buffers_requested_ = true;
+  output_client_format_ = pixel_format;
+
+  if (image_processor_) {
+    for (size_t i = 0; i < output_buffer_map_.size(); ++i) {
+      if (!MapDeviceBuffer(i, &output_buffer_map_[i])) {
+        NOTIFY_ERROR(PLATFORM_FAILURE);
+        return false;
+      }
+    }
+  }
+
+  VLOGF(2) << "Decoding to "
+           << (image_processor_ ? "device buffers, converted by image processor"
+                                : "client buffers");
+  return true;
+}
+
+bool V4L2VideoDecodeAccelerator::MapDeviceBuffer(size_t index,
+                                                 OutputRecord* output_record) {
+  DCHECK(output_record->device_mappings.empty());
+  DCHECK_LE(output_planes_count_,
+            static_cast<size_t>(SoftwareImageProcessor::kMaxPlanes));
+
+  struct v4l2_buffer_custom buffer;
+  std::unique_ptr<struct v4l2_plane[]> planes(
+      new v4l2_plane[output_planes_count_]);
+  memset(&buffer, 0, sizeof(buffer));
+  memset(planes.get(), 0, sizeof(struct v4l2_plane) * output_planes_count_);
+  buffer.index = index;
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.m.planes = planes.get();
+  buffer.length = output_planes_count_;
+  IOCTL_OR_ERROR_RETURN_FALSE(VIDIOC_QUERYBUF, &buffer);
+
+  for (size_t i = 0; i < output_planes_count_; ++i) {
+    void* address = device_->Mmap(NULL, planes[i].length, PROT_READ,
+                                  MAP_SHARED, planes[i].m.mem_offset);
+    if (address == MAP_FAILED) {
+      VPLOGF(1) << "mmap() failed";
+      return false;
+    }
+    output_record->device_mappings.push_back({address, planes[i].length});
+  }
+  return true;
+}
+
+bool V4L2VideoDecodeAccelerator::MapClientBuffer(
+    const std::vector<NativePixmapPlane>& planes,
+    OutputRecord* output_record) {
+  DCHECK(output_record->client_mappings.empty());
+
+  const size_t num_planes = output_client_format_ == PIXEL_FORMAT_NV12 ? 2 : 3;
+  if (planes.size() < num_planes || output_record->output_fds.empty() ||
+      output_record->output_fds.size() >
+          static_cast<size_t>(SoftwareImageProcessor::kMaxPlanes)) {
+    VLOGF(1) << "Invalid client buffer, planes: " << planes.size()
+             << ", dmabufs: " << output_record->output_fds.size();
+    return false;
+  }
+
+  for (const auto& fd : output_record->output_fds) {
+    off_t length = lseek(fd.get(), 0, SEEK_END);
+    if (length <= 0) {
+      VPLOGF(1) << "Failed to get dmabuf size";
+      return false;
+    }
+    void* address = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd.get(), 0);
+    if (address == MAP_FAILED) {
+      VPLOGF(1) << "mmap() failed";
+      return false;
+    }
+    output_record->client_mappings.push_back(
+        {address, static_cast<size_t>(length)});
+  }
+
+  SoftwareImageProcessor::MappedFrame& client_frame =
+      output_record->client_frame;
+  for (const auto& fd : output_record->output_fds)
+    client_frame.dmabuf_fds[client_frame.num_dmabufs++] = fd.get();
+
+  const std::vector<Mapping>& mappings = output_record->client_mappings;
+  for (size_t i = 0; i < num_planes; ++i) {
+    // Planes without a dmabuf of their own are in the last one.
+    const Mapping& mapping = mappings[std::min(i, mappings.size() - 1)];
+    if (planes[i].offset < 0 ||
+        static_cast<size_t>(planes[i].offset) >= mapping.length) {
+      VLOGF(1) << "Plane " << i << " offset out of the buffer: "
+               << planes[i].offset;
+      return false;
+    }
+    client_frame.data[i] =
+        static_cast<uint8_t*>(mapping.address) + planes[i].offset;
+    client_frame.stride[i] = planes[i].stride;
+  }
+  return true;
+}
+
+void V4L2VideoDecodeAccelerator::UnmapOutputRecord(
+    OutputRecord* output_record) {
+  for (const auto& mapping : output_record->device_mappings)
+    device_->Munmap(mapping.address, mapping.length);
+  output_record->device_mappings.clear();
+  for (const auto& mapping : output_record->client_mappings)
+    munmap(mapping.address, mapping.length);
+  output_record->client_mappings.clear();
+  output_record->client_frame = SoftwareImageProcessor::MappedFrame();
+}
+
 void V4L2VideoDecodeAccelerator::ReusePictureBuffer(int32_t picture_buffer_id) {
   DVLOGF(4) << "picture_buffer_id=" << picture_buffer_id;
   // Must be run on child thread, as we'll insert a sync in the EGL context.
@@ -485,6 +701,7 @@ void V4L2VideoDecodeAccelerator::DecodeTask(
   DVLOGF(4) << "input_id=" << bitstream_buffer.id();
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
   DCHECK_NE(decoder_state_, kUninitialized);
+  ScopedTraceEvent trace_event("DecodeTask", bitstream_buffer.id());
 
   std::unique_ptr<BitstreamBufferRef> bitstream_record(new BitstreamBufferRef(
       decode_client_, decode_task_runner_,
@@ -502,6 +719,11 @@ void V4L2VideoDecodeAccelerator::DecodeTask(
     return;
   }
   DVLOGF(4) << "mapped at=" << bitstream_record->shm->memory();
+  if (memory_usage_tracker_) {
+    memory_usage_tracker_->Add(MemoryUsageTracker::kBitstreamBuffers,
+                               bitstream_record->shm->size(), 1);
+    bitstream_record->memory_usage_tracker = memory_usage_tracker_;
+  }
 
   if (decoder_state_ == kResetting || decoder_flushing_) {
     // In the case that we're resetting or flushing, we need to delay decoding
@@ -972,6 +1194,7 @@ void V4L2VideoDecodeAccelerator::Enqueue() {
   DVLOGF(4);
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
   DCHECK_NE(decoder_state_, kUninitialized);
+  ScopedTraceEvent trace_event("Enqueue");
 
   // Drain the pipe of completed decode buffers.
   const int old_inputs_queued = input_buffer_queued_count_;
@@ -1065,6 +1288,7 @@ void V4L2VideoDecodeAccelerator::Dequeue() {
   DVLOGF(4);
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
   DCHECK_NE(decoder_state_, kUninitialized);
+  ScopedTraceEvent trace_event("Dequeue");
 
   while (input_buffer_queued_count_ > 0) {
     if (!DequeueInputBuffer())
@@ -1125,7 +1349,7 @@ bool V4L2VideoDecodeAccelerator::DequeueOutputBuffer() {
   memset(&dqbuf, 0, sizeof(dqbuf));
   memset(planes.get(), 0, sizeof(struct v4l2_plane) * output_planes_count_);
   dqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  dqbuf.memory = V4L2_MEMORY_MMAP;
+  dqbuf.memory = output_memory_type_;
   dqbuf.m.planes = planes.get();
   dqbuf.length = output_planes_count_;
   if (device_->Ioctl(VIDIOC_DQBUF, &dqbuf) != 0) {
@@ -1153,14 +1377,19 @@ bool V4L2VideoDecodeAccelerator::DequeueOutputBuffer() {
     DCHECK_GE(bitstream_buffer_id, 0);
     DVLOGF(4) << "Dequeue output buffer: dqbuf index=" << dqbuf.index
               << " bitstream input_id=" << bitstream_buffer_id;
-    output_record.state = kAtClient;
-    decoder_frames_at_client_++;
-
-    const Picture picture(output_record.picture_id, bitstream_buffer_id,
-                          Rect(visible_size_), false);
-    pending_picture_ready_.push(PictureRecord(output_record.cleared, picture));
-    SendPictureReady();
-    output_record.cleared = true;
+    if (image_processor_) {
+      ProcessFrame(bitstream_buffer_id, dqbuf.index);
+    } else {
+      output_record.state = kAtClient;
+      decoder_frames_at_client_++;
+
+      const Picture picture(output_record.picture_id, bitstream_buffer_id,
+                            Rect(visible_size_), false);
+      pending_picture_ready_.push(
+          PictureRecord(output_record.cleared, picture));
+      SendPictureReady();
+      output_record.cleared = true;
+    }
   }
   if (dqbuf.flags & V4L2_BUF_FLAG_LAST) {
     DVLOGF(3) << "Got last output buffer. Waiting last buffer="
@@ -1221,7 +1450,11 @@ bool V4L2VideoDecodeAccelerator::EnqueueOutputRecord() {
          sizeof(struct v4l2_plane) * output_planes_count_);
   qbuf.index = buffer;
   qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  qbuf.memory = V4L2_MEMORY_MMAP;
+  qbuf.memory = output_memory_type_;
+  if (output_memory_type_ == V4L2_MEMORY_DMABUF) {
+    for (size_t i = 0; i < output_planes_count_; ++i)
+      qbuf_planes[i].m.fd = output_record.output_fds[i].get();
+  }
   qbuf.m.planes = qbuf_planes.get();
   qbuf.length = output_planes_count_;
   DVLOGF(4) << "qbuf.index=" << qbuf.index;
@@ -1232,6 +1465,81 @@ bool V4L2VideoDecodeAccelerator::EnqueueOutputRecord() {
   return true;
 }
 
+void V4L2VideoDecodeAccelerator::ProcessFrame(int32_t bitstream_buffer_id,
+                                              int index) {
+  DVLOGF(4) << "bitstream_buffer_id=" << bitstream_buffer_id
+            << ", index=" << index;
+  DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
+
+  OutputRecord& output_record = output_buffer_map_[index];
+  SoftwareImageProcessor::MappedFrame input;
+  for (size_t i = 0; i < output_record.device_mappings.size(); ++i) {
+    input.data[i] =
+        static_cast<uint8_t*>(output_record.device_mappings[i].address);
+    input.stride[i] = output_plane_strides_[i];
+  }
+  if (output_planes_count_ == 1) {
+    // The chroma plane follows the luma rows in the single V4L2 plane.
+    input.data[1] = input.data[0] + input.stride[0] * coded_size_.height();
+    input.stride[1] = input.stride[0];
+  }
+
+  output_record.state = kAtProcessor;
+  image_processor_bitstream_buffer_ids_.push(bitstream_buffer_id);
+  image_processor_->Process(
+      input, output_record.client_frame,
+      base::Bind(&V4L2VideoDecodeAccelerator::FrameProcessed,
+                 base::Unretained(this), bitstream_buffer_id, index));
+}
+
+void V4L2VideoDecodeAccelerator::FrameProcessed(int32_t bitstream_buffer_id,
+                                                int index) {
+  DVLOGF(4) << "bitstream_buffer_id=" << bitstream_buffer_id
+            << ", index=" << index;
+  DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
+
+  if (decoder_state_ == kError) {
+    DVLOGF(4) << "early out: kError state";
+    return;
+  }
+
+  OutputRecord& output_record = output_buffer_map_[index];
+  DCHECK_EQ(output_record.state, kAtProcessor);
+  if (image_processor_frames_to_drop_ > 0) {
+    // This frame was decoded before a reset, drop it.
+    image_processor_frames_to_drop_--;
+    output_record.state = kFree;
+    free_output_buffers_.push_back(index);
+  } else {
+    DCHECK(!image_processor_bitstream_buffer_ids_.empty());
+    DCHECK_EQ(image_processor_bitstream_buffer_ids_.front(),
+              bitstream_buffer_id);
+    image_processor_bitstream_buffer_ids_.pop();
+    output_record.state = kAtClient;
+    decoder_frames_at_client_++;
+
+    const Picture picture(output_record.picture_id, bitstream_buffer_id,
+                          Rect(visible_size_), false);
+    pending_picture_ready_.push(PictureRecord(output_record.cleared, picture));
+    SendPictureReady();
+    output_record.cleared = true;
+  }
+
+  if (decoder_state_ == kChangingResolution) {
+    if (!IsImageProcessorBusy())
+      FinishResolutionChange();
+    return;
+  }
+
+  Enqueue();
+  NotifyFlushDoneIfNeeded();
+}
+
+bool V4L2VideoDecodeAccelerator::IsImageProcessorBusy() const {
+  return !image_processor_bitstream_buffer_ids_.empty() ||
+         image_processor_frames_to_drop_ > 0;
+}
+
 void V4L2VideoDecodeAccelerator::ReusePictureBufferTask(int32_t picture_buffer_id) {
   DVLOGF(4) << "picture_buffer_id=" << picture_buffer_id;
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
@@ -1325,6 +1633,10 @@ void V4L2VideoDecodeAccelerator::NotifyFlushDoneIfNeeded() {
     DVLOGF(3) << "Some input buffers are not dequeued.";
     return;
   }
+  if (IsImageProcessorBusy()) {
+    DVLOGF(3) << "Some frames are being converted.";
+    return;
+  }
   if (flush_awaiting_last_output_buffer_) {
     DVLOGF(3) << "Waiting for last output buffer.";
     return;
@@ -1425,6 +1737,12 @@ void V4L2VideoDecodeAccelerator::FinishReset() {
   if (!(StopDevicePoll() && StopOutputStream()))
     return;
 
+  // The frames being converted are from before the reset, drop them once the
+  // image processor returns them.
+  image_processor_frames_to_drop_ +=
+      image_processor_bitstream_buffer_ids_.size();
+  image_processor_bitstream_buffer_ids_ = std::queue<int32_t>();
+
   if (DequeueResolutionChangeEvent()) {
     reset_pending_ = true;
     StartResolutionChange();
@@ -1515,6 +1833,8 @@ bool V4L2VideoDecodeAccelerator::StartDevicePoll() {
     NOTIFY_ERROR(PLATFORM_FAILURE);
     return false;
   }
+  PostApplyThreadSchedulingConfig(device_poll_thread_.task_runner(),
+                                  device_poll_thread_scheduling_);
   device_poll_thread_.task_runner()->PostTask(
       FROM_HERE, base::Bind(&V4L2VideoDecodeAccelerator::DevicePollTask,
                             base::Unretained(this), 0));
@@ -1610,9 +1930,10 @@ void V4L2VideoDecodeAccelerator::StartResolutionChange() {
   decoder_state_ = kChangingResolution;
   SendPictureReady();  // Send all pending PictureReady.
 
-  if (!DestroyOutputBuffers()) {
-    VLOGF(1) << "Failed destroying output buffers.";
-    NOTIFY_ERROR(PLATFORM_FAILURE);
+  // No frame can be dropped during resolution change, FrameProcessed() will
+  // finish it once the image processor has returned all of them.
+  if (IsImageProcessorBusy()) {
+    VLOGF(2) << "Wait for image processor to return all frames";
     return;
   }
 
@@ -1629,6 +1950,13 @@ void V4L2VideoDecodeAccelerator::FinishResolutionChange() {
     return;
   }
 
+  DCHECK(!IsImageProcessorBusy());
+  if (!DestroyOutputBuffers()) {
+    VLOGF(1) << "Failed destroying output buffers.";
+    NOTIFY_ERROR(PLATFORM_FAILURE);
+    return;
+  }
+
   struct v4l2_format format;
   bool again;
   Size visible_size;
@@ -1740,8 +2068,15 @@ bool V4L2VideoDecodeAccelerator::CreateBuffersForFormat(
     const Size& visible_size) {
   DCHECK(decoder_thread_.task_runner()->BelongsToCurrentThread());
   output_planes_count_ = format.fmt.pix_mp.num_planes;
+  output_plane_strides_.clear();
+  for (size_t i = 0; i < output_planes_count_; ++i) {
+    output_plane_strides_.push_back(
+        format.fmt.pix_mp.plane_fmt[i].bytesperline);
+  }
   coded_size_.SetSize(format.fmt.pix_mp.width, format.fmt.pix_mp.height);
   visible_size_ = visible_size;
+  device_->SetSessionMacroblockRate(
+      V4L2DeviceSelector::GetMacroblockRate(coded_size_, frame_rate_));
 
   VLOGF(2) << "new resolution: " << coded_size_.ToString()
            << ", visible size: " << visible_size_.ToString()
@@ -1839,6 +2174,10 @@ bool V4L2VideoDecodeAccelerator::CreateInputBuffers() {
     }
     input_buffer_map_[i].address = address;
     input_buffer_map_[i].length = buffer.m.planes[0].length;
+    if (memory_usage_tracker_) {
+      memory_usage_tracker_->Add(MemoryUsageTracker::kInputBuffers,
+                                 input_buffer_map_[i].length, 1);
+    }
   }
 
   return true;
@@ -1899,7 +2238,9 @@ bool V4L2VideoDecodeAccelerator::SetupFormats() {
 
   // We have to set up the format for output, because the driver may not allow
   // changing it once we start streaming; whether it can support our chosen
-  // output format or not may depend on the input format.
+  // output format or not may depend on the input format. Prefer a format the
+  // client buffers can have, otherwise use one the image processor converts.
+  uint32_t processor_input_fourcc = 0;
   memset(&fmtdesc, 0, sizeof(fmtdesc));
   fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
   while (device_->Ioctl(VIDIOC_ENUM_FMT, &fmtdesc) == 0) {
@@ -1907,11 +2248,18 @@ bool V4L2VideoDecodeAccelerator::SetupFormats() {
       output_format_fourcc_ = fmtdesc.pixelformat;
       break;
     }
+    if (processor_input_fourcc == 0 &&
+        SoftwareImageProcessor::IsSupported(fmtdesc.pixelformat,
+                                            PIXEL_FORMAT_NV12)) {
+      processor_input_fourcc = fmtdesc.pixelformat;
+    }
     ++fmtdesc.index;
   }
+  if (output_format_fourcc_ == 0)
+    output_format_fourcc_ = processor_input_fourcc;
 
   if (output_format_fourcc_ == 0) {
-    VLOGF(2) << "Image processor not available";
+    VLOGF(2) << "No supported output format";
     return false;
   }
   VLOGF(2) << "Output format=" << output_format_fourcc_;
@@ -1943,7 +2291,7 @@ bool V4L2VideoDecodeAccelerator::CreateOutputBuffers() {
 
   // Output format setup in Initialize().
 
-  uint32_t buffer_count = output_dpb_size_ + kDpbOutputBufferExtraCount;
+  uint32_t buffer_count = GetRequiredOutputBufferCount();
 
   VideoPixelFormat pixel_format =
       V4L2Device::V4L2PixFmtToVideoPixelFormat(output_format_fourcc_);
@@ -1966,6 +2314,16 @@ bool V4L2VideoDecodeAccelerator::CreateOutputBuffers() {
   return true;
 }
 
+uint32_t V4L2VideoDecodeAccelerator::GetRequiredOutputBufferCount() const {
+  uint32_t buffer_count = output_dpb_size_ + kDpbOutputBufferExtraCount;
+  // The device output always goes through the image processor if clients
+  // cannot use its format; one more buffer lets the device keep decoding
+  // while a frame is being converted.
+  if (!IsSupportedOutputFormat(output_format_fourcc_))
+    buffer_count += kDpbOutputBufferExtraCountForImageProcessor;
+  return buffer_count;
+}
+
 void V4L2VideoDecodeAccelerator::DestroyInputBuffers() {
   VLOGF(2);
   DCHECK(!decoder_thread_.IsRunning() ||
@@ -1979,6 +2337,10 @@ void V4L2VideoDecodeAccelerator::DestroyInputBuffers() {
     if (input_buffer_map_[i].address != NULL) {
       device_->Munmap(input_buffer_map_[i].address,
                       input_buffer_map_[i].length);
+      if (memory_usage_tracker_) {
+        memory_usage_tracker_->Remove(MemoryUsageTracker::kInputBuffers,
+                                      input_buffer_map_[i].length, 1);
+      }
     }
   }
 
@@ -2000,11 +2362,17 @@ bool V4L2VideoDecodeAccelerator::DestroyOutputBuffers() {
   DCHECK(!output_streamon_);
   bool success = true;
 
+  // Drops the frames still being converted, if any, before unmapping them.
+  image_processor_.reset();
+  image_processor_bitstream_buffer_ids_ = std::queue<int32_t>();
+  image_processor_frames_to_drop_ = 0;
+
   if (output_buffer_map_.empty())
     return true;
 
   for (size_t i = 0; i < output_buffer_map_.size(); ++i) {
     OutputRecord& output_record = output_buffer_map_[i];
+    UnmapOutputRecord(&output_record);
 
     DVLOGF(3) << "dismissing PictureBuffer id=" << output_record.picture_id;
     child_task_runner_->PostTask(
@@ -2016,7 +2384,7 @@ bool V4L2VideoDecodeAccelerator::DestroyOutputBuffers() {
   memset(&reqbufs, 0, sizeof(reqbufs));
   reqbufs.count = 0;
   reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  reqbufs.memory = V4L2_MEMORY_MMAP;
+  reqbufs.memory = output_memory_type_;
   if (device_->Ioctl(VIDIOC_REQBUFS, &reqbufs) != 0) {
     VPLOGF(1) << "ioctl() failed: VIDIOC_REQBUFS";
     NOTIFY_ERROR(PLATFORM_FAILURE);
@@ -2024,6 +2392,9 @@ bool V4L2VideoDecodeAccelerator::DestroyOutputBuffers() {
   }
 
   output_buffer_map_.clear();
+  output_memory_type_ = V4L2_MEMORY_MMAP;
+  output_buffers_requested_ = false;
+  output_client_format_ = PIXEL_FORMAT_UNKNOWN;
   while (!free_output_buffers_.empty())
     free_output_buffers_.pop_front();
   output_buffer_queued_count_ = 0;
@@ -2042,6 +2413,8 @@ void V4L2VideoDecodeAccelerator::SendPictureReady() {
   while (pending_picture_ready_.size() > 0) {
     bool cleared = pending_picture_ready_.front().cleared;
     const Picture& picture = pending_picture_ready_.front().picture;
+    ScopedTraceEvent trace_event("SendPictureReady",
+                                 picture.bitstream_buffer_id());
     if (cleared && picture_clearing_count_ == 0) {
       // This picture is cleared. It can be posted to a thread different than
       // the main GPU thread to reduce latency. This should be the case after
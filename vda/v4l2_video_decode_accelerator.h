@@ -6,7 +6,8 @@
 // that utilizes hardware video decoders, which expose Video4Linux 2 API
 // (http://linuxtv.org/downloads/v4l-dvb-apis/).
 // Note: ported from Chromium commit head: 85fdf90
-// Note: image processor is not ported.
+// Note: V4L2 image processor is not ported, SoftwareImageProcessor converts the
+// output instead.
 
 #ifndef MEDIA_GPU_V4L2_VIDEO_DECODE_ACCELERATOR_H_
 #define MEDIA_GPU_V4L2_VIDEO_DECODE_ACCELERATOR_H_
@@ -25,8 +26,10 @@
 #include "base/memory/ref_counted.h"
 #include "base/synchronization/waitable_event.h"
 #include "base/threading/thread.h"
+#include "native_pixmap_handle.h"
 #include "picture.h"
 #include "size.h"
+#include "software_image_processor.h"
 #include "v4l2_device.h"
 #include "video_decode_accelerator.h"
 
@@ -125,6 +128,9 @@ class V4L2VideoDecodeAccelerator
     // limits::kMaxVideoFrames to fill up the GpuVideoDecode pipeline,
     // and +1 for a frame in transit.
     kDpbOutputBufferExtraCount = kMaxVideoFrames + 1,
+    // Frame rate assumed to account the load of the streams whose frame rate
+    // is not known.
+    kDefaultFrameRate = 30,
     // Number of extra output buffers if image processor is used.
     kDpbOutputBufferExtraCountForImageProcessor = 1,
   };
@@ -178,6 +184,12 @@ class V4L2VideoDecodeAccelerator
     int32_t input_id;  // triggering input_id as given to Decode().
   };
 
+  // A memory mapping of a buffer plane.
+  struct Mapping {
+    void* address;
+    size_t length;
+  };
+
   // Record for output buffers.
   struct OutputRecord {
     OutputRecord();
@@ -187,8 +199,14 @@ class V4L2VideoDecodeAccelerator
     int32_t picture_id;     // picture buffer id as returned to PictureReady().
     bool cleared;           // Whether the texture is cleared and safe to render
                             // from. See TextureManager for details.
-    // Output fds of the processor. Used only when OutputMode is IMPORT.
-    std::vector<base::ScopedFD> processor_output_fds;
+    // Dmabufs of the client buffer. They are queued to the device, or written
+    // by the image processor if it is used.
+    std::vector<base::ScopedFD> output_fds;
+    // When the image processor is used, mappings of the device buffer planes
+    // and of |output_fds|, and the client buffer frame in the latter.
+    std::vector<Mapping> device_mappings;
+    std::vector<Mapping> client_mappings;
+    SoftwareImageProcessor::MappedFrame client_frame;
   };
 
   //
@@ -229,9 +247,36 @@ class V4L2VideoDecodeAccelerator
 
   // Use buffer backed by dmabuf file descriptors in |dmabuf_fds| for the
   // OutputRecord associated with |picture_buffer_id|, taking ownership of the
-  // file descriptors.
+  // file descriptors. |pixel_format| and |planes| describe the buffer layout.
   void ImportBufferForPictureTask(int32_t picture_buffer_id,
-                                  std::vector<base::ScopedFD> dmabuf_fds);
+                                  VideoPixelFormat pixel_format,
+                                  std::vector<base::ScopedFD> dmabuf_fds,
+                                  const std::vector<NativePixmapPlane>& planes);
+
+  // Allocate the V4L2 output buffers once the first client buffer is
+  // imported. The device decodes directly to the client buffers if it can use
+  // their |pixel_format| and |planes| layout, otherwise to its own buffers,
+  // which the image processor converts to the client buffers.
+  bool RequestOutputBuffers(VideoPixelFormat pixel_format,
+                            size_t num_fds,
+                            const std::vector<NativePixmapPlane>& planes);
+  // Map the planes of the device buffer of |output_record| at |index|.
+  bool MapDeviceBuffer(size_t index, OutputRecord* output_record);
+  // Map |output_record|'s client buffer, of |planes| layout, for the image
+  // processor to write it.
+  bool MapClientBuffer(const std::vector<NativePixmapPlane>& planes,
+                       OutputRecord* output_record);
+  // Release the mappings of |output_record|.
+  void UnmapOutputRecord(OutputRecord* output_record);
+
+  // Send the decoded frame of the output buffer at |index| to the image
+  // processor.
+  void ProcessFrame(int32_t bitstream_buffer_id, int index);
+  // Called on decoder thread when the image processor is done with the output
+  // buffer at |index|.
+  void FrameProcessed(int32_t bitstream_buffer_id, int index);
+  // Return true if the image processor still holds output buffers.
+  bool IsImageProcessorBusy() const;
 
   // Service I/O on the V4L2 devices.  This task should only be scheduled from
   // DevicePollTask().  If |event_pending| is true, one or more events
@@ -291,6 +336,9 @@ class V4L2VideoDecodeAccelerator
   bool StopInputStream();
   bool StopOutputStream();
 
+  // Stop the output stream for a resolution change. The change is completed by
+  // FinishResolutionChange(), once the image processor has returned all the
+  // frames.
   void StartResolutionChange();
   void FinishResolutionChange();
 
@@ -334,6 +382,8 @@ class V4L2VideoDecodeAccelerator
   // Create the buffers we need.
   bool CreateInputBuffers();
   bool CreateOutputBuffers();
+  // Number of output buffers needed for the current format.
+  uint32_t GetRequiredOutputBufferCount() const;
 
   // Destroy buffers.
   void DestroyInputBuffers();
@@ -468,6 +518,23 @@ class V4L2VideoDecodeAccelerator
 
   // Number of planes (i.e. separate memory buffers) for output.
   size_t output_planes_count_;
+  // Bytes per line of each output plane.
+  std::vector<int> output_plane_strides_;
+  // Memory type of the output buffers, once they are requested to the device.
+  enum v4l2_memory output_memory_type_;
+  bool output_buffers_requested_;
+  // Pixel format of the client buffers.
+  VideoPixelFormat output_client_format_;
+
+  // Converts the device output to the client buffers, when the device cannot
+  // write them directly.
+  std::unique_ptr<SoftwareImageProcessor> image_processor_;
+  // Bitstream buffer ids of the frames being converted by |image_processor_|,
+  // in order.
+  std::queue<int32_t> image_processor_bitstream_buffer_ids_;
+  // Number of frames being converted that were decoded before a reset, and
+  // are dropped once returned.
+  int image_processor_frames_to_drop_;
 
   // Pictures that are ready but not sent to PictureReady yet.
   std::queue<PictureRecord> pending_picture_ready_;
@@ -487,6 +554,11 @@ class V4L2VideoDecodeAccelerator
 
   // The thread.
   base::Thread device_poll_thread_;
+  // Scheduling of |device_poll_thread_|, applied each time it starts.
+  ThreadSchedulingConfig device_poll_thread_scheduling_;
+
+  // Memory accounting of the session, may be null.
+  scoped_refptr<MemoryUsageTracker> memory_usage_tracker_;
 
   //
   // Other state, held by the child (main) thread.
@@ -494,6 +566,8 @@ class V4L2VideoDecodeAccelerator
 
   // The codec we'll be decoding for.
   VideoCodecProfile video_profile_;
+  // Frame rate of the stream, to account its load on the device.
+  int frame_rate_;
   // Chosen input format for video_profile_.
   uint32_t input_format_fourcc_;
   // Chosen output format.
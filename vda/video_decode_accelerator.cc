@@ -20,6 +20,18 @@ VideoDecodeAccelerator::Config::~Config() = default;
 std::string VideoDecodeAccelerator::Config::AsHumanReadableString() const {
   std::ostringstream s;
   s << "profile: " << GetProfileName(profile);
+  if (keyframes_only)
+    s << ", keyframes only";
+  if (error_resilient)
+    s << ", error resilient";
+  if (!decoder_thread_scheduling.IsDefault()) {
+    s << ", decoder thread: "
+      << decoder_thread_scheduling.AsHumanReadableString();
+  }
+  if (!device_poll_thread_scheduling.IsDefault()) {
+    s << ", device poll thread: "
+      << device_poll_thread_scheduling.AsHumanReadableString();
+  }
   return s.str();
 }
 
@@ -28,6 +40,12 @@ void VideoDecodeAccelerator::Client::NotifyInitializationComplete(
   NOTREACHED() << "By default deferred initialization is not supported.";
 }
 
+void VideoDecodeAccelerator::Client::NotifyBitstreamBufferSkipped(
+    int32_t bitstream_buffer_id) {}
+
+void VideoDecodeAccelerator::Client::NotifyBitstreamBufferError(
+    int32_t bitstream_buffer_id) {}
+
 VideoDecodeAccelerator::~VideoDecodeAccelerator() = default;
 
 bool VideoDecodeAccelerator::TryToSetupDecodeOnSeparateThread(
@@ -45,6 +63,8 @@ void VideoDecodeAccelerator::ImportBufferForPicture(
   NOTREACHED() << "Buffer import not supported.";
 }
 
+void VideoDecodeAccelerator::SetSkipNonReferenceFrames(bool skip) {}
+
 VideoDecodeAccelerator::SupportedProfile::SupportedProfile()
     : profile(VIDEO_CODEC_PROFILE_UNKNOWN), encrypted_only(false) {}
 
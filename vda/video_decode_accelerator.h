@@ -12,9 +12,11 @@
 #include "base/memory/weak_ptr.h"
 
 #include "bitstream_buffer.h"
+#include "memory_usage_tracker.h"
 #include "native_pixmap_handle.h"
 #include "picture.h"
 #include "size.h"
+#include "thread_scheduling.h"
 #include "video_codecs.h"
 #include "video_pixel_format.h"
 
@@ -138,6 +140,11 @@ class VideoDecodeAccelerator {
     // Coded size of the video frame hint, subject to change.
     Size initial_expected_coded_size = Size(320, 240);
 
+    // Frame rate of the stream hint, in frames per second, or 0 if unknown.
+    // Along with |initial_expected_coded_size|, it is the expected load of
+    // the session, which may be refused if the device is at capacity.
+    int frame_rate = 0;
+
     OutputMode output_mode = OutputMode::ALLOCATE;
 
     // The list of picture buffer formats that the client knows how to use. An
@@ -149,6 +156,30 @@ class VideoDecodeAccelerator {
     // Each SPS and PPS is prefixed with the Annex B framing bytes: 0, 0, 0, 1.
     std::vector<uint8_t> sps;
     std::vector<uint8_t> pps;
+
+    // Whether only the keyframes are to be decoded, e.g. to extract
+    // thumbnails. Other frames are reported as skipped through
+    // Client::NotifyBitstreamBufferSkipped(). Implementations not parsing the
+    // bitstream cannot drop frames, and fail to initialize if this is set.
+    bool keyframes_only = false;
+
+    // Whether to recover from the errors in the bitstream by resuming at the
+    // next keyframe, instead of failing with PLATFORM_FAILURE. The buffer in
+    // error is reported through Client::NotifyBitstreamBufferError(). Only
+    // implementations parsing the bitstream support it, others fail to
+    // initialize if this is set.
+    bool error_resilient = false;
+
+    // Scheduling of the decoder and device poll threads of the
+    // implementation, applied when these threads start. The default config
+    // keeps the scheduling they inherit.
+    ThreadSchedulingConfig decoder_thread_scheduling;
+    ThreadSchedulingConfig device_poll_thread_scheduling;
+
+    // Accounts the memory held by the implementation for this session, i.e.
+    // its input buffers, the bitstream buffers mapped until decoded and the
+    // parser state. Not accounted if null.
+    scoped_refptr<MemoryUsageTracker> memory_usage_tracker;
   };
 
   // Interface for collaborating with picture interface to provide memory for
@@ -188,6 +219,20 @@ class VideoDecodeAccelerator {
     // bitstream buffer.
     virtual void NotifyEndOfBitstreamBuffer(int32_t bitstream_buffer_id) = 0;
 
+    // Callback to notify that the frames of the bitstream buffer were dropped
+    // as requested by SetSkipNonReferenceFrames() or Config::keyframes_only,
+    // and that no picture will be delivered for it. This is called before
+    // NotifyEndOfBitstreamBuffer() for the same buffer. The default
+    // implementation does nothing.
+    virtual void NotifyBitstreamBufferSkipped(int32_t bitstream_buffer_id);
+
+    // Callback to notify that the bitstream buffer could not be decoded, and
+    // that decoding resumes at the next keyframe, as requested by
+    // Config::error_resilient. This is called before
+    // NotifyEndOfBitstreamBuffer() for the same buffer. The default
+    // implementation does nothing.
+    virtual void NotifyBitstreamBufferError(int32_t bitstream_buffer_id);
+
     // Flush completion callback.
     virtual void NotifyFlushDone() = 0;
 
@@ -270,6 +315,13 @@ class VideoDecodeAccelerator {
   //  |picture_buffer_id| id of the picture buffer that is to be reused.
   virtual void ReusePictureBuffer(int32_t picture_buffer_id) = 0;
 
+  // Have the decoder drop the frames no other frame refers to, before they are
+  // decoded, in the bitstream buffers passed to Decode() after this call and
+  // until it is called again. This lets a client that falls behind catch up
+  // without corrupting the following frames. The default implementation
+  // ignores the request and keeps decoding every frame.
+  virtual void SetSkipNonReferenceFrames(bool skip);
+
   // Flushes the decoder: all pending inputs will be decoded and pictures handed
   // back to the client, followed by NotifyFlushDone() being called on the
   // client.  Can be used to implement "end of stream" notification.
@@ -46,11 +46,13 @@ struct v4l2_ext_control_custom {
 struct v4l2_ext_controls_custom {
   union {
     __u32 ctrl_class;
+    __u32 which;
     __u32 config_store;
   };
   __u32 count;
   __u32 error_idx;
-  __u32 reserved[2];
+  __s32 request_fd;
+  __u32 reserved[1];
   struct v4l2_ext_control_custom *controls;
 };
 
@@ -81,6 +83,8 @@ struct v4l2_ext_controls_custom {
  *		buffers (when type != *_MPLANE); number of elements in the
  *		planes array for multi-plane buffers
  * @config_store: this buffer should use this configuration store
+ * @request_fd: fd of the request that this buffer should use, if
+ *		V4L2_BUF_FLAG_REQUEST_FD is set in @flags
  *
  * Contains data exchanged by application and driver using one of the Streaming
  * I/O methods.
@@ -105,7 +109,10 @@ struct v4l2_buffer_custom {
   } m;
   __u32	length;
   __u32	config_store;
-  __u32 reserved;
+  union {
+    __s32 request_fd;
+    __u32 reserved;
+  };
 };
 
 #endif  // VIDEODEV2_CUSTOM_H_
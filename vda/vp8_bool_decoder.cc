@@ -42,10 +42,12 @@
 // It is used to decode bits from a vp8 stream.
 
 #include <limits.h>
+#include <string.h>
 
 #include <algorithm>
 
 #include "base/numerics/safe_conversions.h"
+#include "base/sys_byteorder.h"
 #include "vp8_bool_decoder.h"
 
 namespace media {
@@ -60,25 +62,8 @@ static const int kDefaultProbability = 0x80;  // 0x80 / 256 = 0.5
 // modest values like 100 would work fine.
 #define VP8_LOTS_OF_BITS (0x40000000)
 
-// The number of leading zeros.
-static const unsigned char kVp8Norm[256] = {
-    0, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
-    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
-    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-};
+// Number of bytes loaded at once to refill |value_|.
+static const size_t kBulkFillBytes = sizeof(uint64_t);
 
 Vp8BoolDecoder::Vp8BoolDecoder()
     : user_buffer_(NULL),
@@ -104,6 +89,22 @@ void Vp8BoolDecoder::FillDecoder() {
   DCHECK(user_buffer_ != NULL);
   int shift = VP8_BD_VALUE_BIT - CHAR_BIT - (count_ + CHAR_BIT);
   size_t bytes_left = user_buffer_end_ - user_buffer_;
+
+  if (bytes_left > kBulkFillBytes && shift >= 0) {
+    // Load the next bytes as one big-endian word and shift as many whole
+    // bytes into |value_| as fit, rather than filling it byte by byte. The
+    // end of the data is never reached here, that is left to the loop below.
+    uint64_t next_bytes;
+    memcpy(&next_bytes, user_buffer_, sizeof(next_bytes));
+    next_bytes = base::NetToHost64(next_bytes);
+    int num_bytes = shift / CHAR_BIT + 1;
+    value_ |= static_cast<size_t>(next_bytes >> (64 - num_bytes * CHAR_BIT))
+              << (shift - (num_bytes - 1) * CHAR_BIT);
+    user_buffer_ += num_bytes;
+    count_ += num_bytes * CHAR_BIT;
+    return;
+  }
+
   size_t bits_left = bytes_left * CHAR_BIT;
   int x = shift + CHAR_BIT - static_cast<int>(bits_left);
   int loop_end = 0;
@@ -123,25 +124,24 @@ void Vp8BoolDecoder::FillDecoder() {
   }
 }
 
-int Vp8BoolDecoder::ReadBit(int probability) {
-  int bit = 0;
+inline int Vp8BoolDecoder::ReadBit(int probability) {
   size_t split = 1 + (((range_ - 1) * probability) >> 8);
   if (count_ < 0)
     FillDecoder();
   size_t bigsplit = static_cast<size_t>(split) << (VP8_BD_VALUE_BIT - 8);
 
-  if (value_ >= bigsplit) {
-    range_ -= split;
-    value_ -= bigsplit;
-    bit = 1;
-  } else {
-    range_ = split;
-  }
+  // Written so that the compiler can use conditional moves instead of
+  // branching on the hard to predict decoded bit.
+  const int bit = value_ >= bigsplit;
+  range_ = bit ? range_ - split : split;
+  value_ = bit ? value_ - bigsplit : value_;
 
-  size_t shift = kVp8Norm[range_];
+  // Normalize |range_| back to [128, 255]; it is never 0 here.
+  int shift = __builtin_clz(static_cast<unsigned int>(range_)) -
+              static_cast<int>((sizeof(unsigned int) - 1) * CHAR_BIT);
   range_ <<= shift;
   value_ <<= shift;
-  count_ -= static_cast<int>(shift);
+  count_ -= shift;
 
   DCHECK_EQ(1U, (range_ >> 7));  // In the range [128, 255].
 
@@ -165,6 +165,22 @@ bool Vp8BoolDecoder::ReadBool(bool* out) {
   return ReadBool(out, kDefaultProbability);
 }
 
+bool Vp8BoolDecoder::ReadCoeffProbUpdates(const uint8_t* update_probs,
+                                          uint8_t* probs,
+                                          size_t count) {
+  // The data running out is sticky, so it is enough to check for it once
+  // after the loop.
+  for (size_t i = 0; i < count; ++i) {
+    if (ReadBit(update_probs[i])) {
+      int prob = 0;
+      for (size_t bit = 0; bit < 8; ++bit)
+        prob = (prob << 1) | ReadBit(kDefaultProbability);
+      probs[i] = static_cast<uint8_t>(prob);
+    }
+  }
+  return !OutOfBuffer();
+}
+
 bool Vp8BoolDecoder::ReadLiteralWithSign(size_t num_bits, int* out) {
   ReadLiteral(num_bits, out);
   // Read sign.
@@ -87,6 +87,15 @@ class Vp8BoolDecoder {
   // This is different from the "read_signed_literal(d, n)" defined in RFC 6386.
   bool ReadLiteralWithSign(size_t num_bits, int* out);
 
+  // Reads |count| coefficient probability updates (RFC 6386 section 13.4).
+  // For each entry a flag is read with probability |update_probs[i]|, and
+  // if it is set, an 8-bit literal replacing |probs[i]| follows. Returns
+  // false if it has reached the end of |data|, in which case |probs| may be
+  // partially updated.
+  bool ReadCoeffProbUpdates(const uint8_t* update_probs,
+                            uint8_t* probs,
+                            size_t count);
+
   // The following methods are used to get the internal states of the decoder.
 
   // Returns the bit offset to the current top bit of the coded stream. It is
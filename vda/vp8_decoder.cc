@@ -15,6 +15,9 @@ VP8Decoder::VP8Decoder(VP8Accelerator* accelerator)
     : state_(kNeedStreamMetadata),
       curr_frame_start_(nullptr),
       frame_size_(0),
+      skip_non_reference_frames_(false),
+      keyframes_only_(false),
+      num_skipped_frames_(0),
       accelerator_(accelerator) {
   DCHECK(accelerator_);
 }
@@ -85,9 +88,25 @@ VP8Decoder::DecodeResult VP8Decoder::Decode() {
   } else {
     if (state_ != kDecoding) {
       // Need a resume point.
+      num_skipped_frames_++;
       curr_frame_hdr_.reset();
       return kRanOutOfStreamData;
     }
+
+    // The probability updates of the frame are kept by |parser_| already, so
+    // a frame that refreshes no reference can be dropped after parsing. In
+    // keyframe-only mode the references are dropped too, as the next decoded
+    // frame refreshes all of them.
+    if (keyframes_only_ ||
+        (skip_non_reference_frames_ && IsCurrentFrameNonReference())) {
+      DVLOG(4) << "Skipping " << (keyframes_only_ ? "non-key" : "non-reference")
+               << " frame";
+      num_skipped_frames_++;
+      curr_frame_hdr_ = nullptr;
+      curr_frame_start_ = nullptr;
+      frame_size_ = 0;
+      return kRanOutOfStreamData;
+    }
   }
 
   curr_pic_ = accelerator_->CreateVP8Picture();
@@ -149,6 +168,15 @@ void VP8Decoder::RefreshReferenceFrames() {
     last_frame_ = curr_pic_;
 }
 
+bool VP8Decoder::IsCurrentFrameNonReference() const {
+  DCHECK(curr_frame_hdr_);
+  return !curr_frame_hdr_->IsKeyframe() && !curr_frame_hdr_->refresh_last &&
+         !curr_frame_hdr_->refresh_golden_frame &&
+         !curr_frame_hdr_->refresh_alternate_frame &&
+         !curr_frame_hdr_->copy_buffer_to_golden &&
+         !curr_frame_hdr_->copy_buffer_to_alternate;
+}
+
 bool VP8Decoder::DecodeAndOutputCurrentFrame() {
   DCHECK(!pic_size_.IsEmpty());
   DCHECK(curr_pic_);
@@ -187,6 +215,8 @@ Size VP8Decoder::GetPicSize() const {
 }
 
 size_t VP8Decoder::GetRequiredNumOfPictures() const {
+  if (keyframes_only_)
+    return kNumPicturesForKeyframesOnly;
   const size_t kVP8NumFramesActive = 4;
   // TODO(johnylin): see if we could get rid of kMaxVideoFrames.
   const size_t kMaxVideoFrames = 4;
@@ -194,4 +224,39 @@ size_t VP8Decoder::GetRequiredNumOfPictures() const {
   return kVP8NumFramesActive + kPicsInPipeline;
 }
 
+size_t VP8Decoder::GetMaxCodedFrameSize(int frame_rate) const {
+  // The level, and so its macroblock rate, is not signaled in the stream.
+  return GetMaxCodedFrameSizeFor(pic_size_, frame_rate, 0,
+                                 kDefaultMinCompressionRatio);
+}
+
+void VP8Decoder::SetSkipNonReferenceFrames(bool skip) {
+  // This is set for each stream, only log the changes.
+  DVLOG_IF(2, skip != skip_non_reference_frames_)
+      << (skip ? "Start" : "Stop") << " skipping non-reference frames";
+  skip_non_reference_frames_ = skip;
+}
+
+void VP8Decoder::ResetAfterError() {
+  DVLOG(1) << "Resetting after error";
+  // Any keyframe is a resume point, but kNeedStreamMetadata is kept until
+  // the first one is decoded.
+  if (state_ == kError)
+    state_ = pic_size_.IsEmpty() ? kNeedStreamMetadata : kAfterReset;
+  Reset();
+}
+
+void VP8Decoder::SetDecodeKeyframesOnly(bool keyframes_only) {
+  DVLOG(2) << "Decoding " << (keyframes_only ? "key" : "all") << " frames";
+  keyframes_only_ = keyframes_only;
+}
+
+size_t VP8Decoder::GetNumSkippedFrames() const {
+  return num_skipped_frames_;
+}
+
+size_t VP8Decoder::GetParserStateSize() const {
+  return sizeof(parser_);
+}
+
 }  // namespace media
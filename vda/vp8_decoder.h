@@ -75,10 +75,18 @@ class VP8Decoder : public AcceleratedVideoDecoder {
   DecodeResult Decode() override WARN_UNUSED_RESULT;
   Size GetPicSize() const override;
   size_t GetRequiredNumOfPictures() const override;
+  size_t GetMaxCodedFrameSize(int frame_rate) const override;
+  void SetSkipNonReferenceFrames(bool skip) override;
+  void SetDecodeKeyframesOnly(bool keyframes_only) override;
+  void ResetAfterError() override;
+  size_t GetNumSkippedFrames() const override;
+  size_t GetParserStateSize() const override;
 
  private:
   bool DecodeAndOutputCurrentFrame();
   void RefreshReferenceFrames();
+  // Return true if the current frame does not update any reference frame.
+  bool IsCurrentFrameNonReference() const;
 
   enum State {
     kNeedStreamMetadata,  // After initialization, need a keyframe.
@@ -104,6 +112,10 @@ class VP8Decoder : public AcceleratedVideoDecoder {
   int horizontal_scale_;
   int vertical_scale_;
 
+  bool skip_non_reference_frames_;
+  bool keyframes_only_;
+  size_t num_skipped_frames_;
+
   VP8Accelerator* accelerator_;
 
   DISALLOW_COPY_AND_ASSIGN(VP8Decoder);
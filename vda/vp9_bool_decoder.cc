@@ -8,7 +8,6 @@
 #include <algorithm>
 
 #include "base/logging.h"
-#include "bit_reader.h"
 
 namespace media {
 
@@ -49,7 +48,7 @@ bool Vp9BoolDecoder::Initialize(const uint8_t* data, size_t size) {
     return false;
   }
 
-  reader_.reset(new BitReader(data, size));
+  reader_.Initialize(data, size);
   valid_ = true;
 
   bool_value_ = 0;
@@ -68,7 +67,7 @@ bool Vp9BoolDecoder::Initialize(const uint8_t* data, size_t size) {
 bool Vp9BoolDecoder::Fill() {
   DCHECK_GE(count_to_fill_, 0);
 
-  int bits_left = reader_->bits_available();
+  int bits_left = reader_.bits_available();
   if (bits_left < count_to_fill_) {
     valid_ = false;
     DVLOG(1) << "Vp9BoolDecoder reads beyond the end of stream";
@@ -80,7 +79,7 @@ bool Vp9BoolDecoder::Fill() {
   int bits_to_read = std::min(max_bits_to_read, bits_left);
 
   BigBool data;
-  reader_->ReadBits(bits_to_read, &data);
+  reader_.ReadBits(bits_to_read, &data);
   bool_value_ |= data << (max_bits_to_read - bits_to_read);
   count_to_fill_ -= bits_to_read;
 
@@ -89,8 +88,6 @@ bool Vp9BoolDecoder::Fill() {
 
 // 9.2.2 Boolean decoding process
 bool Vp9BoolDecoder::ReadBool(int prob) {
-  DCHECK(reader_);
-
   if (count_to_fill_ > 0) {
     if (!Fill())
       return false;
@@ -125,7 +122,6 @@ bool Vp9BoolDecoder::ReadBool(int prob) {
 // 9.2.4 Parsing process for read_literal
 uint8_t Vp9BoolDecoder::ReadLiteral(int bits) {
   DCHECK_LT(static_cast<size_t>(bits), sizeof(uint8_t) * 8);
-  DCHECK(reader_);
 
   uint8_t x = 0;
   for (int i = 0; i < bits; i++)
@@ -135,9 +131,7 @@ uint8_t Vp9BoolDecoder::ReadLiteral(int bits) {
 }
 
 bool Vp9BoolDecoder::ConsumePaddingBits() {
-  DCHECK(reader_);
-
-  if (count_to_fill_ > reader_->bits_available()) {
+  if (count_to_fill_ > reader_.bits_available()) {
     // 9.2.2 Boolean decoding process
     // Although we actually don't used the value, spec says the bitstream
     // should have enough bits to fill bool range, this should never happen.
@@ -149,11 +143,11 @@ bool Vp9BoolDecoder::ConsumePaddingBits() {
     DVLOG(1) << "prefilled padding bits are not zero";
     return false;
   }
-  while (reader_->bits_available() > 0) {
+  while (reader_.bits_available() > 0) {
     int data;
     int size_to_read =
-        std::min(reader_->bits_available(), static_cast<int>(sizeof(data) * 8));
-    reader_->ReadBits(size_to_read, &data);
+        std::min(reader_.bits_available(), static_cast<int>(sizeof(data) * 8));
+    reader_.ReadBits(size_to_read, &data);
     if (data != 0) {
       DVLOG(1) << "padding bits are not zero";
       return false;
@@ -9,14 +9,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <memory>
-
 #include "base/macros.h"
+#include "bit_reader.h"
 
 namespace media {
 
-class BitReader;
-
 class Vp9BoolDecoder {
  public:
   Vp9BoolDecoder();
@@ -52,7 +49,7 @@ class Vp9BoolDecoder {
 
   bool Fill();
 
-  std::unique_ptr<BitReader> reader_;
+  BitReader reader_;
 
   // Indicates if none of the reads since the last Initialize() call has gone
   // beyond the end of available data.
@@ -19,6 +19,9 @@ VP9Decoder::VP9Accelerator::~VP9Accelerator() {}
 
 VP9Decoder::VP9Decoder(VP9Accelerator* accelerator)
     : state_(kNeedStreamMetadata),
+      skip_non_reference_frames_(false),
+      keyframes_only_(false),
+      num_skipped_frames_(0),
       accelerator_(accelerator),
       parser_(accelerator->IsFrameContextRequired()) {
   ref_frames_.resize(kVp9NumRefFrames);
@@ -83,11 +86,19 @@ VP9Decoder::DecodeResult VP9Decoder::Decode() {
       if (curr_frame_hdr_->IsKeyframe()) {
         state_ = kDecoding;
       } else {
+        num_skipped_frames_++;
         curr_frame_hdr_.reset();
         continue;
       }
     }
 
+    // In keyframe-only mode, frames showing an existing one are dropped too,
+    // as they would show a keyframe outputted already.
+    if (keyframes_only_ && !curr_frame_hdr_->IsKeyframe()) {
+      SkipCurrentFrame();
+      continue;
+    }
+
     if (curr_frame_hdr_->show_existing_frame) {
       // This frame header only instructs us to display one of the
       // previously-decoded frames, but has no frame data otherwise. Display
@@ -108,6 +119,11 @@ VP9Decoder::DecodeResult VP9Decoder::Decode() {
       continue;
     }
 
+    if (skip_non_reference_frames_ && IsCurrentFrameNonReference()) {
+      SkipCurrentFrame();
+      continue;
+    }
+
     Size new_pic_size(curr_frame_hdr_->frame_width,
                            curr_frame_hdr_->frame_height);
     DCHECK(!new_pic_size.IsEmpty());
@@ -182,6 +198,35 @@ void VP9Decoder::UpdateFrameContext(
   context_refresh_cb.Run(frame_ctx);
 }
 
+bool VP9Decoder::IsCurrentFrameNonReference() {
+  DCHECK(curr_frame_hdr_);
+  // The frame must not refresh any reference frame, nor a frame context that
+  // only the accelerator can provide once the frame is decoded. Probability
+  // updates not depending on the decoding are applied by |parser_| already.
+  return curr_frame_hdr_->refresh_frame_flags == 0 &&
+         parser_.GetContextRefreshCb(curr_frame_hdr_->frame_context_idx)
+             .is_null();
+}
+
+void VP9Decoder::SkipCurrentFrame() {
+  DCHECK(curr_frame_hdr_);
+  DVLOG(4) << "Skipping " << (keyframes_only_ ? "non-key" : "non-reference")
+           << " frame";
+
+  // |parser_| waits for the frame context refreshed by a frame to parse the
+  // frames using it. In keyframe-only mode, those frames are dropped until the
+  // next keyframe resets all contexts, so the context as parsed will do.
+  if (!curr_frame_hdr_->show_existing_frame) {
+    const auto& context_refresh_cb =
+        parser_.GetContextRefreshCb(curr_frame_hdr_->frame_context_idx);
+    if (!context_refresh_cb.is_null())
+      context_refresh_cb.Run(curr_frame_hdr_->frame_context);
+  }
+
+  num_skipped_frames_++;
+  curr_frame_hdr_.reset();
+}
+
 bool VP9Decoder::DecodeAndOutputPicture(scoped_refptr<VP9Picture> pic) {
   DCHECK(!pic_size_.IsEmpty());
   DCHECK(pic->frame_hdr);
@@ -217,6 +262,8 @@ Size VP9Decoder::GetPicSize() const {
 }
 
 size_t VP9Decoder::GetRequiredNumOfPictures() const {
+  if (keyframes_only_)
+    return kNumPicturesForKeyframesOnly;
   // kMaxVideoFrames to keep higher level media pipeline populated, +2 for the
   // pictures being parsed and decoded currently.
   // TODO(johnylin): see if we could get rid of kMaxVideoFrames.
@@ -224,4 +271,40 @@ size_t VP9Decoder::GetRequiredNumOfPictures() const {
   return kMaxVideoFrames + kVp9NumRefFrames + 2;
 }
 
+size_t VP9Decoder::GetMaxCodedFrameSize(int frame_rate) const {
+  // The level, and so its macroblock rate, is not signaled in the stream.
+  return GetMaxCodedFrameSizeFor(pic_size_, frame_rate, 0,
+                                 kDefaultMinCompressionRatio);
+}
+
+void VP9Decoder::SetSkipNonReferenceFrames(bool skip) {
+  // This is set for each stream, only log the changes.
+  DVLOG_IF(2, skip != skip_non_reference_frames_)
+      << (skip ? "Start" : "Stop") << " skipping non-reference frames";
+  skip_non_reference_frames_ = skip;
+}
+
+void VP9Decoder::ResetAfterError() {
+  DVLOG(1) << "Resetting after error";
+  // Any keyframe is a resume point, but kNeedStreamMetadata is kept until
+  // the first one is decoded.
+  if (state_ == kError)
+    state_ = pic_size_.IsEmpty() ? kNeedStreamMetadata : kAfterReset;
+  Reset();
+}
+
+void VP9Decoder::SetDecodeKeyframesOnly(bool keyframes_only) {
+  DVLOG(2) << "Decoding " << (keyframes_only ? "key" : "all") << " frames";
+  keyframes_only_ = keyframes_only;
+}
+
+size_t VP9Decoder::GetNumSkippedFrames() const {
+  return num_skipped_frames_;
+}
+
+size_t VP9Decoder::GetParserStateSize() const {
+  // The probability contexts and segmentation maps are held in the parser.
+  return sizeof(parser_);
+}
+
 }  // namespace media
@@ -103,11 +103,24 @@ class VP9Decoder : public AcceleratedVideoDecoder {
   DecodeResult Decode() override WARN_UNUSED_RESULT;
   Size GetPicSize() const override;
   size_t GetRequiredNumOfPictures() const override;
+  size_t GetMaxCodedFrameSize(int frame_rate) const override;
+  void SetSkipNonReferenceFrames(bool skip) override;
+  void SetDecodeKeyframesOnly(bool keyframes_only) override;
+  void ResetAfterError() override;
+  size_t GetNumSkippedFrames() const override;
+  size_t GetParserStateSize() const override;
 
  private:
   // Update ref_frames_ based on the information in current frame header.
   void RefreshReferenceFrames(const scoped_refptr<VP9Picture>& pic);
 
+  // Return true if the current frame can be dropped without affecting the
+  // decoding of the following frames.
+  bool IsCurrentFrameNonReference();
+
+  // Drop the current frame without decoding it.
+  void SkipCurrentFrame();
+
   // Decode and possibly output |pic| (if the picture is to be shown).
   // Return true on success, false otherwise.
   bool DecodeAndOutputPicture(scoped_refptr<VP9Picture> pic);
@@ -141,6 +154,10 @@ class VP9Decoder : public AcceleratedVideoDecoder {
   // Current coded resolution.
   Size pic_size_;
 
+  bool skip_non_reference_frames_;
+  bool keyframes_only_;
+  size_t num_skipped_frames_;
+
   // VP9Accelerator instance owned by the client.
   VP9Accelerator* accelerator_;
 
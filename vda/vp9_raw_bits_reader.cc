@@ -8,7 +8,6 @@
 #include <limits.h>
 
 #include "base/logging.h"
-#include "bit_reader.h"
 
 namespace media {
 
@@ -18,28 +17,26 @@ Vp9RawBitsReader::~Vp9RawBitsReader() = default;
 
 void Vp9RawBitsReader::Initialize(const uint8_t* data, size_t size) {
   DCHECK(data);
-  reader_.reset(new BitReader(data, size));
+  reader_.Initialize(data, size);
   valid_ = true;
 }
 
 bool Vp9RawBitsReader::ReadBool() {
-  DCHECK(reader_);
   if (!valid_)
     return false;
 
   int value = 0;
-  valid_ = reader_->ReadBits(1, &value);
+  valid_ = reader_.ReadBits(1, &value);
   return valid_ ? value == 1 : false;
 }
 
 int Vp9RawBitsReader::ReadLiteral(int bits) {
-  DCHECK(reader_);
   if (!valid_)
     return 0;
 
   int value = 0;
   DCHECK_LT(static_cast<size_t>(bits), sizeof(value) * 8);
-  valid_ = reader_->ReadBits(bits, &value);
+  valid_ = reader_.ReadBits(bits, &value);
   return valid_ ? value : 0;
 }
 
@@ -49,13 +46,11 @@ int Vp9RawBitsReader::ReadSignedLiteral(int bits) {
 }
 
 size_t Vp9RawBitsReader::GetBytesRead() const {
-  DCHECK(reader_);
-  return (reader_->bits_read() + 7) / 8;
+  return (reader_.bits_read() + 7) / 8;
 }
 
 bool Vp9RawBitsReader::ConsumeTrailingBits() {
-  DCHECK(reader_);
-  int bits_left = GetBytesRead() * 8 - reader_->bits_read();
+  int bits_left = GetBytesRead() * 8 - reader_.bits_read();
   return ReadLiteral(bits_left) == 0;
 }
 
@@ -9,14 +9,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <memory>
-
 #include "base/macros.h"
+#include "bit_reader.h"
 
 namespace media {
 
-class BitReader;
-
 // A class to read raw bits stream. See VP9 spec, "RAW-BITS DECODING" section
 // for detail.
 class Vp9RawBitsReader {
@@ -53,7 +50,7 @@ class Vp9RawBitsReader {
   bool ConsumeTrailingBits();
 
  private:
-  std::unique_ptr<BitReader> reader_;
+  BitReader reader_;
 
   // Indicates if none of the reads since the last Initialize() call has gone
   // beyond the end of available data.
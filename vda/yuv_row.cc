@@ -0,0 +1,75 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "yuv_row.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAS_NEON_ROWS 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HAS_SSE2_ROWS 1
+#endif
+
+namespace media {
+
+void CopyRow(const uint8_t* src, uint8_t* dst, int width) {
+  // memcpy() is already vectorized by the C library.
+  memcpy(dst, src, width);
+}
+
+void DetileRow(const uint8_t* src,
+               ptrdiff_t src_tile_stride,
+               uint8_t* dst,
+               int width) {
+  int x = 0;
+  for (; x + kTileWidth <= width; x += kTileWidth) {
+#if defined(HAS_NEON_ROWS)
+    vst1q_u8(dst + x, vld1q_u8(src));
+#elif defined(HAS_SSE2_ROWS)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+#else
+    memcpy(dst + x, src, kTileWidth);
+#endif
+    src += src_tile_stride;
+  }
+  if (x < width)
+    memcpy(dst + x, src, width - x);
+}
+
+void SplitUVRow(const uint8_t* src_uv,
+                uint8_t* dst_u,
+                uint8_t* dst_v,
+                int width) {
+  int x = 0;
+#if defined(HAS_NEON_ROWS)
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t uv = vld2q_u8(src_uv + 2 * x);
+    vst1q_u8(dst_u + x, uv.val[0]);
+    vst1q_u8(dst_v + x, uv.val[1]);
+  }
+#elif defined(HAS_SSE2_ROWS)
+  const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+  for (; x + 16 <= width; x += 16) {
+    const __m128i* src = reinterpret_cast<const __m128i*>(src_uv + 2 * x);
+    __m128i uv0 = _mm_loadu_si128(src);
+    __m128i uv1 = _mm_loadu_si128(src + 1);
+    __m128i u = _mm_packus_epi16(_mm_and_si128(uv0, low_bytes),
+                                 _mm_and_si128(uv1, low_bytes));
+    __m128i v = _mm_packus_epi16(_mm_srli_epi16(uv0, 8),
+                                 _mm_srli_epi16(uv1, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_u + x), u);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_v + x), v);
+  }
+#endif
+  for (; x < width; ++x) {
+    dst_u[x] = src_uv[2 * x];
+    dst_v[x] = src_uv[2 * x + 1];
+  }
+}
+
+}  // namespace media
@@ -0,0 +1,40 @@
+// Copyright 2018 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Row kernels used by SoftwareImageProcessor to convert decoded frames. Each
+// kernel processes one row of a plane; NEON and SSE2 versions are selected at
+// compile time, with a portable fallback for the remaining bytes and for other
+// architectures.
+
+#ifndef YUV_ROW_H_
+#define YUV_ROW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace media {
+
+// Width in bytes of the tiles handled by DetileRow().
+constexpr int kTileWidth = 16;
+
+// Copy |width| bytes from |src| to |dst|.
+void CopyRow(const uint8_t* src, uint8_t* dst, int width);
+
+// Copy |width| bytes of a row stored in |kTileWidth| bytes wide tiles to the
+// linear |dst|. |src| points to the row in the first tile, consecutive tiles
+// of the row are |src_tile_stride| bytes apart.
+void DetileRow(const uint8_t* src,
+               ptrdiff_t src_tile_stride,
+               uint8_t* dst,
+               int width);
+
+// Deinterleave |width| pairs of |src_uv| into |dst_u| and |dst_v|.
+void SplitUVRow(const uint8_t* src_uv,
+                uint8_t* dst_u,
+                uint8_t* dst_v,
+                int width);
+
+}  // namespace media
+
+#endif  // YUV_ROW_H_